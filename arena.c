@@ -0,0 +1,161 @@
+// arena.c
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "arena.h"
+
+#define ARENA_DEFAULT_BLOCK (64 * 1024)
+#define ARENA_ALIGN         (sizeof(max_align_t))
+
+static size_t align_up(size_t n) {
+    return (n + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+}
+
+static ArenaBlock *block_new(size_t cap) {
+    ArenaBlock *b = malloc(sizeof(ArenaBlock) + cap);
+    if (!b) return NULL;
+    b->next = NULL;
+    b->cap = cap;
+    b->used = 0;
+    return b;
+}
+
+void arena_init(Arena *a, size_t block_size) {
+    if (!a) return;
+    memset(a, 0, sizeof(*a));
+    a->block_size = block_size ? align_up(block_size) : ARENA_DEFAULT_BLOCK;
+}
+
+void arena_destroy(Arena *a) {
+    if (!a) return;
+    ArenaBlock *b = a->head;
+    while (b) {
+        ArenaBlock *next = b->next;
+        free(b);
+        b = next;
+    }
+    a->head = a->cur = NULL;
+    a->last = NULL;
+}
+
+/* arena_reset
+ * Drop every allocation at once. If the last line spilled into extra blocks,
+ * they are merged into a single block big enough for that high-water mark so
+ * the next line of similar size doesn't malloc again. */
+void arena_reset(Arena *a) {
+    if (!a || !a->head) return;
+    a->last = NULL;
+
+    if (!a->head->next) {
+        a->head->used = 0;
+        a->cur = a->head;
+        return;
+    }
+
+    size_t total = 0;
+    for (ArenaBlock *b = a->head; b; b = b->next) total += b->used;
+    arena_destroy(a);
+
+    size_t cap = a->block_size;
+    while (cap < total) cap <<= 1;
+    a->head = a->cur = block_new(cap); // NULL is fine: next alloc retries
+}
+
+ArenaMark arena_mark(const Arena *a) {
+    if (!a || !a->cur) return (ArenaMark){ NULL, 0 };
+    return (ArenaMark){ a->cur, a->cur->used };
+}
+
+/* arena_rewind
+ * Blocks chained after the mark stay in the list, emptied, so the next
+ * allocations walk into them instead of calling malloc again. */
+void arena_rewind(Arena *a, ArenaMark m) {
+    if (!a || !a->head) return;
+    a->last = NULL;
+    ArenaBlock *b = m.block ? m.block : a->head;
+    b->used = m.block ? m.used : 0;
+    a->cur = b;
+    for (b = b->next; b; b = b->next) b->used = 0;
+}
+
+void *arena_alloc(Arena *a, size_t size) {
+    if (!a) return malloc(size ? size : 1);
+
+    size_t need = align_up(size ? size : 1);
+    if (need < size) return NULL; // overflow
+
+    ArenaBlock *b = a->cur;
+    if (!b || b->cap - b->used < need) {
+        // Walk forward through blocks kept from before, else chain a new one
+        while (b && b->next && b->cap - b->used < need) b = b->next;
+        if (!b || b->cap - b->used < need) {
+            size_t cap = a->block_size;
+            while (cap < need) {
+                if (cap > SIZE_MAX / 2) return NULL;
+                cap <<= 1;
+            }
+            ArenaBlock *nb = block_new(cap);
+            if (!nb) return NULL;
+            if (b) b->next = nb;
+            else a->head = nb;
+            b = nb;
+        }
+        a->cur = b;
+    }
+
+    void *p = (char *)b->data + b->used;
+    b->used += need;
+    a->last = p;
+    return p;
+}
+
+void *arena_calloc(Arena *a, size_t nmemb, size_t size) {
+    if (!a) return calloc(nmemb ? nmemb : 1, size ? size : 1);
+    if (nmemb && size > SIZE_MAX / nmemb) return NULL;
+    void *p = arena_alloc(a, nmemb * size);
+    if (p) memset(p, 0, nmemb * size);
+    return p;
+}
+
+/* arena_realloc
+ * The most recent allocation grows in place while its block has room; any
+ * other pointer is copied into fresh space (the old bytes are reclaimed at
+ * the next reset). */
+void *arena_realloc(Arena *a, void *ptr, size_t old_size, size_t new_size) {
+    if (!a) return realloc(ptr, new_size);
+    if (!ptr) return arena_alloc(a, new_size);
+    if (new_size <= old_size) return ptr;
+
+    ArenaBlock *b = a->cur;
+    if (ptr == a->last && b) {
+        size_t off = (size_t)((char *)ptr - (char *)b->data);
+        size_t need = align_up(new_size);
+        if (need >= new_size && off + need <= b->cap) {
+            b->used = off + need;
+            return ptr;
+        }
+    }
+
+    void *np = arena_alloc(a, new_size);
+    if (np) memcpy(np, ptr, old_size);
+    return np;
+}
+
+char *arena_strndup(Arena *a, const char *s, size_t n) {
+    if (!s) return NULL;
+    size_t len = strnlen(s, n);
+    char *p = arena_alloc(a, len + 1);
+    if (!p) return NULL;
+    memcpy(p, s, len);
+    p[len] = '\0';
+    return p;
+}
+
+char *arena_strdup(Arena *a, const char *s) {
+    if (!s) return NULL;
+    return arena_strndup(a, s, strlen(s));
+}
+
+void arena_free(Arena *a, void *ptr) {
+    if (!a) free(ptr);
+}
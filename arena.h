@@ -0,0 +1,50 @@
+// arena.h
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/* Bump allocator for per-line scratch memory.
+ * Everything parsed, split and expanded for one input line is carved out of
+ * the arena and released in one go by arena_reset() at the end of the main
+ * loop iteration — no per-token free().
+ *
+ * Every function accepts a NULL arena and then falls back to the heap
+ * (malloc/realloc/free), so the same code path serves callers that want
+ * individually owned allocations. */
+typedef struct ArenaBlock {
+    struct ArenaBlock *next; // next block in the chain (newer)
+    size_t cap;              // usable bytes in data[]
+    size_t used;             // bytes handed out so far
+    max_align_t data[];      // payload, aligned for any object
+} ArenaBlock;
+
+typedef struct Arena {
+    ArenaBlock *head;        // first block, kept across resets
+    ArenaBlock *cur;         // block currently being bumped
+    size_t block_size;       // minimum size of each new block
+    void *last;              // most recent allocation (grown in place by arena_realloc)
+} Arena;
+
+void  arena_init(Arena *a, size_t block_size);  // 0 → default (64 KiB)
+void  arena_reset(Arena *a);                    // release everything, keep one block
+
+// A point to come back to: arena_rewind() releases everything allocated
+// since arena_mark(), keeping the blocks (a loop iteration's scratch).
+typedef struct {
+    ArenaBlock *block;       // cur at the mark (NULL: nothing allocated yet)
+    size_t used;
+} ArenaMark;
+
+ArenaMark arena_mark(const Arena *a);
+void  arena_rewind(Arena *a, ArenaMark m);
+void  arena_destroy(Arena *a);                  // release all blocks
+
+void *arena_alloc(Arena *a, size_t size);
+void *arena_calloc(Arena *a, size_t nmemb, size_t size);
+void *arena_realloc(Arena *a, void *ptr, size_t old_size, size_t new_size);
+char *arena_strdup(Arena *a, const char *s);
+char *arena_strndup(Arena *a, const char *s, size_t n);
+void  arena_free(Arena *a, void *ptr);          // no-op for arena memory, free() for heap
+
+#endif // ARENA_H
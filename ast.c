@@ -0,0 +1,277 @@
+// ast.c
+/* Recursive descent over the token list. Reserved words count only where a
+ * command name could start (first word after ;, newline, & or another
+ * reserved word) and only when typed bare: `echo done`, "if" and \fi are
+ * plain words. Running out of tokens inside an open construct is not an
+ * error but AST_INCOMPLETE, which is how the REPL and scripts know to read
+ * the next line. */
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include "ast.h"
+#include "debug.h"
+
+typedef enum {
+    KW_NONE,
+    KW_IF, KW_THEN, KW_ELIF, KW_ELSE, KW_FI,
+    KW_WHILE, KW_UNTIL, KW_DO, KW_DONE,
+    KW_FOR, KW_IN,
+    KW_COUNT
+} Keyword;
+
+static const char *const keyword_name[KW_COUNT] = {
+    [KW_IF] = "if", [KW_THEN] = "then", [KW_ELIF] = "elif", [KW_ELSE] = "else", [KW_FI] = "fi",
+    [KW_WHILE] = "while", [KW_UNTIL] = "until", [KW_DO] = "do", [KW_DONE] = "done",
+    [KW_FOR] = "for", [KW_IN] = "in",
+};
+
+#define KW_BIT(kw) (1u << (kw))
+// Words that close or continue a construct; they end whatever list is open
+#define KW_CLOSERS (KW_BIT(KW_THEN) | KW_BIT(KW_ELIF) | KW_BIT(KW_ELSE) | KW_BIT(KW_FI) | \
+                    KW_BIT(KW_DO) | KW_BIT(KW_DONE))
+
+typedef struct {
+    const TokenList *tl;
+    Arena *arena;
+    size_t k; // next token
+} Builder;
+
+static bool at_end(const Builder *B) {
+    return B->k >= B->tl->count;
+}
+
+static const Token *tok(const Builder *B) {
+    return &B->tl->tok[B->k];
+}
+
+static Keyword keyword_at(const Builder *B) {
+    if (at_end(B)) return KW_NONE;
+    const Token *t = tok(B);
+    if (t->type != TOK_WORD || t->quoted || t->nparts != 1) return KW_NONE;
+    const WordPart *wp = &B->tl->parts[t->first_part];
+    if (wp->kind != WP_UNQ) return KW_NONE;
+    for (int kw = KW_IF; kw < KW_COUNT; ++kw)
+        if (strcmp(wp->text, keyword_name[kw]) == 0) return (Keyword)kw;
+    return KW_NONE;
+}
+
+static bool is_redirection(TokType type) {
+    return type == TOK_LESS || type == TOK_GREAT || type == TOK_DGREAT ||
+           type == TOK_GREATAND || type == TOK_LESSAND;
+}
+
+// Words are quoted from the source; operators by their spelling
+static AstStatus unexpected(const Builder *B) {
+    if (at_end(B)) {
+        fprintf(stderr, "thrash: syntax error near unexpected token `newline'\n");
+    } else if (tok(B)->type == TOK_WORD) {
+        fprintf(stderr, "thrash: syntax error near unexpected token `%.*s'\n",
+                (int)tok(B)->len, B->tl->src + tok(B)->start);
+    } else {
+        fprintf(stderr, "thrash: syntax error near unexpected token `%s'\n", tok_spelling(B->tl, tok(B)));
+    }
+    return AST_SYNTAX;
+}
+
+static AstNode *new_node(Builder *B, AstType type) {
+    AstNode *n = arena_calloc(B->arena, 1, sizeof(AstNode));
+    if (n) n->type = type;
+    return n;
+}
+
+static bool list_push(Builder *B, AstList *l, size_t *cap, AstNode *n) {
+    if (l->count == *cap) {
+        size_t ncap = *cap ? *cap * 2 : 4;
+        AstNode **ni = arena_realloc(B->arena, l->items, *cap * sizeof(AstNode *), ncap * sizeof(AstNode *));
+        if (!ni) return false;
+        l->items = ni;
+        *cap = ncap;
+    }
+    l->items[l->count++] = n;
+    return true;
+}
+
+static AstStatus parse_item(Builder *B, AstNode **out);
+
+/* parse_list
+ * Commands up to one of the closers in stops (left unconsumed). With stops
+ * empty this is the top level and runs to the end of the tokens; otherwise
+ * the end means the construct is still open. An empty list, or a closer
+ * that belongs to no open construct, is a syntax error. */
+static AstStatus parse_list(Builder *B, unsigned stops, AstList *out) {
+    *out = (AstList){0};
+    size_t cap = 0;
+    for (;;) {
+        while (!at_end(B) && tok(B)->type == TOK_SEP) B->k++;
+        if (at_end(B)) {
+            if (stops) return AST_INCOMPLETE;
+            break;
+        }
+        Keyword kw = keyword_at(B);
+        if (KW_BIT(kw) & KW_CLOSERS) {
+            if (!(KW_BIT(kw) & stops) || out->count == 0) return unexpected(B);
+            break;
+        }
+        AstNode *n = NULL;
+        AstStatus st = parse_item(B, &n);
+        if (st != AST_OK) return st;
+        if (!list_push(B, out, &cap, n)) return AST_NOMEM;
+    }
+    return AST_OK;
+}
+
+// After fi/done: redirections for the whole construct, then ; or the end
+static AstStatus parse_tail(Builder *B, AstNode *n) {
+    n->redir_first = B->k;
+    while (!at_end(B) && tok(B)->type != TOK_SEP) {
+        if (!is_redirection(tok(B)->type)) return unexpected(B); // a word, | or &
+        B->k++;
+        if (at_end(B) || tok(B)->type != TOK_WORD) return unexpected(B);
+        B->k++;
+    }
+    n->redir_last = B->k;
+    return AST_OK;
+}
+
+// From `if` (or `elif`, which shares the outer if's fi) through fi
+static AstStatus parse_if(Builder *B, AstNode **out, bool elif) {
+    AstNode *n = new_node(B, AST_IF);
+    if (!n) return AST_NOMEM;
+    B->k++;
+
+    AstStatus st = parse_list(B, KW_BIT(KW_THEN), &n->cond);
+    if (st != AST_OK) return st;
+    B->k++;
+    st = parse_list(B, KW_BIT(KW_ELIF) | KW_BIT(KW_ELSE) | KW_BIT(KW_FI), &n->body);
+    if (st != AST_OK) return st;
+
+    Keyword kw = keyword_at(B);
+    if (kw == KW_ELIF) {
+        AstNode *inner = NULL;
+        size_t cap = 0;
+        st = parse_if(B, &inner, true);
+        if (st != AST_OK) return st;
+        if (!list_push(B, &n->orelse, &cap, inner)) return AST_NOMEM;
+    } else {
+        if (kw == KW_ELSE) {
+            B->k++;
+            st = parse_list(B, KW_BIT(KW_FI), &n->orelse);
+            if (st != AST_OK) return st;
+        }
+        B->k++; // fi
+    }
+    *out = n;
+    return elif ? AST_OK : parse_tail(B, n);
+}
+
+// do ... done, the part every loop shares
+static AstStatus parse_do_group(Builder *B, AstNode *n) {
+    if (at_end(B)) return AST_INCOMPLETE;
+    if (keyword_at(B) != KW_DO) return unexpected(B);
+    B->k++;
+    AstStatus st = parse_list(B, KW_BIT(KW_DONE), &n->body);
+    if (st != AST_OK) return st;
+    B->k++;
+    return parse_tail(B, n);
+}
+
+static AstStatus parse_while(Builder *B, AstNode **out) {
+    AstNode *n = new_node(B, keyword_at(B) == KW_UNTIL ? AST_UNTIL : AST_WHILE);
+    if (!n) return AST_NOMEM;
+    B->k++;
+    AstStatus st = parse_list(B, KW_BIT(KW_DO), &n->cond);
+    if (st != AST_OK) return st;
+    *out = n;
+    return parse_do_group(B, n);
+}
+
+static bool valid_identifier(const char *s) {
+    if (!(*s == '_' || isalpha((unsigned char)*s))) return false;
+    while (*++s)
+        if (!(*s == '_' || isalnum((unsigned char)*s))) return false;
+    return true;
+}
+
+// for name [in word...] ; do ... done. Without "in" the list is empty (no
+// positional parameters yet), so the body never runs.
+static AstStatus parse_for(Builder *B, AstNode **out) {
+    AstNode *n = new_node(B, AST_FOR);
+    if (!n) return AST_NOMEM;
+    B->k++;
+
+    if (at_end(B)) return AST_INCOMPLETE;
+    const Token *name = tok(B);
+    if (name->type != TOK_WORD) return unexpected(B);
+    const WordPart *wp = &B->tl->parts[name->first_part];
+    if (name->quoted || name->nparts != 1 || wp->kind != WP_UNQ || !valid_identifier(wp->text)) {
+        fprintf(stderr, "thrash: `%.*s': not a valid identifier\n",
+                (int)name->len, B->tl->src + name->start);
+        return AST_SYNTAX;
+    }
+    n->var = wp->text;
+    B->k++;
+
+    n->first = n->last = B->k;
+    if (keyword_at(B) == KW_IN) {
+        B->k++;
+        n->first = B->k;
+        while (!at_end(B) && tok(B)->type == TOK_WORD) B->k++;
+        n->last = B->k;
+        if (at_end(B)) return AST_INCOMPLETE;
+        if (tok(B)->type != TOK_SEP) return unexpected(B);
+    }
+    while (!at_end(B) && tok(B)->type == TOK_SEP) B->k++;
+    *out = n;
+    return parse_do_group(B, n);
+}
+
+/* A plain pipeline runs to the next ; newline or &. Its last stage may be a
+ * compound command (`seq 3 | while read x; do ...; done`): the stages before
+ * it stay a token range and the construct becomes n->tail, which ends the
+ * pipeline. A compound command anywhere else in a pipeline, or one put in
+ * the background, is still a syntax error. */
+static AstStatus parse_pipeline(Builder *B, AstNode **out) {
+    AstNode *n = new_node(B, AST_PIPELINE);
+    if (!n) return AST_NOMEM;
+    n->first = B->k;
+    while (!at_end(B) && tok(B)->type != TOK_SEP && tok(B)->type != TOK_AMP) {
+        bool pipe = tok(B)->type == TOK_PIPE;
+        B->k++;
+        if (!pipe) continue;
+        Keyword kw = keyword_at(B); // right after | is command position
+        if (kw != KW_IF && kw != KW_WHILE && kw != KW_UNTIL && kw != KW_FOR) continue;
+        n->last = B->k - 1;
+        if (n->first == n->last) {
+            B->k = n->last;
+            return unexpected(B); // `| while`
+        }
+        *out = n;
+        return parse_item(B, &n->tail);
+    }
+    n->last = B->k;
+    if (n->first == n->last) return unexpected(B); // `then &`
+    if (!at_end(B) && tok(B)->type == TOK_AMP) {
+        n->background = true;
+        B->k++;
+    }
+    *out = n;
+    return AST_OK;
+}
+
+static AstStatus parse_item(Builder *B, AstNode **out) {
+    switch (keyword_at(B)) {
+    case KW_IF:    return parse_if(B, out, false);
+    case KW_WHILE:
+    case KW_UNTIL: return parse_while(B, out);
+    case KW_FOR:   return parse_for(B, out);
+    default:       return parse_pipeline(B, out);
+    }
+}
+
+AstStatus ast_build(const TokenList *tl, Arena *arena, AstList *out) {
+    Builder B = { tl, arena, 0 };
+    AstStatus st = parse_list(&B, 0, out);
+    LOG(LOG_LEVEL_INFO, "ast: %zu top-level commands, status %d", out->count, st);
+    return st;
+}
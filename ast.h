@@ -0,0 +1,51 @@
+#ifndef AST_H
+#define AST_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "arena.h"
+#include "lexer.h"
+
+/* Command tree over a TokenList.
+ * Built once per input before any of it runs. Only structure is decided
+ * here: which tokens make up each pipeline, which lists are an if's
+ * condition or a loop's body. Words stay tokens, so they are expanded when
+ * their node runs, every time it runs; a loop body is walked again, never
+ * re-lexed or re-split. Nodes come from the TokenList's arena. */
+
+typedef enum {
+    AST_PIPELINE, // tokens [first, last): one segment, for parse_tokens(); see tail
+    AST_IF,       // if cond; then body; [elif ... | else orelse;] fi
+    AST_WHILE,    // while cond; do body; done
+    AST_UNTIL,    // until cond; do body; done
+    AST_FOR       // for var [in words]; do body; done
+} AstType;
+
+typedef struct AstNode AstNode;
+
+typedef struct {
+    AstNode **items;
+    size_t count;
+} AstList;
+
+struct AstNode {
+    AstType type;
+    size_t first, last;             // pipeline: its tokens; for: the words after "in"
+    size_t redir_first, redir_last; // compound: redirections after fi/done
+    bool background;                // pipeline ended by &
+    AstList cond, body;             // for: body only
+    AstList orelse;                 // if: the else part; an elif is one AST_IF here
+    const char *var;                // for: the loop variable
+    AstNode *tail;                  // pipeline: a compound command as its last stage
+};
+
+typedef enum {
+    AST_OK,
+    AST_INCOMPLETE, // a compound command is still open: read another line
+    AST_SYNTAX,     // reported on stderr
+    AST_NOMEM
+} AstStatus;
+
+AstStatus ast_build(const TokenList *tl, Arena *arena, AstList *out);
+
+#endif // AST_H
@@ -0,0 +1,394 @@
+// bench.c
+/* Microbenchmarks against the shell's real objects (everything but main.o),
+ * plus end-to-end runs of the thrash binary. Results go to stdout as one
+ * JSON document so runs can be compared across releases.
+ *
+ *   bench [--quick] [--shell PATH] [name-substring]
+ *
+ * --quick scales every iteration count down (a smoke test, or PGO training);
+ * --shell is the binary for the end-to-end cases (default ./thrash). Build
+ * and run with `make bench`. */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include "arena.h"
+#include "parser.h"
+#include "command.h"
+#include "input.h"
+#include "var.h"
+#include "history.h"
+#include "path.h"
+#include "completion.h"
+
+typedef struct {
+    const char *name;
+    const char *unit;    // what one iteration is
+    uint64_t iters;
+    double total_ms;
+    double ns_per_op;
+    double mb_per_s;     // 0 unless the case processes a byte stream
+} Result;
+
+static Result *results = NULL;
+static size_t nresults = 0, results_cap = 0;
+static unsigned scale_div = 1;          // --quick: 20
+static const char *filter = NULL;
+static const char *shell_path = "./thrash";
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static bool wanted(const char *name) {
+    return !filter || strstr(name, filter) != NULL;
+}
+
+static uint64_t scaled(uint64_t iters) {
+    uint64_t n = iters / scale_div;
+    return n ? n : 1;
+}
+
+static void record(const char *name, const char *unit, uint64_t iters, uint64_t ns, size_t bytes) {
+    if (nresults == results_cap) {
+        size_t ncap = results_cap ? results_cap * 2 : 32;
+        Result *nr = realloc(results, ncap * sizeof(*nr));
+        if (!nr) return;
+        results = nr;
+        results_cap = ncap;
+    }
+    Result *r = &results[nresults++];
+    *r = (Result){ .name = strdup(name), .unit = unit, .iters = iters,
+                   .total_ms = ns / 1e6, .ns_per_op = iters ? (double)ns / iters : 0 };
+    if (bytes && ns) r->mb_per_s = (bytes / 1e6) / (ns / 1e9);
+    fprintf(stderr, "%-28s %10.1f ns/%s\n", name, r->ns_per_op, unit);
+}
+
+/* ---- Microbenchmarks ------------------------------------------------------ */
+
+static const char *const pipeline_line =
+    "cat < in.txt | grep -v \"$PATTERN\" | sort -u | tr a-z A-Z >> out.txt";
+
+static void bench_parse(void) {
+    if (!wanted("parse_commands")) return;
+    Arena a;
+    arena_init(&a, 0);
+    uint64_t n = scaled(200000), t0 = now_ns();
+    for (uint64_t i = 0; i < n; ++i) {
+        int num = 0;
+        parse_commands(pipeline_line, &num, &a);
+        arena_reset(&a);
+    }
+    record("parse_commands", "line", n, now_ns() - t0, n * strlen(pipeline_line));
+    arena_destroy(&a);
+}
+
+static void bench_split(void) {
+    if (!wanted("split_on_semicolons")) return;
+    const char *line = "cd /tmp; ls -l 'a;b' \"c;d\"; echo done; X=1; echo $X # trailing; comment";
+    Arena a;
+    arena_init(&a, 0);
+    uint64_t n = scaled(300000), t0 = now_ns();
+    for (uint64_t i = 0; i < n; ++i) {
+        split_on_semicolons(line, &a);
+        arena_reset(&a);
+    }
+    record("split_on_semicolons", "line", n, now_ns() - t0, n * strlen(line));
+    arena_destroy(&a);
+}
+
+static void bench_expand(VarTable *vt) {
+    static const struct { const char *name, *input; } cases[] = {
+        { "expand_variables_ex/plain", "just some words with no dollar sign in them at all" },
+        { "expand_variables_ex/vars",  "hello $USER_NAME in ${HOME_DIR}: $? and $MISSING end" },
+    };
+    Arena a;
+    arena_init(&a, 0);
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); ++c) {
+        if (!wanted(cases[c].name)) continue;
+        uint64_t n = scaled(500000), t0 = now_ns();
+        for (uint64_t i = 0; i < n; ++i) {
+            expand_variables_ex(cases[c].input, 0, vt, &a);
+            arena_reset(&a);
+        }
+        record(cases[c].name, "call", n, now_ns() - t0, n * strlen(cases[c].input));
+    }
+    arena_destroy(&a);
+}
+
+static void bench_vars(void) {
+    enum { NVARS = 1000 };
+    static char names[NVARS][16];
+    for (int i = 0; i < NVARS; ++i) snprintf(names[i], sizeof(names[i]), "VAR_%d", i);
+
+    VarTable vt;
+    if (!vart_init(&vt, 64)) return;
+    uint64_t rounds = scaled(200);
+
+    if (wanted("vart_set")) {
+        uint64_t t0 = now_ns();
+        for (uint64_t r = 0; r < rounds; ++r)
+            for (int i = 0; i < NVARS; ++i) vart_set(&vt, names[i], (r & 1) ? "odd" : "even", 0);
+        record("vart_set", "call", rounds * NVARS, now_ns() - t0, 0);
+    } else {
+        for (int i = 0; i < NVARS; ++i) vart_set(&vt, names[i], "x", 0);
+    }
+
+    if (wanted("vart_get")) {
+        uint64_t t0 = now_ns();
+        size_t hits = 0;
+        for (uint64_t r = 0; r < rounds * 5; ++r)
+            for (int i = 0; i < NVARS; ++i) hits += vart_get(&vt, names[i]) != NULL;
+        record("vart_get", "call", rounds * 5 * NVARS, now_ns() - t0, 0);
+        if (hits == 0) fprintf(stderr, "vart_get: no hits?\n");
+    }
+
+    vart_set(&vt, "USER_NAME", "bench", 0);
+    vart_set(&vt, "HOME_DIR", "/home/bench", 0);
+    bench_expand(&vt);
+    vart_destroy(&vt);
+}
+
+static void bench_history(void) {
+    if (!wanted("history_add")) return;
+    enum { CAP = 10000 };
+    History h;
+    if (history_init(&h, NULL, CAP, 0) != 0) return;
+    char line[64];
+    for (int i = 0; i < CAP; ++i) {
+        snprintf(line, sizeof(line), "git commit -m 'prefill %d'", i);
+        history_add(&h, line);
+    }
+    // Full ring: every add drops the oldest entry
+    uint64_t n = scaled(1000000), t0 = now_ns();
+    for (uint64_t i = 0; i < n; ++i) {
+        snprintf(line, sizeof(line), "make -j8 target_%llu", (unsigned long long)i);
+        history_add(&h, line);
+    }
+    record("history_add/at_capacity", "add", n, now_ns() - t0, 0);
+    history_dispose(&h);
+}
+
+static void bench_path(void) {
+    const char *path = getenv("PATH");
+    path_set_search(path ? path : "/usr/local/bin:/usr/bin:/bin");
+    if (wanted("search_path_alloc/cold")) {
+        uint64_t n = scaled(50000), t0 = now_ns();
+        for (uint64_t i = 0; i < n; ++i) {
+            char *out = NULL;
+            path_hash_clear();
+            search_path_alloc("sh", &out);
+            free(out);
+        }
+        record("search_path_alloc/cold", "lookup", n, now_ns() - t0, 0);
+    }
+    if (wanted("search_path_alloc/hashed")) {
+        uint64_t n = scaled(200000), t0 = now_ns();
+        for (uint64_t i = 0; i < n; ++i) {
+            char *out = NULL;
+            search_path_alloc("sh", &out);
+            free(out);
+        }
+        record("search_path_alloc/hashed", "lookup", n, now_ns() - t0, 0);
+    }
+    // Tab on "g" in command position: the first press builds the PATH index,
+    // later ones only stat the directories
+    for (int warm = 0; warm < 2; ++warm) {
+        const char *name = warm ? "complete_command/warm" : "complete_command/cold";
+        if (!wanted(name)) continue;
+        uint64_t n = warm ? scaled(2000) : scaled(200), t0 = now_ns();
+        for (uint64_t i = 0; i < n; ++i) {
+            if (!warm) completion_dispose();
+            size_t count = 0;
+            char **m = complete_command("g", &count);
+            for (size_t k = 0; k < count; ++k) free(m[k]);
+            free(m);
+        }
+        record(name, "tab", n, now_ns() - t0, 0);
+    }
+    completion_dispose();
+    path_hash_dispose();
+}
+
+/* ---- End to end ----------------------------------------------------------- */
+
+// Run the shell with args, all std fds on /dev/null. Returns elapsed ns, or 0.
+static uint64_t run_shell(char *const argv[]) {
+    uint64_t t0 = now_ns();
+    pid_t pid = fork();
+    if (pid < 0) return 0;
+    if (pid == 0) {
+        int fd = open("/dev/null", O_RDWR);
+        if (fd >= 0) {
+            dup2(fd, 0);
+            dup2(fd, 1);
+            dup2(fd, 2);
+        }
+        execv(argv[0], argv);
+        _exit(127);
+    }
+    int st;
+    while (waitpid(pid, &st, 0) < 0) {}
+    if (!WIFEXITED(st) || WEXITSTATUS(st) == 127) {
+        fprintf(stderr, "bench: %s did not run (status 0x%x)\n", argv[0], st);
+        return 0;
+    }
+    return now_ns() - t0;
+}
+
+// Write body repeated until the file reaches at least bytes (or count times).
+static char *write_script(const char *body, size_t count, size_t bytes, size_t *written) {
+    char *path = strdup("/tmp/thrash-bench.XXXXXX");
+    int fd = path ? mkstemp(path) : -1;
+    if (fd < 0) {
+        free(path);
+        return NULL;
+    }
+    FILE *f = fdopen(fd, "w");
+    size_t len = strlen(body), total = 0;
+    for (size_t i = 0; (count && i < count) || (bytes && total < bytes); ++i) {
+        fputs(body, f);
+        total += len;
+    }
+    fclose(f);
+    if (written) *written = total;
+    return path;
+}
+
+static void bench_script(const char *name, const char *unit, const char *body,
+                         size_t count, size_t bytes) {
+    if (!wanted(name)) return;
+    size_t total = 0;
+    char *path = write_script(body, count, bytes, &total);
+    if (!path) return;
+    char *argv[] = { (char *)shell_path, path, NULL };
+    uint64_t ns = run_shell(argv);
+    if (ns) record(name, unit, count ? count : total / strlen(body), ns, bytes ? total : 0);
+    unlink(path);
+    free(path);
+}
+
+static void bench_e2e(void) {
+    if (access(shell_path, X_OK) != 0) {
+        fprintf(stderr, "bench: %s: not executable, skipping end-to-end cases\n", shell_path);
+        return;
+    }
+
+    if (wanted("startup")) {
+        char *argv[] = { (char *)shell_path, "-c", "true", NULL };
+        uint64_t n = scaled(200), total = 0, ok = 0;
+        for (uint64_t i = 0; i < n; ++i) {
+            uint64_t ns = run_shell(argv);
+            if (ns) { total += ns; ok++; }
+        }
+        if (ok) record("startup/-c true", "run", ok, total, 0);
+    }
+
+    // External commands only: lines of /bin/true, forked or spawned one by one
+    bench_script("fork/true", "command", "/bin/true\n", scaled(2000), 0);
+
+    for (int depth = 1; depth <= 16; depth *= 2) {
+        char name[32], line[256] = "/bin/true";
+        for (int d = 1; d < depth; ++d) strcat(line, " | /bin/true");
+        strcat(line, "\n");
+        snprintf(name, sizeof(name), "pipeline/depth_%d", depth);
+        bench_script(name, "pipeline", line, scaled(1000) / (size_t)depth + 1, 0);
+    }
+
+    // Parsing and in-process execution only: ~1 MB of assignments and builtins
+    bench_script("script/1MB", "line",
+                 "X=value; Y=\"$X and $X\"; : $Y 'quoted; text' \"$HOME\" # comment\n",
+                 0, (1u << 20) / scale_div);
+
+    // The same commands as a loop body: lexed and built once, then only
+    // expanded and run per iteration. Nested fors of 10 give 10^levels rounds.
+    if (wanted("script/loop")) {
+        int levels = scale_div > 1 ? 3 : 5;
+        char text[1024] = "";
+        for (int d = 0; d < levels; ++d)
+            snprintf(text + strlen(text), sizeof(text) - strlen(text), "for d%d in 0 1 2 3 4 5 6 7 8 9; do ", d);
+        strcat(text, "X=value; Y=\"$X and $X\"; : $Y 'quoted; text' \"$HOME\"");
+        for (int d = 0; d < levels; ++d) strcat(text, "; done");
+        strcat(text, "\n");
+        char *path = write_script(text, 1, 0, NULL);
+        if (path) {
+            char *argv[] = { (char *)shell_path, path, NULL };
+            uint64_t ns = run_shell(argv), iters = 1;
+            for (int d = 0; d < levels; ++d) iters *= 10;
+            if (ns) record("script/loop", "iteration", iters, ns, 0);
+            unlink(path);
+            free(path);
+        }
+    }
+
+    // `while read` over a file: blocks from readbuf.c, not a read(2) per byte
+    if (wanted("script/read")) {
+        size_t lines = scaled(200000), bytes = 0;
+        char *data = write_script("2024-01-01T00:00:00 INFO worker-3 request done in 12 ms\n", lines, 0, &bytes);
+        char text[256];
+        snprintf(text, sizeof(text), "while read when level who rest; do :; done < %s\n", data ? data : "");
+        char *path = data ? write_script(text, 1, 0, NULL) : NULL;
+        if (path) {
+            char *argv[] = { (char *)shell_path, path, NULL };
+            uint64_t ns = run_shell(argv);
+            if (ns) record("script/read", "line", lines, ns, bytes);
+            unlink(path);
+            free(path);
+        }
+        if (data) {
+            unlink(data);
+            free(data);
+        }
+    }
+}
+
+/* ---- Driver ----------------------------------------------------------------- */
+
+static void print_json(FILE *out) {
+    fprintf(out, "{\n  \"suite\": \"thrash-bench\",\n  \"quick\": %s,\n  \"results\": [\n",
+            scale_div > 1 ? "true" : "false");
+    for (size_t i = 0; i < nresults; ++i) {
+        const Result *r = &results[i];
+        fprintf(out, "    {\"name\": \"%s\", \"unit\": \"%s\", \"iters\": %llu, "
+                "\"total_ms\": %.3f, \"ns_per_op\": %.1f", r->name, r->unit,
+                (unsigned long long)r->iters, r->total_ms, r->ns_per_op);
+        if (r->mb_per_s > 0) fprintf(out, ", \"mb_per_s\": %.1f", r->mb_per_s);
+        fprintf(out, "}%s\n", i + 1 < nresults ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+}
+
+int main(int argc, char **argv) {
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--quick") == 0) {
+            scale_div = 20;
+        } else if (strcmp(argv[i], "--shell") == 0 && i + 1 < argc) {
+            shell_path = argv[++i];
+        } else if (argv[i][0] == '-') {
+            fprintf(stderr, "usage: %s [--quick] [--shell PATH] [name-substring]\n", argv[0]);
+            return 2;
+        } else {
+            filter = argv[i];
+        }
+    }
+
+    bench_parse();
+    bench_split();
+    bench_vars();
+    bench_history();
+    bench_path();
+    bench_e2e();
+
+    print_json(stdout);
+    for (size_t i = 0; i < nresults; ++i) free((char *)results[i].name);
+    free(results);
+    return 0;
+}
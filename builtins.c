@@ -1,45 +1,917 @@
-#include "builtins.h"
-#include <unistd.h>
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <stdbool.h>
-#include "command.h"
-#include "debug.h"
-#include "path.h"
-
-#define SHELL_EXIT 42 
-
-int handle_cd(Command *cmd) {
-    if (!cmd || !cmd->argv || !cmd->argv[0]) return -1;
-
-    // Use second argument as path, or fallback to $HOME
-    const char *path = cmd->argv[1] ? cmd->argv[1] : getenv("HOME");
-    //if (!path) {
-    //    fprintf(stderr, "thrash: cd: no path and $HOME not set\n");
-    //    return -1;
-    //}
-    if (!is_directory(path)) {
-        fprintf(stderr, "thrash: cd: '%s' is not a directory\n", path);
-        return -1;
-    }
-    
-    LOG(LOG_LEVEL_INFO, "cd: changing directory to '%s'", path);
-
-    if (chdir(path) != 0) {
-        perror("cd");
-        return -1;
-    }
-
-    return 0;
-}
-
-int handle_exit() {
-    return SHELL_EXIT;
-}
-
-
-// add builtins as needed
-bool is_builtin(const char *cmd) {
-    return strcmp(cmd, "cd") == 0 || strcmp(cmd, "exit") == 0 || strcmp(cmd, "export") == 0;
+#include "builtins.h"
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include "command.h"
+#include "debug.h"
+#include "path.h"
+#include "jobs.h"
+#include "histindex.h"
+#include "input.h"
+#include "trace.h"
+#include "stats.h"
+#include "parallel.h"
+#include "readbuf.h"
+#include "signals.h"
+
+/* cd [dir | -]
+ * No argument: $HOME. "-": $OLDPWD, printing where we land. A successful
+ * change refreshes cwd, PWD/OLDPWD and the prompt (shell_cwd_changed). */
+int handle_cd(ShellContext *shell, Command *cmd, FILE *out) {
+    if (!cmd || !cmd->argv || !cmd->argv[0]) return -1;
+
+    // Use second argument as path, or fallback to $HOME
+    const char *path = cmd->argv[1];
+    bool dash = path && strcmp(path, "-") == 0;
+    if (!path || dash) {
+        const char *name = dash ? "OLDPWD" : "HOME";
+        Var *v = vart_get(shell->vars, name);
+        if (!v || !*v->value) {
+            fprintf(stderr, "thrash: cd: %s not set\n", name);
+            return -1;
+        }
+        path = v->value;
+    }
+    if (!is_directory(path)) {
+        fprintf(stderr, "thrash: cd: '%s' is not a directory\n", path);
+        return -1;
+    }
+    
+    LOG(LOG_LEVEL_INFO, "cd: changing directory to '%s'", path);
+
+    if (chdir(path) != 0) {
+        perror("cd");
+        return -1;
+    }
+
+    shell_cwd_changed(shell);
+    if (dash) fprintf(out, "%s\n", shell->cwd);
+    return 0;
+}
+
+/* hash [-r] [name ...]
+ * No args: list the command hash. -r: forget everything.
+ * Names: search PATH now and remember the result. */
+int handle_hash(Command *cmd, FILE *out) {
+    if (!cmd || !cmd->argv) return 1;
+
+    if (!cmd->argv[1]) {
+        path_hash_print(out);
+        return 0;
+    }
+
+    int status = 0;
+    for (int i = 1; cmd->argv[i]; ++i) {
+        const char *arg = cmd->argv[i];
+        if (strcmp(arg, "-r") == 0) {
+            path_hash_clear();
+            continue;
+        }
+        if (has_slash(arg) || !path_hash_remember(arg)) {
+            fprintf(stderr, "thrash: hash: %s: not found\n", arg);
+            status = 1;
+        }
+    }
+    return status;
+}
+
+/* export [-n] [name[=value] ...]
+ * No args: list exported variables. name=value sets and exports, name exports
+ * (creating it empty), -n drops the export flag from the names that follow. */
+int handle_export(VarTable *vars, Command *cmd, FILE *out) {
+    if (!vars || !cmd || !cmd->argv) return 1;
+
+    if (!cmd->argv[1]) {
+        for (char *const *e = vart_envp(vars); *e; ++e) {
+            const char *eq = strchr(*e, '=');
+            fprintf(out, "export %.*s=\"%s\"\n", (int)(eq - *e), *e, eq + 1);
+        }
+        return 0;
+    }
+
+    int status = 0;
+    bool unexport = false;
+    for (int i = 1; cmd->argv[i]; ++i) {
+        const char *arg = cmd->argv[i];
+        if (i == 1 && strcmp(arg, "-n") == 0) {
+            unexport = true;
+            continue;
+        }
+        const char *eq = strchr(arg, '=');
+        bool ok;
+        if (eq && !unexport) {
+            char *name = strndup(arg, (size_t)(eq - arg));
+            ok = name && vart_set(vars, name, eq + 1, V_EXPORT);
+            free(name);
+        } else if (unexport) {
+            ok = vart_unexport(vars, arg) || !vart_get(vars, arg);
+        } else {
+            ok = vart_export(vars, arg);
+        }
+        if (!ok) {
+            fprintf(stderr, "thrash: export: `%s': not a valid identifier\n", arg);
+            status = 1;
+        }
+    }
+    return status;
+}
+
+/* unset name ...
+ * Remove shell variables; readonly or missing names are reported. */
+int handle_unset(VarTable *vars, Command *cmd) {
+    if (!cmd->argv[1]) {
+        fprintf(stderr, "unset: missing variable name\n");
+        return 1;
+    }
+    int status = 0;
+    for (int j = 1; cmd->argv[j]; ++j) {
+        if (!vart_unset(vars, cmd->argv[j])) {
+            fprintf(stderr, "unset: failed to unset '%s'\n", cmd->argv[j]);
+            status = 1;
+        }
+    }
+    return status;
+}
+
+/* exit [n]
+ * Stop the main loop; the shell exits with n, or the last status. */
+int handle_exit(ShellContext *shell, Command *cmd) {
+    shell->running = 0;
+    if (!cmd->argv[1]) return shell->last_status;
+    char *end;
+    long n = strtol(cmd->argv[1], &end, 10);
+    if (*cmd->argv[1] == '\0' || *end != '\0') {
+        fprintf(stderr, "thrash: exit: %s: numeric argument required\n", cmd->argv[1]);
+        return 2;
+    }
+    return (int)(n & 0xff);
+}
+
+
+/* ---- Output builtins --------------------------------------------------
+ * These only write to `out`, so in a pipeline the shell can run them
+ * in-process against a memory stream instead of forking (see pipeline.c). */
+
+// One backslash escape from *pp (just past the '\'); advances *pp.
+// Returns the byte, or -1 for \c (stop all output).
+static int unescape(const char **pp) {
+    const char *p = *pp;
+    int c = (unsigned char)*p++;
+    switch (c) {
+        case 'a': c = '\a'; break;
+        case 'b': c = '\b'; break;
+        case 'c': *pp = p; return -1;
+        case 'e': c = 27; break;
+        case 'f': c = '\f'; break;
+        case 'n': c = '\n'; break;
+        case 'r': c = '\r'; break;
+        case 't': c = '\t'; break;
+        case 'v': c = '\v'; break;
+        case '\\': c = '\\'; break;
+        case '0': {
+            int v = 0;
+            for (int k = 0; k < 3 && *p >= '0' && *p <= '7'; ++k) v = v * 8 + (*p++ - '0');
+            c = v;
+            break;
+        }
+        case '\0': p--; c = '\\'; break; // trailing lone backslash
+        default: // unknown escape: keep it verbatim
+            *pp = p - 1;
+            return '\\';
+    }
+    *pp = p;
+    return c;
+}
+
+// Write s, interpreting escapes. Returns false once \c asked to stop.
+static bool put_escaped(FILE *out, const char *s) {
+    while (*s) {
+        if (*s != '\\') { fputc(*s++, out); continue; }
+        s++;
+        int c = unescape(&s);
+        if (c < 0) return false;
+        fputc(c, out);
+    }
+    return true;
+}
+
+/* echo [-neE] [arg ...] */
+static int bi_echo(ShellContext *shell, Command *cmd, FILE *out) {
+    (void)shell;
+    bool newline = true, escapes = false;
+    int i = 1;
+    for (; cmd->argv[i] && cmd->argv[i][0] == '-' && cmd->argv[i][1]; ++i) {
+        const char *f = cmd->argv[i] + 1;
+        if (strspn(f, "neE") != strlen(f)) break; // not an option: print it
+        for (; *f; ++f) {
+            if (*f == 'n') newline = false;
+            else if (*f == 'e') escapes = true;
+            else escapes = false;
+        }
+    }
+    for (bool first = true; cmd->argv[i]; ++i, first = false) {
+        if (!first) fputc(' ', out);
+        if (!escapes) fputs(cmd->argv[i], out);
+        else if (!put_escaped(out, cmd->argv[i])) return 0;
+    }
+    if (newline) fputc('\n', out);
+    return 0;
+}
+
+/* printf format [arg ...]
+ * %s %b %c %d %i %u %o %x %X %% with flags/width/precision; the format is
+ * reused while arguments remain, missing arguments read as "" / 0. */
+static int bi_printf(ShellContext *shell, Command *cmd, FILE *out) {
+    (void)shell;
+    if (!cmd->argv[1]) {
+        fprintf(stderr, "printf: usage: printf format [arguments]\n");
+        return 2;
+    }
+    const char *fmt = cmd->argv[1];
+    char **args = cmd->argv + 2;
+    int status = 0;
+
+    do {
+        char **before = args;
+        for (const char *p = fmt; *p; ) {
+            if (*p == '\\') {
+                p++;
+                int c = unescape(&p);
+                if (c < 0) return status;
+                fputc(c, out);
+                continue;
+            }
+            if (*p != '%') { fputc(*p++, out); continue; }
+            if (p[1] == '%') { fputc('%', out); p += 2; continue; }
+            if (p[1] == '\0') { fputc('%', out); p++; continue; } // trailing %: literal, as bash
+
+            // Copy "%[flags][width][.prec]" then the conversion
+            char spec[32];
+            size_t n = 0;
+            spec[n++] = *p++;
+            while (*p && strchr("-+ #0123456789.", *p) && n < sizeof(spec) - 4) spec[n++] = *p++; // room for "ll", conv, NUL
+            char conv = *p ? *p++ : '\0';
+            const char *arg = *args ? *args++ : NULL;
+
+            switch (conv) {
+                case 's':
+                case 'c':
+                    spec[n++] = conv == 'c' ? 'c' : 's';
+                    spec[n] = '\0';
+                    if (conv == 'c') fprintf(out, spec, arg ? arg[0] : '\0');
+                    else fprintf(out, spec, arg ? arg : "");
+                    break;
+                case 'b':
+                    if (arg && !put_escaped(out, arg)) return status;
+                    break;
+                case 'd': case 'i': case 'u': case 'o': case 'x': case 'X': {
+                    spec[n++] = 'l';
+                    spec[n++] = 'l';
+                    spec[n++] = conv;
+                    spec[n] = '\0';
+                    char *end = NULL;
+                    errno = 0;
+                    long long v = 0;
+                    if (arg && (arg[0] == '\'' || arg[0] == '"')) v = (unsigned char)arg[1];
+                    else if (arg) v = strtoll(arg, &end, 0);
+                    if (arg && end && (*end || errno)) {
+                        fprintf(stderr, "thrash: printf: %s: invalid number\n", arg);
+                        status = 1;
+                    }
+                    fprintf(out, spec, v);
+                    break;
+                }
+                default:
+                    fprintf(stderr, "thrash: printf: %%%c: invalid directive\n", conv ? conv : ' ');
+                    return 1;
+            }
+        }
+        if (args == before) break; // format consumed nothing: don't loop forever
+    } while (*args);
+    return status;
+}
+
+static int bi_true(ShellContext *shell, Command *cmd, FILE *out) {
+    (void)shell; (void)cmd; (void)out;
+    return 0;
+}
+
+static int bi_false(ShellContext *shell, Command *cmd, FILE *out) {
+    (void)shell; (void)cmd; (void)out;
+    return 1;
+}
+
+/* ---- Shell-state builtins: adapters onto the handlers above ---------- */
+
+static int bi_cd(ShellContext *shell, Command *cmd, FILE *out) {
+    return handle_cd(shell, cmd, out) == 0 ? 0 : 1;
+}
+
+static int bi_exit(ShellContext *shell, Command *cmd, FILE *out) {
+    (void)out;
+    return handle_exit(shell, cmd);
+}
+
+static int bi_export(ShellContext *shell, Command *cmd, FILE *out) {
+    return handle_export(shell->vars, cmd, out);
+}
+
+static int bi_unset(ShellContext *shell, Command *cmd, FILE *out) {
+    (void)out;
+    return handle_unset(shell->vars, cmd);
+}
+
+static int bi_hash(ShellContext *shell, Command *cmd, FILE *out) {
+    (void)shell;
+    return handle_hash(cmd, out);
+}
+
+/* ---- Job control: see jobs.c ------------------------------------------ */
+
+// The named job, or the current one; reports "no such job" itself.
+static Job *job_arg(const char *who, const char *spec) {
+    Job *job = job_find_spec(spec);
+    if (!job) fprintf(stderr, "thrash: %s: %s: no such job\n", who, spec ? spec : "current");
+    return job;
+}
+
+/* jobs [-l | -p] [job ...]
+ * List jobs with their state; -l adds the process group, -p prints only
+ * that. Finished jobs that have been listed are forgotten. */
+static int bi_jobs(ShellContext *shell, Command *cmd, FILE *out) {
+    (void)shell;
+    bool with_pids = false, pids_only = false;
+    int i = 1;
+    for (; cmd->argv[i] && cmd->argv[i][0] == '-' && cmd->argv[i][1]; ++i) {
+        if (strcmp(cmd->argv[i], "-l") == 0)      with_pids = true;
+        else if (strcmp(cmd->argv[i], "-p") == 0) pids_only = true;
+        else {
+            fprintf(stderr, "thrash: jobs: %s: invalid option\n", cmd->argv[i]);
+            return 2;
+        }
+    }
+
+    jobs_reap();
+    int status = 0;
+    size_t n = cmd->argv[i] ? (size_t)(cmd->argc - i) : job_count();
+    for (size_t k = 0; k < n; ++k) {
+        Job *job = cmd->argv[i] ? job_arg("jobs", cmd->argv[i + k]) : job_at(k);
+        if (!job) {
+            status = 1;
+            continue;
+        }
+        if (pids_only) fprintf(out, "%d\n", (int)job->pgid);
+        else           jobs_print(out, job, with_pids);
+        job->notified = true;
+    }
+
+    // Done and reported: drop them now that the listing is complete
+    for (size_t k = 0; k < job_count();) {
+        Job *job = job_at(k);
+        if (job_state(job) == JOB_DONE && job->notified) job_remove(job);
+        else k++;
+    }
+    return status;
+}
+
+// fg [job]: continue a job (if stopped) with the terminal, and wait for it
+static int bi_fg(ShellContext *shell, Command *cmd, FILE *out) {
+    jobs_reap();
+    Job *job = job_arg("fg", cmd->argv[1]);
+    if (!job) return 1;
+    fprintf(out, "%s\n", job->cmdline);
+    fflush(out);
+    return job_foreground(shell, job, job_state(job) == JOB_STOPPED);
+}
+
+// bg [job ...]: continue stopped jobs in the background
+static int bi_bg(ShellContext *shell, Command *cmd, FILE *out) {
+    jobs_reap();
+    int status = 0;
+    int n = cmd->argv[1] ? cmd->argc - 1 : 1;
+    for (int k = 0; k < n; ++k) {
+        Job *job = job_arg("bg", cmd->argv[1] ? cmd->argv[1 + k] : NULL);
+        if (!job) {
+            status = 1;
+            continue;
+        }
+        if (job_state(job) == JOB_DONE) {
+            fprintf(stderr, "thrash: bg: job %d has already completed\n", job->id);
+            status = 1;
+            continue;
+        }
+        job_continue(shell, job, false);
+        fprintf(out, "[%d]+ %s &\n", job->id, job->cmdline);
+    }
+    return status;
+}
+
+/* wait [job | pid ...]
+ * No operands: wait for every running job and return 0. Otherwise wait for
+ * each operand in turn; the status is the last one's (127 if unknown). */
+static int bi_wait(ShellContext *shell, Command *cmd, FILE *out) {
+    (void)shell; (void)out;
+    jobs_reap();
+
+    if (!cmd->argv[1]) {
+        for (size_t k = 0; k < job_count();) {
+            Job *job = job_at(k);
+            if (job_state(job) == JOB_RUNNING) job_wait(job);
+            if (job_state(job) == JOB_DONE) job_remove(job); // reported by wait itself
+            else k++;
+        }
+        return 0;
+    }
+
+    int status = 0;
+    for (int i = 1; cmd->argv[i]; ++i) {
+        const char *arg = cmd->argv[i];
+        Job *job;
+        pid_t pid = 0;
+        if (arg[0] == '%') {
+            job = job_arg("wait", arg);
+        } else {
+            char *end = NULL;
+            long v = strtol(arg, &end, 10);
+            if (!*arg || *end || v <= 0) {
+                fprintf(stderr, "thrash: wait: `%s': not a pid or valid job spec\n", arg);
+                status = 2;
+                continue;
+            }
+            pid = (pid_t)v;
+            job = job_by_pid(pid);
+            if (!job && jobs_done_status(pid, &status)) continue; // finished and dropped already
+            if (!job) fprintf(stderr, "thrash: wait: pid %ld is not a child of this shell\n", v);
+        }
+        if (!job) { status = 127; continue; }
+
+        status = job_wait(job);
+        for (size_t k = 0; pid && k < job->nprocs; ++k)
+            if (job->procs[k].pid == pid) status = job->procs[k].exit_code;
+        if (job_state(job) == JOB_DONE) job_remove(job);
+    }
+    return status;
+}
+
+/* break [n] | continue [n]
+ * Leave the n-th enclosing loop (default 1), or start its next round. The
+ * executor unwinds the loops in between (shell->loop_ctl). */
+static int loop_control(ShellContext *shell, Command *cmd, bool cont) {
+    const char *name = cont ? "continue" : "break";
+    long n = 1;
+    if (cmd->argv[1]) {
+        n = is_numeric(cmd->argv[1]) ? strtol(cmd->argv[1], NULL, 10) : 0;
+        if (n < 1) {
+            fprintf(stderr, "thrash: %s: %s: loop count out of range\n", name, cmd->argv[1]);
+            return 1;
+        }
+    }
+    if (shell->loop_depth == 0) {
+        fprintf(stderr, "thrash: %s: only meaningful in a `for', `while', or `until' loop\n", name);
+        return 0;
+    }
+    shell->loop_ctl = n < shell->loop_depth ? (int)n : shell->loop_depth;
+    shell->loop_continue = cont;
+    return 0;
+}
+
+static int bi_break(ShellContext *shell, Command *cmd, FILE *out) {
+    (void)out;
+    return loop_control(shell, cmd, false);
+}
+
+static int bi_continue(ShellContext *shell, Command *cmd, FILE *out) {
+    (void)out;
+    return loop_control(shell, cmd, true);
+}
+
+static int bi_parallel(ShellContext *shell, Command *cmd, FILE *out) {
+    return run_parallel(shell, cmd, out);
+}
+
+/* read [-r] [name ...]
+ * One line of stdin split into the names by $IFS (default space, tab,
+ * newline), the last name taking the rest of the line; with no names the
+ * whole line goes to REPLY. Without -r a backslash quotes the next character
+ * and one ending the line joins the next. Returns 1 at end of file, with
+ * what was there still assigned. Lines come from readbuf.c, in blocks where
+ * it can; the line itself is built in buffers kept from call to call. */
+static char *read_line;
+static unsigned char *read_quoted; // read_line[i] came after a backslash
+static size_t read_cap;
+
+static bool read_reserve(size_t n) {
+    if (n <= read_cap) return true;
+    size_t ncap = read_cap ? read_cap : 256;
+    while (ncap < n) ncap *= 2;
+    char *nl = realloc(read_line, ncap);
+    if (!nl) return false;
+    read_line = nl;
+    unsigned char *nq = realloc(read_quoted, ncap);
+    if (!nq) return false;
+    read_quoted = nq;
+    read_cap = ncap;
+    return true;
+}
+
+static bool is_name(const char *s) {
+    if (!(*s == '_' || isalpha((unsigned char)*s))) return false;
+    while (*++s)
+        if (!(*s == '_' || isalnum((unsigned char)*s))) return false;
+    return true;
+}
+
+// Appends one physical line; returns 0, 1 at a lone EOF, 130 on ^C, -1 on error.
+// *more: it ended in a backslash-newline and the next line joins it.
+static int read_physical(ShellContext *shell, bool raw, size_t *len, bool *more) {
+    *more = false;
+    for (;;) {
+        size_t n;
+        bool newline;
+        char *line = readbuf_line(&n, &newline);
+        if (!line) {
+            if (errno == EINTR) {
+                if (shell->interactive && sigint_caught()) return 130;
+                continue;
+            }
+            if (errno) fprintf(stderr, "thrash: read: %s\n", strerror(errno));
+            return errno ? -1 : 1;
+        }
+        if (!read_reserve(*len + n + 1)) {
+            fprintf(stderr, "thrash: read: out of memory\n");
+            return -1;
+        }
+        for (size_t k = 0; k < n; ++k) {
+            char c = line[k];
+            bool quoted = false;
+            if (c == '\0') continue; // can't be in a variable
+            if (!raw && c == '\\') {
+                if (k + 1 == n) {
+                    *more = newline;
+                    break;
+                }
+                c = line[++k];
+                quoted = true;
+            }
+            read_quoted[*len] = quoted;
+            read_line[(*len)++] = c;
+        }
+        return newline ? 0 : 1;
+    }
+}
+
+// read_line[p] splits fields; a blank one (space, tab, newline) also trims
+static bool ifs_char(const char *ifs, size_t p) {
+    return !read_quoted[p] && strchr(ifs, read_line[p]);
+}
+
+static bool ifs_blank(const char *ifs, size_t p) {
+    char c = read_line[p];
+    return (c == ' ' || c == '\t' || c == '\n') && ifs_char(ifs, p);
+}
+
+static int bi_read(ShellContext *shell, Command *cmd, FILE *out) {
+    (void)out;
+    bool raw = false;
+    int i = 1;
+    for (; cmd->argv[i] && cmd->argv[i][0] == '-' && cmd->argv[i][1]; ++i) {
+        if (strcmp(cmd->argv[i], "--") == 0) { i++; break; }
+        if (strcmp(cmd->argv[i], "-r") == 0) { raw = true; continue; }
+        fprintf(stderr, "thrash: read: %s: invalid option\n", cmd->argv[i]);
+        fprintf(stderr, "thrash: read: usage: read [-r] [name ...]\n");
+        return 2;
+    }
+    char **names = cmd->argv + i;
+    for (int k = 0; names[k]; ++k) {
+        if (!is_name(names[k])) {
+            fprintf(stderr, "thrash: read: `%s': not a valid identifier\n", names[k]);
+            return 1;
+        }
+    }
+
+    // At a terminal ^C has to end the read; the shell otherwise ignores it
+    if (shell->interactive) sigint_catch(true);
+    size_t len = 0;
+    bool more;
+    int status;
+    do status = read_physical(shell, raw, &len, &more);
+    while (status == 0 && more);
+    if (shell->interactive) sigint_catch(false);
+    if (status == 130 || status < 0) return status < 0 ? 1 : status;
+    if (!read_reserve(len + 1)) {
+        fprintf(stderr, "thrash: read: out of memory\n");
+        return 1;
+    }
+    read_line[len] = '\0';
+
+    if (!names[0]) {
+        if (!vart_set(shell->vars, "REPLY", read_line, 0)) status = 1;
+        return status;
+    }
+
+    Var *iv = vart_get(shell->vars, "IFS");
+    const char *ifs = iv ? iv->value : " \t\n";
+    size_t p = 0;
+    while (p < len && ifs_blank(ifs, p)) p++;
+    for (int k = 0; names[k]; ++k) {
+        size_t start = p, end;
+        if (!names[k + 1]) {
+            // The last name: everything left, less trailing IFS whitespace
+            end = len;
+            while (end > start && ifs_blank(ifs, end - 1)) end--;
+            p = len;
+        } else {
+            while (p < len && !ifs_char(ifs, p)) p++;
+            end = p;
+            while (p < len && ifs_blank(ifs, p)) p++;
+            if (p < len && ifs_char(ifs, p)) { // one non-blank delimiter, blanks around it
+                p++;
+                while (p < len && ifs_blank(ifs, p)) p++;
+            }
+        }
+        read_line[end] = '\0';
+        if (!vart_set(shell->vars, names[k], read_line + start, 0)) {
+            fprintf(stderr, "thrash: read: %s: readonly variable\n", names[k]);
+            status = 1;
+        }
+    }
+    return status;
+}
+
+/* set [-o | +o] [option]
+ * The shell's options: -o name turns one on, +o name off. -o alone (or no
+ * arguments) lists them, +o alone as the commands that would restore them. */
+static const struct {
+    const char *name;
+    unsigned bit;
+} set_options[] = {
+    { "failfast", JOBOPT_FAILFAST }, // a failed stage ends the rest of its pipeline
+    { "pipefail", JOBOPT_PIPEFAIL }, // a pipeline's status is its rightmost failure
+};
+
+static int bi_set(ShellContext *shell, Command *cmd, FILE *out) {
+    (void)shell;
+    size_t nopts = sizeof(set_options) / sizeof(set_options[0]);
+    unsigned opts = jobs_options();
+    if (!cmd->argv[1] || (!cmd->argv[2] && (strcmp(cmd->argv[1], "-o") == 0 || strcmp(cmd->argv[1], "+o") == 0))) {
+        bool as_commands = cmd->argv[1] && cmd->argv[1][0] == '+';
+        for (size_t k = 0; k < nopts; ++k) {
+            bool on = opts & set_options[k].bit;
+            if (as_commands) fprintf(out, "set %co %s\n", on ? '-' : '+', set_options[k].name);
+            else             fprintf(out, "%-15s %s\n", set_options[k].name, on ? "on" : "off");
+        }
+        return 0;
+    }
+    for (int i = 1; cmd->argv[i]; i += 2) {
+        const char *flag = cmd->argv[i], *name = cmd->argv[i + 1];
+        if ((strcmp(flag, "-o") != 0 && strcmp(flag, "+o") != 0) || !name) {
+            fprintf(stderr, "thrash: set: usage: set [-o | +o] [option]\n");
+            return 2;
+        }
+        size_t k = 0;
+        while (k < nopts && strcmp(set_options[k].name, name) != 0) k++;
+        if (k == nopts) {
+            fprintf(stderr, "thrash: set: %s: invalid option name\n", name);
+            return 1;
+        }
+        if (flag[0] == '-') opts |= set_options[k].bit;
+        else                opts &= ~set_options[k].bit;
+    }
+    jobs_set_options(opts);
+    return 0;
+}
+
+/* ---- History ------------------------------------------------------------ */
+
+// One `history -v` line: when, status, wall/user/sys time, peak RSS, command.
+static void print_history_verbose(FILE *out, size_t num, const HistEntry *e) {
+    char when[32];
+    struct tm tm;
+    time_t t = e->when;
+    strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime_r(&t, &tm));
+    fprintf(out, "%5zu  %s  ", num, when);
+    if (e->status >= 0) fprintf(out, "%3d  ", e->status);
+    else                fprintf(out, "  -  ");
+    if (e->timed) {
+        fprintf(out, "%9.3fs %8.3fs %8.3fs %8ldKB  ", e->usage.wall_us / 1e6,
+                e->usage.user_us / 1e6, e->usage.sys_us / 1e6, e->usage.maxrss_kb);
+    } else {
+        fprintf(out, "%10s %9s %9s %10s  ", "-", "-", "-", "-");
+    }
+    fprintf(out, "%s\n", e->line);
+}
+
+/* history [-v] [n]
+ * history search [-p] [-n max] text...
+ * List the last n entries (all by default); -v adds each command's time,
+ * exit status, wall/user/system time and peak memory. search lists the
+ * entries containing text (-p: starting with it), found through the
+ * trigram index, oldest match first; -n keeps only the newest max. The
+ * line running the search is left out. */
+static int bi_history(ShellContext *shell, Command *cmd, FILE *out) {
+    History *h = &shell->history;
+    size_t count = history_count(h);
+
+    if (cmd->argv[1] && strcmp(cmd->argv[1], "search") == 0) {
+        int flags = 0;
+        size_t max = count, i = 2;
+        for (; cmd->argv[i] && cmd->argv[i][0] == '-'; ++i) {
+            if (strcmp(cmd->argv[i], "-p") == 0) {
+                flags |= HSEARCH_PREFIX;
+            } else if (strcmp(cmd->argv[i], "-n") == 0 && cmd->argv[i + 1] && is_numeric(cmd->argv[i + 1])) {
+                max = strtoul(cmd->argv[++i], NULL, 10);
+            } else {
+                fprintf(stderr, "thrash: history: usage: history search [-p] [-n max] text...\n");
+                return 2;
+            }
+        }
+        if (!cmd->argv[i]) {
+            fprintf(stderr, "thrash: history: search: missing text\n");
+            return 2;
+        }
+
+        // Words are joined back with single spaces: `history search git push`
+        size_t qlen = 0;
+        for (size_t k = i; cmd->argv[k]; ++k) qlen += strlen(cmd->argv[k]) + 1;
+        // Not the `history search` line itself, which is the newest entry
+        size_t before = count;
+        if (count && shell->hist_id && get_history(h, count - 1)->id == shell->hist_id) before--;
+        if (max > before) max = before; // no more hits than entries, whatever -n said
+
+        char *query = malloc(qlen);
+        size_t *hits = calloc(max ? max : 1, sizeof *hits);
+        if (!query || !hits) {
+            free(query);
+            free(hits);
+            fprintf(stderr, "thrash: history: out of memory\n");
+            return 1;
+        }
+        query[0] = '\0';
+        for (size_t k = i; cmd->argv[k]; ++k) {
+            if (k > i) strcat(query, " ");
+            strcat(query, cmd->argv[k]);
+        }
+
+        size_t n = history_find(h, query, flags, before, hits, max);
+        for (size_t k = n; k-- > 0;)
+            fprintf(out, "%5zu  %s\n", hits[k] + 1, get_history(h, hits[k])->line);
+        free(query);
+        free(hits);
+        return n ? 0 : 1;
+    }
+
+    int a = 1;
+    bool verbose = cmd->argv[a] && strcmp(cmd->argv[a], "-v") == 0;
+    if (verbose) a++;
+
+    size_t start = 0;
+    if (cmd->argv[a]) {
+        if (!is_numeric(cmd->argv[a])) {
+            fprintf(stderr, "thrash: history: %s: numeric argument required\n", cmd->argv[a]);
+            return 2;
+        }
+        size_t last = strtoul(cmd->argv[a], NULL, 10);
+        if (last < count) start = count - last;
+    }
+    if (verbose) {
+        fprintf(out, "%5s  %-19s  %3s  %10s %9s %9s %10s  %s\n",
+                "#", "when", "st", "wall", "user", "sys", "maxrss", "command");
+    }
+    for (size_t k = start; k < count; ++k) {
+        if (verbose) print_history_verbose(out, k + 1, get_history(h, k));
+        else         fprintf(out, "%5zu  %s\n", k + 1, get_history(h, k)->line);
+    }
+    return 0;
+}
+
+/* trace dump | trace clear
+ * Print the in-memory event ring (trace.h), oldest first, or forget it. */
+static int bi_trace(ShellContext *shell, Command *cmd, FILE *out) {
+    (void)shell;
+    const char *sub = cmd->argv[1];
+    if (sub && !cmd->argv[2] && strcmp(sub, "dump") == 0) {
+        trace_dump(out);
+        return 0;
+    }
+    if (sub && !cmd->argv[2] && strcmp(sub, "clear") == 0) {
+        trace_clear();
+        return 0;
+    }
+    fprintf(stderr, "thrash: trace: usage: trace dump | trace clear\n");
+    return 2;
+}
+
+/* stats [-v] | stats reset
+ * Calls and latency of the shell's own stages (stats.h): lexing, parsing,
+ * expansion, PATH lookup, fork/spawn, waiting and history. -v adds each
+ * stage's histogram. */
+static int bi_stats(ShellContext *shell, Command *cmd, FILE *out) {
+    (void)shell;
+    const char *sub = cmd->argv[1];
+    if (!sub || (strcmp(sub, "-v") == 0 && !cmd->argv[2])) {
+        stats_print(out, sub != NULL);
+        return 0;
+    }
+    if (strcmp(sub, "reset") == 0 && !cmd->argv[2]) {
+        stats_reset();
+        return 0;
+    }
+    fprintf(stderr, "thrash: stats: usage: stats [-v] | stats reset\n");
+    return 2;
+}
+
+// Sorted by name only for readability; lookup is a linear scan over a handful of entries
+static const Builtin builtin_table[] = {
+    { ":",      bi_true,   BI_OUTPUT },
+    { "bg",     bi_bg,     BI_SHELL | BI_NOPIPE },
+    { "break",  bi_break,  BI_SHELL | BI_NOPIPE },
+    { "cd",     bi_cd,     BI_SHELL  },
+    { "continue", bi_continue, BI_SHELL | BI_NOPIPE },
+    { "echo",   bi_echo,   BI_OUTPUT },
+    { "exit",   bi_exit,   BI_SHELL | BI_NOPIPE },
+    { "export", bi_export, BI_SHELL | BI_NOPIPE },
+    { "false",  bi_false,  BI_OUTPUT },
+    { "fg",     bi_fg,     BI_SHELL | BI_NOPIPE | BI_JOB },
+    { "hash",   bi_hash,   BI_SHELL  },
+    { "history", bi_history, BI_SHELL },
+    { "jobs",   bi_jobs,   BI_SHELL  },
+    { "parallel", bi_parallel, BI_SHELL | BI_NOPIPE },
+    { "printf", bi_printf, BI_OUTPUT },
+    { "read",   bi_read,   BI_SHELL | BI_NOPIPE },
+    { "set",    bi_set,    BI_SHELL  },
+    { "stats",  bi_stats,  BI_OUTPUT },
+    { "trace",  bi_trace,  BI_OUTPUT },
+    { "true",   bi_true,   BI_OUTPUT },
+    { "unset",  bi_unset,  BI_SHELL | BI_NOPIPE },
+    { "wait",   bi_wait,   BI_SHELL | BI_NOPIPE },
+};
+
+const Builtin *find_builtin(const char *name) {
+    if (!name) return NULL;
+    for (size_t i = 0; i < sizeof(builtin_table) / sizeof(builtin_table[0]); ++i)
+        if (strcmp(builtin_table[i].name, name) == 0) return &builtin_table[i];
+    return NULL;
+}
+
+const Builtin *builtin_at(size_t i) {
+    return i < sizeof(builtin_table) / sizeof(builtin_table[0]) ? &builtin_table[i] : NULL;
+}
+
+bool is_builtin(const char *cmd) {
+    return find_builtin(cmd) != NULL;
+}
+
+int run_builtin(ShellContext *shell, const Builtin *b, Command *cmd, FILE *out) {
+    LOG(LOG_LEVEL_INFO, "builtin %s (in-process)", b->name);
+    int status = b->fn(shell, cmd, out);
+    fflush(out);
+    return status;
+}
+
+/* run_builtin_redirected
+ * run_builtin() with cmd's redirections applied to the shell's own fds and
+ * undone afterwards, so `echo hi >f` or `history 2>/dev/null` need no child.
+ * Once a redirection has moved fd 1 the output goes to stdout (the new fd 1)
+ * even when out was a pipe buffer. A failed redirection is reported, the
+ * builtin doesn't run, and the status is 1; so is output that couldn't be
+ * written where the redirections sent it. */
+int run_builtin_redirected(ShellContext *shell, const Builtin *b, Command *cmd, FILE *out) {
+    Redirection *list = NULL;
+    int count = extract_redirections(cmd, &list);
+    if (count < 0) {
+        fprintf(stderr, "thrash: out of memory\n");
+        return 1;
+    }
+    if (count == 0) return run_builtin(shell, b, cmd, out);
+
+    // stdio buffers belong to the fds as they are now
+    fflush(out);
+    fflush(stdout);
+    fflush(stderr);
+
+    RedirSave save = {0};
+    int status = 1;
+    if (apply_redirections_saved(list, count, &save) == 0) {
+        if (redirections_moved(&save, STDOUT_FILENO)) out = stdout;
+        clearerr(out);
+        status = run_builtin(shell, b, cmd, out);
+        // `echo x >&-`, `echo x >/dev/full`: the output went nowhere
+        int failed = fflush(out) != 0 || ferror(out);
+        int err = errno;
+        if (failed) {
+            fprintf(stderr, "thrash: %s: write error: %s\n", b->name, strerror(err));
+            if (status == 0) status = 1;
+            clearerr(out);
+        }
+        fflush(stdout);
+        fflush(stderr);
+    }
+    restore_redirections(&save);
+    free(list);
+    return status;
 }
\ No newline at end of file
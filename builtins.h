@@ -1,13 +1,46 @@
-#ifndef BUILTINS_H
-#define BUILTINS_H
-
-#include "redirect.h"
-#include <stdbool.h>
-
-int handle_cd(Command *cmd);
-
-int handle_exit();
-
-bool is_builtin(const char *cmd);
-
-#endif
+#ifndef BUILTINS_H
+#define BUILTINS_H
+
+#include "redirect.h"
+#include "var.h"
+#include "shell.h"
+#include <stdbool.h>
+#include <stdio.h>
+
+/* Builtin dispatch table.
+ * Every builtin writes its normal output to `out` (stdout when run directly,
+ * a memory stream when it feeds a pipe) and returns its exit status. */
+typedef int (*builtin_fn)(ShellContext *shell, Command *cmd, FILE *out);
+
+enum {
+    BI_OUTPUT = 1u << 0,  // only writes to out: safe to run in-process anywhere in a pipeline
+    BI_SHELL  = 1u << 1,  // changes shell state: always runs in the shell itself
+    BI_NOPIPE = 1u << 2,  // refused inside a pipeline (exit, export, unset)
+    BI_JOB    = 1u << 3   // waits for a job in the foreground, which sets $PIPESTATUS (fg)
+};
+
+typedef struct {
+    const char *name;
+    builtin_fn fn;
+    unsigned flags;
+} Builtin;
+
+const Builtin *find_builtin(const char *name);
+const Builtin *builtin_at(size_t i); // table order, NULL past the end
+
+int run_builtin(ShellContext *shell, const Builtin *b, Command *cmd, FILE *out); // fn + fflush(out)
+int run_builtin_redirected(ShellContext *shell, const Builtin *b, Command *cmd, FILE *out); // in the shell, redirections undone after
+
+int handle_cd(ShellContext *shell, Command *cmd, FILE *out);
+
+int handle_hash(Command *cmd, FILE *out);
+
+int handle_export(VarTable *vars, Command *cmd, FILE *out);
+
+int handle_unset(VarTable *vars, Command *cmd);
+
+int handle_exit(ShellContext *shell, Command *cmd);
+
+bool is_builtin(const char *cmd);
+
+#endif
@@ -1,12 +1,16 @@
 #include "command.h"
+#include "redirect.h"
 #include "debug.h"
 #include <stdlib.h>
 
 //-----------------------------------------------------------------------------
 //                       FREE  ROUTINES
 //-----------------------------------------------------------------------------
+// Arena-backed lists (parse_commands with an arena) are released by
+// arena_reset(); these routines only tear down heap-owned commands.
 void free_command_list(Command **cmds, int num_cmds) {
     if (!cmds) return;
+    if (num_cmds > 0 && cmds[0] && cmds[0]->arena) return;
     for (int i = 0; i < num_cmds; ++i) {
         Command *cmd = cmds[i];
         if (cmd && cmd->argv && cmd->argv[0]) {
@@ -22,19 +26,21 @@ void free_command_list(Command **cmds, int num_cmds) {
 }
 
 void free_command(Command *cmd) {
-    if (!cmd) return;
+    if (!cmd || cmd->arena) return;
     if (cmd->argv) {
         for (int i = 0; i < cmd->argc; ++i) {
             free(cmd->argv[i]);
         }
         free(cmd->argv);
     }
-    free(cmd->input_file);
-    free(cmd->output_file);
-    free(cmd->append_file);
-    free(cmd->error_file);
+    for (int i = 0; i < cmd->nredirs; ++i) {
+        free(cmd->redirs[i]->filename);
+        free(cmd->redirs[i]);
+    }
+    free(cmd->redirs);
     free(cmd->heredoc);
     free(cmd->cwd_override);
     free(cmd->raw_input);
+    free(cmd->resolved_path);
     free(cmd);
 }
\ No newline at end of file
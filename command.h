@@ -5,26 +5,29 @@
 #include <stdbool.h>
 #include <unistd.h>
 #include <signal.h>
+#include "arena.h"
 
+struct Redirection; // redirect.h
+struct AstNode;     // ast.h
+struct TokenList;   // lexer.h
 
 typedef struct {
     char **argv;               // Command and arguments
     int argc;                  // tracking count 
-    char *input_file;          // For `<`
-    char *output_file;         // For `>`
-    char *append_file;         // For `>>`
-    char *error_file;          // For `2>`
-    bool output_to_error;      // For `2>&1`
-    bool error_to_output;      // For `&>` or `>&`
-    int input_fd;              // For `n<file` (e.g., `3<foo`)
-    int output_fd;             // For `n>file` (e.g., `4>bar`)
-    int error_fd;              // For `n>&m` (e.g., `2>&1`)
+    struct Redirection **redirs; // `n<f`, `n>f`, `n>>f`, `n>&m`, `n<&-`... in source order, NULL-terminated
+    int nredirs;
     bool background;           // For trailing `&`
+    bool quiet;                // background without the "[n] pid" notice (parallel's jobs)
+    int time_format;           // `time` prefix: TIME_* from jobs.h, 0 if not timed
     bool is_builtin;           // Flag for built-in command
     pid_t pgid;                // Process group ID (for job control)
     char *heredoc;             // For `<<EOF` style input
     char *cwd_override;        // For `cd` or directory-specific exec
     char *raw_input;           // Original input string (for debugging/logging)
+    char *resolved_path;       // Executable found by resolve_command() before fork
+    Arena *arena;              // Owning per-line arena (NULL = heap, see free_command)
+    const struct AstNode *compound;      // last stage is an if/while/for, run in its child...
+    const struct TokenList *compound_tl; // ...over these tokens (see run_segment)
 } Command;
 
 void free_command(Command *cmd);
@@ -0,0 +1,296 @@
+// completion.c
+/* PATH executables come from an index kept per PATH directory: its entry
+ * names, sorted, and the mtime they were read at. A Tab press stats each
+ * directory once and re-reads only those whose mtime moved (a file was added,
+ * removed or renamed); the index is rebuilt from scratch only when PATH
+ * itself changes (path_generation()). A prefix is then a binary search per
+ * directory. Only names that match are checked (regular file, X_OK), once:
+ * the answer is kept with the name until its directory is re-read, so like
+ * the command hash, a chmod alone goes unnoticed until then. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <readline/readline.h>
+#include "completion.h"
+#include "builtins.h"
+#include "path.h"
+#include "var.h"
+#include "debug.h"
+
+typedef struct {
+    char *dir;             // PATH segment ("" → ".")
+    struct timespec mtime; // when names was read; 0 = not read (missing dir)
+    char **names;          // sorted
+    signed char *runnable; // per name: -1 not checked yet, else 0/1
+    size_t count;
+} PathDir;
+
+static PathDir *dirs = NULL;
+static size_t ndirs = 0;
+static unsigned long built_gen = 0; // path_generation() dirs was split for
+static bool built = false;
+
+static ShellContext *comp_shell = NULL;
+
+static int cmp_str(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static void clear_names(PathDir *d) {
+    for (size_t i = 0; i < d->count; ++i) free(d->names[i]);
+    free(d->names);
+    free(d->runnable);
+    d->names = NULL;
+    d->runnable = NULL;
+    d->count = 0;
+}
+
+// (Re)read one directory's entries. Subdirectories are left out when the
+// file system says so cheaply (d_type); the rest is settled at match time.
+static void read_dir(PathDir *d, const struct timespec *mtime) {
+    clear_names(d);
+    d->mtime = *mtime;
+    DIR *dp = opendir(d->dir);
+    if (!dp) return;
+
+    size_t cap = 0;
+    struct dirent *e;
+    while ((e = readdir(dp)) != NULL) {
+        if (e->d_name[0] == '.') continue;
+        if (e->d_type == DT_DIR) continue;
+        if (d->count == cap) {
+            size_t ncap = cap ? cap * 2 : 64;
+            char **n = realloc(d->names, ncap * sizeof(char *));
+            if (!n) break;
+            d->names = n;
+            cap = ncap;
+        }
+        char *name = strdup(e->d_name);
+        if (!name) break;
+        d->names[d->count++] = name;
+    }
+    closedir(dp);
+    qsort(d->names, d->count, sizeof(char *), cmp_str);
+    d->runnable = malloc(d->count ? d->count : 1);
+    if (!d->runnable) {
+        clear_names(d);
+        return;
+    }
+    memset(d->runnable, -1, d->count);
+    LOG(LOG_LEVEL_INFO, "completion: indexed %zu names in %s", d->count, d->dir);
+}
+
+static void drop_index(void) {
+    for (size_t i = 0; i < ndirs; ++i) {
+        clear_names(&dirs[i]);
+        free(dirs[i].dir);
+    }
+    free(dirs);
+    dirs = NULL;
+    ndirs = 0;
+    built = false;
+}
+
+// Split PATH into directories (first occurrence of each wins, as in lookup)
+static void split_path(void) {
+    drop_index();
+    built = true;
+    built_gen = path_generation();
+    const char *p = path_search();
+    if (!p || !*p) return;
+
+    size_t segs = 1;
+    for (const char *c = p; *c; ++c) segs += (*c == ':');
+    dirs = calloc(segs, sizeof(PathDir));
+    if (!dirs) return;
+
+    while (true) {
+        const char *end = strchr(p, ':');
+        size_t len = end ? (size_t)(end - p) : strlen(p);
+        char *dir = len ? strndup(p, len) : strdup(".");
+        bool dup = false;
+        for (size_t i = 0; dir && i < ndirs; ++i) dup = dup || strcmp(dirs[i].dir, dir) == 0;
+        if (dir && !dup) dirs[ndirs++].dir = dir;
+        else free(dir);
+        if (!end) break;
+        p = end + 1;
+    }
+}
+
+static void refresh_index(void) {
+    if (!built || built_gen != path_generation()) split_path();
+    for (size_t i = 0; i < ndirs; ++i) {
+        PathDir *d = &dirs[i];
+        struct stat st;
+        if (stat(d->dir, &st) != 0 || !S_ISDIR(st.st_mode)) {
+            clear_names(d);
+            d->mtime = (struct timespec){0};
+            continue;
+        }
+        if (st.st_mtim.tv_sec != d->mtime.tv_sec || st.st_mtim.tv_nsec != d->mtime.tv_nsec)
+            read_dir(d, &st.st_mtim);
+    }
+}
+
+// First index whose name is >= prefix
+static size_t lower_bound(char **names, size_t count, const char *prefix) {
+    size_t lo = 0, hi = count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (strcmp(names[mid], prefix) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+/* ---- Candidate lists ---------------------------------------------------- */
+
+typedef struct {
+    char **items;
+    size_t count, cap;
+} Matches;
+
+static bool add_match(Matches *m, const char *s, size_t len) {
+    if (m->count == m->cap) {
+        size_t ncap = m->cap ? m->cap * 2 : 16;
+        char **n = realloc(m->items, ncap * sizeof(char *));
+        if (!n) return false;
+        m->items = n;
+        m->cap = ncap;
+    }
+    char *copy = strndup(s, len);
+    if (!copy) return false;
+    m->items[m->count++] = copy;
+    return true;
+}
+
+// Sort, then drop repeats (a builtin also on PATH, a name in two PATH dirs)
+static void finish_matches(Matches *m) {
+    if (m->count < 2) return;
+    qsort(m->items, m->count, sizeof(char *), cmp_str);
+    size_t w = 1;
+    for (size_t r = 1; r < m->count; ++r) {
+        if (strcmp(m->items[r], m->items[w - 1]) == 0) free(m->items[r]);
+        else m->items[w++] = m->items[r];
+    }
+    m->count = w;
+}
+
+static bool runnable(PathDir *d, size_t k) {
+    if (d->runnable[k] < 0) {
+        char full[4096];
+        int n = snprintf(full, sizeof(full), "%s/%s", d->dir, d->names[k]);
+        struct stat st;
+        d->runnable[k] = n > 0 && (size_t)n < sizeof(full) && stat(full, &st) == 0 &&
+                         S_ISREG(st.st_mode) && access(full, X_OK) == 0;
+    }
+    return d->runnable[k];
+}
+
+char **complete_command(const char *prefix, size_t *count) {
+    Matches m = {0};
+    size_t plen = strlen(prefix);
+
+    for (size_t i = 0; builtin_at(i); ++i) {
+        const char *name = builtin_at(i)->name;
+        if (strncmp(name, prefix, plen) == 0) add_match(&m, name, strlen(name));
+    }
+
+    refresh_index();
+    for (size_t i = 0; i < ndirs; ++i) {
+        PathDir *d = &dirs[i];
+        for (size_t k = lower_bound(d->names, d->count, prefix); k < d->count; ++k) {
+            if (strncmp(d->names[k], prefix, plen) != 0) break;
+            if (runnable(d, k)) add_match(&m, d->names[k], strlen(d->names[k]));
+        }
+    }
+
+    finish_matches(&m);
+    *count = m.count;
+    return m.items;
+}
+
+// "$PRE" → every "$NAME" with NAME starting with PRE
+static char **complete_variable(const char *prefix, size_t *count) {
+    Matches m = {0};
+    size_t plen = strlen(prefix);
+    const VarTable *t = comp_shell ? comp_shell->vars : NULL;
+    for (size_t i = 0; t && i < t->nbuckets; ++i) {
+        for (const Var *v = t->buckets[i]; v; v = v->next) {
+            if (v->name_len < plen || memcmp(v->name, prefix, plen) != 0) continue;
+            char buf[1 + 256];
+            if (v->name_len + 1 >= sizeof(buf)) continue;
+            buf[0] = '$';
+            memcpy(buf + 1, v->name, v->name_len);
+            add_match(&m, buf, v->name_len + 1);
+        }
+    }
+    finish_matches(&m);
+    *count = m.count;
+    return m.items;
+}
+
+/* ---- readline glue -------------------------------------------------------- */
+
+static char **pending = NULL; // handed out one by one by next_match()
+static size_t npending = 0, pending_at = 0;
+
+static char *next_match(const char *text, int state) {
+    (void)text;
+    if (state == 0) pending_at = 0;
+    if (pending_at < npending) {
+        char *s = pending[pending_at];
+        pending[pending_at++] = NULL; // readline frees it
+        return s;
+    }
+    return NULL;
+}
+
+static void drop_pending(void) {
+    for (size_t i = 0; i < npending; ++i) free(pending[i]);
+    free(pending);
+    pending = NULL;
+    npending = pending_at = 0;
+}
+
+// The word starting at start is a command name: first on the line, or
+// right after |, ; or &
+static bool command_position(int start) {
+    int i = start - 1;
+    while (i >= 0 && (rl_line_buffer[i] == ' ' || rl_line_buffer[i] == '\t')) i--;
+    if (i < 0) return true;
+    char c = rl_line_buffer[i];
+    return c == '|' || c == ';' || c == '&';
+}
+
+static char **thrash_completion(const char *text, int start, int end) {
+    (void)end;
+    drop_pending();
+    if (text[0] == '$') {
+        pending = complete_variable(text + 1, &npending);
+    } else if (command_position(start) && !strchr(text, '/')) {
+        pending = complete_command(text, &npending);
+    } else {
+        return NULL; // readline's filename completion
+    }
+    rl_attempted_completion_over = 1; // no filename fallback when nothing matched
+    char **out = npending ? rl_completion_matches(text, next_match) : NULL;
+    drop_pending();
+    return out;
+}
+
+void completion_init(ShellContext *shell) {
+    comp_shell = shell;
+    rl_attempted_completion_function = thrash_completion;
+    // Readline's default set breaks words at '$'; keep "$NAME" together
+    rl_completer_word_break_characters = " \t\n\"\\'`@><=;|&{(";
+}
+
+void completion_dispose(void) {
+    drop_pending();
+    drop_index();
+}
@@ -0,0 +1,18 @@
+#ifndef COMPLETION_H
+#define COMPLETION_H
+
+#include <stddef.h>
+#include "shell.h"
+
+/* Tab completion for the REPL.
+ * Command position: builtins and PATH executables. $NAME: shell variables.
+ * Anything else falls through to readline's filename completion. */
+
+void completion_init(ShellContext *shell); // install as readline's completer
+void completion_dispose(void);             // free the PATH index
+
+// The matching logic without readline, for the bench: candidates for a
+// command-position prefix, sorted, unique, malloc'd (free each and the array)
+char **complete_command(const char *prefix, size_t *count);
+
+#endif
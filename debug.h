@@ -11,9 +11,16 @@
 #define LOG_LEVEL_WARN 2
 #define LOG_LEVEL_ERR  3
 
-// Minimum log level to emit (override at compile time with -DLOG_LEVEL_MIN)
+#define LOG_LEVEL_OFF  4
+
+// Minimum log level to emit (override at compile time with -DLOG_LEVEL_MIN).
+// Without DEBUG nothing is logged at all.
 #ifndef LOG_LEVEL_MIN
+#ifdef DEBUG
 #define LOG_LEVEL_MIN LOG_LEVEL_INFO
+#else
+#define LOG_LEVEL_MIN LOG_LEVEL_OFF
+#endif
 #endif
 
 // ─────────────────────────────────────────────────────────────
@@ -43,32 +50,37 @@ static inline const char* debug_timestamp(void) {
 // ─────────────────────────────────────────────────────────────
 // Main logging macro
 //
-// Emits logs only when DEBUG is defined and
-// `level >= LOG_LEVEL_MIN`.
+// Filtered by the preprocessor: LOG(LOG_LEVEL_X, ...) pastes to
+// LOG_AT_LOG_LEVEL_X, which is empty below LOG_LEVEL_MIN, so filtered
+// calls cost nothing (their arguments aren't even evaluated). The level
+// must therefore be one of the LOG_LEVEL_* names, not a variable.
 // Format:
 //   [timestamp] <COLOR>[LEVEL]</COLOR> file.c:123 (func): your message
+// For always-on, low-cost event recording see trace.h.
 // ─────────────────────────────────────────────────────────────
-#ifdef DEBUG
-#define LOG(level, fmt, ...)                                                        \
-    do {                                                                             \
-        if ((level) >= LOG_LEVEL_MIN) {                                              \
-            const char *color, *label;                                               \
-            switch (level) {                                                         \
-                case LOG_LEVEL_WARN: color = COLOR_WARN; label = "WARN"; break;      \
-                case LOG_LEVEL_ERR:  color = COLOR_ERR;  label = "ERROR"; break;     \
-                case LOG_LEVEL_INFO:                                                  \
-                default:         color = COLOR_INFO; label = "INFO"; break;         \
-            }                                                                        \
-            fprintf(stderr,                                                          \
-                    "%s %s[%s]%s %s:%d (%s): " fmt "%s\n",                           \
-                    debug_timestamp(),                                              \
-                    color, label, COLOR_RESET,                                      \
-                    __FILE__, __LINE__, __func__,                                    \
-                    ##__VA_ARGS__, COLOR_RESET);                                     \
-        }                                                                            \
-    } while (0)
+#define LOG(level, fmt, ...) LOG_AT_##level(fmt, ##__VA_ARGS__)
+
+#define LOG_EMIT(color, label, fmt, ...)                                             \
+    fprintf(stderr, "%s %s[%s]%s %s:%d (%s): " fmt "%s\n",                            \
+            debug_timestamp(), color, label, COLOR_RESET,                            \
+            __FILE__, __LINE__, __func__, ##__VA_ARGS__, COLOR_RESET)
+
+#if LOG_LEVEL_MIN <= LOG_LEVEL_INFO
+#define LOG_AT_LOG_LEVEL_INFO(fmt, ...) LOG_EMIT(COLOR_INFO, "INFO", fmt, ##__VA_ARGS__)
+#else
+#define LOG_AT_LOG_LEVEL_INFO(fmt, ...) do {} while (0)
+#endif
+
+#if LOG_LEVEL_MIN <= LOG_LEVEL_WARN
+#define LOG_AT_LOG_LEVEL_WARN(fmt, ...) LOG_EMIT(COLOR_WARN, "WARN", fmt, ##__VA_ARGS__)
+#else
+#define LOG_AT_LOG_LEVEL_WARN(fmt, ...) do {} while (0)
+#endif
+
+#if LOG_LEVEL_MIN <= LOG_LEVEL_ERR
+#define LOG_AT_LOG_LEVEL_ERR(fmt, ...) LOG_EMIT(COLOR_ERR, "ERROR", fmt, ##__VA_ARGS__)
 #else
-#define LOG(level, fmt, ...) do {} while (0)
+#define LOG_AT_LOG_LEVEL_ERR(fmt, ...) do {} while (0)
 #endif
 
-#endif // DEBUG_H
\ No newline at end of file
+#endif // DEBUG_H
@@ -1,452 +1,792 @@
-/* =========================================== executor.c ======================================================
- thrash command execution and pipeline orchestration with Bash-like semantics.
-
- Responsibilities:
- - Builtins (e.g., cd) handled directly and returned without forking.
- - External commands:
-   - If argv[0] contains a slash, treat as a path and validate directly.
-   - If no slash, search $PATH manually to distinguish:
-       * not found       → "command not found" (exit 127), no fork
-       * found directory → "is a directory" (exit 126), no fork
-       * found non-exec  → "permission denied" (exit 126), no fork
-       * found exec file → fork + exec
-
-       - On exec failure, print a clean one-line error and exit with:
-       * 126 for non-runnable files (EACCES, ENOEXEC, directory)
-       * 127 for missing files (ENOENT, ENOTDIR)
- - 
- Pipeline execution:
- - Allocates pipes and pids dynamically (no VLAs).
- - Forks each stage, wires stdin/stdout via dup2(), and sets CLOEXEC on pipe fds.
- - Assigns a shared process group (PGID) for job control.
- - Handles terminal handoff and reclaiming via tcsetpgrp().
- - Tracks last command’s PID to return accurate pipeline exit status.
- - Cleans up all fds and memory on every exit path.
-
- Signal handling:
- - Shell ignores SIGINT, SIGQUIT, SIGTSTP, SIGTTIN, SIGTTOU.
- - Children restore default signals before exec.
- - Optional SIGCHLD blocking is available to prevent early reaping.
-
- This file ensures robust, race-tolerant execution with clear diagnostics and correct exit codes. */
-
-#include "executor.h"
-#include "builtins.h"
-#include "debug.h"
-#include "signals.h"
-#include "shell.h"
-#include "jobs.h"
-#include "input.h"
-#include "var.h"
-#include "redirect.h"
-#include "command.h"
-#include "parser.h"
-#include "path.h"
-#include "pipeline.h"
-#include <errno.h>
-#include <termios.h>    
-#include <limits.h>
-#include <stdbool.h>
-#include <stdio.h>
-#include <stdlib.h>
-#include <unistd.h>
-#include <string.h>
-#include <sys/stat.h>
-#include <sys/wait.h>
-#include <sys/types.h>
-#include <unistd.h>
-#include <signal.h>
-#include <fcntl.h>
-#include <ctype.h>  
-#include <errno.h>
-#include <time.h>
-#include <limits.h>
-
-extern char **environ;
-
-
-// Execute a single command with redirection and cwd override.
-// This is called in the child process after fork().
-void exec_command(ShellContext *shell, Command *cmd) {
-  
-    char *resolved_path = NULL;
-
-    if (has_slash(cmd->argv[0])) {
-        if (!is_regular(cmd->argv[0]) || !is_executable(cmd->argv[0])) {
-            print_exec_error(cmd->argv[0], errno);
-            exit(1);
-        }
-        resolved_path = cmd->argv[0];
-    } else {
-        if (search_path_alloc(cmd->argv[0], &resolved_path) != 0 || !resolved_path) {
-            print_exec_error(cmd->argv[0], ENOENT);
-            exit(1);
-        }
-        if (!is_regular(resolved_path) || !is_executable(resolved_path)) {
-            print_exec_error(resolved_path, errno);
-            free((void *)resolved_path);
-            exit(1);
-        }
-    }
-    
-    Redirection *redirs = NULL;
-    int redir_count = extract_redirections(cmd, &redirs); // you write this helper
-
-    
-    LOG(LOG_LEVEL_INFO, "Performing redirections");
-    if (perform_redirections(redirs, redir_count) != 0) {
-        if (resolved_path != cmd->argv[0]) free((void *)resolved_path);
-        free(redirs);
-        exit(1); // early bail in child
-    }
-
-    // 🚀 Execute
-    execve(resolved_path, cmd->argv, environ);
-
-    // only reached if execve() fails
-    print_exec_error(resolved_path, errno);
-
-    if (resolved_path != cmd->argv[0]) free((void *)resolved_path);
-    free(redirs);
-    _exit(1);
-}
-
-
-/* ================= Refactored launch_commands ================= */
-// Ownership: cmds is BORROWED. launch_commands MUST NOT free or modify cmds or any Command/argv.
-// Caller (process_input_segments) frees via free_command_list(cmds, num_cmds) after return.
-int launch_commands(ShellContext *shell, Command **cmds, int num_cmds) {
-    int i, status = 0, last_exit = 0;
-    pid_t pgid = 0;
-    shell->pipeline_pgid = 0; // Reset pipeline PGID
-
-    /* Single-command case */
-    if (num_cmds == 1) {
-        Command *cmd = cmds[0];
-        if (!cmd || !cmd->argv || !cmd->argv[0]) {
-            return 0; // Empty command
-        }
-        if (strcmp(cmd->argv[0], "exit") == 0) {
-            shell->running = 0;
-            return 0;
-        }
-
-        // Built-in: cd (no freeing of cmd)
-        if (strcmp(cmd->argv[0], "cd") == 0) {
-            int cd_res = handle_cd(cmd);
-            return cd_res;
-        }
-
-        pid_t pid = fork();
-        if (pid < 0) {
-            perror("fork");
-            return 1;
-        }
-
-        if (pid == 0) {
-            // Child
-            setpgid(0, 0);             // Create new process group
-            setup_child_signals();      // Reset signal handlers
-            exec_command(shell, cmd);   // Exec external command with redirection
-            _exit(127);                 // If exec fails
-        }
-
-        // Parent
-        pgid = pid;
-        shell->pipeline_pgid = pgid;
-
-        // Set PGID, ignore benign races
-        if (setpgid(pid, pgid) < 0 &&
-            errno != EACCES && errno != EINVAL && errno != EPERM) {
-            // benign race, ignore
-        }
-
-        give_terminal_to_pgid(shell, pgid);
-
-        // Wait for child to finish or stop
-        if (waitpid(pgid, &status, WUNTRACED) < 0 && errno != ECHILD) {
-            perror("waitpid");
-        }
-
-        if (WIFSTOPPED(status)) {
-            reclaim_terminal(shell);
-            shell->last_pgid = pgid;
-            shell->pipeline_pgid = 0;
-            return 128 + WSTOPSIG(status);
-        }
-
-        if (WIFEXITED(status))        last_exit = WEXITSTATUS(status);
-        else if (WIFSIGNALED(status)) last_exit = 128 + WTERMSIG(status);
-
-        reclaim_terminal(shell);
-        shell->pipeline_pgid = 0;
-        return last_exit;
-    }
-
-    /* Multi-stage pipeline */
-    pid_t *pids = calloc(num_cmds, sizeof(pid_t));
-    if (!pids) {
-        perror("calloc pids");
-        shell->pipeline_pgid = 0;
-        return 1;
-    }
-
-    pipe_pair_t *pipes = create_pipes(num_cmds);
-    if (num_cmds > 1 && !pipes) {
-        perror("pipe setup");
-        free(pids);
-        shell->pipeline_pgid = 0;
-        return 1;
-    }
-
-    pid_t last_pid = -1;
-    int final_status = 0, got_last = 0;
-
-    for (i = 0; i < num_cmds; ++i) {
-        Command *cmd = cmds[i];
-        if (!cmd || !cmd->argv || !cmd->argv[0]) {
-            LOG(LOG_LEVEL_INFO, "cmds[%d] is NULL or empty", i);
-            continue;
-        }
-
-        LOG(LOG_LEVEL_INFO, "cmds[%d][0] = '%s'", i, cmd->argv[0]);
-
-        int builtin_res = handle_builtin_in_pipeline(shell, cmd, num_cmds);
-        if (builtin_res == 1) continue; // Handled without fork
-        if (builtin_res == 2) {
-            // Early return (e.g., 'exit' in pipeline semantics)
-            destroy_pipes(pipes, num_cmds);
-            free(pids);
-            shell->pipeline_pgid = 0;
-            return 0;
-        }
-
-        pids[i] = fork();
-        if (pids[i] < 0) {
-            LOG(LOG_LEVEL_ERR, "fork failed for cmds[%d]", i);
-            perror("fork");
-            destroy_pipes(pipes, num_cmds);
-            free(pids);
-            shell->pipeline_pgid = 0;
-            return 1;
-        }
-
-        if (pids[i] == 0) {
-            // Child
-            pid_t leader = (pgid == 0) ? 0 : pgid;
-            setup_pipeline_child(shell, i, num_cmds, pipes, cmd, leader);
-            // setup_pipeline_child should exec or _exit on failure
-            _exit(127);
-        } else {
-            // Parent
-            if (pgid == 0) {
-                pgid = pids[i];
-                shell->pipeline_pgid = pgid;
-                try_setpgid(pids[i], pgid);
-                give_terminal_to_pgid(shell, pgid);
-            } else {
-                try_setpgid(pids[i], pgid);
-            }
-        }
-    }
-
-    int forked = 0;
-    last_pid = -1;
-    for (int k = 0; k < num_cmds; ++k) {
-        if (pids[k] > 0) {
-            ++forked;
-            LOG(LOG_LEVEL_INFO, "child %d successfully forked", k + 1);
-            last_pid = pids[k];
-        } else {
-            LOG(LOG_LEVEL_INFO, "child %d failed fork", k + 1);
-        }
-    }
-
-    int live = forked;
-    if (pipes) close_pipes(pipes, num_cmds);
-
-    while (live > 0) {
-        pid_t w = waitpid(-pgid, &status, WUNTRACED);
-        if (w < 0) {
-            if (errno == EINTR) continue;
-            if (errno == ECHILD) break;
-            perror("waitpid");
-            break;
-        }
-
-        if (WIFSTOPPED(status)) {
-            reclaim_terminal(shell);
-            shell->last_pgid = pgid;
-            shell->pipeline_pgid = 0;
-            destroy_pipes(pipes, num_cmds);
-            free(pids);
-            return 128 + WSTOPSIG(status);
-        }
-
-        if (WIFEXITED(status) || WIFSIGNALED(status)) {
-            --live;
-            if (WIFEXITED(status))        last_exit = WEXITSTATUS(status);
-            else if (WIFSIGNALED(status)) last_exit = 128 + WTERMSIG(status);
-            if (w == last_pid) {
-                final_status = status;
-                got_last = 1;
-            }
-        }
-    }
-
-    reclaim_terminal(shell);
-    shell->last_pgid = pgid;
-
-    int ret;
-    if (got_last) {
-        if (WIFEXITED(final_status))        ret = WEXITSTATUS(final_status);
-        else if (WIFSIGNALED(final_status)) ret = 128 + WTERMSIG(final_status);
-        else                                ret = last_exit;
-    } else {
-        if (last_pid > 0) {
-            int tmp;
-            pid_t r = waitpid(last_pid, &tmp, WNOHANG);
-            if (r == last_pid) {
-                if (WIFEXITED(tmp))        ret = WEXITSTATUS(tmp);
-                else if (WIFSIGNALED(tmp)) ret = 128 + WTERMSIG(tmp);
-                else                       ret = last_exit;
-            } else {
-                ret = last_exit;
-            }
-        } else {
-            ret = last_exit;
-        }
-    }
-
-    destroy_pipes(pipes, num_cmds);
-    free(pids);
-    shell->pipeline_pgid = 0;
-
-    // Do NOT free cmds or Command here.
-    return ret;
-}
-
-/*=================================process_input_segments=====================================
-processes expanded input, splitting at semicolons for */
-void process_input_segments(ShellContext *shell, const char *expanded_input) {
-    
-    char **segments = split_on_semicolons(expanded_input);
-    if (!segments) return;
-
-    for (int i = 0; segments[i]; ++i) {
-        int num_cmds = 0;
-        Command **cmds = parse_commands(segments[i], &num_cmds);
-        LOG(LOG_LEVEL_INFO, "parse_commands returned %d commands", num_cmds);
-
-        // Validate command list before doing anything
-        bool valid = true;
-        if (!cmds || num_cmds <= 0) {
-            valid = false;
-        } else {
-            for (int j = 0; j < num_cmds; ++j) {
-                if (!cmds[j]) {
-                    LOG(LOG_LEVEL_ERR, "cmds[%d] is NULL", j);
-                    valid = false;
-                    break;
-                }
-                if (!cmds[j]->argv || !cmds[j]->argv[0]) {
-                    LOG(LOG_LEVEL_ERR, "cmds[%d] has invalid argv", j);
-                    valid = false;
-                    break;
-                }
-            }
-        }
-
-        if (!valid) {
-            LOG(LOG_LEVEL_WARN, "Skipping invalid command segment: '%s'", segments[i]);
-            free_command_list(cmds, num_cmds);
-            continue;
-        }
-
-        const char *cmd_name = cmds[0]->argv[0];
-
-        // Built-in: exit
-        if (strcmp(cmd_name, "exit") == 0) {
-            shell->running = 0;
-            free_command_list(cmds, num_cmds);
-            break;
-        }
-
-        // Built-in: unset
-        if (strcmp(cmd_name, "unset") == 0) {
-            if (num_cmds > 1) {
-                fprintf(stderr, "%s: cannot be used in a pipeline\n", cmd_name);
-                shell->last_status = 1;
-                free_command_list(cmds, num_cmds);
-                continue;
-            }
-
-            if (!cmds[0]->argv[1]) {
-                fprintf(stderr, "unset: missing variable name\n");
-                shell->last_status = 1;
-                free_command_list(cmds, num_cmds);
-                continue;
-            }
-
-            LOG(LOG_LEVEL_INFO, "Unsetting variable(s)");
-            for (int j = 1; cmds[0]->argv[j]; ++j) {
-                LOG(LOG_LEVEL_INFO, "checking variable");
-                if (!vart_unset(shell->vars, cmds[0]->argv[j])) {
-                    fprintf(stderr, "unset: failed to unset '%s'\n", cmds[0]->argv[j]);
-                    shell->last_status = 1;
-                }
-            }
-            shell->last_status = 0;
-            free_command_list(cmds, num_cmds);
-            continue;
-        }
-
-        // Variable assignment
-        if (is_var_assignment(cmd_name)) {
-            LOG(LOG_LEVEL_INFO, "initiating variable");
-            char *eq = strchr(cmd_name, '=');
-            size_t name_len = eq - cmd_name;
-            char *name = strndup(cmd_name, name_len);
-            char *value = strdup(eq + 1);
-            vart_set(shell->vars, name, value, 0);
-            LOG(LOG_LEVEL_INFO, "%s set to %s", name, value);
-
-            if (num_cmds > 1 && cmds[1] && cmds[1]->argv && cmds[1]->argv[0]) {
-                fprintf(stderr, "Setting variable kills pipeline. Killed before (%s %s)\n",
-                        cmds[1]->argv[0], cmds[1]->argv[1] ? cmds[1]->argv[1] : "");
-            }
-
-            free(name);
-            free(value);
-            free_command_list(cmds, num_cmds);
-            continue;
-        }
-
-        LOG(LOG_LEVEL_INFO, "Executing segment: '%s'", segments[i]);
-        int status = launch_commands(shell, cmds, num_cmds);
-        shell->last_status = status;
-        LOG(LOG_LEVEL_INFO, "Segment %d exited with status %d", i, status);
-
-        if (status == 128 + SIGTSTP) {
-            add_job(shell->last_pgid, segments[i]);
-            fprintf(stderr, "[%d]+  Stopped  %s\n", next_job_id() - 1, segments[i]);
-        }
-        
-        if (num_cmds == 1) { LOG(LOG_LEVEL_INFO, "command exited with %d", status); }  
-         else { LOG(LOG_LEVEL_INFO, "pipeline exited with %d", status); } 
-    
-        free_command_list(cmds, num_cmds);
-    }
-
-    free_segments(segments);
-}
-
-
-void free_segments(char **segments) {
-    if (!segments) return;
-    for (int i = 0; segments[i]; ++i) {
-        free(segments[i]);
-    }
-    free(segments);
-}
-
+/* =========================================== executor.c ======================================================
+ thrash command execution and pipeline orchestration with Bash-like semantics.
+
+ Responsibilities:
+ - Builtins (e.g., cd) handled directly and returned without forking.
+ - External commands:
+   - Resolved in the parent by resolve_command() before any fork(); the result is
+     cached on Command.resolved_path (and, for bare names, in the command hash).
+   - If argv[0] contains a slash, treat as a path and validate directly.
+   - If no slash, search $PATH manually to distinguish:
+       * not found       → "command not found" (exit 127), no fork
+       * found directory → "is a directory" (exit 126), no fork
+       * found non-exec  → "permission denied" (exit 126), no fork
+       * found exec file → fork + exec
+
+       - On exec failure, print a clean one-line error and exit with:
+       * 126 for non-runnable files (EACCES, ENOEXEC, directory)
+       * 127 for missing files (ENOENT, ENOTDIR)
+ - 
+ Pipeline execution:
+ - Allocates pipes and pids dynamically (no VLAs).
+ - Forks each stage, wires stdin/stdout via dup2(), and sets CLOEXEC on pipe fds.
+ - Assigns a shared process group (PGID) for job control.
+ - Handles terminal handoff and reclaiming via tcsetpgrp().
+ - Tracks last command’s PID to return accurate pipeline exit status.
+ - Cleans up all fds and memory on every exit path.
+
+ Signal handling:
+ - Shell ignores SIGINT, SIGQUIT, SIGTSTP, SIGTTIN, SIGTTOU.
+ - Children restore default signals before exec.
+ - SIGCHLD only wakes the reaper; every forked pipeline is a job (jobs.c), so a
+   foreground wait that reaps a background child credits it to its own job.
+
+ This file ensures robust, race-tolerant execution with clear diagnostics and correct exit codes. */
+
+#include "executor.h"
+#include "builtins.h"
+#include "debug.h"
+#include "trace.h"
+#include "stats.h"
+#include "signals.h"
+#include "shell.h"
+#include "jobs.h"
+#include "input.h"
+#include "var.h"
+#include "redirect.h"
+#include "command.h"
+#include "parser.h"
+#include "lexer.h"
+#include "ast.h"
+#include "path.h"
+#include "pipeline.h"
+#include "spawn.h"
+#include "readbuf.h"
+#include <errno.h>
+#include <termios.h>    
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <ctype.h>  
+#include <errno.h>
+#include <time.h>
+#include <limits.h>
+
+
+
+/* resolve_command
+ * Parent-side argv[0] lookup, done once before fork() so failures never cost a child.
+ * On success stores a heap copy of the executable path in cmd->resolved_path and
+ * returns 0. Otherwise prints a shell-style diagnostic and returns the status the
+ * command should report: 127 (not found) or 126 (found but not runnable). */
+int resolve_command(Command *cmd) {
+    if (!cmd || !cmd->argv || !cmd->argv[0]) return 127;
+    if (cmd->resolved_path) return 0; // already resolved (e.g. re-run job)
+
+    const char *name = cmd->argv[0];
+
+    if (has_slash(name)) {
+        struct stat st;
+        if (stat(name, &st) != 0) {
+            int err = errno;
+            print_exec_error(name, err);
+            return (err == ENOENT || err == ENOTDIR) ? 127 : 126;
+        }
+        if (S_ISDIR(st.st_mode)) {
+            fprintf(stderr, "thrash: %s: Is a directory\n", name);
+            return 126;
+        }
+        if (!S_ISREG(st.st_mode) || !is_executable(name)) {
+            print_exec_error(name, EACCES);
+            return 126;
+        }
+        cmd->resolved_path = cmd->arena ? arena_strdup(cmd->arena, name) : strdup(name);
+        if (!cmd->resolved_path) { perror("strdup"); return 126; }
+        return 0;
+    }
+
+    char *found = NULL;
+    uint64_t t0 = STATS_START();
+    int rc = search_path_alloc(name, &found);
+    STATS_STOP(STAT_RESOLVE, t0);
+    switch (rc) {
+        case FOUND_EXEC:
+            if (cmd->arena) { // keep arena-backed commands free of heap pointers
+                cmd->resolved_path = arena_strdup(cmd->arena, found);
+                free(found);
+                if (!cmd->resolved_path) { perror("arena_strdup"); return 126; }
+            } else {
+                cmd->resolved_path = found; // take ownership
+            }
+            return 0;
+        case FOUND_NOEXEC:
+            print_exec_error(name, EACCES);
+            return 126;
+        case FOUND_DIR:
+            fprintf(stderr, "thrash: %s: Is a directory\n", name);
+            return 126;
+        case NOT_FOUND:
+        default:
+            fprintf(stderr, "thrash: %s: command not found\n", name);
+            return 127;
+    }
+}
+
+static void run_compound_stage(ShellContext *shell, const Command *cmd);
+
+// Execute a single command with redirection and cwd override.
+// This is called in the child process after fork(); the parent has normally
+// resolved argv[0] already, the lookup here is only a fallback. A builtin only
+// gets here when it carries redirections: it runs in this child after them.
+void exec_command(ShellContext *shell, Command *cmd) {
+    if (cmd->compound) run_compound_stage(shell, cmd); // does not return
+
+    const Builtin *b = find_builtin(cmd->argv[0]);
+    if (!b && !cmd->resolved_path) {
+        int rc = resolve_command(cmd);
+        if (rc != 0) _exit(rc);
+    }
+
+    Redirection *redirs = NULL;
+    int redir_count = extract_redirections(cmd, &redirs);
+    if (redir_count < 0) {
+        fprintf(stderr, "thrash: out of memory\n");
+        _exit(1);
+    }
+
+    LOG(LOG_LEVEL_INFO, "Performing redirections");
+    if (perform_redirections(redirs, redir_count) != 0) {
+        free(redirs);
+        _exit(1); // early bail in child
+    }
+
+    if (b) {
+        free(redirs);
+        _exit(run_builtin(shell, b, cmd, stdout) & 0xff);
+    }
+
+    // 🚀 Execute
+    execve(cmd->resolved_path, cmd->argv, (char **)vart_envp(shell->vars));
+
+    // only reached if execve() fails
+    int err = errno;
+    print_exec_error(cmd->resolved_path, err);
+
+    free(redirs);
+    _exit((err == ENOENT || err == ENOTDIR) ? 127 : 126);
+}
+
+
+/* ================= Refactored launch_commands ================= */
+// Every forked pipeline becomes a job (jobs.c). A foreground job is waited for
+// here; a background one (cmds end with '&') is left to the reaper.
+// $PIPESTATUS for a command that never became a job (builtin, failed lookup)
+static int pipestatus_one(ShellContext *shell, int rc) {
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%d", rc);
+    vart_set(shell->vars, "PIPESTATUS", buf, 0);
+    return rc;
+}
+
+static int finish_job(ShellContext *shell, Job *job, bool quiet) {
+    if (!job->background) return job_foreground(shell, job, false); // sets PIPESTATUS
+    // $! is the last stage that forked, as wait PID expects
+    pid_t last = job->pgid;
+    for (size_t i = 0; i < job->nprocs; ++i) {
+        if (job->procs[i].pid > 0) last = job->procs[i].pid;
+    }
+    shell->vars->last_bg_pid = (long)last;
+    if (shell->interactive && !quiet) fprintf(stderr, "[%d] %d\n", job->id, (int)job->pgid);
+    shell->pipeline_pgid = 0;
+    return pipestatus_one(shell, 0);
+}
+
+// Without job control a background job must not compete with the shell for
+// its stdin: like other shells, give it /dev/null instead.
+static int background_stdin(ShellContext *shell, bool background) {
+    if (!background || shell->interactive) return -1;
+    return open("/dev/null", O_RDONLY | O_CLOEXEC);
+}
+
+// Ownership: cmds is BORROWED. launch_commands MUST NOT free or modify cmds or any Command/argv.
+// Caller (run_segment) releases them with the arena after return.
+int launch_commands(ShellContext *shell, Command **cmds, int num_cmds, const char *label) {
+    int i;
+    pid_t pgid = 0;
+    shell->pipeline_pgid = 0; // Reset pipeline PGID
+    bool use_spawn = (spawn_backend(shell) == SPAWN_POSIX);
+    bool background = num_cmds > 0 && cmds[num_cmds - 1] && cmds[num_cmds - 1]->background;
+
+    /* Single-command case */
+    if (num_cmds == 1) {
+        Command *cmd = cmds[0];
+        if (!cmd || !cmd->argv || !cmd->argv[0]) {
+            return 0; // Empty command
+        }
+        // Builtins run in the shell, their redirections applied around them and
+        // undone after. Only a cwd override still needs a child.
+        const Builtin *b = find_builtin(cmd->argv[0]);
+        if (b && ((b->flags & BI_SHELL) || !cmd->cwd_override)) {
+            // `time` reports from a job; give the builtin a one-stage one
+            Job *timed = cmd->time_format ? job_create(label, background, 1) : NULL;
+            if (timed) timed->time_format = cmd->time_format;
+            int rc = run_builtin_redirected(shell, b, cmd, stdout);
+            if (timed) {
+                job_add_finished(timed, cmd->argv[0], rc);
+                job_remove(timed);
+            }
+            if (b->flags & BI_JOB) return background ? 0 : rc;
+            return pipestatus_one(shell, background ? 0 : rc);
+        }
+
+        // Resolve before forking: typos and non-executables never cost a fork
+        int resolve_rc = b ? 0 : resolve_command(cmd);
+        if (resolve_rc != 0) {
+            return pipestatus_one(shell, resolve_rc);
+        }
+
+        Job *job = job_create(label, background, 1);
+        if (!job) {
+            fprintf(stderr, "thrash: out of memory\n");
+            return pipestatus_one(shell, 1);
+        }
+        job->time_format = cmd->time_format;
+        readbuf_sync(); // the child shares fd 0: nothing of it may sit in read's buffer
+        int bg_stdin = background_stdin(shell, background);
+
+        pid_t pid;
+        if (use_spawn && spawn_eligible(cmd)) {
+            int spawn_rc = 0;
+            uint64_t t0 = STATS_START();
+            pid = spawn_command(cmd, shell->interactive ? 0 : -1, bg_stdin, -1,
+                                vart_envp(shell->vars), &spawn_rc);
+            STATS_STOP(STAT_SPAWN, t0);
+            if (pid < 0) {
+                if (bg_stdin >= 0) close(bg_stdin);
+                job_remove(job);
+                return pipestatus_one(shell, spawn_rc);
+            }
+        } else {
+            uint64_t t0 = STATS_START();
+            pid = fork();
+            if (pid > 0) STATS_STOP(STAT_FORK, t0);
+            if (pid < 0) {
+                perror("fork");
+                if (bg_stdin >= 0) close(bg_stdin);
+                job_remove(job);
+                return pipestatus_one(shell, 1);
+            }
+
+            if (pid == 0) {
+                // Child
+                if (shell->interactive) setpgid(0, 0); // Create new process group
+                if (bg_stdin >= 0) dup2(bg_stdin, STDIN_FILENO);
+                setup_child_signals();      // Reset signal handlers
+                exec_command(shell, cmd);   // Exec external command with redirection
+                _exit(127);                 // If exec fails
+            }
+        }
+        if (bg_stdin >= 0) close(bg_stdin);
+
+        // Parent
+        pgid = pid;
+        shell->pipeline_pgid = pgid;
+
+        if (shell->interactive) join_pgid(pid, pgid);
+
+        TRACE(use_spawn && spawn_eligible(cmd) ? TR_SPAWN : TR_FORK, pid, 0);
+        job_add_proc(job, pid, cmd->argv[0]);
+        return finish_job(shell, job, cmd->quiet);
+    }
+
+    /* Multi-stage pipeline */
+    readbuf_sync();
+    pipe_pair_t *pipes = create_pipes(num_cmds, pipe_buffer_size(shell));
+    if (num_cmds > 1 && !pipes) {
+        perror("pipe setup");
+        shell->pipeline_pgid = 0;
+        return pipestatus_one(shell, 1);
+    }
+
+    Job *job = job_create(label, background, (size_t)num_cmds);
+    if (!job) {
+        fprintf(stderr, "thrash: out of memory\n");
+        destroy_pipes(pipes, num_cmds);
+        return pipestatus_one(shell, 1);
+    }
+    job->time_format = cmds[num_cmds - 1] ? cmds[num_cmds - 1]->time_format : 0;
+    int bg_stdin = background_stdin(shell, background);
+
+    // Stages that never fork (builtins, failed lookups) are recorded as
+    // finished, in pipeline order, so the job's status is its last stage's
+    int forked = 0;
+    // One envp for every stage: builtins can't run between the spawns, so it can't change
+    char *const *envp = vart_envp(shell->vars);
+
+    for (i = 0; i < num_cmds; ++i) {
+        // Both stages on pipe i-2 exist now; the parent is done with it
+        if (i >= 2) release_pipe(pipes, i - 2);
+
+        Command *cmd = cmds[i];
+        if (!cmd || !cmd->argv || !cmd->argv[0]) {
+            LOG(LOG_LEVEL_INFO, "cmds[%d] is NULL or empty", i);
+            continue;
+        }
+
+        LOG(LOG_LEVEL_INFO, "cmds[%d][0] = '%s'", i, cmd->argv[0]);
+
+        // failfast: an earlier stage that never forked has already failed
+        if (job->cut_status) {
+            job_add_cut(job, cmd->argv[0]);
+            continue;
+        }
+
+        // Builtins run in the shell: the last stage writes to stdout, earlier
+        // ones feed their pipe (see pipeline.c). No fork, no exec.
+        int builtin_status = 0;
+        int out_fd = (i < num_cmds - 1) ? pipes[i][1] : -1;
+        if (!cmd->compound && handle_builtin_in_pipeline(shell, cmd, out_fd, &builtin_status)) {
+            job_add_finished(job, cmd->argv[0], builtin_status);
+            continue;
+        }
+
+        // Resolve in the parent; a failed stage is simply not forked. Its pipe
+        // ends are closed with the rest below, so neighbours see EOF/EPIPE.
+        // Builtins that still need a child (redirections) and a compound last
+        // stage skip the PATH search.
+        int resolve_rc = (cmd->compound || find_builtin(cmd->argv[0])) ? 0 : resolve_command(cmd);
+        if (resolve_rc != 0) {
+            job_add_finished(job, cmd->argv[0], resolve_rc);
+            continue;
+        }
+
+        pid_t pid;
+        if (use_spawn && spawn_eligible(cmd)) {
+            int in_fd  = (i > 0) ? pipes[i - 1][0] : bg_stdin;
+            int spawn_rc = 0;
+            pid_t group = shell->interactive ? pgid : -1;
+            uint64_t t0 = STATS_START();
+            pid = spawn_command(cmd, group, in_fd, out_fd, envp, &spawn_rc);
+            STATS_STOP(STAT_SPAWN, t0);
+            if (pid < 0) {
+                // treated like a stage that never started
+                job_add_finished(job, cmd->argv[0], spawn_rc);
+                continue;
+            }
+            if (pgid == 0) {
+                pgid = pid;
+                shell->pipeline_pgid = pgid;
+            }
+        } else {
+            uint64_t t0 = STATS_START();
+            pid = fork();
+            if (pid > 0) STATS_STOP(STAT_FORK, t0);
+            if (pid < 0) {
+                LOG(LOG_LEVEL_ERR, "fork failed for cmds[%d]", i);
+                perror("fork");
+                job_add_finished(job, cmd->argv[0], 1);
+                break; // wait for what already runs; the rest sees EOF/EPIPE
+            }
+
+            if (pid == 0) {
+                // Child
+                pid_t leader = (pgid == 0) ? 0 : pgid;
+                if (i == 0 && bg_stdin >= 0) dup2(bg_stdin, STDIN_FILENO);
+                setup_pipeline_child(shell, i, num_cmds, pipes, cmd, leader);
+                // setup_pipeline_child should exec or _exit on failure
+                _exit(127);
+            }
+
+            // Parent
+            if (pgid == 0) {
+                pgid = pid;
+                shell->pipeline_pgid = pgid;
+            }
+            if (shell->interactive) join_pgid(pid, pgid);
+        }
+        LOG(LOG_LEVEL_INFO, "child %d started, pid %d", i + 1, (int)pid);
+        TRACE(use_spawn && spawn_eligible(cmd) ? TR_SPAWN : TR_FORK, pid, i);
+        job_add_proc(job, pid, cmd->argv[0]);
+        forked++;
+    }
+
+    if (bg_stdin >= 0) close(bg_stdin);
+    if (pipes) close_pipes(pipes, num_cmds);
+    destroy_pipes(pipes, num_cmds);
+
+    if (forked == 0) {
+        // Nothing left the shell: there is no job to wait for
+        int rc = job_status(job);
+        if (background) pipestatus_one(shell, 0);
+        else            job_set_pipestatus(shell, job);
+        job_remove(job); // where a timed one reports
+        shell->pipeline_pgid = 0;
+        return background ? 0 : rc;
+    }
+
+    // Do NOT free cmds or Command here.
+    return finish_job(shell, job, cmds[num_cmds - 1]->quiet);
+}
+
+// An unquoted word spelled exactly w (reserved words such as `time`)
+static bool token_is(const TokenList *tl, const Token *t, const char *w) {
+    size_t n = strlen(w);
+    return t->type == TOK_WORD && !t->quoted && t->len == n && memcmp(tl->src + t->start, w, n) == 0;
+}
+
+/* parse_time_prefix
+ * `time [-p | -j] pipeline`: skip the reserved word and its options, leaving
+ * *first on the pipeline. Returns the TIME_* format, TIME_NONE when the
+ * segment isn't timed, or -1 after a usage error. */
+static int parse_time_prefix(const TokenList *tl, size_t *first, size_t last) {
+    if (!token_is(tl, &tl->tok[*first], "time")) return TIME_NONE;
+    int format = TIME_DEFAULT;
+    size_t k = *first + 1;
+    for (; k < last; ++k) {
+        const Token *t = &tl->tok[k];
+        if (token_is(tl, t, "-p"))      format = TIME_POSIX;
+        else if (token_is(tl, t, "-j")) format = TIME_JSON;
+        else break;
+    }
+    if (k == last) {
+        fprintf(stderr, "thrash: time: usage: time [-p | -j] pipeline\n");
+        return -1;
+    }
+    *first = k;
+    return format;
+}
+
+// cmds plus a last stage for tail, in the arena; its argv[0] only names it
+static Command **add_compound_stage(ShellContext *shell, const TokenList *tl, const AstNode *tail,
+                                    Command **cmds, int num_cmds) {
+    static const char *const names[] = {
+        [AST_IF] = "if", [AST_WHILE] = "while", [AST_UNTIL] = "until", [AST_FOR] = "for",
+    };
+    Command **all = arena_alloc(&shell->arena, (size_t)(num_cmds + 2) * sizeof(Command *));
+    Command *c = arena_calloc(&shell->arena, 1, sizeof(Command));
+    char **argv = arena_alloc(&shell->arena, 2 * sizeof(char *));
+    if (!all || !c || !argv) return NULL;
+    argv[0] = (char *)names[tail->type];
+    argv[1] = NULL;
+    c->argv = argv;
+    c->argc = 1;
+    c->arena = &shell->arena;
+    c->compound = tail;
+    c->compound_tl = tl;
+    memcpy(all, cmds, (size_t)num_cmds * sizeof(Command *));
+    all[num_cmds] = c;
+    all[num_cmds + 1] = NULL;
+    return all;
+}
+
+/*=================================run_segment=====================================
+Parse (and expand) tokens [first, last) of one ;- or &-terminated segment and
+run it, in the background for &. A compound command piped into (tail) is
+added as one more stage, which runs it in a forked child.
+Expansion happens here rather than on the whole line, so `X=1; echo $X` sees
+the new X. Everything lives in shell->arena; the caller resets it per line. */
+static void run_segment(ShellContext *shell, const TokenList *tl, size_t first, size_t last,
+                        bool background, const AstNode *tail) {
+    int time_format = parse_time_prefix(tl, &first, last);
+    if (time_format < 0) {
+        shell->last_status = 2;
+        return;
+    }
+
+    size_t start = tl->tok[first].start;
+    size_t end_tok = tail ? tail->redir_last : last;
+    size_t end = tl->tok[end_tok - 1].start + tl->tok[end_tok - 1].len;
+    char *seg = arena_strndup(&shell->arena, tl->src + start, end - start); // job label / logs
+    if (!seg) return;
+
+    int num_cmds = 0;
+    uint64_t t0 = STATS_START();
+    Command **cmds = parse_tokens(tl, first, last, shell->vars, shell->last_status,
+                                  &shell->arena, &num_cmds);
+    STATS_STOP(STAT_PARSE, t0);
+    LOG(LOG_LEVEL_INFO, "parse_tokens returned %d commands", num_cmds);
+    if (num_cmds < 0) {
+        shell->last_status = 2; // syntax error, already reported
+        return;
+    }
+
+    // Validate command list before doing anything
+    bool valid = true;
+    if (!cmds || num_cmds <= 0) {
+        valid = false;
+    } else {
+        for (int j = 0; j < num_cmds; ++j) {
+            if (!cmds[j]) {
+                LOG(LOG_LEVEL_ERR, "cmds[%d] is NULL", j);
+                valid = false;
+                break;
+            }
+            if (!cmds[j]->argv || !cmds[j]->argv[0]) {
+                LOG(LOG_LEVEL_ERR, "cmds[%d] has invalid argv", j);
+                valid = false;
+                break;
+            }
+        }
+    }
+
+    if (!valid) {
+        LOG(LOG_LEVEL_WARN, "Skipping invalid command segment: '%s'", seg);
+        return;
+    }
+
+    const char *cmd_name = cmds[0]->argv[0];
+
+    // Variable assignment
+    if (is_var_assignment(cmd_name)) {
+        LOG(LOG_LEVEL_INFO, "initiating variable");
+        char *eq = strchr(cmd_name, '=');
+        size_t name_len = eq - cmd_name;
+        char *name = arena_strndup(&shell->arena, cmd_name, name_len);
+        const char *value = eq + 1;
+        vart_set(shell->vars, name, value, 0);
+        LOG(LOG_LEVEL_INFO, "%s set to %s", name, value);
+
+        if (num_cmds > 1 && cmds[1] && cmds[1]->argv && cmds[1]->argv[0]) {
+            fprintf(stderr, "Setting variable kills pipeline. Killed before (%s %s)\n",
+                    cmds[1]->argv[0], cmds[1]->argv[1] ? cmds[1]->argv[1] : "");
+        }
+
+        return;
+    }
+
+    if (tail) {
+        cmds = add_compound_stage(shell, tl, tail, cmds, num_cmds);
+        if (!cmds) {
+            fprintf(stderr, "thrash: out of memory\n");
+            shell->last_status = 1;
+            return;
+        }
+        num_cmds++;
+    }
+
+    for (int j = 0; j < num_cmds; ++j) {
+        cmds[j]->background = background;
+        cmds[j]->time_format = time_format;
+    }
+
+    LOG(LOG_LEVEL_INFO, "Executing segment: '%s'%s", seg, background ? " &" : "");
+    int status = launch_commands(shell, cmds, num_cmds, seg);
+    shell->last_status = status;
+    TRACE(TR_SEGMENT, num_cmds, status);
+    LOG(LOG_LEVEL_INFO, "Segment '%s' exited with status %d", seg, status);
+
+    if (num_cmds == 1) { LOG(LOG_LEVEL_INFO, "command exited with %d", status); }  
+     else { LOG(LOG_LEVEL_INFO, "pipeline exited with %d", status); }
+}
+
+/*=================================compound commands=================================
+Walk the tree ast_build() made. A pipeline node is one run_segment(), so its
+words are expanded each time it runs; everything a loop iteration allocates
+is rewound from the arena before the next one, so a long loop runs in the
+space of one iteration. */
+
+static void run_list(ShellContext *shell, const TokenList *tl, const AstList *list);
+
+// After a loop's body (or condition): true to leave the loop. break n and
+// continue n unwind one loop level each; the last level continues for continue.
+static bool loop_leave(ShellContext *shell) {
+    if (!shell->running) return true;
+    if (shell->loop_ctl == 0) return false;
+    if (--shell->loop_ctl > 0) return true;
+    return !shell->loop_continue;
+}
+
+static void run_if(ShellContext *shell, const TokenList *tl, const AstNode *n) {
+    run_list(shell, tl, &n->cond);
+    if (!shell->running || shell->loop_ctl) return;
+    if (shell->last_status == 0) run_list(shell, tl, &n->body);
+    else if (n->orelse.count)    run_list(shell, tl, &n->orelse);
+    else                         shell->last_status = 0;
+}
+
+// Status: the body's last run, 0 if it never ran
+static void run_while(ShellContext *shell, const TokenList *tl, const AstNode *n) {
+    int status = 0;
+    shell->loop_depth++;
+    for (;;) {
+        ArenaMark m = arena_mark(&shell->arena);
+        run_list(shell, tl, &n->cond);
+        bool leave;
+        if (!shell->running || shell->loop_ctl) {
+            leave = loop_leave(shell); // break/continue/exit in the condition
+        } else if ((shell->last_status == 0) == (n->type == AST_UNTIL)) {
+            leave = true;
+        } else {
+            run_list(shell, tl, &n->body);
+            status = shell->last_status;
+            leave = loop_leave(shell);
+        }
+        arena_rewind(&shell->arena, m);
+        if (leave) break;
+    }
+    shell->loop_depth--;
+    if (shell->running) shell->last_status = status;
+}
+
+// The word list is expanded once, when the loop starts
+static void run_for(ShellContext *shell, const TokenList *tl, const AstNode *n) {
+    size_t count = 0;
+    char **words = expand_words(tl, n->first, n->last, shell->vars, shell->last_status,
+                                &shell->arena, &count);
+    if (!words) {
+        fprintf(stderr, "thrash: out of memory\n");
+        shell->last_status = 1;
+        return;
+    }
+    int status = 0;
+    shell->loop_depth++;
+    for (size_t i = 0; i < count; ++i) {
+        ArenaMark m = arena_mark(&shell->arena);
+        vart_set(shell->vars, n->var, words[i], 0);
+        run_list(shell, tl, &n->body);
+        status = shell->last_status;
+        bool leave = loop_leave(shell);
+        arena_rewind(&shell->arena, m);
+        if (leave) break;
+    }
+    shell->loop_depth--;
+    if (shell->running) shell->last_status = status;
+}
+
+/* A compound command's own redirections (`done <hosts`, `fi >log`) are
+ * applied in the shell around the whole construct, like a builtin's, so
+ * every command inside inherits them. */
+static void run_compound(ShellContext *shell, const TokenList *tl, const AstNode *n) {
+    Redirection *list = NULL;
+    int count = 0;
+    RedirSave save = { .owns_stdin = true };
+    if (n->redir_last > n->redir_first) {
+        int ncmds = 0;
+        Command **c = parse_tokens(tl, n->redir_first, n->redir_last, shell->vars,
+                                   shell->last_status, &shell->arena, &ncmds);
+        if (ncmds < 0) {
+            shell->last_status = 2;
+            return;
+        }
+        count = c ? extract_redirections(c[0], &list) : -1;
+        if (count < 0) {
+            fprintf(stderr, "thrash: out of memory\n");
+            shell->last_status = 1;
+            return;
+        }
+        fflush(stdout);
+        fflush(stderr);
+        if (apply_redirections_saved(list, count, &save) != 0) {
+            restore_redirections(&save);
+            free(list);
+            shell->last_status = 1;
+            return;
+        }
+    }
+
+    switch (n->type) {
+    case AST_IF:    run_if(shell, tl, n); break;
+    case AST_WHILE:
+    case AST_UNTIL: run_while(shell, tl, n); break;
+    case AST_FOR:   run_for(shell, tl, n); break;
+    default:        break;
+    }
+
+    if (count) {
+        fflush(stdout);
+        fflush(stderr);
+        restore_redirections(&save);
+        free(list);
+    }
+}
+
+/* The last stage of `... | while read l; do ...; done`, in its forked child
+ * after the pipe is on fd 0: a copy of the shell without job control (the
+ * stage already sits in the pipeline's group) and without the parent's jobs.
+ * The loop owns that pipe, so read may buffer it. */
+static void run_compound_stage(ShellContext *shell, const Command *cmd) {
+    shell->interactive = 0;
+    jobs_destroy();
+    readbuf_push(true);
+    run_compound(shell, cmd->compound_tl, cmd->compound);
+    fflush(stdout);
+    fflush(stderr);
+    _exit(shell->last_status & 0xff);
+}
+
+static void run_node(ShellContext *shell, const TokenList *tl, const AstNode *n) {
+    if (n->type != AST_PIPELINE) {
+        run_compound(shell, tl, n);
+        return;
+    }
+    run_segment(shell, tl, n->first, n->last, n->background, n->tail);
+    jobs_reap(); // keep zombies from piling up between prompts
+    if (!shell->interactive) jobs_forget_done(); // ...and finished jobs, with no prompt to report them
+    // Interactive ^C reaches the foreground job, never the shell: a command
+    // it kills inside a loop ends every enclosing loop, not just itself
+    if (shell->loop_depth && shell->interactive && shell->last_status == 128 + SIGINT) {
+        shell->loop_ctl = shell->loop_depth;
+        shell->loop_continue = false;
+    }
+}
+
+static void run_list(ShellContext *shell, const TokenList *tl, const AstList *list) {
+    for (size_t i = 0; i < list->count && shell->running && !shell->loop_ctl; ++i)
+        run_node(shell, tl, list->items[i]);
+}
+
+/*=================================execute_input=====================================
+Lex a buffer once, build its command tree and run it. Returns false, without
+running anything, while the input is incomplete (open quote, trailing backslash,
+or an if/while/for without its fi/done) so the caller can read another line.
+Shared by the REPL and script mode. */
+bool execute_input(ShellContext *shell, const char *input) {
+    TokenList tl;
+    uint64_t t0 = STATS_START();
+    LexStatus st = lex_input(input, &shell->arena, &tl);
+    STATS_STOP(STAT_LEX, t0);
+    if (lex_incomplete(st)) return false;
+    if (st == LEX_NOMEM) {
+        fprintf(stderr, "thrash: out of memory\n");
+        shell->last_status = 1;
+        return true;
+    }
+
+    // A stray "&" (nothing before it) or an unsupported "&&" rejects the whole
+    // line before any of it runs, as it would be a parse error in any shell
+    for (size_t k = 0; k < tl.count; ++k) {
+        const Token *t = &tl.tok[k];
+        if (t->type != TOK_AMP) continue;
+        if (t->len == 2 || k == 0 || tl.tok[k - 1].type == TOK_SEP || tl.tok[k - 1].type == TOK_AMP) {
+            fprintf(stderr, "thrash: syntax error near unexpected token `%s'\n", tok_spelling(&tl, t));
+            shell->last_status = 2;
+            return true;
+        }
+    }
+
+    AstList program;
+    switch (ast_build(&tl, &shell->arena, &program)) {
+    case AST_INCOMPLETE:
+        return false;
+    case AST_SYNTAX:
+        shell->last_status = 2;
+        return true;
+    case AST_NOMEM:
+        fprintf(stderr, "thrash: out of memory\n");
+        shell->last_status = 1;
+        return true;
+    case AST_OK:
+        break;
+    }
+    run_list(shell, &tl, &program);
+    return true;
+}
+
+
+void free_segments(char **segments) {
+    if (!segments) return;
+    for (int i = 0; segments[i]; ++i) {
+        free(segments[i]);
+    }
+    free(segments);
+}
+
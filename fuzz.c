@@ -0,0 +1,325 @@
+// fuzz.c
+/* Fuzz targets for the code that takes arbitrary text: the parser, the
+ * ;-splitter, $ expansion, the lexer + command tree, and the history file
+ * reader. One input drives one target, picked by its first byte, so a single
+ * corpus covers all of them. Besides not crashing (ASan/UBSan do the
+ * watching), each target checks a few things that must hold of its result
+ * and aborts when they don't.
+ *
+ * Built with libFuzzer (-DFUZZ_LIBFUZZER) only LLVMFuzzerTestOneInput is
+ * here. Otherwise this file has its own driver:
+ *
+ *   fuzz [-runs N] [-seed S] [-v] [file...]
+ *
+ * Files (or - for stdin, which is what AFL's `fuzz @@` needs) are replayed
+ * one by one; without any, N random inputs are made from shell fragments and
+ * noise. `make fuzz` builds it with ASan and UBSan and runs it. */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+#include "arena.h"
+#include "parser.h"
+#include "command.h"
+#include "input.h"
+#include "lexer.h"
+#include "ast.h"
+#include "var.h"
+#include "history.h"
+
+typedef enum {
+    FUZZ_PARSE,   // parse_commands
+    FUZZ_SPLIT,   // split_on_semicolons
+    FUZZ_EXPAND,  // expand_variables_ex
+    FUZZ_AST,     // lex_input + ast_build
+    FUZZ_HISTORY, // history_load of the bytes as a file, then save + reload
+    FUZZ_TARGETS
+} FuzzTarget;
+
+static const char *const target_name[FUZZ_TARGETS] = {
+    "parse", "split", "expand", "ast", "history",
+};
+
+static Arena arena;
+static VarTable vars;
+static char hist_path[64];
+static uint64_t target_runs[FUZZ_TARGETS];
+
+static void (*on_failure)(void); // the driver saves the input; libFuzzer does its own
+
+static void fail(const char *file, int line, const char *what) {
+    fprintf(stdout, "fuzz: %s:%d: check failed: %s\n", file, line, what);
+    fflush(stdout);
+    if (on_failure) on_failure();
+    abort();
+}
+
+#define CHECK(cond) do { if (!(cond)) fail(__FILE__, __LINE__, #cond); } while (0)
+
+static void fuzz_init(void) {
+    arena_init(&arena, 0);
+    vart_init(&vars, 64);
+    vart_set(&vars, "HOME", "/home/fuzz", V_EXPORT);
+    vart_set(&vars, "EMPTY", "", 0);
+    vart_set(&vars, "X", "value with spaces", 0);
+    char big[4096]; // a value longer than any fixed buffer would hold
+    memset(big, 'v', sizeof(big) - 1);
+    big[sizeof(big) - 1] = '\0';
+    vart_set(&vars, "BIG", big, 0);
+    snprintf(hist_path, sizeof(hist_path), "/tmp/thrash-fuzz-hist.%d", (int)getpid());
+}
+
+static void fuzz_parse(const char *s) {
+    int n = 0;
+    Command **cmds = parse_commands(s, &n, &arena);
+    if (!cmds) return;
+    for (int i = 0; i < n; ++i) {
+        CHECK(cmds[i]);
+        if (!cmds[i]->argv) continue;
+        CHECK(cmds[i]->argc >= 0);
+        CHECK(cmds[i]->argv[cmds[i]->argc] == NULL);
+    }
+}
+
+static void fuzz_split(const char *s) {
+    char **parts = split_on_semicolons(s, &arena);
+    if (!parts) return;
+    size_t total = 0, len = strlen(s);
+    for (size_t i = 0; parts[i]; ++i) {
+        total += strlen(parts[i]);
+        CHECK(total <= len); // pieces of the input, never more than it
+    }
+}
+
+static void fuzz_expand(const char *s) {
+    char *x = expand_variables_ex(s, 42, &vars, &arena);
+    CHECK(x);
+    // Without a $ there is nothing to expand
+    if (!strchr(s, '$')) CHECK(strlen(x) <= strlen(s));
+}
+
+static void fuzz_ast(const char *s) {
+    TokenList tl;
+    LexStatus st = lex_input(s, &arena, &tl);
+    if (st != LEX_OK) return;
+    AstList program;
+    AstStatus as = ast_build(&tl, &arena, &program);
+    CHECK(as == AST_OK || as == AST_INCOMPLETE || as == AST_SYNTAX || as == AST_NOMEM);
+    for (size_t i = 0; as == AST_OK && i < program.count; ++i) {
+        const AstNode *n = program.items[i];
+        CHECK(n && n->first <= n->last && n->last <= tl.count);
+    }
+}
+
+// What history_load() makes of the bytes must survive history_save() and a
+// second load unchanged: the escaping round-trips
+static void fuzz_history(const uint8_t *data, size_t size) {
+    FILE *f = fopen(hist_path, "w");
+    if (!f) return;
+    fwrite(data, 1, size, f);
+    fclose(f);
+
+    History a, b;
+    if (history_init(&a, hist_path, 64, 0) != 0) return;
+    if (history_load(&a) == 0) {
+        CHECK(history_count(&a) <= 64);
+        for (size_t i = 0; i < history_count(&a); ++i) CHECK(get_history(&a, i)->line);
+        if (history_save(&a) == 0 && history_init(&b, hist_path, 64, 0) == 0) {
+            CHECK(history_load(&b) == 0);
+            CHECK(history_count(&b) == history_count(&a));
+            for (size_t i = 0; i < history_count(&a); ++i)
+                CHECK(strcmp(get_history(&a, i)->line, get_history(&b, i)->line) == 0);
+            history_dispose(&b);
+        }
+    }
+    history_dispose(&a);
+    unlink(hist_path);
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    static bool ready = false;
+    if (!ready) {
+        fuzz_init();
+        ready = true;
+    }
+    if (size == 0) return 0;
+    FuzzTarget t = (FuzzTarget)(data[0] % FUZZ_TARGETS);
+    target_runs[t]++;
+    data++;
+    size--;
+    if (t == FUZZ_HISTORY) {
+        fuzz_history(data, size);
+        return 0;
+    }
+
+    char *s = malloc(size + 1); // the text targets take a C string
+    if (!s) return 0;
+    memcpy(s, data, size);
+    s[size] = '\0';
+    switch (t) {
+    case FUZZ_PARSE:  fuzz_parse(s);  break;
+    case FUZZ_SPLIT:  fuzz_split(s);  break;
+    case FUZZ_EXPAND: fuzz_expand(s); break;
+    case FUZZ_AST:    fuzz_ast(s);    break;
+    default:          break;
+    }
+    arena_reset(&arena);
+    free(s);
+    return 0;
+}
+
+#ifndef FUZZ_LIBFUZZER
+
+/* ---- Standalone driver ------------------------------------------------------ */
+
+static const char *const fragments[] = {
+    "echo", " ", " ", "\t", "\n", ";", ";;", "|", "&", "&&", "<", ">", ">>", "2>&1", "<&-", "<<EOF\n",
+    "'", "\"", "\\", "\\\n", "$", "$X", "${X}", "${", "}", "$?", "$$", "$BIG", "${EMPTY}", "$1",
+    "#", "=", "X=1", "if", "then", "elif", "else", "fi", "while", "until", "do", "done",
+    "for", "in", "time", "-p", "cd", "{}", ":::", "*", "~", "\xff", "\xc3\xa9",
+    "\t\\\\\t", "12345\t0\t", "#ts ", "\\n", "\\t",
+};
+
+static uint64_t rng_state;
+static const uint8_t *cur_input; // what is running, for save_input()
+static size_t cur_len;
+static uint64_t cur_run, cur_seed;
+
+// Set by the sanitizers' runtime when linked in: called before they exit
+extern void __sanitizer_set_death_callback(void (*callback)(void)) __attribute__((weak));
+
+// crash-SEED-RUN in the current directory, to replay with `fuzz FILE`
+static void save_input(void) {
+    if (!cur_input) return;
+    char name[64];
+    snprintf(name, sizeof(name), "crash-%llu-%llu", (unsigned long long)cur_seed,
+             (unsigned long long)cur_run);
+    FILE *f = fopen(name, "wb");
+    if (!f) return;
+    fwrite(cur_input, 1, cur_len, f);
+    fclose(f);
+    fprintf(stdout, "fuzz: input saved to %s\n", name);
+    fflush(stdout);
+    cur_input = NULL;
+}
+
+static uint64_t rng(void) { // xorshift64*
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 2685821657736338717ull;
+}
+
+// A random input: a target byte, then fragments and noise. One in 64 is long
+// (up to 64K), past the sizes the old fixed buffers had.
+static size_t make_input(uint8_t *buf, size_t cap) {
+    size_t max = (rng() % 64 == 0) ? cap : 512;
+    size_t want = 1 + rng() % max, n = 0;
+    buf[n++] = (uint8_t)(rng() % FUZZ_TARGETS);
+    size_t nfrag = sizeof(fragments) / sizeof(fragments[0]);
+    while (n < want) {
+        uint64_t r = rng();
+        if (r % 8 == 0) {
+            buf[n++] = (uint8_t)(r >> 8);
+            continue;
+        }
+        const char *f = fragments[(r >> 8) % nfrag];
+        size_t len = strlen(f);
+        if (n + len > cap) break;
+        memcpy(buf + n, f, len);
+        n += len;
+    }
+    return n;
+}
+
+static int replay(const char *path) {
+    FILE *f = strcmp(path, "-") == 0 ? stdin : fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        return 1;
+    }
+    uint8_t *buf = NULL;
+    size_t len = 0, cap = 0;
+    for (;;) {
+        if (len == cap) {
+            cap = cap ? cap * 2 : 4096;
+            uint8_t *nb = realloc(buf, cap);
+            if (!nb) break;
+            buf = nb;
+        }
+        size_t n = fread(buf + len, 1, cap - len, f);
+        if (n == 0) break;
+        len += n;
+    }
+    if (f != stdin) fclose(f);
+    LLVMFuzzerTestOneInput(buf, len);
+    free(buf);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    uint64_t runs = 100000, seed = (uint64_t)time(NULL);
+    bool verbose = false;
+    int first_file = argc;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-runs") == 0 && i + 1 < argc) {
+            runs = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-seed") == 0 && i + 1 < argc) {
+            seed = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-v") == 0) {
+            verbose = true;
+        } else if (argv[i][0] == '-' && argv[i][1]) {
+            fprintf(stderr, "usage: %s [-runs N] [-seed S] [-v] [file...]\n", argv[0]);
+            return 2;
+        } else {
+            first_file = i;
+            break;
+        }
+    }
+    // The code under test reports syntax errors on stderr: mute the stream,
+    // not fd 2, where the sanitizers write
+    if (!verbose) {
+        FILE *devnull = fopen("/dev/null", "w");
+        if (devnull) stderr = devnull;
+    }
+
+    if (first_file < argc) {
+        int rc = 0;
+        for (int i = first_file; i < argc; ++i) rc |= replay(argv[i]);
+        return rc;
+    }
+
+    on_failure = save_input;
+    if (__sanitizer_set_death_callback) __sanitizer_set_death_callback(save_input);
+    cur_seed = seed;
+    rng_state = seed ? seed : 1;
+    printf("fuzz: %llu runs, seed %llu\n", (unsigned long long)runs, (unsigned long long)seed);
+    fflush(stdout);
+    enum { FUZZ_MAX_INPUT = 64 * 1024 };
+    uint8_t *buf = malloc(FUZZ_MAX_INPUT);
+    if (!buf) return 1;
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (uint64_t i = 0; i < runs; ++i) {
+        size_t n = make_input(buf, FUZZ_MAX_INPUT);
+        cur_input = buf;
+        cur_len = n;
+        cur_run = i;
+        LLVMFuzzerTestOneInput(buf, n);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    cur_input = NULL;
+    free(buf);
+    for (int t = 0; t < FUZZ_TARGETS; ++t)
+        printf("  %-8s %10llu\n", target_name[t], (unsigned long long)target_runs[t]);
+    printf("fuzz: ok, %.2fs\n", (double)(t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9);
+    arena_destroy(&arena);
+    vart_destroy(&vars);
+    return 0;
+}
+
+#endif // FUZZ_LIBFUZZER
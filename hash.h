@@ -0,0 +1,47 @@
+// hash.h
+#ifndef HASH_H
+#define HASH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+//  Define a 64-bit FNV-1a hash for fast, well-distributed string hashing.
+//  Shared by the variable table (var.c) and the command hash (path.c).
+//  Inline for performance; static so each translation unit gets its own copy.
+static inline uint64_t fnv1a64(const char *s) {
+    //  Initialize with the FNV-1a offset basis constant for 64-bit.
+    uint64_t h = 1469598103934665603ull; // FNV offset basis
+    //  Iterate over each byte in the NUL-terminated string.
+    for (; *s; ++s) {
+        //  XOR the current byte into the hash; cast to unsigned to avoid sign-extension.
+        h ^= (unsigned char)*s;          // XOR byte into hash
+        //  Multiply by the 64-bit FNV prime to diffuse bits.
+        h *= 1099511628211ull;           // FNV prime
+    }
+    //  Return the final 64-bit hash value.
+    return h;
+}
+
+//  Same hash over exactly n bytes (the string need not be NUL-terminated).
+static inline uint64_t fnv1a64n(const char *s, size_t n) {
+    uint64_t h = 1469598103934665603ull;
+    for (size_t i = 0; i < n; ++i) {
+        h ^= (unsigned char)s[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+//  Same hash of a NUL-terminated string, also measuring it in the same pass.
+static inline uint64_t fnv1a64_len(const char *s, size_t *len) {
+    const char *p = s;
+    uint64_t h = 1469598103934665603ull;
+    for (; *p; ++p) {
+        h ^= (unsigned char)*p;
+        h *= 1099511628211ull;
+    }
+    *len = (size_t)(p - s);
+    return h;
+}
+
+#endif // HASH_H
@@ -0,0 +1,169 @@
+// histindex.c
+#define _GNU_SOURCE // memmem()
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "histindex.h"
+#include "debug.h"
+
+// One trigram's posting list: entry ids relative to HistIndex.base, ascending
+typedef struct {
+    uint32_t key;       // trigram + 1; 0 marks an empty bucket
+    uint32_t len, cap;
+    uint32_t *ids;
+} Posting;
+
+struct HistIndex {
+    Posting *tab;       // open addressing, linear probing
+    size_t mask;        // buckets - 1 (power of two)
+    size_t used;
+    uint64_t base;      // id that ids[] values are relative to
+};
+
+static uint32_t trigram(const char *s) {
+    const unsigned char *u = (const unsigned char *)s;
+    return ((uint32_t)u[0] << 16 | (uint32_t)u[1] << 8 | u[2]) + 1;
+}
+
+static size_t bucket_of(const HistIndex *ix, uint32_t key) {
+    return (size_t)((key * 2654435761u) >> 8) & ix->mask;
+}
+
+static Posting *lookup(const HistIndex *ix, uint32_t key) {
+    for (size_t b = bucket_of(ix, key);; b = (b + 1) & ix->mask) {
+        Posting *p = &ix->tab[b];
+        if (p->key == key) return p;
+        if (p->key == 0) return NULL;
+    }
+}
+
+static bool grow_table(HistIndex *ix) {
+    size_t nb = (ix->mask + 1) * 2;
+    Posting *nt = calloc(nb, sizeof(Posting));
+    if (!nt) return false;
+    Posting *old = ix->tab;
+    size_t oldn = ix->mask + 1;
+    ix->tab = nt;
+    ix->mask = nb - 1;
+    for (size_t i = 0; i < oldn; ++i) {
+        if (!old[i].key) continue;
+        size_t b = bucket_of(ix, old[i].key);
+        while (nt[b].key) b = (b + 1) & ix->mask;
+        nt[b] = old[i];
+    }
+    free(old);
+    return true;
+}
+
+static Posting *lookup_or_insert(HistIndex *ix, uint32_t key) {
+    if ((ix->used + 1) * 2 > ix->mask + 1 && !grow_table(ix)) return NULL;
+    size_t b = bucket_of(ix, key);
+    while (ix->tab[b].key && ix->tab[b].key != key) b = (b + 1) & ix->mask;
+    Posting *p = &ix->tab[b];
+    if (!p->key) {
+        p->key = key;
+        ix->used++;
+    }
+    return p;
+}
+
+static void index_entry(HistIndex *ix, const HistEntry *e) {
+    if (!e->line) return;
+    uint32_t rel = (uint32_t)(e->id - ix->base);
+    size_t n = strlen(e->line);
+    for (size_t i = 0; i + 3 <= n; ++i) {
+        Posting *p = lookup_or_insert(ix, trigram(e->line + i));
+        if (!p) return;
+        if (p->len && p->ids[p->len - 1] == rel) continue; // trigram repeats in this line
+        if (p->len == p->cap) {
+            uint32_t ncap = p->cap ? p->cap * 2 : 4;
+            uint32_t *ni = realloc(p->ids, ncap * sizeof(uint32_t));
+            if (!ni) return;
+            p->ids = ni;
+            p->cap = ncap;
+        }
+        p->ids[p->len++] = rel;
+    }
+}
+
+void histindex_free(HistIndex *ix) {
+    if (!ix) return;
+    for (size_t i = 0; i <= ix->mask; ++i) free(ix->tab[i].ids);
+    free(ix->tab);
+    free(ix);
+}
+
+static HistIndex *build(const History *h) {
+    HistIndex *ix = calloc(1, sizeof(*ix));
+    if (!ix) return NULL;
+    ix->mask = 4096 - 1;
+    ix->tab = calloc(ix->mask + 1, sizeof(Posting));
+    if (!ix->tab) {
+        free(ix);
+        return NULL;
+    }
+    const HistEntry *first = get_history(h, 0);
+    ix->base = first ? first->id : h->next_id;
+    for (size_t i = 0; i < history_count(h); ++i) index_entry(ix, get_history(h, i));
+    LOG(LOG_LEVEL_INFO, "history index: %zu entries, %zu trigrams", history_count(h), ix->used);
+    return ix;
+}
+
+// Index present and not mostly made of dropped entries; NULL if it can't be built
+static HistIndex *current_index(History *h) {
+    const HistEntry *first = get_history(h, 0);
+    if (h->index && first && first->id - h->index->base > history_count(h)) {
+        histindex_free(h->index); // dead postings outnumber live ones
+        h->index = NULL;
+    }
+    if (!h->index) h->index = build(h);
+    return h->index;
+}
+
+void histindex_add(History *h, const HistEntry *e) {
+    if (h->index) index_entry(current_index(h), e);
+}
+
+static bool matches(const char *line, const char *q, size_t qlen, int flags) {
+    if (!line) return false;
+    if (flags & HSEARCH_PREFIX) return strncmp(line, q, qlen) == 0;
+    return qlen == 0 || memmem(line, strlen(line), q, qlen) != NULL;
+}
+
+size_t history_find(History *h, const char *query, int flags,
+                    size_t before, size_t *out, size_t max_out) {
+    size_t count = history_count(h);
+    size_t qlen = strlen(query);
+    size_t found = 0;
+    if (before > count) before = count;
+    if (!max_out || !before) return 0;
+
+    HistIndex *ix = (qlen >= 3) ? current_index(h) : NULL;
+    if (!ix) {
+        // Short query (or no memory for the index): a reverse scan
+        for (size_t i = before; i-- > 0 && found < max_out;)
+            if (matches(get_history(h, i)->line, query, qlen, flags)) out[found++] = i;
+        return found;
+    }
+
+    // Candidates come from the query's rarest trigram; a missing one means no match
+    const Posting *best = NULL;
+    for (size_t i = 0; i + 3 <= qlen; ++i) {
+        const Posting *p = lookup(ix, trigram(query + i));
+        if (!p) return 0;
+        if (!best || p->len < best->len) best = p;
+    }
+
+    uint64_t first_id = get_history(h, 0)->id;
+    for (size_t k = best->len; k-- > 0 && found < max_out;) {
+        uint64_t id = ix->base + best->ids[k];
+        if (id < first_id) break;          // the rest were dropped from the ring
+        size_t idx = (size_t)(id - first_id);
+        if (idx >= before) continue;
+        const HistEntry *e = get_history(h, idx);
+        if (e->id != id) continue;         // ids not contiguous: never index a stranger
+        if (matches(e->line, query, qlen, flags)) out[found++] = idx;
+    }
+    return found;
+}
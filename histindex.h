@@ -0,0 +1,28 @@
+#ifndef HISTINDEX_H
+#define HISTINDEX_H
+
+#include <stddef.h>
+#include "history.h"
+
+/* Trigram index over a History, for the Ctrl-R search and `history search`.
+ * Every 3-byte substring of a line maps to the ids of the entries holding
+ * it, so a query only verifies the entries on its rarest trigram's list.
+ * Built on the first search, then kept current by history_add(); postings
+ * for entries the ring has dropped are skipped, and the index is rebuilt
+ * once they outnumber the live ones. Queries shorter than three bytes scan. */
+
+enum HistSearchFlags {
+    HSEARCH_PREFIX = 1 << 0  // match only at the start of the line
+};
+
+// Entries containing query (or starting with it), newest first, among the
+// logical indices [0, before). Up to max_out indices are written to out;
+// returns how many.
+size_t history_find(History *h, const char *query, int flags,
+                    size_t before, size_t *out, size_t max_out);
+
+// history.c hooks
+void histindex_add(History *h, const HistEntry *e);
+void histindex_free(HistIndex *ix);
+
+#endif // HISTINDEX_H
@@ -1,9 +1,12 @@
 // Enable POSIX APIs like getline(), strdup(), etc. by setting feature macros
-#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE // memrchr(); also implies _POSIX_C_SOURCE 200809L
 
 // Local project headers
 #include "history.h"  // Declares History, HistEntry, and related API
+#include "histindex.h" // Search index kept in step with adds
 #include "debug.h"    // Declares LOG() macro and log levels
+#include "trace.h"
+#include "redirect.h"   // move_fd_high()
 
 // Standard library headers
 #include <stdlib.h>   // malloc(), realloc(), free(), size_t, NULL
@@ -11,9 +14,13 @@
 #include <errno.h>    // errno constants (EINVAL, ENOENT, etc.)
 #include <ctype.h>    // isspace()
 #include <stdio.h>    // FILE I/O (fopen, fprintf, etc.)
+#include <fcntl.h>    // open(), O_APPEND
+#include <unistd.h>   // write(), close()
+#include <sys/file.h> // flock()
+#include <sys/mman.h> // mmap()
+#include <sys/stat.h> // fstat(), stat()
 
-// This would pull in GNU readline history support if used
-//#include <readline/history.h>
+// Readline keeps no copy of its own: input.c searches and walks History directly
 
 #pragma region small_helpers
 // strdup() clone: duplicates a string with malloc.
@@ -55,49 +62,161 @@ size_t history_count(const History *h) {
     return h ? h->len : 0;
 }
 
+/* Storage
+ * Entries live in a ring: logical index i is slot (head + i) mod cap, so
+ * dropping the oldest entry at capacity is one slot advance, not a memmove.
+ * Their strings come from a pool of large chunks, allocated and released in
+ * the same oldest-first order, so a chunk goes back once its last line does. */
+#define HIST_CHUNK_SIZE (64 * 1024)
+
+struct HistChunk {
+    struct HistChunk *next;  // newer chunk
+    size_t used, cap;        // bytes handed out / available in data
+    size_t live;             // strings still in use
+    char data[];
+};
+
+static HistEntry *slot(const History *h, size_t idx) {
+    size_t k = h->head + idx;
+    if (k >= h->cap) k -= h->cap;
+    return &h->v[k];
+}
+
 // Retrieve pointer to entry at given index; NULL if out-of-bounds.
 const HistEntry* get_history(const History *h, size_t idx) {
     if (!h || idx >= h->len) return NULL;
-    return &h->v[idx];  // Direct pointer into h->v array
+    return slot(h, idx);  // 0 = oldest
 }
 
-// Ensure capacity for 'need' entries; grow exponentially if necessary.
+// Ensure capacity for 'need' entries, never beyond what max requires.
+// Growing re-linearizes the ring (head back to 0); this only happens while
+// the history is filling up, so it is amortized O(1) per entry.
 // Returns 0 on success, -1 on allocation failure.
 static int check_cap(History *h, size_t need) {
-    LOG(LOG_LEVEL_INFO, "checking need");
     if (need <= h->cap) return 0;        // Already enough capacity
 
     // Start with double capacity, or 128 if starting from zero
     size_t new_cap = h->cap ? h->cap * 2 : 128;
     while (new_cap < need)               // Keep doubling until large enough
         new_cap *= 2;
+    if (new_cap > h->max && need <= h->max) new_cap = h->max; // the ring never needs more
 
-    // Reallocate underlying array to new_cap entries
-    HistEntry *nv = (HistEntry*)xreallocarray(h->v, new_cap, sizeof(HistEntry));
+    HistEntry *nv = (HistEntry*)xreallocarray(NULL, new_cap, sizeof(HistEntry));
     if (!nv) return -1;                   // Allocation failed
+    for (size_t i = 0; i < h->len; ++i)
+        nv[i] = *slot(h, i);
+    free(h->v);
     h->v = nv;
     h->cap = new_cap;
+    h->head = 0;
     return 0;
 }
 
+// Bump-allocate n bytes for a line from the newest chunk.
+static char *pool_alloc(History *h, size_t n) {
+    HistChunk *c = h->pool_tail;
+    if (!c || c->cap - c->used < n) {
+        if (h->pool_spare && h->pool_spare->cap >= n) {
+            c = h->pool_spare;           // Recycle the chunk kept back below
+            h->pool_spare = NULL;
+        } else {
+            size_t cap = n > HIST_CHUNK_SIZE ? n : HIST_CHUNK_SIZE; // long lines get their own
+            c = (HistChunk*)malloc(sizeof(HistChunk) + cap);
+            if (!c) return NULL;
+            c->cap = cap;
+        }
+        c->used = c->live = 0;
+        c->next = NULL;
+        if (h->pool_tail) h->pool_tail->next = c;
+        else              h->pool_head = c;
+        h->pool_tail = c;
+    }
+    char *p = c->data + c->used;
+    c->used += n;
+    c->live++;
+    return p;
+}
+
+// Give back the most recent pool_alloc() (a line that was then ignored).
+static void pool_unalloc(History *h, size_t n) {
+    HistChunk *c = h->pool_tail;
+    c->used -= n;
+    c->live--;
+}
+
+// Release one line. Lines die oldest-first, so the owner is almost always
+// the first chunk; an emptied chunk is unlinked and kept as the spare.
+static void pool_release(History *h, const char *p) {
+    HistChunk *prev = NULL;
+    for (HistChunk *c = h->pool_head; c; prev = c, c = c->next) {
+        if (p < c->data || p >= c->data + c->used) continue;
+        if (--c->live > 0) return;
+        if (c == h->pool_tail) {
+            c->used = 0;                  // Newest chunk: just start it over
+            return;
+        }
+        if (prev) prev->next = c->next;
+        else      h->pool_head = c->next;
+        if (!h->pool_spare && c->cap == HIST_CHUNK_SIZE) h->pool_spare = c;
+        else                                            free(c);
+        return;
+    }
+}
+
+static char *pool_strndup(History *h, const char *s, size_t n) {
+    char *p = pool_alloc(h, n + 1);
+    if (!p) return NULL;
+    memcpy(p, s, n);
+    p[n] = '\0';
+    return p;
+}
+
 // Free dynamic fields inside a HistEntry and zero the struct.
 // Does not free the HistEntry pointer itself (caller controls array).
-static void free_entry(HistEntry *e) {
+static void free_entry(History *h, HistEntry *e) {
     if (!e) return;
-    free(e->line);                        // Release string
+    if (e->line) pool_release(h, e->line); // Release string
     memset(e, 0, sizeof(*e));             // Zero all fields (id, status, etc.)
 }
 
+// Drop the oldest entry: O(1), the ring just moves on.
+static void drop_oldest(History *h) {
+    free_entry(h, slot(h, 0));
+    h->head = (h->head + 1 == h->cap) ? 0 : h->head + 1;
+    h->len--;
+}
+
+// Append e as the newest entry, dropping the oldest one if at max.
+static int push_entry(History *h, const HistEntry *e) {
+    if (h->len >= h->max && h->len) drop_oldest(h);
+    if (check_cap(h, h->len + 1) != 0) return -1;
+    *slot(h, h->len) = *e;
+    h->len++;
+    return 0;
+}
+
+static void flush_pending(History *h); // append mode, below
+
 // Free entire history: all entries, storage array, and path string.
 void history_dispose(History *h) {
     if (!h) return;
-    for (size_t i = 0; i < h->len; ++i)
-        free_entry(&h->v[i]);              // Clean entry payloads
-    free(h->v);                            // Release array block
+    if (h->flags & HISTORY_APPEND) flush_pending(h);
+    free(h->v);                            // Release ring (strings die with the pool)
     h->v = NULL;
-    h->len = h->cap = 0;
+    h->len = h->cap = h->head = 0;
+    while (h->pool_head) {                 // Release string pool
+        HistChunk *next = h->pool_head->next;
+        free(h->pool_head);
+        h->pool_head = next;
+    }
+    free(h->pool_spare);
+    h->pool_tail = h->pool_spare = NULL;
+    histindex_free(h->index);              // Release search index
+    h->index = NULL;
     free(h->path);                         // Release saved path
     h->path = NULL;
+    if (h->fd >= 0) close(h->fd);          // Append-mode file
+    h->fd = -1;
     h->next_id = 1;                        // Reset ID counter
 }
 
@@ -108,6 +227,7 @@ int history_init(History *h, const char *path, size_t max_entries, int flags) {
     h->max = max_entries ? max_entries : 1000; // Default = 1000 entries
     h->flags = flags;
     h->next_id = 1;
+    h->fd = -1;                            // Opened by the first append
     if (path) {
         h->path = xstrdup(path);           // Duplicate for owned storage
         if (!h->path) return -1;           // Propagate allocation failure
@@ -115,24 +235,16 @@ int history_init(History *h, const char *path, size_t max_entries, int flags) {
     return 0;
 }
 
-// Write escaped version of s to FILE*: escape backslash, tab, newline.
-// Ensures save file can be parsed back unambiguously.
-static void fescape(FILE *f, const char *s) {
-    for (; *s; ++s) {
-        unsigned char c = (unsigned char)*s;
-        if (c == '\\')       { fputs("\\\\", f); } // Literal backslash
-        else if (c == '\t')  { fputs("\\t",  f); } // Literal tab
-        else if (c == '\n')  { fputs("\\n",  f); } // Literal newline
-        else                 { fputc(c, f);       } // Pass through
-    }
-}
-
-// Decode escape sequences from storage form to actual chars.
-// Allocates a new buffer; caller must free.
-static char *unescape(const char *s) {
-    size_t n = strlen(s);
-    char *out = (char*)malloc(n + 1);     // Worst case: no escapes → same length
+// Decode escape sequences in s[0..n) from storage form to actual chars.
+// The result is allocated from h's string pool.
+static char *unescape_n(History *h, const char *s, size_t n) {
+    char *out = pool_alloc(h, n + 1);     // Worst case: no escapes → same length
     if (!out) return NULL;
+    if (!memchr(s, '\\', n)) {            // Common case: nothing to decode
+        memcpy(out, s, n);
+        out[n] = '\0';
+        return out;
+    }
     size_t j = 0;
     for (size_t i = 0; i < n; ++i) {
         if (s[i] == '\\' && i + 1 < n) {  // Found escape marker
@@ -148,10 +260,49 @@ static char *unescape(const char *s) {
     return out;
 }
 
+/* Format one record into a malloc'd buffer, so append mode can hand it to a
+ * single write(2):
+ *     epoch\tstatus\tcommand\n
+ *     epoch\tstatus,wall_us,user_us,sys_us,maxrss_kb\tcommand\n   (timed)
+ * A reader that predates timing parses the status with strtol() and stops at
+ * the first comma, so both forms stay readable by both versions. */
+#define RECORD_HEAD_MAX 128
+
+static char *format_record(const HistEntry *e, size_t *out_len) {
+    const char *s = e->line ? e->line : "";
+    size_t n = strlen(s);
+    char *buf = (char*)malloc(2 * n + RECORD_HEAD_MAX);  // every byte may need an escape
+    if (!buf) return NULL;
+    int head;
+    if (e->timed) {
+        head = snprintf(buf, RECORD_HEAD_MAX, "%ld\t%d,%llu,%llu,%llu,%ld\t", (long)e->when, e->status,
+                        (unsigned long long)e->usage.wall_us, (unsigned long long)e->usage.user_us,
+                        (unsigned long long)e->usage.sys_us, e->usage.maxrss_kb);
+    } else {
+        head = snprintf(buf, RECORD_HEAD_MAX, "%ld\t%d\t", (long)e->when, e->status);
+    }
+    size_t j = (size_t)head;
+    for (size_t i = 0; i < n; ++i) {
+        char c = s[i];
+        if      (c == '\\') { buf[j++] = '\\'; buf[j++] = '\\'; }
+        else if (c == '\t') { buf[j++] = '\\'; buf[j++] = 't'; }
+        else if (c == '\n') { buf[j++] = '\\'; buf[j++] = 'n'; }
+        else                  buf[j++] = c;
+    }
+    buf[j++] = '\n';
+    *out_len = j;
+    return buf;
+}
+
 // Save history entries to disk, writing to <path>.tmp then renaming.
-// Enforces max entry limit before writing.
-int history_save(const History *h) {
+// Enforces max entry limit before writing. In append mode every entry is
+// already on disk, so this only compacts the file if it has grown too long.
+int history_save(History *h) {
     if (!h || !h->path) { errno = EINVAL; return -1; }
+    if (h->flags & HISTORY_APPEND) {
+        flush_pending(h);
+        return (h->file_lines > h->max) ? history_compact(h) : 0;
+    }
     char tmppath[4096];
     snprintf(tmppath, sizeof(tmppath), "%s.tmp", h->path);
     FILE *f = fopen(tmppath, "w");
@@ -160,101 +311,271 @@ int history_save(const History *h) {
     // Determine slice start to fit max constraint
     size_t start = (h->len > h->max) ? (h->len - h->max) : 0;
     for (size_t i = start; i < h->len; ++i) {
-        const HistEntry *e = &h->v[i];
-        // epoch\tstatus\tcommand\n
-        fprintf(f, "%ld\t%d\t", (long)e->when, e->status);
-        fescape(f, e->line ? e->line : "");
-        fputc('\n', f);
+        size_t len = 0;
+        char *rec = format_record(slot(h, i), &len);
+        if (!rec) { fclose(f); remove(tmppath); return -1; }
+        fwrite(rec, 1, len, f);
+        free(rec);
     }
     if (fclose(f) != 0) { remove(tmppath); return -1; }
     if (rename(tmppath, h->path) != 0) { remove(tmppath); return -1; }
     return 0;
 }
 
-// Load history file from disk into memory, parsing escapes and enforcing max.
-int history_load(History *h) {
-    if (!h || !h->path) { errno = EINVAL; return -1; }
-    FILE *f = fopen(h->path, "r");
-    if (!f) return (errno == ENOENT) ? 0 : -1;
-
-    char *line = NULL;
-    size_t cap = 0;
-
-    // ssize_t is used by getline() for the length read (including newline if present).
-    ssize_t n;
-
-    // Read file line-by-line until EOF.
-    while ((n = getline(&line, &cap, f)) != -1) {
-        // Strip a single trailing '\n' added by getline(), if present.
-        if (n && (line[n-1] == '\n')) line[n-1] = '\0';
+/* A read-only view of the history file. mmap means load and compaction only
+ * touch the pages holding the tail they need, however long the file is. */
+typedef struct {
+    const char *data;
+    size_t size;
+} FileMap;
+
+static int map_file(int fd, FileMap *m) {
+    struct stat st;
+    m->data = NULL;
+    m->size = 0;
+    if (fstat(fd, &st) != 0) return -1;
+    if (st.st_size == 0) return 0;
+    void *p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED) return -1;
+    m->data = (const char*)p;
+    m->size = (size_t)st.st_size;
+    return 0;
+}
 
-        // Parse the expected format: "<epoch>\t<status>\t<cmd>"
-        char *p = line;
+static void unmap_file(FileMap *m) {
+    if (m->data) munmap((void*)m->data, m->size);
+    m->data = NULL;
+}
 
-        // Find first tab separating <epoch> and <status>.
-        char *tab1 = strchr(p, '\t');
-        if (!tab1) continue;   // Malformed line: skip without failing the load
-        *tab1 = '\0';          // Terminate <epoch> field
+// Offset of the first of the last `want` lines. *found gets the number of
+// lines from there to the end (fewer than want if the file is shorter).
+static size_t tail_start(const FileMap *m, size_t want, size_t *found) {
+    size_t end = m->size;
+    size_t n = 0;
+    if (end && m->data[end - 1] == '\n') end--;  // final newline ends the last line
+    while (end > 0) {
+        const char *nl = memrchr(m->data, '\n', end);
+        if (!nl) break;
+        n++;                                     // the line after nl
+        if (n == want) {
+            *found = n;
+            return (size_t)(nl - m->data) + 1;
+        }
+        end = (size_t)(nl - m->data);
+    }
+    *found = m->size ? n + 1 : 0;                // plus the first line
+    return 0;
+}
 
-        // Find second tab separating <status> and <cmd>.
-        char *tab2 = strchr(tab1 + 1, '\t');
-        if (!tab2) continue;   // Malformed line: skip
-        *tab2 = '\0';          // Terminate <status> field
+// Parse "<epoch>\t<status>\t<cmd>" in line[0..n). Malformed lines return 1
+// (skip), allocation failure -1.
+static int parse_record(History *h, const char *line, size_t n, HistEntry *e) {
+    const char *tab1 = memchr(line, '\t', n);
+    if (!tab1) return 1;
+    const char *tab2 = memchr(tab1 + 1, '\t', n - (size_t)(tab1 + 1 - line));
+    if (!tab2) return 1;
+
+    // Lenient numeric fields, as before: anything malformed reads as 0
+    long epoch = 0;
+    for (const char *p = line; p < tab1 && *p >= '0' && *p <= '9'; ++p)
+        epoch = epoch * 10 + (*p - '0');
+    const char *p = tab1 + 1;
+    int sign = 1, status = 0;
+    if (p < tab2 && *p == '-') { sign = -1; p++; }
+    for (; p < tab2 && *p >= '0' && *p <= '9'; ++p)
+        status = status * 10 + (*p - '0');
+
+    // Optional ",wall,user,sys,maxrss" after the status
+    uint64_t fields[4] = {0};
+    int nfields = 0;
+    while (p < tab2 && *p == ',' && nfields < 4) {
+        uint64_t v = 0;
+        for (++p; p < tab2 && *p >= '0' && *p <= '9'; ++p)
+            v = v * 10 + (uint64_t)(*p - '0');
+        fields[nfields++] = v;
+    }
+    if (nfields == 4) {
+        e->timed = 1;
+        e->usage = (HistUsage){ fields[0], fields[1], fields[2], (long)fields[3] };
+    }
 
-        // Convert epoch (base 10). Error handling is lenient: malformed → 0.
-        long epoch = strtol(p, NULL, 10);
+    char *cmd = unescape_n(h, tab2 + 1, n - (size_t)(tab2 + 1 - line));
+    if (!cmd) return -1;
+    e->when = (time_t)epoch;
+    e->status = sign * status;
+    e->line = cmd;
+    return 0;
+}
 
-        // Convert status (base 10). Likewise lenient conversion.
-        int status = (int)strtol(tab1 + 1, NULL, 10);
+// Load history file from disk into memory: only the last h->max records are
+// parsed; everything before them is never read.
+int history_load(History *h) {
+    if (!h || !h->path) { errno = EINVAL; return -1; }
+    int fd = open(h->path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return (errno == ENOENT) ? 0 : -1;
+
+    FileMap m;
+    int rc = map_file(fd, &m);
+    close(fd);
+    if (rc != 0) return -1;
+
+    size_t found = 0;
+    size_t pos = tail_start(&m, h->max, &found);
+    // Count a little past max so append mode knows how overdue compaction is
+    size_t total = found;
+    if (pos > 0) {
+        size_t more = 0;
+        tail_start(&m, h->max + h->max / 2 + 1, &more);
+        total = more;
+    }
+    h->file_lines = total;
 
-        // Unescape command payload; returns freshly malloc'd string.
-        char *cmd_unesc = unescape(tab2 + 1);
-        if (!cmd_unesc) {
-            // Allocation failure: clean up and abort the load.
-            free(line);
-            fclose(f);
+    size_t want = h->len + found < h->max ? h->len + found : h->max;
+    if (check_cap(h, want) != 0) {
+        unmap_file(&m);
+        return -1;
+    }
+    while (pos < m.size) {
+        const char *line = m.data + pos;
+        const char *nl = memchr(line, '\n', m.size - pos);
+        size_t n = nl ? (size_t)(nl - line) : m.size - pos;
+        pos += n + 1;
+
+        HistEntry e = {0};
+        int pr = parse_record(h, line, n, &e);
+        if (pr < 0) {
+            unmap_file(&m);
             return -1;
         }
-
-        // Ensure we have capacity for a new entry; on failure, abort cleanly.
-        if (check_cap(h, h->len + 1) != 0) {
-            free(cmd_unesc);
-            free(line);
-            fclose(f);
+        if (pr > 0) continue;   // Malformed line: skip without failing the load
+        e.id = h->next_id;     // Assign monotonically increasing ID
+        if (push_entry(h, &e) != 0) {
+            pool_release(h, e.line);
+            unmap_file(&m);
             return -1;
         }
-
-        // Append a new entry at the end of the array.
-        HistEntry *e = &h->v[h->len++];
-        e->id = h->next_id++;         // Assign monotonically increasing ID
-        e->when = (time_t)epoch;      // Restore timestamp
-        e->status = status;           // Restore status
-        e->line = cmd_unesc;          // Take ownership of unescaped command buffer
+        h->next_id++;
+        histindex_add(h, slot(h, h->len - 1));
     }
+    unmap_file(&m);
 
-    // getline()-managed buffer: free once after loop.
-    free(line);
+    return 0;
+}
 
-    // Close the file regardless of parse results; errors already handled above.
-    fclose(f);
+// Open (or re-open after another shell compacted the file) the append fd,
+// and take the file lock. Returns the fd, or -1.
+static int lock_append_fd(History *h) {
+    for (int tries = 0; tries < 4; ++tries) {
+        if (h->fd < 0) {
+            h->fd = open(h->path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+            if (h->fd < 0) return -1;
+            h->fd = move_fd_high(h->fd); // kept open: out of redirections' way
+        }
+        if (flock(h->fd, LOCK_EX) != 0) return -1;
+
+        // Compaction renames a new file into place: if the path no longer
+        // names our inode, writes would go to the orphaned file
+        struct stat fst, pst;
+        if (fstat(h->fd, &fst) == 0 && stat(h->path, &pst) == 0 &&
+            fst.st_dev == pst.st_dev && fst.st_ino == pst.st_ino)
+            return h->fd;
+        flock(h->fd, LOCK_UN);
+        close(h->fd);
+        h->fd = -1;
+    }
+    errno = EAGAIN;
+    return -1;
+}
 
-    // Enforce maximum capacity post-load by dropping oldest entries if needed.
-    if (h->len > h->max) {
-        size_t drop = h->len - h->max;  // Number of oldest entries to remove
+// Append one record with a single O_APPEND write, under the file lock so
+// concurrent shells never interleave or lose records to a compaction.
+static int append_record(History *h, const HistEntry *e) {
+    size_t len = 0;
+    char *rec = format_record(e, &len);
+    if (!rec) return -1;
+
+    int fd = lock_append_fd(h);
+    if (fd < 0) {
+        free(rec);
+        return -1;
+    }
+    ssize_t w;
+    do {
+        w = write(fd, rec, len);
+    } while (w < 0 && errno == EINTR);
+    flock(fd, LOCK_UN);
+    free(rec);
+    if (w != (ssize_t)len) return -1;
+
+    h->file_lines++;
+    // Let the file run to 1.5x max before paying for a rewrite
+    if (h->file_lines > h->max + h->max / 2) history_compact(h);
+    return 0;
+}
 
-        // Free dynamic payloads for entries being dropped.
-        for (size_t i = 0; i < drop; ++i)
-            free_entry(&h->v[i]);
+// Entry by id: ids are consecutive in ring order, so this is a subtraction.
+static HistEntry *entry_by_id(const History *h, uint64_t id) {
+    if (h->len == 0) return NULL;
+    HistEntry *first = slot(h, 0);
+    if (id < first->id || id - first->id >= h->len) return NULL;
+    HistEntry *e = slot(h, (size_t)(id - first->id));
+    return (e->id == id) ? e : NULL;
+}
 
-        // Slide the surviving entries down to the start.
-        // memmove is used (not memcpy) due to overlapping regions.
-        memmove(h->v, h->v + drop, (h->len - drop) * sizeof(HistEntry));
+// Append mode writes an entry once its command has finished, so the record
+// carries the status and timing. Anything still held back goes out now.
+static void flush_pending(History *h) {
+    if (!h->pending_id) return;
+    HistEntry *e = entry_by_id(h, h->pending_id);
+    h->pending_id = 0;
+    if (e && h->path && append_record(h, e) != 0)
+        LOG(LOG_LEVEL_WARN, "history append failed: %s", strerror(errno));
+}
 
-        // Update logical length to reflect removed entries.
-        h->len -= drop;
+/* history_compact
+ * Rewrite the file to its last max records (whatever any shell appended),
+ * via <path>.tmp + rename while holding the lock, so appenders either land
+ * before the copy or notice the new inode and re-open. */
+int history_compact(History *h) {
+    if (!h || !h->path) { errno = EINVAL; return -1; }
+    int fd = lock_append_fd(h);
+    if (fd < 0) return -1;
+
+    int rc = -1;
+    int rfd = open(h->path, O_RDONLY | O_CLOEXEC);
+    FileMap m = {0};
+    if (rfd >= 0 && map_file(rfd, &m) == 0) {
+        size_t found = 0;
+        size_t pos = tail_start(&m, h->max, &found);
+        char tmppath[4096];
+        snprintf(tmppath, sizeof(tmppath), "%s.tmp", h->path);
+        int tfd = open(tmppath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (tfd >= 0) {
+            size_t off = pos;
+            while (off < m.size) {
+                ssize_t w = write(tfd, m.data + off, m.size - off);
+                if (w < 0 && errno == EINTR) continue;
+                if (w <= 0) break;
+                off += (size_t)w;
+            }
+            if (off == m.size && close(tfd) == 0 && rename(tmppath, h->path) == 0) {
+                h->file_lines = found;
+                rc = 0;
+            } else {
+                if (off != m.size) close(tfd);
+                remove(tmppath);
+            }
+        }
+        unmap_file(&m);
     }
-
-    return 0;
+    if (rfd >= 0) close(rfd);
+
+    flock(fd, LOCK_UN);
+    // Our fd still names the old inode; the next append re-opens the path
+    close(h->fd);
+    h->fd = -1;
+    LOG(LOG_LEVEL_INFO, "history compacted to %zu lines (rc=%d)", h->file_lines, rc);
+    return rc;
 }
 
 // Adjust maximum entries immediately, dropping oldest items if over the limit.
@@ -266,21 +587,9 @@ int history_stifle(History *h, size_t max_entries) {
     // Update maximum if a new nonzero limit is provided; otherwise leave unchanged.
     h->max = max_entries ? max_entries : h->max;
 
-    // Already within limit: nothing to do.
-    if (h->len <= h->max) return 0;
-
-    // Determine how many oldest entries must be dropped.
-    size_t drop = h->len - h->max;
-
-    // Free payloads for the entries that will be removed from the front.
-    for (size_t i = 0; i < drop; ++i)
-        free_entry(&h->v[i]);
-
-    // Shift remaining entries to the front of the array (handles overlap safely).
-    memmove(h->v, h->v + drop, (h->len - drop) * sizeof(HistEntry));
-
-    // Shrink logical length.
-    h->len -= drop;
+    // Drop the oldest entries past the limit: each is one ring advance.
+    while (h->len > h->max)
+        drop_oldest(h);
 
     return 0;
 }
@@ -314,7 +623,7 @@ static int should_ignore(const History *h, const char *line) {
             h->len, line ? line : "<null>");
         if (h->len) {
             // Compare against previous entry's line
-            const char *prev = h->v[h->len - 1].line;
+            const char *prev = slot(h, h->len - 1)->line;
             LOG(LOG_LEVEL_INFO, "[dupchk] prev=\"%s\" new=\"%s\"\n",
                 prev ? prev : "<null>",
                 line ? line : "<null>");
@@ -326,51 +635,52 @@ static int should_ignore(const History *h, const char *line) {
 }
 
 // Add a new history entry from a given line.
-// Returns a HistoryAddResult struct with id and readline sync info.
+// Returns a HistoryAddResult struct with the new entry's id (0 if not added).
 HistoryAddResult history_add(History *h, const char *line) {
     LOG(LOG_LEVEL_INFO, "adding %s", line);
     HistoryAddResult res = {0, 0};          // Default return: id=0, added_to_readline=0
     if (!h || !line) { errno = EINVAL; return res; }
 
-    // Make a working copy so we can trim or modify before storing
-    char *work = xstrdup(line);
-    LOG(LOG_LEVEL_INFO, "duping %s", line);
+    flush_pending(h); // the previous command never reported back
+
+    // Copy into the pool first so trimming needs no scratch buffer; an
+    // ignored line is simply handed back
+    size_t n = strlen(line);
+    char *work = pool_strndup(h, line, n);
     if (!work) return res;                  // malloc failure → return empty result
 
     // Optionally trim trailing spaces/tabs/newlines
     if (h->flags & HISTORY_TRIM_TRAILING)
         rtrim_spaces(work);
-    LOG(LOG_LEVEL_INFO, "trimming %s", line);
 
     // Apply all ignore rules to the (possibly trimmed) copy
     if (should_ignore(h, work)) {
-        free(work);
+        pool_unalloc(h, n + 1);
         return res;
     }
 
-    // Ensure there’s capacity for one more entry
-    if (check_cap(h, h->len + 1) != 0) {
-        free(work);
+    // Newest entry; at max the oldest is dropped in O(1)
+    HistEntry ne = {
+        .id = h->next_id,                   // Unique ID; consumed only once stored
+        .when = time(NULL),                 // Timestamp = now
+        .status = -1,                       // Default/unknown status
+        .line = work,                       // Owned by the pool
+    };
+    if (push_entry(h, &ne) != 0) {
+        pool_unalloc(h, n + 1);
         return res;                         // Allocation failure
     }
+    h->next_id++;
+    HistEntry *e = slot(h, h->len - 1);
+    histindex_add(h, e);                    // No-op until the first search
 
-    // Populate the new HistEntry struct at end of array
-    HistEntry *e = &h->v[h->len++];
-    e->id = h->next_id++;                   // Assign unique ID and increment counter
-    e->when = time(NULL);                   // Timestamp = now
-    e->status = -1;                         // Default/unknown status
-    e->line = work;                         // Take ownership of strdup'd buffer
-
-    // Mirror into GNU readline’s in-memory history (if linked)
-    extern void add_history(const char *);  // Declared here to avoid header dep
-    add_history(e->line);
+    // Append mode: written (and visible to other shells) when the command
+    // finishes; see history_set_usage_by_id()
+    if (h->flags & HISTORY_APPEND) h->pending_id = e->id;
 
     // Fill out result info for caller
     res.id = e->id;
-    res.added_to_readline = 1;
-
-    // Enforce maximum entry limit immediately (drop oldest if needed)
-    history_stifle(h, h->max);
+    TRACE(TR_HIST_ADD, e->id, n);
 
     LOG(LOG_LEVEL_INFO, "returning result");
     return res;
@@ -380,22 +690,34 @@ HistoryAddResult history_add(History *h, const char *line) {
 // Returns 0 on success, -1 if not found.
 int history_set_status_by_id(History *h, uint64_t id, int status) {
     if (!h || id == 0) { errno = EINVAL; return -1; }
-    // Reverse iteration: if multiple share ID (shouldn't happen), hit latest first.
-    for (size_t i = h->len; i-- > 0; ) {
-        if (h->v[i].id == id) {
-            h->v[i].status = status;
-            return 0;
-        }
+    HistEntry *e = entry_by_id(h, id);
+    if (!e) {
+        errno = ENOENT; // No such entry
+        return -1;
     }
-    errno = ENOENT; // No such entry
-    return -1;
+    e->status = status;
+    if (h->pending_id == id) flush_pending(h);
+    return 0;
 }
 
 // Set status of the most recent history entry.
 int history_set_status_last(History *h, int status) {
     if (!h || h->len == 0) { errno = EINVAL; return -1; }
-    h->v[h->len - 1].status = status;
-    return 0;
+    return history_set_status_by_id(h, slot(h, h->len - 1)->id, status);
+}
+
+// Record how the command behind entry id finished. In append mode this is
+// what writes its record.
+int history_set_usage_by_id(History *h, uint64_t id, int status, const HistUsage *u) {
+    if (!h || id == 0 || !u) { errno = EINVAL; return -1; }
+    HistEntry *e = entry_by_id(h, id);
+    if (!e) {
+        errno = ENOENT;
+        return -1;
+    }
+    e->usage = *u;
+    e->timed = 1;
+    return history_set_status_by_id(h, id, status);
 }
 
 // Derive a default path for the history file based on environment variables.
@@ -9,33 +9,55 @@
 extern "C" {
 #endif
 
+// What a command line cost: wall clock for the whole line, and the rusage
+// that wait4() reported for the children it waited for.
+typedef struct HistUsage {
+    uint64_t wall_us;   // Wall-clock time
+    uint64_t user_us;   // Children's user CPU
+    uint64_t sys_us;    // Children's system CPU
+    long     maxrss_kb; // Largest child resident set
+} HistUsage;
+
 typedef struct HistEntry {
-    uint64_t id;        // Monotonic per-session id (not persisted as index)
+    uint64_t id;        // Monotonic per-session id (not persisted as index); consecutive in ring order
     time_t   when;      // Time added
     int      status;    // Exit status (or -1 if unknown)
-    char    *line;      // Command string (heap-owned)
+    char    *line;      // Command string (owned by the History's string pool)
+    HistUsage usage;    // Valid when timed
+    int      timed;     // usage was recorded (history_set_usage_by_id)
 } HistEntry;
 
+typedef struct HistChunk HistChunk; // string pool block (history.c)
+typedef struct HistIndex HistIndex; // search index (histindex.c)
+
 typedef struct History {
-    HistEntry *v;       // Dynamic array
+    HistEntry *v;       // Ring buffer of cap slots; see get_history()
+    size_t     head;    // Slot of the oldest entry
     size_t     len;     // Used length
-    size_t     cap;     // Capacity
+    size_t     cap;     // Capacity (grows up to max)
     size_t     max;     // Max entries (cap and on-disk cap)
     uint64_t   next_id; // Next id to assign
     int        flags;   // Behavior flags
     char      *path;    // Persist file path (heap-owned)
+    int        fd;      // HISTORY_APPEND: O_APPEND fd, -1 until first add
+    uint64_t   pending_id; // HISTORY_APPEND: entry whose record waits for its status
+    size_t     file_lines; // Records believed to be in the file (drives compaction)
+    HistChunk *pool_head, *pool_tail; // String pool, oldest to newest chunk
+    HistChunk *pool_spare;            // One emptied chunk kept for reuse
+    HistIndex *index;   // Trigram index, built by the first history_find()
 } History;
 
 enum HistoryFlags {
     HISTORY_IGNORE_EMPTY   = 1 << 0, // ignore empty/whitespace-only
     HISTORY_IGNORE_SPACE   = 1 << 1, // ignore commands starting with space
     HISTORY_IGNORE_DUPS    = 1 << 2, // ignore consecutive duplicates
-    HISTORY_TRIM_TRAILING  = 1 << 3  // trim trailing spaces
+    HISTORY_TRIM_TRAILING  = 1 << 3, // trim trailing spaces
+    HISTORY_APPEND         = 1 << 4  // write each entry to the file once its command finishes (shared by concurrent shells)
 };
 
 typedef struct HistoryAddResult {
     uint64_t id;  // 0 if not added due to filtering
-    int      added_to_readline; // boolean
+    int      added_to_readline; // always 0: readline no longer keeps a copy (see input.c)
 } HistoryAddResult;
 
 // Initialization and lifecycle
@@ -43,17 +65,19 @@ int  history_init(History *h, const char *path, size_t max_entries, int flags);
 void history_dispose(History *h); // frees all allocations
 
 // Persistence (our format)
-int  history_load(History *h);           // load from h->path (no readline side-effects)
-int  history_save(const History *h);     // save to h->path (atomic)
+int  history_load(History *h);           // load the last max records of h->path (no readline side-effects)
+int  history_save(History *h);           // save to h->path (atomic); append mode: compact if due
+int  history_compact(History *h);        // rewrite h->path to its last max records
 
 // Add / update
 HistoryAddResult history_add(History *h, const char *line); // adds now, status unknown
 int  history_set_status_by_id(History *h, uint64_t id, int status);
 int  history_set_status_last(History *h, int status);
+int  history_set_usage_by_id(History *h, uint64_t id, int status, const HistUsage *u);
 
 // Query
 size_t          history_count(const History *h);
-const HistEntry*get_history(const History *h, size_t idx); // 0..len-1
+const HistEntry*get_history(const History *h, size_t idx); // 0..len-1, oldest first
 
 // Utilities
 int  history_stifle(History *h, size_t max_entries); // trims if needed
@@ -9,8 +9,11 @@
 #include <readline/readline.h> 
 #include <readline/history.h> 
 #include "input.h" // 
+#include "lexer.h"
 #include "executor.h"
-#include <unistd.h> // for getcwd
+#include "builtins.h"
+#include "jobs.h"
+#include "histindex.h"
 #include "debug.h"
 
 /*BASIC ANSI CODES FOR COLOR
@@ -24,8 +27,131 @@ UNCOMMENT IF USING
 
 /*Initialize readline library. This function sets up readline for input handling
  It can be used to enable features like command history and line editing */
+// Called by readline while it waits for keys: collect exited background
+// jobs so they don't sit as zombies until the next line is entered.
+static int reap_while_idle(void) {
+    jobs_reap();
+    return 0;
+}
+
 void initialize_readline(void) {
     rl_bind_key('\t', rl_complete); // optional: enable tab completion
+    rl_event_hook = reap_while_idle;
+}
+
+/* ---- History keys ------------------------------------------------------
+ * Readline keeps no history list of its own: Up/Down and Ctrl-R work on the
+ * shell's History directly, searching through its trigram index. */
+
+static History *bound_history = NULL;
+static size_t nav_pos;          // entry shown by Up/Down; == count on the line being typed
+static char *nav_saved = NULL;  // that line, kept while browsing
+
+static void show_line(const char *line) {
+    rl_replace_line(line ? line : "", 0);
+    rl_point = rl_end;
+}
+
+static int hist_prev(int count, int key) {
+    (void)key;
+    size_t n = history_count(bound_history);
+    if (nav_pos > n) nav_pos = n;
+    if (count < 1) count = 1;
+    if (nav_pos == 0) return rl_ding();
+    if (nav_pos == n) {
+        free(nav_saved);
+        nav_saved = strdup(rl_line_buffer);
+    }
+    nav_pos = (nav_pos > (size_t)count) ? nav_pos - (size_t)count : 0;
+    show_line(get_history(bound_history, nav_pos)->line);
+    return 0;
+}
+
+static int hist_next(int count, int key) {
+    (void)key;
+    size_t n = history_count(bound_history);
+    if (count < 1) count = 1;
+    if (nav_pos >= n) return rl_ding();
+    nav_pos += (size_t)count;
+    if (nav_pos >= n) {
+        nav_pos = n;
+        show_line(nav_saved);
+    } else {
+        show_line(get_history(bound_history, nav_pos)->line);
+    }
+    return 0;
+}
+
+/* hist_isearch (Ctrl-R)
+ * Incremental reverse search: typing narrows, Ctrl-R again steps to the next
+ * older match, Enter runs the match, Ctrl-G restores the line, and any other
+ * key leaves the match in place for editing and is then handled normally. */
+static int hist_isearch(int count, int key) {
+    (void)count; (void)key;
+    char query[256] = "";
+    size_t qlen = 0;
+    size_t n = history_count(bound_history);
+    size_t match = n;           // n: nothing found yet
+    bool failed = false;
+    char *orig = strdup(rl_line_buffer);
+
+    rl_save_prompt();
+    for (;;) {
+        rl_message("(%sreverse-i-search)`%s': ", failed ? "failed " : "", query);
+        rl_redisplay();
+
+        int c = rl_read_key();
+        size_t before;
+        if (c == CTRL('R')) {
+            before = match;                        // strictly older than the current match
+        } else if (c == RUBOUT || c == CTRL('H')) {
+            if (qlen) query[--qlen] = '\0';
+            before = n;                            // shorter query: start over from the newest
+        } else if (c >= ' ' && c < RUBOUT && qlen + 1 < sizeof(query)) {
+            query[qlen++] = (char)c;
+            query[qlen] = '\0';
+            before = (match < n) ? match + 1 : n;  // the current match may still fit
+        } else {
+            rl_restore_prompt();
+            rl_clear_message();
+            if (c == CTRL('G')) {
+                show_line(orig);
+            } else if (c == '\r' || c == '\n') {
+                rl_done = 1;                       // run it
+            } else {
+                rl_execute_next(c);
+            }
+            break;
+        }
+
+        size_t hit;
+        if (history_find(bound_history, query, 0, before, &hit, 1) == 1) {
+            match = hit;
+            failed = false;
+            const char *line = get_history(bound_history, hit)->line;
+            show_line(line);
+            const char *at = strstr(line, query);
+            if (at) rl_point = (int)(at - line);
+        } else {
+            failed = true;
+            rl_ding();
+        }
+    }
+    if (match < n) nav_pos = match;
+    free(orig);
+    return 0;
+}
+
+void input_attach_history(History *h) {
+    bound_history = h;
+    nav_pos = history_count(h);
+    rl_bind_key(CTRL('R'), hist_isearch);
+    rl_bind_key(CTRL('P'), hist_prev);
+    rl_bind_key(CTRL('N'), hist_next);
+    rl_bind_keyseq("\\e[A", hist_prev); // arrow keys, normal and application mode
+    rl_bind_keyseq("\\e[B", hist_next);
+    rl_bind_keyseq("\\eOA", hist_prev);
+    rl_bind_keyseq("\\eOB", hist_next);
 }
 
 /* This function can be used to free any resources allocated by readline. It is called at the end of the shell session to ensure no memory leaks
@@ -62,37 +188,42 @@ void free_buffer(char **buf) {
     }
 }
 
+// Complete = no open quote and no trailing backslash. Same rules the parser
+// uses, because it is the same lexer run in status-only mode (no allocation).
 bool is_command_complete(const char *cmd) {
-    bool in_single = false, in_double = false, escaped = false;
-    for (const char *p = cmd; *p; p++) {
-        if (escaped) { escaped = false; continue; }
-        if (*p == '\\') { escaped = true; continue; }
-        if (*p == '\'' && !in_double) in_single = !in_single;
-        else if (*p == '"' && !in_single) in_double = !in_double;
-    }
-    return !in_single && !in_double;
+    return !lex_incomplete(lex_input(cmd, NULL, NULL));
 }
 
 
 
 
+#define PROMPT_FMT "\001\033[38;2;186;114;4m\002THRASH)\001\033[0m\002 \001\033[38;2;43;;214m\002%s\001\033[0m\002: "
+#define PROMPT_CONTINUATION "🔪 THRASH wants closure 🔪 "
+
+// The prompt for ctx->cwd, rendered once per directory (shell_cwd_changed()
+// drops it) instead of once per line
+static const char *main_prompt(ShellContext *ctx) {
+    if (ctx->prompt) return ctx->prompt;
+    const char *cwd = ctx->cwd ? ctx->cwd : "";
+    int n = snprintf(NULL, 0, PROMPT_FMT, cwd);
+    if (n < 0 || !(ctx->prompt = malloc((size_t)n + 1))) return "THRASH) ";
+    snprintf(ctx->prompt, (size_t)n + 1, PROMPT_FMT, cwd);
+    return ctx->prompt;
+}
+
 int read_input(ShellContext *ctx, bool continuation) {
-    getcwd(ctx->cwd, sizeof(ctx->cwd)); // update cwd for prompt
-    char prompt[512];
+    const char *prompt = continuation ? PROMPT_CONTINUATION : main_prompt(ctx);
 
-    if (continuation) {
-        snprintf(prompt, sizeof(prompt),
-                 "🔪 THRASH wants closure 🔪 ");
-    } else {
-        snprintf(prompt, sizeof(prompt), "\001\033[38;2;186;114;4m\002THRASH)\001\033[0m\002 \001\033[38;2;43;;214m\002%.450s\001\033[0m\002: ", ctx->cwd);
-    }
+    // A fresh line: Up starts again from the newest entry
+    if (bound_history) nav_pos = history_count(bound_history);
+    free(nav_saved);
+    nav_saved = NULL;
 
     char *line = readline(prompt);
     if (!line) return 0; // Ctrl+D / EOF
 
-    strncpy(ctx->input, line, sizeof(ctx->input) - 1);
-    ctx->input[sizeof(ctx->input) - 1] = '\0';
-    free(line);
+    free(ctx->input);
+    ctx->input = line; // keep readline's buffer: no copy, no length limit
     return 1;
 }
 
@@ -120,119 +251,50 @@ bool handle_literal_expansion(ShellContext *shell, Command *cmd) {
 
     LOG(LOG_LEVEL_INFO, "Intercepted numeric literal: '%s'", cmd->argv[0]);
 
-    // Optional: rewrite argv to echo the literal
+    // Echo the literal through the echo builtin: in-process, no fork
     char *args[] = { "echo", cmd->argv[0], NULL };
-    cmd->argv = args;
-    cmd->argc = 2;
-    cmd->is_builtin = true;  // if echo is handled as a builtin
-
-    Command *cmds[] = { cmd };
-    launch_commands(shell, cmds, 1);
+    Command echo_cmd = { .argv = args, .argc = 2, .is_builtin = true };
+    shell->last_status = run_builtin(shell, find_builtin("echo"), &echo_cmd, stdout);
 
     return true;
 }
 
 
 
-// Note: whitespace trimming deferred to parse_commands()
-// This function only handles quote-aware semicolon splitting
-char **split_on_semicolons(const char *input) {
-    if (!input) return NULL; // Defensive: null input yields null output
-
-    size_t len = strlen(input);
-    if (len == 0) return NULL; // Empty input yields null output
+// Quote-aware splitting on ';' and newlines, driven by the lexer's TOK_SEP
+// tokens. Each segment is the source text from its first to its last token
+// (comments and surrounding blanks dropped). With an arena the segments live
+// there (nothing to free); with NULL release them with free_segments().
+char **split_on_semicolons(const char *input, Arena *arena) {
+    if (!input || !*input) return NULL;
 
-    // Make a modifiable copy of the input string — we will insert NULs here
-    char *copy = strdup(input);
-    if (!copy) return NULL;
+    TokenList tl;
+    if (lex_input(input, arena, &tl) == LEX_NOMEM) return NULL;
 
-    // Allocate space for output segments (+1 for NULL terminator)
-    // Worst case: every character is a delimiter, so len+1 segments
-    char **segments = calloc(len + 2, sizeof(char *));
+    char **segments = arena_calloc(arena, tl.count + 1, sizeof(char *));
     if (!segments) {
-        free(copy);
+        token_list_free(&tl, arena);
         return NULL;
     }
 
     int seg_count = 0;
-    char *start = copy; // Marks the beginning of the current segment
-    char *p = copy;     // Current scan position
-    char quote = '\0';  // Quote state: '\0' means unquoted, otherwise holds quote char
-    int escape = 0;     // Escape state: 1 means next char is literal
-
-    while (*p) {
-        if (escape) {
-            /*
-             * Previous char was a backslash, so this char is taken literally.
-             * This bypasses quote toggling and delimiter checks.
-             */
-            escape = 0; // Reset escape after consuming one char
-            ++p;
-            continue;
-        }
-
-        if (*p == '\\') {
-            /*
-             * Found a backslash — set escape so the next char is treated literally.
-             * Do not include '\' itself in any special logic.
-             */
-            escape = 1;
-            // Optionally: memmove(p, p+1, strlen(p)); to strip '\' from output
-            ++p;
-            continue;
-        }
-
-        if (*p == '\'' || *p == '"') {
-            /*
-             * Quote handling:
-             * - If unquoted, enter quoted mode using this char as the delimiter.
-             * - If already quoted with the same char, close quote.
-             * Inside quotes, delimiters like ';' are ignored.
-             */
-            if (quote == '\0') {
-                quote = *p; // Enter quoted mode
-            } else if (quote == *p) {
-                quote = '\0'; // Exit quoted mode
-            }
-            ++p;
-            continue;
-        }
-
-        if (((*p == ';') || (*p == '\n')) && (quote == '\0')) {
-            /*
-             * We found a delimiter (semicolon or newline) while NOT in quotes
-             * and NOT escaped (escape is always 0 here because that branch returns early).
-             */
-            if (p > start && *(p - 1) == '\r') {
-                *(p - 1) = '\0'; // Trim carriage return from CRLF endings
-            }
-            *p = '\0'; // Terminate the current segment string
-
-            if (*start) {
-                // Only store non-empty segments
-                segments[seg_count++] = strdup(start);
-                LOG(LOG_LEVEL_INFO,
-                    "[split] segment[%d]: '%s'\n",
-                    seg_count - 1,
-                    segments[seg_count - 1]);
+    size_t first = 0;
+    while (first < tl.count) {
+        size_t last = first;
+        while (last < tl.count && tl.tok[last].type != TOK_SEP) last++;
+        if (last > first) {
+            size_t start = tl.tok[first].start;
+            size_t end = tl.tok[last - 1].start + tl.tok[last - 1].len;
+            segments[seg_count] = arena_strndup(arena, input + start, end - start);
+            if (segments[seg_count]) {
+                LOG(LOG_LEVEL_INFO, "[split] segment[%d]: '%s'", seg_count, segments[seg_count]);
+                seg_count++;
             }
-
-            start = p + 1; // New segment starts after the delimiter
-            ++p;
-            continue;
         }
-
-        // Default: just advance to next character
-        ++p;
-    }
-
-    // After loop ends, handle the final segment (if non-empty)
-    if (*start) {
-        segments[seg_count++] = strdup(start);
+        first = last + 1;
     }
-
     segments[seg_count] = NULL; // NULL-terminate the array
 
-    free(copy);
+    token_list_free(&tl, arena);
     return segments;
-}
\ No newline at end of file
+}
@@ -4,18 +4,21 @@
 #include "shell.h" // for ShellContext
 #include <stdbool.h>
 #include "redirect.h"
+#include "arena.h"
 
 int read_input(ShellContext *ctx, bool continuation); 
 
 void initialize_readline(void);
 
+void input_attach_history(History *h); // Up/Down/Ctrl-R over h (no readline copy)
+
 void cleanup_readline(void);
 
 bool is_numeric(const char *s);
 
 bool handle_literal_expansion(ShellContext *shell, Command *cmd);
 
-char **split_on_semicolons(const char *input);
+char **split_on_semicolons(const char *input, Arena *arena);
 
 void append_to_buffer(char **buf, const char *chunk);
 
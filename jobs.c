@@ -1,27 +1,528 @@
 // jobs.c
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/wait.h>
 #include "jobs.h"
+#include "signals.h"
+#include "debug.h"
+#include "trace.h"
+#include "stats.h"
+#include "var.h"
 
-typedef struct {
-    int id;
-    pid_t pgid;
-    char *cmdline;
-    int status; // 0 = running, 1 = stopped
-} Job;
+/* Jobs in creation order: the last one is %+, the one before it %-.
+ * Lookups are linear; a shell juggles tens of jobs, not thousands. */
+static Job **job_table = NULL;
+static size_t njobs = 0, jobs_cap = 0;
+static unsigned options; // JOBOPT_*
 
-static Job job_table[64];
-static int job_count = 0;
+/* Stages of background jobs dropped by jobs_forget_done() unwaited, so that
+ * `wait $!` still finds the status. The newest DONE_PIDS are kept. */
+#define DONE_PIDS 256
+static struct { pid_t pid; int status; } done_pids[DONE_PIDS];
+static size_t ndone_pids; // ever recorded; next slot is ndone_pids % DONE_PIDS
 
-void add_job(pid_t pgid, const char *cmdline) {
-    if (job_count >= 64) return;
-    job_table[job_count].id = job_count + 1;
-    job_table[job_count].pgid = pgid;
-    job_table[job_count].cmdline = strdup(cmdline);
-    job_table[job_count].status = 1;
-    job_count++;
+unsigned jobs_options(void) {
+    return options;
 }
 
-int next_job_id(void) {
-    return job_count + 1;
+void jobs_set_options(unsigned opts) {
+    options = opts;
+}
+
+Job *job_create(const char *cmdline, bool background, size_t nstages) {
+    if (njobs == jobs_cap) {
+        size_t ncap = jobs_cap ? jobs_cap * 2 : 16;
+        Job **nt = realloc(job_table, ncap * sizeof(*nt));
+        if (!nt) return NULL;
+        job_table = nt;
+        jobs_cap = ncap;
+    }
+
+    Job *job = calloc(1, sizeof(*job));
+    if (!job) return NULL;
+    job->cmdline = strdup(cmdline ? cmdline : "");
+    job->cap = nstages ? nstages : 1;
+    job->procs = calloc(job->cap, sizeof(JobProc));
+    if (!job->cmdline || !job->procs) {
+        free(job->cmdline);
+        free(job->procs);
+        free(job);
+        return NULL;
+    }
+    job->id = njobs ? job_table[njobs - 1]->id + 1 : 1;
+    job->background = background;
+    clock_gettime(CLOCK_MONOTONIC, &job->started);
+    job_table[njobs++] = job;
+    return job;
+}
+
+// Room for every stage was reserved by job_create(), so this cannot fail
+// after a fork has already happened. A name that can't be copied is left out.
+void job_add_proc(Job *job, pid_t pid, const char *name) {
+    if (job->nprocs == job->cap) return;
+    job->procs[job->nprocs++] = (JobProc){ .pid = pid, .name = name ? strdup(name) : NULL };
+    job->running++;
+    if (job->pgid == 0) job->pgid = pid;
+}
+
+static void cut_rest(Job *job, const JobProc *failed);
+
+// A failing stage that never forked cuts the rest under failfast like one
+// that was reaped; stages not started yet are left to job_add_cut()
+void job_add_finished(Job *job, const char *name, int exit_code) {
+    if (job->nprocs == job->cap) return;
+    JobProc *p = &job->procs[job->nprocs++];
+    *p = (JobProc){ .exit_code = exit_code, .done = true, .name = name ? strdup(name) : NULL };
+    clock_gettime(CLOCK_MONOTONIC, &p->ended);
+    if (exit_code && (options & JOBOPT_FAILFAST)) cut_rest(job, p);
+}
+
+void job_add_cut(Job *job, const char *name) {
+    job_add_finished(job, name, 128 + SIGPIPE);
+    if (job->nprocs) job->procs[job->nprocs - 1].cut = true;
+}
+
+static void report_time(FILE *out, const Job *job);
+
+void job_remove(Job *job) {
+    if (job->nprocs && job_state(job) == JOB_DONE) {
+        TRACE(TR_JOB_DONE, job->id, job_status(job));
+        if (job->time_format) report_time(stderr, job);
+    }
+    for (size_t i = 0; i < njobs; ++i) {
+        if (job_table[i] != job) continue;
+        memmove(&job_table[i], &job_table[i + 1], (njobs - i - 1) * sizeof(*job_table));
+        njobs--;
+        break;
+    }
+    for (size_t i = 0; i < job->nprocs; ++i) free(job->procs[i].name);
+    free(job->cmdline);
+    free(job->procs);
+    free(job);
+}
+
+JobState job_state(const Job *job) {
+    if (job->running) return JOB_RUNNING;
+    for (size_t i = 0; i < job->nprocs; ++i)
+        if (!job->procs[i].done) return JOB_STOPPED;
+    return JOB_DONE;
+}
+
+/* A stage failfast cut short doesn't count as failing: under pipefail the
+ * stage that failed first is found instead, and a cut last stage reports
+ * that stage's status. */
+int job_status(const Job *job) {
+    for (size_t i = 0; i < job->nprocs; ++i) {
+        const JobProc *p = &job->procs[i];
+        if (!p->done && p->stopped) return 128 + p->stop_sig;
+    }
+    if (!job->nprocs) return 0;
+    if (options & JOBOPT_PIPEFAIL) {
+        for (size_t i = job->nprocs; i-- > 0;) {
+            const JobProc *p = &job->procs[i];
+            if (!p->cut && p->exit_code) return p->exit_code;
+        }
+        return 0;
+    }
+    const JobProc *last = &job->procs[job->nprocs - 1];
+    return last->cut ? job->cut_status : last->exit_code;
+}
+
+// Space-separated, as $PARALLEL_STATUS; a stopped stage shows 128+sig
+void job_set_pipestatus(ShellContext *shell, const Job *job) {
+    char small[128], *buf = small;
+    size_t cap = job->nprocs * 12 + 1, len = 0;
+    if (cap > sizeof(small) && !(buf = malloc(cap))) return;
+    buf[0] = '\0';
+    for (size_t i = 0; i < job->nprocs; ++i) {
+        const JobProc *p = &job->procs[i];
+        int code = (!p->done && p->stopped) ? 128 + p->stop_sig : p->exit_code;
+        len += (size_t)snprintf(buf + len, cap - len, "%s%d", i ? " " : "", code);
+    }
+    vart_set(shell->vars, "PIPESTATUS", buf, 0);
+    if (buf != small) free(buf);
+}
+
+Job *job_current(void) {
+    return njobs ? job_table[njobs - 1] : NULL;
+}
+
+size_t job_count(void) {
+    return njobs;
+}
+
+Job *job_at(size_t i) {
+    return i < njobs ? job_table[i] : NULL;
+}
+
+Job *job_find_spec(const char *spec) {
+    if (!spec || strcmp(spec, "%%") == 0 || strcmp(spec, "%+") == 0 || strcmp(spec, "%") == 0)
+        return job_current();
+    if (strcmp(spec, "%-") == 0)
+        return njobs > 1 ? job_table[njobs - 2] : NULL;
+
+    const char *num = (spec[0] == '%') ? spec + 1 : spec;
+    char *end = NULL;
+    long id = strtol(num, &end, 10);
+    if (!*num || *end) return NULL;
+    for (size_t i = 0; i < njobs; ++i)
+        if (job_table[i]->id == id) return job_table[i];
+    return NULL;
+}
+
+static JobProc *find_proc(pid_t pid, Job **owner) {
+    // Newest first: the job being waited on in the foreground is usually last
+    for (size_t i = njobs; i-- > 0;) {
+        Job *job = job_table[i];
+        for (size_t k = 0; k < job->nprocs; ++k) {
+            if (job->procs[k].pid == pid) {
+                if (owner) *owner = job;
+                return &job->procs[k];
+            }
+        }
+    }
+    return NULL;
+}
+
+Job *job_by_pid(pid_t pid) {
+    Job *job = NULL;
+    return find_proc(pid, &job) ? job : NULL;
+}
+
+static uint64_t tv_us(struct timeval tv) {
+    return (uint64_t)tv.tv_sec * 1000000u + (uint64_t)tv.tv_usec;
+}
+
+void job_usage(const Job *job, HistUsage *u) {
+    for (size_t i = 0; i < job->nprocs; ++i) {
+        const JobProc *p = &job->procs[i];
+        u->user_us += p->user_us;
+        u->sys_us += p->sys_us;
+        if (p->maxrss_kb > u->maxrss_kb) u->maxrss_kb = p->maxrss_kb;
+    }
+}
+
+// failfast: failed is done and failed; SIGPIPE for every stage still running,
+// as if it had written to (or read from) a pipe that went away. Stages the
+// launcher hasn't reached yet (failed is a builtin) count: it skips them.
+static void cut_rest(Job *job, const JobProc *failed) {
+    if (failed == &job->procs[job->cap - 1] || failed->exit_code == 128 + SIGPIPE) return;
+    bool any = job->nprocs < job->cap;
+    for (size_t i = 0; i < job->nprocs; ++i) {
+        JobProc *p = &job->procs[i];
+        if (p->pid <= 0 || p->done) continue;
+        p->cut = true;
+        kill(p->pid, SIGPIPE);
+        any = true;
+    }
+    if (any && !job->cut_status) {
+        job->cut_status = failed->exit_code;
+        LOG(LOG_LEVEL_INFO, "job %d: pid %d failed with %d, cutting the rest", job->id,
+            (int)failed->pid, failed->exit_code);
+    }
+}
+
+void jobs_record(pid_t pid, int wstatus, const struct rusage *ru) {
+    TRACE(TR_REAP, pid, wstatus);
+    Job *job = NULL;
+    JobProc *p = find_proc(pid, &job);
+    if (!p) {
+        LOG(LOG_LEVEL_WARN, "reaped pid %d that belongs to no job", (int)pid);
+        return;
+    }
+
+    bool was_running = !p->done && !p->stopped;
+    if (WIFSTOPPED(wstatus)) {
+        p->stopped = true;
+        p->stop_sig = WSTOPSIG(wstatus);
+    } else if (WIFCONTINUED(wstatus)) {
+        p->stopped = false;
+    } else {
+        p->done = true;
+        p->stopped = false;
+        clock_gettime(CLOCK_MONOTONIC, &p->ended);
+        p->exit_code = WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : 128 + WTERMSIG(wstatus);
+        if (ru) {
+            p->user_us = tv_us(ru->ru_utime);
+            p->sys_us = tv_us(ru->ru_stime);
+            p->maxrss_kb = ru->ru_maxrss; // kilobytes on Linux
+        }
+    }
+    bool now_running = !p->done && !p->stopped;
+    if (was_running != now_running) {
+        if (now_running) job->running++;
+        else             job->running--;
+    }
+    if (p->done && p->exit_code && (options & JOBOPT_FAILFAST)) cut_rest(job, p);
+    job->notified = false;
+    LOG(LOG_LEVEL_INFO, "job %d: pid %d status 0x%x", job->id, (int)pid, wstatus);
+}
+
+/* jobs_reap
+ * Collect whatever has changed state since the last call. The SIGCHLD
+ * handler only pokes a pipe, so when nothing arrived this is one read(). */
+void jobs_reap(void) {
+    if (!sigchld_consume()) return;
+    for (;;) {
+        int st;
+        struct rusage ru;
+        pid_t pid = wait4(-1, &st, WNOHANG | WUNTRACED | WCONTINUED, &ru);
+        if (pid > 0) {
+            jobs_record(pid, st, &ru);
+            continue;
+        }
+        if (pid < 0 && errno == EINTR) continue;
+        break; // 0: nothing more right now; ECHILD: no children at all
+    }
+}
+
+/* job_wait
+ * Block until every stage of job has exited or stopped. Any child may be
+ * reported meanwhile; background jobs are credited as they finish, so many
+ * jobs can run at once without the shell waiting on them in turn. Each
+ * stage's status is kept where wait4() left it (job->procs), and the
+ * running count makes the loop test O(1). */
+int job_wait(Job *job) {
+    uint64_t t0 = STATS_START();
+    while (job->running) {
+        int st;
+        struct rusage ru;
+        pid_t pid = wait4(-1, &st, WUNTRACED, &ru);
+        if (pid < 0) {
+            if (errno == EINTR) continue;
+            if (errno != ECHILD) perror("wait4");
+            // Nobody left to wait for: whatever is still marked running is
+            // gone, its status lost. Not a success.
+            for (size_t i = 0; i < job->nprocs; ++i) {
+                JobProc *p = &job->procs[i];
+                if (p->done) continue;
+                LOG(LOG_LEVEL_WARN, "job %d: pid %d vanished, status unknown", job->id, (int)p->pid);
+                p->done = true;
+                p->stopped = false;
+                p->exit_code = 1;
+                clock_gettime(CLOCK_MONOTONIC, &p->ended);
+            }
+            job->running = 0;
+            break;
+        }
+        jobs_record(pid, st, &ru);
+    }
+    STATS_STOP(STAT_WAIT, t0);
+    return job_status(job);
+}
+
+void job_continue(ShellContext *shell, Job *job, bool foreground) {
+    job->background = !foreground;
+    job->notified = false;
+    // Without job control the stages share the shell's group: signal each one
+    if (shell->interactive) {
+        if (killpg(job->pgid, SIGCONT) < 0) perror("kill");
+    } else {
+        for (size_t i = 0; i < job->nprocs; ++i)
+            if (job->procs[i].pid > 0 && !job->procs[i].done) kill(job->procs[i].pid, SIGCONT);
+    }
+    job->running = 0;
+    for (size_t i = 0; i < job->nprocs; ++i) {
+        job->procs[i].stopped = false;
+        if (!job->procs[i].done) job->running++;
+    }
+}
+
+/* job_foreground
+ * Hand the terminal to job, wait for it, and take the terminal back. A job
+ * that finishes leaves the table; one that stops stays, as a background job. */
+int job_foreground(ShellContext *shell, Job *job, bool cont) {
+    shell->pipeline_pgid = job->pgid;
+    give_terminal_to_pgid(shell, job->pgid);
+    if (cont) job_continue(shell, job, true);
+    job->background = false;
+
+    int status = job_wait(job);
+
+    reclaim_terminal(shell);
+    shell->last_pgid = job->pgid;
+    shell->pipeline_pgid = 0;
+
+    job_set_pipestatus(shell, job);
+    if (job_state(job) == JOB_STOPPED) {
+        job->background = true;
+        job->notified = true;
+        fprintf(stderr, "\n[%d]+  Stopped  %s\n", job->id, job->cmdline);
+        return status;
+    }
+    job_usage(job, &shell->usage); // charged to the input line (history -v)
+    job_remove(job);
+    return status;
+}
+
+/* ---- time --------------------------------------------------------------- */
+
+static uint64_t since_us(const struct timespec *from, const struct timespec *to) {
+    if (to->tv_sec == 0 && to->tv_nsec == 0) return 0; // never seen finishing
+    int64_t us = (int64_t)(to->tv_sec - from->tv_sec) * 1000000 +
+                 (to->tv_nsec - from->tv_nsec) / 1000;
+    return us > 0 ? (uint64_t)us : 0;
+}
+
+static void json_string(FILE *out, const char *s) {
+    fputc('"', out);
+    for (const unsigned char *p = (const unsigned char *)(s ? s : ""); *p; ++p) {
+        if (*p == '"' || *p == '\\')  fprintf(out, "\\%c", *p);
+        else if (*p < 0x20)          fprintf(out, "\\u%04x", *p);
+        else                         fputc(*p, out);
+    }
+    fputc('"', out);
+}
+
+// bash's "0m0.302s"
+static void print_mins(FILE *out, const char *label, uint64_t us) {
+    fprintf(out, "%s\t%llum%.3fs\n", label, (unsigned long long)(us / 60000000u),
+            (double)(us % 60000000u) / 1e6);
+}
+
+/* report_time
+ * The `time` report for a finished job. Real time runs from job_create() to
+ * the last stage seen exiting; user/sys are the stages' wait4() figures, so
+ * in-process builtins count as zero CPU. Each stage's real time is when it
+ * finished, measured from the pipeline's start. */
+static void report_time(FILE *out, const Job *job) {
+    HistUsage total = {0};
+    job_usage(job, &total);
+    for (size_t i = 0; i < job->nprocs; ++i) {
+        uint64_t r = since_us(&job->started, &job->procs[i].ended);
+        if (r > total.wall_us) total.wall_us = r;
+    }
+
+    if (job->time_format == TIME_POSIX) {
+        fprintf(out, "real %.2f\nuser %.2f\nsys %.2f\n", total.wall_us / 1e6,
+                total.user_us / 1e6, total.sys_us / 1e6);
+    } else if (job->time_format == TIME_JSON) {
+        fprintf(out, "{\"command\":");
+        json_string(out, job->cmdline);
+        fprintf(out, ",\"status\":%d,\"real_us\":%llu,\"user_us\":%llu,\"sys_us\":%llu,"
+                "\"maxrss_kb\":%ld,\"stages\":[", job_status(job),
+                (unsigned long long)total.wall_us, (unsigned long long)total.user_us,
+                (unsigned long long)total.sys_us, total.maxrss_kb);
+        for (size_t i = 0; i < job->nprocs; ++i) {
+            const JobProc *p = &job->procs[i];
+            fprintf(out, "%s{\"name\":", i ? "," : "");
+            json_string(out, p->name);
+            fprintf(out, ",\"pid\":%d,\"status\":%d,\"real_us\":%llu,\"user_us\":%llu,"
+                    "\"sys_us\":%llu,\"maxrss_kb\":%ld}", (int)p->pid, p->exit_code,
+                    (unsigned long long)since_us(&job->started, &p->ended),
+                    (unsigned long long)p->user_us, (unsigned long long)p->sys_us, p->maxrss_kb);
+        }
+        fprintf(out, "]}\n");
+    } else {
+        fputc('\n', out);
+        print_mins(out, "real", total.wall_us);
+        print_mins(out, "user", total.user_us);
+        print_mins(out, "sys", total.sys_us);
+        if (job->nprocs > 1) {
+            fprintf(out, "%5s %8s %6s %9s %9s %9s %9s  %s\n",
+                    "stage", "pid", "status", "real", "user", "sys", "maxrss", "command");
+            for (size_t i = 0; i < job->nprocs; ++i) {
+                const JobProc *p = &job->procs[i];
+                char pid[16];
+                if (p->pid > 0) snprintf(pid, sizeof(pid), "%d", (int)p->pid);
+                else            snprintf(pid, sizeof(pid), "-");
+                fprintf(out, "%5zu %8s %6d %8.3fs %8.3fs %8.3fs %7ldKB  %s\n", i + 1, pid,
+                        p->exit_code, since_us(&job->started, &p->ended) / 1e6,
+                        p->user_us / 1e6, p->sys_us / 1e6, p->maxrss_kb,
+                        p->name ? p->name : "?");
+            }
+        }
+    }
+    fflush(out);
+}
+
+static char job_marker(const Job *job) {
+    if (njobs > 0 && job_table[njobs - 1] == job) return '+';
+    if (njobs > 1 && job_table[njobs - 2] == job) return '-';
+    return ' ';
+}
+
+void jobs_print(FILE *out, const Job *job, bool with_pids) {
+    char state[32];
+    switch (job_state(job)) {
+    case JOB_RUNNING:
+        snprintf(state, sizeof(state), "Running");
+        break;
+    case JOB_STOPPED:
+        snprintf(state, sizeof(state), "Stopped");
+        break;
+    case JOB_DONE:
+    default: {
+        int code = job_status(job);
+        if (code == 0) snprintf(state, sizeof(state), "Done");
+        else           snprintf(state, sizeof(state), "Exit %d", code);
+        break;
+    }
+    }
+
+    fprintf(out, "[%d]%c  ", job->id, job_marker(job));
+    if (with_pids) fprintf(out, "%d ", (int)job->pgid);
+    fprintf(out, "%-24s%s%s\n", state, job->cmdline,
+            job_state(job) == JOB_RUNNING ? " &" : "");
+}
+
+void jobs_notify(FILE *out) {
+    jobs_reap();
+    for (size_t i = 0; i < njobs;) {
+        Job *job = job_table[i];
+        JobState st = job_state(job);
+        if (job->background && !job->notified && st != JOB_RUNNING) {
+            jobs_print(out, job, false);
+            job->notified = true;
+        }
+        if (st == JOB_DONE && job->notified) {
+            job_remove(job); // shifts the rest down: stay on index i
+            continue;
+        }
+        i++;
+    }
+    fflush(out);
+}
+
+/* jobs_forget_done
+ * Without a prompt nobody is told that a background job finished, so
+ * jobs_notify() never drops it; a script starting `cmd &` in a loop would
+ * keep every one. Drop finished background jobs here instead, keeping each
+ * stage's status by pid for wait. */
+void jobs_forget_done(void) {
+    for (size_t i = 0; i < njobs;) {
+        Job *job = job_table[i];
+        if (!job->background || job_state(job) != JOB_DONE) {
+            i++;
+            continue;
+        }
+        for (size_t k = 0; k < job->nprocs; ++k) {
+            if (job->procs[k].pid <= 0) continue;
+            size_t slot = ndone_pids++ % DONE_PIDS;
+            done_pids[slot].pid = job->procs[k].pid;
+            done_pids[slot].status = job->procs[k].exit_code;
+        }
+        job_remove(job); // shifts the rest down: stay on index i
+    }
+}
+
+bool jobs_done_status(pid_t pid, int *status) {
+    size_t n = ndone_pids < DONE_PIDS ? ndone_pids : DONE_PIDS;
+    for (size_t k = 1; k <= n; ++k) { // newest first: pids get reused
+        size_t slot = (ndone_pids - k) % DONE_PIDS;
+        if (done_pids[slot].pid == pid) {
+            *status = done_pids[slot].status;
+            return true;
+        }
+    }
+    return false;
+}
+
+void jobs_destroy(void) {
+    while (njobs) job_remove(job_table[njobs - 1]);
+    free(job_table);
+    job_table = NULL;
+    jobs_cap = 0;
 }
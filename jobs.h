@@ -2,9 +2,95 @@
 #define JOBS_H
 
 #include <sys/types.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "shell.h"
 
-void add_job(pid_t pgid, const char *cmdline);
+/* Job table.
+ * Every pipeline that forks becomes a job, foreground or background, so any
+ * waitpid() result (from the foreground wait or from the SIGCHLD-driven
+ * reaper) can be credited to the job that owns the pid. The table grows on
+ * demand; finished jobs leave it once they have been reported. */
 
-int next_job_id(void);
+typedef enum {
+    JOB_RUNNING,
+    JOB_STOPPED,
+    JOB_DONE
+} JobState;
+
+// `time` prefix report formats (Job.time_format, Command.time_format)
+enum {
+    TIME_NONE = 0,
+    TIME_DEFAULT,      // real/user/sys, plus a per-stage table for pipelines
+    TIME_POSIX,        // time -p: the three POSIX lines only
+    TIME_JSON          // time -j: one JSON object per pipeline
+};
+
+typedef struct {
+    pid_t pid;         // 0: stage that never forked (builtin, failed lookup)
+    char *name;        // argv[0] of the stage, for the `time` breakdown
+    int exit_code;     // shell-style status once done (128+sig if killed)
+    int stop_sig;      // last stopping signal while stopped
+    bool done, stopped;
+    bool cut;          // sent SIGPIPE by failfast after an earlier stage failed
+    uint64_t user_us, sys_us; // from wait4() once done
+    long maxrss_kb;
+    struct timespec ended;    // CLOCK_MONOTONIC when seen done
+} JobProc;
+
+typedef struct {
+    int id;            // %n
+    pid_t pgid;        // process group with job control, else first pid
+    char *cmdline;
+    JobProc *procs;    // one per stage, in pipeline order
+    size_t nprocs, cap;
+    size_t running;    // stages neither done nor stopped
+    int cut_status;    // status of the stage that made failfast cut the rest
+    bool background;
+    bool notified;     // current state already reported to the user
+    struct timespec started; // CLOCK_MONOTONIC at job_create()
+    int time_format;   // TIME_*: reported on stderr when the job finishes
+} Job;
+
+Job *job_create(const char *cmdline, bool background, size_t nstages); // added to the table, id assigned
+void job_add_proc(Job *job, pid_t pid, const char *name);
+void job_add_finished(Job *job, const char *name, int exit_code); // a stage that ran without forking
+void job_add_cut(Job *job, const char *name); // a stage failfast skipped: reads as SIGPIPE
+void job_remove(Job *job); // drop from the table and free; a finished timed job reports first
+
+// Shell options that change how a job's status is made (set -o)
+enum {
+    JOBOPT_PIPEFAIL = 1u << 0, // status: the rightmost stage that failed, 0 if none
+    JOBOPT_FAILFAST = 1u << 1  // a stage but the last failing sends SIGPIPE to the rest
+};
+unsigned jobs_options(void);
+void jobs_set_options(unsigned opts);
+
+JobState job_state(const Job *job);
+int job_status(const Job *job); // last stage's status (see JOBOPT_*); 128+sig while stopped
+void job_set_pipestatus(ShellContext *shell, const Job *job); // $PIPESTATUS: each stage's, in order
+void job_usage(const Job *job, HistUsage *u); // add the stages' CPU, raise maxrss
+
+Job *job_find_spec(const char *spec);  // %n, %%, %+, %-, or a bare n; NULL if none
+Job *job_by_pid(pid_t pid);
+Job *job_current(void);                // most recent job, as %+
+size_t job_count(void);
+Job *job_at(size_t i);                 // creation order, for iteration
+
+void jobs_record(pid_t pid, int wstatus, const struct rusage *ru); // apply one wait4() result
+void jobs_reap(void);                     // collect finished children without blocking
+int job_wait(Job *job);                   // block until job is no longer running; its status
+int job_foreground(ShellContext *shell, Job *job, bool cont); // wait with the terminal, report stops
+void job_continue(ShellContext *shell, Job *job, bool foreground); // SIGCONT a stopped job
+
+void jobs_print(FILE *out, const Job *job, bool with_pids);
+void jobs_notify(FILE *out);              // report and drop finished background jobs
+void jobs_forget_done(void);              // no prompt to report at (scripts): just drop them
+bool jobs_done_status(pid_t pid, int *status); // a stage jobs_forget_done() dropped
+
+void jobs_destroy(void);
 
 #endif
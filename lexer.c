@@ -0,0 +1,279 @@
+// lexer.c
+/* The one place that knows shell quoting. Each byte of the input is looked at
+ * once; words come out already dequoted and split into parts by quote context
+ * so expansion can happen later, per segment, without rescanning the line. */
+
+#include <stdlib.h>
+#include <string.h>
+#include "lexer.h"
+#include "debug.h"
+
+typedef struct {
+    Arena *arena;
+    TokenList *out;       // NULL: status-only scan
+    size_t tok_cap, part_cap;
+    size_t blen;          // bytes used in out->text
+
+    // current word
+    bool in_word;
+    bool io_digits;       // word so far is bare digits (candidate for "2>")
+    size_t word_start;    // source offset
+    size_t word_text;     // out->text offset where the word began
+    size_t first_part;
+    bool quoted, has_dollar;
+
+    // current part of the word
+    bool in_part;
+    WordPartKind pkind;
+    size_t pstart;        // out->text offset
+} Lexer;
+
+static bool push_token(Lexer *L, TokType type, size_t start, size_t len, int io) {
+    TokenList *o = L->out;
+    if (!o) return true;
+    if (o->count == L->tok_cap) {
+        size_t ncap = L->tok_cap ? L->tok_cap * 2 : 16;
+        Token *nt = arena_realloc(L->arena, o->tok, L->tok_cap * sizeof(Token), ncap * sizeof(Token));
+        if (!nt) return false;
+        o->tok = nt;
+        L->tok_cap = ncap;
+    }
+    o->tok[o->count++] = (Token){ .type = type, .start = start, .len = len, .io_number = io };
+    return true;
+}
+
+static bool part_end(Lexer *L) {
+    if (!L->in_part) return true;
+    L->in_part = false;
+    TokenList *o = L->out;
+    if (o->nparts == L->part_cap) {
+        size_t ncap = L->part_cap ? L->part_cap * 2 : 16;
+        WordPart *np = arena_realloc(L->arena, o->parts, L->part_cap * sizeof(WordPart), ncap * sizeof(WordPart));
+        if (!np) return false;
+        o->parts = np;
+        L->part_cap = ncap;
+    }
+    size_t len = L->blen - L->pstart;
+    o->text[L->blen++] = '\0';
+    o->parts[o->nparts++] = (WordPart){ L->pkind, o->text + L->pstart, len };
+    return true;
+}
+
+static void word_begin(Lexer *L, size_t pos) {
+    if (L->in_word) return;
+    L->in_word = true;
+    L->io_digits = true;
+    L->word_start = pos;
+    L->word_text = L->blen;
+    L->first_part = L->out ? L->out->nparts : 0;
+    L->quoted = L->has_dollar = false;
+}
+
+static bool emit(Lexer *L, WordPartKind kind, char c) {
+    if (!L->out) return true;
+    if (L->in_part && L->pkind != kind && !part_end(L)) return false;
+    if (!L->in_part) {
+        L->in_part = true;
+        L->pkind = kind;
+        L->pstart = L->blen;
+    }
+    L->out->text[L->blen++] = c;
+    if (c == '$' && kind != WP_LIT) L->has_dollar = true;
+    return true;
+}
+
+static bool word_end(Lexer *L, size_t pos) {
+    if (!L->in_word) return true;
+    L->in_word = false;
+    if (!L->out) return true;
+    if (!part_end(L)) return false;
+    if (!push_token(L, TOK_WORD, L->word_start, pos - L->word_start, -1)) return false;
+    Token *t = &L->out->tok[L->out->count - 1];
+    t->quoted = L->quoted;
+    t->has_dollar = L->has_dollar;
+    t->first_part = L->first_part;
+    t->nparts = L->out->nparts - L->first_part;
+    return true;
+}
+
+// "2>": the digits typed so far were an fd number, not a word. Forget them.
+static int take_io_number(Lexer *L, const char *src, size_t pos) {
+    int fd = 0;
+    for (size_t k = L->word_start; k < pos; ++k) {
+        fd = fd * 10 + (src[k] - '0');
+        if (fd > 9999) return -1; // far beyond any sane fd; treat as a word
+    }
+    L->in_word = false;
+    L->in_part = false;
+    if (L->out) {
+        L->out->nparts = L->first_part;
+        L->blen = L->word_text;
+    }
+    return fd;
+}
+
+LexStatus lex_input(const char *src, Arena *arena, TokenList *out) {
+    Lexer L = { .arena = arena, .out = out };
+    LexStatus status = LEX_OK;
+    char quote = '\0';
+    size_t i = 0;
+
+    if (!src) src = "";
+    if (out) {
+        *out = (TokenList){ .src = src };
+        size_t n = strlen(src);
+        // Dequoting never grows text; each part adds one NUL at most per input byte
+        out->text = arena_alloc(arena, 2 * n + 2);
+        if (!out->text) return LEX_NOMEM;
+    }
+
+#define EMIT(kind, ch) do { if (!emit(&L, (kind), (ch))) goto nomem; } while (0)
+#define END_WORD()     do { if (!word_end(&L, i)) goto nomem; } while (0)
+
+    while (src[i]) {
+        char c = src[i];
+
+        if (quote == '\'') {
+            if (c == '\'') quote = '\0';
+            else EMIT(WP_LIT, c);
+            i++;
+            continue;
+        }
+
+        if (quote == '"') {
+            if (c == '"') {
+                quote = '\0';
+                i++;
+                continue;
+            }
+            if (c == '\\') {
+                char n = src[i + 1];
+                if (n == '$' || n == '`' || n == '"' || n == '\\') {
+                    EMIT(WP_LIT, n);
+                    i += 2;
+                    continue;
+                }
+                if (n == '\n') { i += 2; continue; } // line continuation
+            }
+            EMIT(WP_DQ, c);
+            i++;
+            continue;
+        }
+
+        switch (c) {
+        case '\\': {
+            char n = src[i + 1];
+            if (n == '\0') { status = LEX_TRAILING_ESCAPE; i++; continue; }
+            if (n == '\n') { i += 2; continue; } // line continuation
+            word_begin(&L, i);
+            L.io_digits = false;
+            EMIT(WP_LIT, n);
+            i += 2;
+            continue;
+        }
+        case '\'':
+        case '"':
+            word_begin(&L, i);
+            L.io_digits = false;
+            L.quoted = true;
+            quote = c;
+            i++;
+            continue;
+        case '\r':
+            // CRLF ends the word like a newline does; a lone CR is an ordinary byte
+            if (src[i + 1] != '\n') break;
+            /* fall through */
+        case ' ':
+        case '\t':
+            END_WORD();
+            i++;
+            continue;
+        case '#':
+            if (L.in_word) break;
+            while (src[i] && src[i] != '\n') i++; // comment runs to end of line
+            continue;
+        case '\n':
+        case ';':
+            END_WORD();
+            if (!push_token(&L, TOK_SEP, i, 1, -1)) goto nomem;
+            i++;
+            continue;
+        case '&': {
+            END_WORD();
+            size_t n = (src[i + 1] == '&') ? 2 : 1; // "&&" is kept whole so it can be rejected by name
+            if (!push_token(&L, TOK_AMP, i, n, -1)) goto nomem;
+            i += n;
+            continue;
+        }
+        case '|':
+            END_WORD();
+            if (!push_token(&L, TOK_PIPE, i, 1, -1)) goto nomem;
+            i++;
+            continue;
+        case '<':
+        case '>': {
+            int io = -1;
+            size_t start = i;
+            if (L.in_word && L.io_digits) {
+                size_t word_start = L.word_start;
+                io = take_io_number(&L, src, i);
+                if (io >= 0) start = word_start;
+            }
+            END_WORD();
+            bool dbl = (c == '>' && src[i + 1] == '>');
+            bool dup = !dbl && src[i + 1] == '&'; // the & belongs to the operator
+            TokType type = dup ? (c == '<' ? TOK_LESSAND : TOK_GREATAND)
+                         : (c == '<') ? TOK_LESS : dbl ? TOK_DGREAT : TOK_GREAT;
+            i += (dbl || dup) ? 2 : 1;
+            if (!push_token(&L, type, start, i - start, io)) goto nomem;
+            continue;
+        }
+        default:
+            break;
+        }
+
+        word_begin(&L, i);
+        if (c < '0' || c > '9') L.io_digits = false;
+        EMIT(WP_UNQ, c);
+        i++;
+    }
+
+    if (quote == '\'') status = LEX_OPEN_SINGLE;
+    else if (quote == '"') status = LEX_OPEN_DOUBLE;
+    END_WORD();
+
+#undef EMIT
+#undef END_WORD
+    LOG(LOG_LEVEL_INFO, "lexed %zu tokens, status %d", out ? out->count : 0, status);
+    return status;
+
+nomem:
+    LOG(LOG_LEVEL_ERR, "lexer out of memory");
+    return LEX_NOMEM;
+}
+
+void token_list_free(TokenList *tl, Arena *arena) {
+    if (!tl) return;
+    arena_free(arena, tl->tok);
+    arena_free(arena, tl->parts);
+    arena_free(arena, tl->text);
+    tl->tok = NULL;
+    tl->parts = NULL;
+    tl->text = NULL;
+    tl->count = tl->nparts = 0;
+}
+
+const char *tok_spelling(const TokenList *tl, const Token *t) {
+    switch (t->type) {
+    case TOK_PIPE:   return "|";
+    case TOK_SEP:    return tl->src[t->start] == ';' ? ";" : "newline";
+    case TOK_AMP:    return t->len == 2 ? "&&" : "&";
+    case TOK_LESS:   return "<";
+    case TOK_GREAT:  return ">";
+    case TOK_DGREAT: return ">>";
+    case TOK_GREATAND: return ">&";
+    case TOK_LESSAND:  return "<&";
+    case TOK_WORD:
+    default:         return "word";
+    }
+}
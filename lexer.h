@@ -0,0 +1,79 @@
+#ifndef LEXER_H
+#define LEXER_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "arena.h"
+
+/* Single-pass shell lexer.
+ * One scan of the input decides quoting for every later stage: completeness
+ * (is_command_complete), segment splitting (TOK_SEP) and parsing/expansion
+ * (parse_tokens) all consume the same TokenList instead of rescanning text. */
+
+typedef enum {
+    TOK_WORD,    // argument / filename, see parts
+    TOK_PIPE,    // |
+    TOK_SEP,     // ; or newline
+    TOK_AMP,     // & : ends a segment like ;, but runs it in the background (len 2: "&&")
+    TOK_LESS,    // [n]<
+    TOK_GREAT,   // [n]>
+    TOK_DGREAT,  // [n]>>
+    TOK_GREATAND,// [n]>&  (target word: fd number, or - to close)
+    TOK_LESSAND  // [n]<&
+} TokType;
+
+/* A word is a run of parts that differ only in quote context. Escapes and
+ * quote characters are already removed from text. */
+typedef enum {
+    WP_LIT,  // single-quoted or backslash-escaped: never expanded
+    WP_UNQ,  // unquoted: expanded, then field split
+    WP_DQ    // double-quoted: expanded, not split
+} WordPartKind;
+
+typedef struct {
+    WordPartKind kind;
+    const char *text;  // NUL-terminated, owned by the TokenList's arena
+    size_t len;
+} WordPart;
+
+typedef struct {
+    TokType type;
+    size_t start, len;   // span in the source (for error messages and job labels)
+    int io_number;       // redirections: explicit fd ("2>" → 2), else -1
+    bool quoted;         // words: some quoting present, so "" still yields an argument
+    bool has_dollar;     // words: some expandable part contains '$'
+    size_t first_part;   // words: index into TokenList.parts
+    size_t nparts;
+} Token;
+
+typedef enum {
+    LEX_OK,
+    LEX_OPEN_SINGLE,      // unterminated '...'
+    LEX_OPEN_DOUBLE,      // unterminated "..."
+    LEX_TRAILING_ESCAPE,  // input ends in an unescaped backslash (line continuation)
+    LEX_NOMEM
+} LexStatus;
+
+typedef struct TokenList {
+    Token *tok;
+    size_t count;
+    WordPart *parts;
+    size_t nparts;
+    char *text;           // backing store for every WordPart.text
+    const char *src;      // input the spans refer to (borrowed)
+} TokenList;
+
+// Tokenize src. With out == NULL only the status is computed (no allocation),
+// which is what is_command_complete() uses. Token storage comes from arena
+// (NULL = heap; release with token_list_free).
+LexStatus lex_input(const char *src, Arena *arena, TokenList *out);
+
+void token_list_free(TokenList *tl, Arena *arena);
+
+static inline bool lex_incomplete(LexStatus st) {
+    return st == LEX_OPEN_SINGLE || st == LEX_OPEN_DOUBLE || st == LEX_TRAILING_ESCAPE;
+}
+
+const char *tok_spelling(const TokenList *tl, const Token *t); // operator text for diagnostics
+
+#endif // LEXER_H
@@ -1,132 +1,245 @@
-/* this is an attempt to create a simple shell in C, called "THRASH" */
-
-#include "input.h"
-#include "shell.h" // Include the shell context and function declarations
-#include "executor.h" // Include the command execution function
-#include "jobs.h"
-#include "history.h"
-#include "var.h" 
-#include <errno.h>
-#include <readline/readline.h>
-#include <readline/history.h>
-#include <stdio.h> // for printf, fgets, perror
-#include <stdlib.h> // for exit,
-#include <string.h> // for str maniopulation functions
-#include "debug.h"
-#include "signals.h"
-#include <signal.h>
-#include <unistd.h>
-
-
-
-// --- Main Loop ---
-int main() {
-    ShellContext shell = { .running = 1 }; // Initialize shell context with running flag set to 1
-    
-    shell.vars = malloc(sizeof(VarTable));
-    if (!shell.vars) {
-        fprintf(stderr, "Failed to allocate VarTable\n");
-        exit(1);
-    }
-
-    if (!vart_init(shell.vars, 64)) { // initialize var tables 
-    LOG(LOG_LEVEL_ERR, "Failed to initialize VarTable");
-    exit(EXIT_FAILURE);
-    } 
-    //init_var_table(&shell);
-    setup_parent_signals(); 
-    setup_shell_job_control(&shell);
-    initialize_readline();
-    
-    //HISTORY SETUP
-    char hist_path[4096];
-    if (history_default_path(hist_path, sizeof(hist_path)) != 0) {
-        // fallback if no $XDG_STATE_HOME / $HOME
-        snprintf(hist_path, sizeof(hist_path), "history.txt");
-    }
-
-    if (history_init(&shell.history, hist_path, 2000,
-                    HISTORY_IGNORE_EMPTY | HISTORY_IGNORE_DUPS | HISTORY_TRIM_TRAILING) != 0) {
-        LOG(LOG_LEVEL_ERR, "Failed to init history: %s", strerror(errno));
-    }
-
-    if (history_load(&shell.history) != 0) {
-        LOG(LOG_LEVEL_WARN, "No existing history loaded: %s", strerror(errno));
-    }
-
-    // Mirror into readline so Up-arrow / Ctrl+R see old entries
-    for (size_t i = 0; i < history_count(&shell.history); ++i) {
-        const HistEntry *e = get_history(&shell.history, i);
-        if (e && e->line) add_history(e->line);
-    }
-    // Optional: limit readline’s in-memory size to match persistent cap
-    //stifle_history((int)shell.history.max);
-    
-    // Log shell startup 
-    LOG(LOG_LEVEL_INFO, "THRASH started, pid=%d", getpid());
-    char *input_buf = NULL;
-    bool continuation_mode = false;
-
-    while (shell.running) {
-        // Show normal cwd prompt or 🔪 continuation prompt
-        if (!read_input(&shell, continuation_mode)) {  
-            LOG(LOG_LEVEL_ERR, "read_input failed: %s", strerror(errno));
-            perror("readline failed");
-            break; // Ctrl+D or error
-        }
-
-        // Skip empty lines
-        if (shell.input[0] == '\0') {
-            continue;
-        }
-
-        // Append this chunk to the growing buffer
-        append_to_buffer(&input_buf, shell.input);
-
-        // Log just the chunk typed this round
-        LOG(LOG_LEVEL_INFO, "logging: %s", shell.input);
-        HistoryAddResult hr = history_add(&shell.history, shell.input);
-        (void)hr;
-
-        // Special-case: "$?" query — print and clear
-        LOG(LOG_LEVEL_INFO, "checking for $?");
-        if (strcmp(shell.input, "$?") == 0) {
-            printf("%d\n", shell.last_status);
-            free_buffer(&input_buf);
-            continuation_mode = false;
-            continue;
-        }
-
-        // Decide if ready to execute or still incomplete
-        if (!is_command_complete(input_buf)) {
-            continuation_mode = true;
-            continue; // Loop again, show continuation prompt
-        }
-
-        // ✅ Command is complete — execute as usual
-        continuation_mode = false;
-
-        LOG(LOG_LEVEL_INFO, "expanding variables in: %s", input_buf);
-        char *expanded = expand_variables_ex(input_buf, shell.last_status, shell.vars);
-        LOG(LOG_LEVEL_INFO, "expanded=%s", expanded);
-        if (!expanded) {
-            perror("expand_variables");
-            free_buffer(&input_buf);
-            continue;
-        }
-        LOG(LOG_LEVEL_INFO, "Expanded input: '%s'", expanded);
-
-        process_input_segments(&shell, expanded);
-
-        free(expanded);
-        free_buffer(&input_buf); // reset for next command
-    }
-    
-    if (history_save(&shell.history) != 0) {
-        LOG(LOG_LEVEL_WARN, "Failed to save history: %s", strerror(errno));
-    }
-    history_dispose(&shell.history);  // free internal buffers
-    //cleanup_readline();
-    vart_destroy(shell.vars);
-    return 0;
-}
+/* this is an attempt to create a simple shell in C, called "THRASH" */
+
+#include "input.h"
+#include "shell.h" // Include the shell context and function declarations
+#include "executor.h" // Include the command execution function
+#include "jobs.h"
+#include "history.h"
+#include "var.h" 
+#include "path.h"
+#include <errno.h>
+#include <readline/readline.h>
+#include <readline/history.h>
+#include <stdio.h> // for printf, fgets, perror
+#include <stdlib.h> // for exit,
+#include <string.h> // for str maniopulation functions
+#include "debug.h"
+#include "signals.h"
+#include "script.h"
+#include "completion.h"
+#include "stats.h"
+#include <signal.h>
+#include <unistd.h>
+#include <time.h>
+
+extern char **environ;
+
+/* --startup-profile: wall time of each init phase, printed to stderr once the
+ * shell is ready to read its first command. */
+#define PROFILE_MAX 12
+static struct {
+    bool on;
+    int n;
+    struct timespec start, last;
+    struct { const char *name; long us; } phase[PROFILE_MAX];
+} profile;
+
+static long elapsed_us(const struct timespec *from, const struct timespec *to) {
+    return (long)(to->tv_sec - from->tv_sec) * 1000000 + (to->tv_nsec - from->tv_nsec) / 1000;
+}
+
+// Close the phase that started at the previous mark
+static void profile_mark(const char *name) {
+    if (!profile.on || profile.n == PROFILE_MAX) return;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    profile.phase[profile.n].name = name;
+    profile.phase[profile.n].us = elapsed_us(&profile.last, &now);
+    profile.n++;
+    profile.last = now;
+}
+
+static void profile_report(void) {
+    if (!profile.on) return;
+    fprintf(stderr, "thrash: startup profile (us)\n");
+    for (int i = 0; i < profile.n; ++i)
+        fprintf(stderr, "  %-12s %8ld\n", profile.phase[i].name, profile.phase[i].us);
+    fprintf(stderr, "  %-12s %8ld\n", "total", elapsed_us(&profile.start, &profile.last));
+}
+
+
+// Release everything both modes allocate; history is interactive-only.
+// $THRASH_STATS_FILE, if set by then, gets this shell's stats appended.
+static void shell_cleanup(ShellContext *shell) {
+    Var *sf = vart_get(shell->vars, "THRASH_STATS_FILE");
+    if (sf && *sf->value && stats_dump_file(sf->value) != 0)
+        fprintf(stderr, "thrash: %s: %s\n", sf->value, strerror(errno));
+    vart_destroy(shell->vars);
+    free(shell->vars);
+    path_hash_dispose();
+    completion_dispose();
+    jobs_destroy();
+    arena_destroy(&shell->arena);
+    free(shell->input);
+    shell->input = NULL;
+    free(shell->cwd);
+    free(shell->prompt);
+    shell->cwd = shell->prompt = NULL;
+}
+
+// --- Main Loop ---
+// thrash                 interactive REPL when stdin is a terminal
+// thrash script.sh       run a script file
+// thrash -c 'commands'   run a command string
+// ... | thrash           run commands streamed on stdin
+// --startup-profile first, in any mode, reports where startup time went
+int main(int argc, char **argv) {
+    ShellContext shell = { .running = 1 }; // Initialize shell context with running flag set to 1
+    const char *command_string = NULL;
+    const char *script_path = NULL;
+
+    int arg = 1;
+    if (arg < argc && strcmp(argv[arg], "--startup-profile") == 0) {
+        profile.on = true;
+        clock_gettime(CLOCK_MONOTONIC, &profile.start);
+        profile.last = profile.start;
+        arg++;
+    }
+    if (arg < argc) {
+        if (strcmp(argv[arg], "-c") == 0) {
+            if (arg + 1 >= argc) {
+                fprintf(stderr, "thrash: -c: option requires an argument\n");
+                return 2;
+            }
+            command_string = argv[arg + 1];
+        } else {
+            script_path = argv[arg];
+        }
+    }
+    shell.interactive = !command_string && !script_path && isatty(STDIN_FILENO);
+    
+    shell.vars = malloc(sizeof(VarTable));
+    if (!shell.vars) {
+        fprintf(stderr, "Failed to allocate VarTable\n");
+        exit(1);
+    }
+
+    if (!vart_init(shell.vars, 64)) { // initialize var tables 
+    LOG(LOG_LEVEL_ERR, "Failed to initialize VarTable");
+    exit(EXIT_FAILURE);
+    } 
+    // Inherited environment becomes exported shell vars; children get vart_envp() from here on
+    if (!vart_import_environ(shell.vars, environ)) {
+        LOG(LOG_LEVEL_WARN, "Some environment variables could not be imported");
+    }
+    profile_mark("vars");
+    shell_init_cwd(&shell); // $PWD, and the prompt's directory
+    profile_mark("cwd");
+    arena_init(&shell.arena, 0); // per-line scratch for parse/expand/execute
+    // Background jobs are reaped from the SIGCHLD self-pipe (jobs_reap)
+    if (setup_sigchld_handler() < 0) {
+        LOG(LOG_LEVEL_WARN, "SIGCHLD handler unavailable; polling for finished jobs");
+    }
+    profile_mark("signals");
+
+    // Non-interactive: no readline, history, prompt or job control
+    if (!shell.interactive) {
+        shell.tty_fd = -1;
+        shell.shell_pgid = getpgrp();
+        profile_report();
+        int status;
+        if (command_string)   status = run_script_string(&shell, command_string);
+        else if (script_path) status = run_script_file(&shell, script_path);
+        else                  status = run_script_fd(&shell, STDIN_FILENO);
+        shell_cleanup(&shell);
+        return status & 0xff;
+    }
+
+    setup_parent_signals(); 
+    setup_shell_job_control(&shell);
+    profile_mark("job control");
+    initialize_readline();
+    completion_init(&shell);
+    profile_mark("readline");
+    
+    //HISTORY SETUP
+    char hist_path[4096];
+    if (history_default_path(hist_path, sizeof(hist_path)) != 0) {
+        // fallback if no $XDG_STATE_HOME / $HOME
+        snprintf(hist_path, sizeof(hist_path), "history.txt");
+    }
+
+    if (history_init(&shell.history, hist_path, 2000,
+                    HISTORY_IGNORE_EMPTY | HISTORY_IGNORE_DUPS | HISTORY_TRIM_TRAILING |
+                    HISTORY_APPEND) != 0) {
+        LOG(LOG_LEVEL_ERR, "Failed to init history: %s", strerror(errno));
+    }
+
+    if (history_load(&shell.history) != 0) {
+        LOG(LOG_LEVEL_WARN, "No existing history loaded: %s", strerror(errno));
+    }
+
+    // Up/Down and Ctrl-R read shell.history directly (indexed search, no readline copy)
+    input_attach_history(&shell.history);
+    profile_mark("history");
+    profile_report();
+    
+    // Log shell startup 
+    LOG(LOG_LEVEL_INFO, "THRASH started, pid=%d", getpid());
+    char *input_buf = NULL;
+    bool continuation_mode = false;
+
+    while (shell.running) {
+        // Report background jobs that finished or stopped since the last prompt
+        if (!continuation_mode) jobs_notify(stderr);
+
+        // Show normal cwd prompt or 🔪 continuation prompt
+        if (!read_input(&shell, continuation_mode)) {  
+            LOG(LOG_LEVEL_ERR, "read_input failed: %s", strerror(errno));
+            perror("readline failed");
+            break; // Ctrl+D or error
+        }
+
+        // Skip empty lines
+        if (shell.input[0] == '\0') {
+            continue;
+        }
+
+        // Append this chunk to the growing buffer
+        append_to_buffer(&input_buf, shell.input);
+
+        // Log just the chunk typed this round
+        LOG(LOG_LEVEL_INFO, "logging: %s", shell.input);
+        uint64_t hist_t0 = STATS_START();
+        HistoryAddResult hr = history_add(&shell.history, shell.input);
+        STATS_STOP(STAT_HIST_ADD, hist_t0);
+        shell.hist_id = hr.id;
+
+        // Special-case: "$?" query — print and clear
+        LOG(LOG_LEVEL_INFO, "checking for $?");
+        if (strcmp(shell.input, "$?") == 0) {
+            printf("%d\n", shell.last_status);
+            free_buffer(&input_buf);
+            continuation_mode = false;
+            continue;
+        }
+
+        // Lex and run; an open quote or trailing backslash means keep reading
+        struct timespec t0, t1;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        shell.usage = (HistUsage){0}; // jobs add their rusage as they finish
+        bool complete = execute_input(&shell, input_buf);
+        arena_reset(&shell.arena); // drops tokens, expanded words and commands at once
+        if (!complete) {
+            continuation_mode = true;
+            continue; // Loop again, show continuation prompt
+        }
+        continuation_mode = false;
+
+        // Wall time and children's rusage go on the history entry (history -v)
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        shell.usage.wall_us = (uint64_t)(t1.tv_sec - t0.tv_sec) * 1000000u +
+                              (uint64_t)((t1.tv_nsec - t0.tv_nsec) / 1000);
+        if (hr.id) history_set_usage_by_id(&shell.history, hr.id, shell.last_status, &shell.usage);
+
+        free_buffer(&input_buf); // reset for next command
+    }
+    
+    if (history_save(&shell.history) != 0) {
+        LOG(LOG_LEVEL_WARN, "Failed to save history: %s", strerror(errno));
+    }
+    history_dispose(&shell.history);  // free internal buffers
+    //cleanup_readline();
+    shell_cleanup(&shell);
+    return shell.last_status & 0xff;
+}
@@ -0,0 +1,349 @@
+// parallel.c
+/* The scheduler: one poll() over the output pipes of the runs in flight
+ * plus the SIGCHLD self-pipe. A run is finished once both its pipes are at
+ * EOF and its job is done; then its output goes out in one piece, so runs
+ * never interleave, and a slot opens for the next value. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include "parallel.h"
+#include "builtins.h"
+#include "executor.h"
+#include "jobs.h"
+#include "pipeline.h"
+#include "redirect.h"
+#include "signals.h"
+#include "arena.h"
+#include "debug.h"
+
+#define PARALLEL_READ (64 * 1024)
+
+typedef struct {
+    char *data;
+    size_t len, cap;
+} Buf;
+
+typedef struct {
+    Job *job;     // while running
+    int fds[2];   // read ends for stdout, stderr; -1 once at EOF
+    Buf out, err;
+    int status;
+    bool done;
+} Run;
+
+static bool buf_put(Buf *b, const char *s, size_t n) {
+    if (b->len + n > b->cap) {
+        size_t ncap = b->cap ? b->cap : 1024;
+        while (ncap < b->len + n) ncap *= 2;
+        char *nd = realloc(b->data, ncap);
+        if (!nd) return false;
+        b->data = nd;
+        b->cap = ncap;
+    }
+    memcpy(b->data + b->len, s, n);
+    b->len += n;
+    return true;
+}
+
+static void usage(void) {
+    fprintf(stderr, "thrash: parallel: usage: parallel [-j N] [-k] command [arg...] ::: value...\n");
+}
+
+// Template word with every {} replaced by value
+static char *substitute(Arena *a, const char *word, const char *value) {
+    size_t vlen = strlen(value), n = 0;
+    for (const char *p = word; (p = strstr(p, "{}")) != NULL; p += 2) n++;
+    char *s = arena_alloc(a, strlen(word) + n * vlen + 1);
+    if (!s) return NULL;
+    char *d = s;
+    for (const char *p = word; *p;) {
+        if (p[0] == '{' && p[1] == '}') {
+            memcpy(d, value, vlen);
+            d += vlen;
+            p += 2;
+        } else {
+            *d++ = *p++;
+        }
+    }
+    *d = '\0';
+    return s;
+}
+
+// argv for one value, from the arena
+static char **build_argv(Arena *a, char **tmpl, int ntmpl, const char *value) {
+    bool placeholder = false;
+    for (int i = 0; i < ntmpl; ++i) placeholder = placeholder || strstr(tmpl[i], "{}");
+    char **argv = arena_alloc(a, (size_t)(ntmpl + 2) * sizeof(char *));
+    if (!argv) return NULL;
+    int n = 0;
+    for (int i = 0; i < ntmpl; ++i) {
+        argv[n] = placeholder ? substitute(a, tmpl[i], value) : tmpl[i];
+        if (!argv[n++]) return NULL;
+    }
+    if (!placeholder) argv[n++] = (char *)value;
+    argv[n] = NULL;
+    return argv;
+}
+
+static char *join_words(Arena *a, char **argv) {
+    size_t len = 1;
+    for (int i = 0; argv[i]; ++i) len += strlen(argv[i]) + 1;
+    char *s = arena_alloc(a, len);
+    if (!s) return NULL;
+    s[0] = '\0';
+    for (int i = 0; argv[i]; ++i) {
+        if (i) strcat(s, " ");
+        strcat(s, argv[i]);
+    }
+    return s;
+}
+
+/* Start one run. An output builtin runs right here into a memory stream; it
+ * never blocks on a reader, so it needs no job. Anything else is launched as
+ * a quiet background job with stdin from /dev/null and stdout/stderr on
+ * pipes of its own. A run that could not start is finished on return with
+ * the status launch_commands() gave (127 for a missing command...). */
+static void start_run(ShellContext *shell, Run *r, char **argv) {
+    r->fds[0] = r->fds[1] = -1;
+    const Builtin *b = find_builtin(argv[0]);
+    if (b) {
+        Command c = { .argv = argv, .arena = &shell->arena };
+        while (c.argv[c.argc]) c.argc++;
+        FILE *mem = open_memstream(&r->out.data, &r->out.len);
+        if (!mem) {
+            r->status = 1;
+        } else {
+            r->status = run_builtin(shell, b, &c, mem);
+            fclose(mem);
+            r->out.cap = r->out.len;
+        }
+        r->done = true;
+        return;
+    }
+
+    int out[2], err[2];
+    if (cloexec_pipe(out) < 0) {
+        perror("thrash: parallel: pipe");
+        r->status = 1;
+        r->done = true;
+        return;
+    }
+    if (cloexec_pipe(err) < 0) {
+        perror("thrash: parallel: pipe");
+        close(out[0]);
+        close(out[1]);
+        r->status = 1;
+        r->done = true;
+        return;
+    }
+
+    Redirection in_null = { REDIR_IN, 0, -1, "/dev/null", NULL };
+    Redirection to_out = { REDIR_DUP, 1, out[1], NULL, NULL };
+    Redirection to_err = { REDIR_DUP, 2, err[1], NULL, NULL };
+    Redirection *redirs[] = { &in_null, &to_out, &to_err, NULL };
+    Command c = { .argv = argv, .redirs = redirs, .nredirs = 3, .background = true,
+                  .quiet = true, .arena = &shell->arena };
+    while (c.argv[c.argc]) c.argc++;
+    Command *cmds[] = { &c };
+
+    size_t before = job_count();
+    int rc = launch_commands(shell, cmds, 1, join_words(&shell->arena, argv));
+    close(out[1]);
+    close(err[1]);
+    if (job_count() > before) {
+        r->job = job_current();
+        r->fds[0] = out[0];
+        r->fds[1] = err[0];
+        fcntl(out[0], F_SETFL, O_NONBLOCK);
+        fcntl(err[0], F_SETFL, O_NONBLOCK);
+        return;
+    }
+    close(out[0]);
+    close(err[0]);
+    r->status = rc ? rc : 1;
+    r->done = true;
+}
+
+// Read what is there; EOF closes the end
+static void drain(Run *r, int which) {
+    char chunk[PARALLEL_READ];
+    Buf *b = which ? &r->err : &r->out;
+    for (;;) {
+        ssize_t n = read(r->fds[which], chunk, sizeof(chunk));
+        if (n > 0) {
+            if (!buf_put(b, chunk, (size_t)n)) LOG(LOG_LEVEL_WARN, "parallel: output dropped (out of memory)");
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && errno == EAGAIN) return;
+        close(r->fds[which]); // EOF, or an error that won't go away
+        r->fds[which] = -1;
+        return;
+    }
+}
+
+static void emit(Run *r, FILE *out) {
+    if (r->out.len) fwrite(r->out.data, 1, r->out.len, out);
+    fflush(out);
+    if (r->err.len) fwrite(r->err.data, 1, r->err.len, stderr);
+    free(r->out.data);
+    free(r->err.data);
+    r->out = r->err = (Buf){0};
+}
+
+int run_parallel(ShellContext *shell, Command *cmd, FILE *out) {
+    long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    bool keep_order = false;
+    int i = 1;
+    for (; cmd->argv[i] && cmd->argv[i][0] == '-'; ++i) {
+        const char *opt = cmd->argv[i];
+        if (strcmp(opt, "--") == 0) { i++; break; }
+        if (strcmp(opt, "-k") == 0) { keep_order = true; continue; }
+        if (strncmp(opt, "-j", 2) == 0) {
+            const char *n = opt[2] ? opt + 2 : cmd->argv[++i];
+            char *end = NULL;
+            jobs = n ? strtol(n, &end, 10) : 0;
+            if (!n || *end || jobs < 1) {
+                fprintf(stderr, "thrash: parallel: -j: %s: expected a positive number\n", n ? n : "");
+                return 2;
+            }
+            continue;
+        }
+        usage();
+        return 2;
+    }
+    if (jobs < 1) jobs = 1; // sysconf() failed
+
+    int first = i, sep = i;
+    while (cmd->argv[sep] && strcmp(cmd->argv[sep], ":::") != 0) sep++;
+    if (sep == first || !cmd->argv[sep]) {
+        usage();
+        return 2;
+    }
+    const Builtin *b = find_builtin(cmd->argv[first]);
+    if (b && !(b->flags & BI_OUTPUT)) {
+        fprintf(stderr, "thrash: parallel: %s: can't run in parallel (it changes the shell)\n", b->name);
+        return 2;
+    }
+    char **tmpl = cmd->argv + first;
+    int ntmpl = sep - first;
+    char **values = cmd->argv + sep + 1;
+    size_t nvalues = 0;
+    while (values[nvalues]) nvalues++;
+
+    size_t slots = (size_t)jobs < nvalues ? (size_t)jobs : nvalues; // runs in flight at most
+    if (slots == 0) slots = 1;
+    Run *runs = calloc(nvalues ? nvalues : 1, sizeof(Run));
+    size_t *live = malloc(slots * sizeof(size_t));
+    struct pollfd *pfd = malloc((2 * slots + 1) * sizeof(struct pollfd)); // two pipes each, SIGCHLD
+    if (!runs || !live || !pfd) {
+        free(runs);
+        free(live);
+        free(pfd);
+        fprintf(stderr, "thrash: parallel: out of memory\n");
+        return 1;
+    }
+
+    // ^C goes to the terminal's foreground group, which is the shell itself
+    // while its jobs run in the background: pass it on to them
+    if (shell->interactive) sigint_catch(true);
+    bool interrupted = false;
+    size_t next = 0, nlive = 0, emitted = 0;
+
+    while (next < nvalues || nlive) {
+        while (!interrupted && next < nvalues && nlive < (size_t)jobs) {
+            Run *r = &runs[next];
+            ArenaMark m = arena_mark(&shell->arena);
+            char **argv = build_argv(&shell->arena, tmpl, ntmpl, values[next]);
+            if (argv) {
+                start_run(shell, r, argv);
+            } else {
+                fprintf(stderr, "thrash: parallel: out of memory\n");
+                r->status = 1;
+                r->done = true;
+            }
+            arena_rewind(&shell->arena, m);
+            if (!r->done) live[nlive++] = next;
+            else if (!keep_order) emit(r, out);
+            next++;
+        }
+        if (interrupted && next < nvalues) {
+            for (; next < nvalues; ++next) { // never started
+                runs[next].status = 128 + SIGINT;
+                runs[next].done = true;
+            }
+        }
+
+        if (nlive) {
+            int nfd = 0;
+            for (size_t k = 0; k < nlive; ++k) {
+                Run *r = &runs[live[k]];
+                for (int w = 0; w < 2; ++w)
+                    if (r->fds[w] >= 0) pfd[nfd++] = (struct pollfd){ .fd = r->fds[w], .events = POLLIN };
+            }
+            int chld = sigchld_fd();
+            if (chld >= 0) pfd[nfd++] = (struct pollfd){ .fd = chld, .events = POLLIN };
+            // Without the self-pipe, exits are only noticed by polling
+            if (poll(pfd, (nfds_t)nfd, chld >= 0 ? -1 : 50) < 0 && errno != EINTR)
+                perror("thrash: parallel: poll");
+        }
+
+        if (shell->interactive && sigint_caught() && !interrupted) {
+            interrupted = true;
+            for (size_t k = 0; k < nlive; ++k) {
+                Job *job = runs[live[k]].job;
+                if (killpg(job->pgid, SIGINT) < 0 && errno != ESRCH) perror("thrash: parallel: kill");
+            }
+        }
+
+        for (size_t k = 0; k < nlive; ++k) {
+            Run *r = &runs[live[k]];
+            for (int w = 0; w < 2; ++w)
+                if (r->fds[w] >= 0) drain(r, w);
+        }
+        jobs_reap();
+
+        // Retire runs whose output is complete and whose job is done
+        size_t kept = 0;
+        for (size_t k = 0; k < nlive; ++k) {
+            Run *r = &runs[live[k]];
+            if (r->fds[0] >= 0 || r->fds[1] >= 0 || job_state(r->job) != JOB_DONE) {
+                live[kept++] = live[k];
+                continue;
+            }
+            r->status = job_status(r->job);
+            job_remove(r->job);
+            r->job = NULL;
+            r->done = true;
+            if (!keep_order) emit(r, out);
+        }
+        nlive = kept;
+
+        if (keep_order)
+            while (emitted < nvalues && runs[emitted].done) emit(&runs[emitted++], out);
+    }
+    if (shell->interactive) sigint_catch(false);
+
+    // $PARALLEL_STATUS: every run's status, in value order
+    size_t failed = 0;
+    char *list = malloc(nvalues * 4 + 1);
+    if (list) list[0] = '\0';
+    for (size_t k = 0; k < nvalues; ++k) {
+        if (runs[k].status != 0) failed++;
+        if (list) sprintf(list + strlen(list), k ? " %d" : "%d", runs[k].status & 0xff);
+    }
+    if (list) vart_set(shell->vars, "PARALLEL_STATUS", list, 0);
+    free(list);
+    free(runs);
+    free(live);
+    free(pfd);
+
+    if (interrupted) return 128 + SIGINT;
+    return failed > 100 ? 101 : (int)failed;
+}
@@ -0,0 +1,19 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <stdio.h>
+#include "command.h"
+#include "shell.h"
+
+/* parallel [-j N] [-k] command [arg...] ::: value...
+ * Run command once per value, with {} in its words replaced by the value
+ * (or the value appended when no word has {}), at most N at a time
+ * (default: online CPUs). Each run is a background job from
+ * launch_commands(); its stdout and stderr are collected through pipes of
+ * its own and written out whole when it finishes, in finishing order, or
+ * in value order with -k. Every run's status goes into $PARALLEL_STATUS
+ * (space-separated, value order); the return value is the number of runs
+ * that failed, 101 at most. */
+int run_parallel(ShellContext *shell, Command *cmd, FILE *out);
+
+#endif // PARALLEL_H
@@ -3,211 +3,359 @@
 #include <stdlib.h> // Required for malloc and free
 #include <ctype.h>
 #include "command.h"
+#include "parser.h"
+#include "lexer.h"
+#include "redirect.h"
+#include "arena.h"
+#include "var.h"
+#include "stats.h"
 #include "debug.h"
 
-#define MAX_CMDS 16
-#define MAX_ARGS 64
+/* Small-vector sizes: typical commands and pipelines never leave the stack.
+ * Past these, storage doubles in the arena (or heap), keeping appends O(1)
+ * amortized however many arguments an expansion produces. */
+#define VEC_INLINE 16
 
-Command **parse_commands(const char *input, int *num_cmds) {
-    Command **cmds = calloc(MAX_CMDS, sizeof(Command *));
-    if (!cmds) {
-        if (num_cmds) *num_cmds = 0;
-        return NULL;
+typedef struct {
+    void **items;    // inline_items until the first spill
+    size_t count, cap;
+    void *inline_items[VEC_INLINE];
+} PtrVec;
+
+static void vec_init(PtrVec *v) {
+    v->items = v->inline_items;
+    v->count = 0;
+    v->cap = VEC_INLINE;
+}
+
+static bool vec_push(Arena *a, PtrVec *v, void *item) {
+    if (v->count == v->cap) {
+        size_t ncap = v->cap * 2;
+        void **ni;
+        if (v->items == v->inline_items) {
+            ni = arena_alloc(a, ncap * sizeof(void *));
+            if (ni) memcpy(ni, v->items, v->count * sizeof(void *));
+        } else {
+            ni = arena_realloc(a, v->items, v->cap * sizeof(void *), ncap * sizeof(void *));
+        }
+        if (!ni) return false;
+        v->items = ni;
+        v->cap = ncap;
+    }
+    v->items[v->count++] = item;
+    return true;
+}
+
+// Hand the contents over as an exact-size NULL-terminated array and reset v.
+// A spilled vector is reused in place; an inline one is copied out once.
+static void **vec_finish(Arena *a, PtrVec *v) {
+    void **out;
+    if (v->items != v->inline_items && v->count < v->cap) {
+        out = v->items;
+    } else {
+        out = arena_alloc(a, (v->count + 1) * sizeof(void *));
+        if (!out) return NULL;
+        memcpy(out, v->items, v->count * sizeof(void *));
+        if (v->items != v->inline_items) arena_free(a, v->items);
     }
+    out[v->count] = NULL;
+    vec_init(v);
+    return out;
+}
 
-    int cmd_index = 0;
-    int arg_index = 0;
-    int buff_index = 0;
+typedef struct {
+    const TokenList *tl;
+    const VarTable *vars;  // NULL: words are taken literally
+    int last_exit;
+    Arena *arena;
+} Parser;
 
-    char token_buff[1024];
-    bool in_single = false, in_double = false;
-    const char *p = input;
-    bool aborted = false;
+/* One field under construction. live means it must be emitted even if empty
+ * (it saw quoted text), so "" is an argument but an unset $X is not. */
+typedef struct {
+    char *buf;
+    size_t len, cap;
+    bool live;
+} Field;
 
-    // Allocate first Command
-    Command *current = calloc(1, sizeof(Command));
-    if (!current) {
-        free(cmds);
-        if (num_cmds) *num_cmds = 0;
-        return NULL;
+static bool field_put(Arena *a, Field *f, const char *s, size_t n) {
+    if (f->len + n + 1 > f->cap) {
+        size_t ncap = f->cap ? f->cap : 32;
+        while (ncap < f->len + n + 1) ncap *= 2;
+        char *nb = arena_realloc(a, f->buf, f->cap, ncap);
+        if (!nb) return false;
+        f->buf = nb;
+        f->cap = ncap;
     }
-    current->argv = calloc(MAX_ARGS, sizeof(char *));
-    if (!current->argv) {
-        free(current);
-        free(cmds);
-        if (num_cmds) *num_cmds = 0;
-        return NULL;
+    memcpy(f->buf + f->len, s, n);
+    f->len += n;
+    f->buf[f->len] = '\0';
+    if (n) f->live = true;
+    return true;
+}
+
+static bool field_flush(Arena *a, Field *f, PtrVec *fields) {
+    char *s = f->buf ? f->buf : arena_strdup(a, "");
+    if (!s || !vec_push(a, fields, s)) {
+        if (s) arena_free(a, s);
+        return false;
     }
+    *f = (Field){0};
+    return true;
+}
 
-    while (*p) {
-        char c = *p;
+// NAME=... as the first word: an assignment, whose value is never field split.
+static bool looks_like_assignment(const TokenList *tl, const Token *t) {
+    if (t->nparts == 0) return false;
+    const WordPart *wp = &tl->parts[t->first_part];
+    if (wp->kind != WP_UNQ) return false;
+    const char *eq = memchr(wp->text, '=', wp->len);
+    if (!eq || eq == wp->text) return false;
+    if (!(wp->text[0] == '_' || isalpha((unsigned char)wp->text[0]))) return false;
+    for (const char *p = wp->text + 1; p < eq; ++p)
+        if (!(*p == '_' || isalnum((unsigned char)*p))) return false;
+    return true;
+}
 
-        // 1) Escape sequence: copy next char verbatim
-        if (c == '\\' && p[1]) {
-            if (buff_index < (int)sizeof(token_buff) - 1) {
-                token_buff[buff_index++] = p[1];
-            }
-            p += 2;
-            continue;
-        }
+/* expand_word
+ * Turn a word token into fields: expand $ in unquoted and double-quoted
+ * parts, and split only what unquoted expansions produced. Fields are
+ * appended to fields. */
+static bool expand_word(Parser *P, const Token *t, bool split, PtrVec *fields) {
+    Field f = {0};
+    size_t before = fields->count;
 
-        // 2) Quote toggles
-        if (c == '\'' && !in_double) {
-            in_single = !in_single;
-            p++;
-            continue;
-        }
-        if (c == '"' && !in_single) {
-            in_double = !in_double;
-            p++;
-            continue;
+    for (size_t k = 0; k < t->nparts; ++k) {
+        const WordPart *wp = &P->tl->parts[t->first_part + k];
+        const char *val = wp->text;
+        size_t vlen = wp->len;
+
+        char *x = NULL;
+        if (P->vars && wp->kind != WP_LIT && memchr(wp->text, '$', wp->len)) {
+            uint64_t t0 = STATS_START();
+            x = expand_variables_ex(wp->text, P->last_exit, P->vars, P->arena);
+            STATS_STOP(STAT_EXPAND, t0);
+            if (!x) return false;
+            val = x;
+            vlen = strlen(x);
         }
 
-        // 3) Pipe: end current command, start next
-        if (c == '|' && !in_single && !in_double) {
-            // flush any pending word
-            if (buff_index > 0) {
-                token_buff[buff_index] = '\0';
-                if (arg_index < MAX_ARGS - 1) {
-                    current->argv[arg_index++] = strdup(token_buff);
-                }
-                buff_index = 0;
+        bool ok = true;
+        if (wp->kind != WP_UNQ || !x || !split) {
+            ok = field_put(P->arena, &f, val, vlen);
+            if (wp->kind != WP_UNQ) f.live = true;
+        } else {
+            // Field splitting on blanks ($IFS is not supported yet)
+            for (size_t j = 0; ok && j < vlen; ++j) {
+                char c = val[j];
+                if (c == ' ' || c == '\t' || c == '\n')
+                    ok = !f.live || field_flush(P->arena, &f, fields);
+                else
+                    ok = field_put(P->arena, &f, &c, 1);
             }
+        }
+        if (x != wp->text) arena_free(P->arena, x); // unchanged text comes back as is
+        if (!ok) return false;
+    }
 
-            // terminate current->argv
-            current->argv[arg_index] = NULL;
-            current->argc = arg_index;
+    // A word made only of quotes ("" or '') is still one empty argument
+    if (f.live || (t->quoted && fields->count == before))
+        return field_flush(P->arena, &f, fields);
+    return true;
+}
 
-            // store command
-            if (cmd_index < MAX_CMDS) {
-                cmds[cmd_index++] = current;
-            } else {
-                LOG(LOG_LEVEL_ERR, "Too many commands, discarding extra");
-                free_command(current);
-                aborted = true;
-                break;
-            }
+static Command *new_command(Arena *arena) {
+    Command *cmd = arena_calloc(arena, 1, sizeof(Command));
+    if (!cmd) return NULL;
+    cmd->arena = arena;
+    return cmd;
+}
+
+// Close the current stage: give it its argv and redirections and queue it in the pipeline.
+static bool finish_stage(Arena *arena, Command *cmd, PtrVec *args, PtrVec *redirs, PtrVec *stages) {
+    cmd->argc = (int)args->count;
+    cmd->argv = (char **)vec_finish(arena, args);
+    if (!cmd->argv) return false;
+    if (redirs->count) {
+        cmd->nredirs = (int)redirs->count;
+        cmd->redirs = (Redirection **)vec_finish(arena, redirs);
+        if (!cmd->redirs) return false;
+    }
+    return vec_push(arena, stages, cmd);
+}
+
+// Queue one redirection on the current stage (file is kept, not copied)
+static bool add_redir(Arena *arena, PtrVec *redirs, RedirType type, int target, int source, char *file) {
+    Redirection *r = arena_alloc(arena, sizeof(Redirection));
+    if (!r) return false;
+    *r = (Redirection){ type, target, source, file, NULL };
+    if (vec_push(arena, redirs, r)) return true;
+    arena_free(arena, r);
+    return false;
+}
+
+// The word after >& or <&: an fd number, -2 for "-" (close), -1 otherwise
+static int dup_target(const char *w) {
+    if (strcmp(w, "-") == 0) return -2;
+    int fd = 0;
+    if (!*w) return -1;
+    for (const char *p = w; *p; ++p) {
+        if (!isdigit((unsigned char)*p)) return -1;
+        fd = fd * 10 + (*p - '0');
+        if (fd > 9999) return -1; // same limit as the lexer's io numbers
+    }
+    return fd;
+}
+
+static void syntax_error(const TokenList *tl, const Token *near) {
+    fprintf(stderr, "thrash: syntax error near unexpected token `%s'\n",
+            near ? tok_spelling(tl, near) : "newline");
+}
+
+/* parse_tokens
+ * Build the pipeline for tokens [first, last) of one segment (no TOK_SEP or
+ * TOK_AMP in range). Words are expanded here, against vars and last_exit, so
+ * a segment sees assignments made by the segments before it.
+ * Returns NULL and *num_cmds = -1 after printing a syntax error; NULL with
+ * *num_cmds = 0 on allocation failure. With an arena everything is released
+ * by arena_reset(), otherwise by free_command_list(). */
+Command **parse_tokens(const TokenList *tl, size_t first, size_t last,
+                       const VarTable *vars, int last_exit, Arena *arena, int *num_cmds) {
+    Parser P = { tl, vars, last_exit, arena };
+    int dummy;
+    if (!num_cmds) num_cmds = &dummy;
+    *num_cmds = 0;
 
-            // allocate next Command
-            current = calloc(1, sizeof(Command));
-            if (!current) { aborted = true; break; }
-            current->argv = calloc(MAX_ARGS, sizeof(char *));
-            if (!current->argv) { free(current); aborted = true; break; }
+    PtrVec args, stages, redirs;
+    vec_init(&args);
+    vec_init(&stages);
+    vec_init(&redirs);
 
-            arg_index = 0;
-            p++;
-            continue;
+    bool stage_empty = true; // no word or redirection yet in the current stage
+    Command *current = new_command(arena);
+    if (!current) goto oom;
+
+    for (size_t k = first; k < last; ++k) {
+        const Token *t = &tl->tok[k];
+
+        switch (t->type) {
+        case TOK_WORD: {
+            bool split = !(args.count == 0 && looks_like_assignment(tl, t));
+            if (!expand_word(&P, t, split, &args)) goto oom;
+            stage_empty = false;
+            break;
         }
 
-        // 4) Redirection: >, >>, <
-        if ((c == '>' || c == '<') && !in_single && !in_double) {
-            char chevron = c;
-            bool is_append = (c == '>' && p[1] == '>');
-            int specified_fd = -1;
-
-            // If the token buffer is all digits, consume it as a FD spec
-            if (buff_index > 0) {
-                bool all_digits = true;
-                for (int i = 0; i < buff_index; i++) {
-                    if (token_buff[i] < '0' || token_buff[i] > '9') {
-                        all_digits = false;
-                        break;
-                    }
-                }
-                if (all_digits) {
-                    specified_fd = atoi(token_buff);
-                    buff_index = 0;
-                } else {
-                    // flush it as a real argv word
-                    token_buff[buff_index] = '\0';
-                    if (arg_index < MAX_ARGS - 1) {
-                        current->argv[arg_index++] = strdup(token_buff);
-                    }
-                    buff_index = 0;
-                }
+        case TOK_PIPE:
+            if (stage_empty || k + 1 == last) {
+                syntax_error(tl, stage_empty ? t : NULL);
+                goto syntax;
             }
+            if (!finish_stage(arena, current, &args, &redirs, &stages)) goto oom;
+            current = new_command(arena);
+            if (!current) goto oom;
+            stage_empty = true;
+            break;
 
-            // skip the chevron(s)
-            p += is_append ? 2 : 1;
-
-            // skip spaces before filename
-            while (*p && isspace((unsigned char)*p)) p++;
-
-            // parse the filename (respecting quotes)
-            buff_index = 0;
-            while (*p && (!isspace((unsigned char)*p) || in_single || in_double)) {
-                if (*p == '\'' && !in_double) {
-                    in_single = !in_single;
-                    p++;
-                } else if (*p == '"' && !in_single) {
-                    in_double = !in_double;
-                    p++;
-                } else {
-                    if (buff_index < (int)sizeof(token_buff) - 1) {
-                        token_buff[buff_index++] = *p;
-                    }
-                    p++;
-                }
+        case TOK_LESS:
+        case TOK_GREAT:
+        case TOK_DGREAT:
+        case TOK_GREATAND:
+        case TOK_LESSAND: {
+            const Token *target = (k + 1 < last) ? &tl->tok[k + 1] : NULL;
+            if (!target || target->type != TOK_WORD) {
+                syntax_error(tl, target);
+                goto syntax;
             }
-            token_buff[buff_index] = '\0';
-            char *filename = strdup(token_buff);
-            buff_index = 0;
-
-            // assign to input/output as appropriate
-            if (chevron == '<') {
-                current->input_file = filename;
-                current->input_fd = (specified_fd != -1) ? specified_fd : 0;
-            } else if (chevron == '>' && is_append) {
-                current->append_file = filename;
-                current->output_fd = (specified_fd != -1) ? specified_fd : 1;
-            } else {
-                current->output_file = filename;
-                current->output_fd = (specified_fd != -1) ? specified_fd : 1;
+            PtrVec name;
+            vec_init(&name);
+            if (!expand_word(&P, target, false, &name)) goto oom;
+            if (name.count != 1) {
+                fprintf(stderr, "thrash: %.*s: ambiguous redirect\n",
+                        (int)target->len, tl->src + target->start);
+                goto syntax;
             }
-
-            // do not push filename to argv
-            continue;
-        }
-
-        // 5) Whitespace: flush token
-        if (isspace((unsigned char)c) && !in_single && !in_double) {
-            if (buff_index > 0) {
-                token_buff[buff_index] = '\0';
-                if (arg_index < MAX_ARGS - 1) {
-                    current->argv[arg_index++] = strdup(token_buff);
+            char *word = name.items[0];
+            bool input = (t->type == TOK_LESS || t->type == TOK_LESSAND);
+            int fd = (t->io_number != -1) ? t->io_number : input ? 0 : 1;
+            bool ok;
+            if (t->type == TOK_LESS) {
+                ok = add_redir(arena, &redirs, REDIR_IN, fd, -1, word);
+            } else if (t->type == TOK_GREAT) {
+                ok = add_redir(arena, &redirs, REDIR_OUT, fd, -1, word);
+            } else if (t->type == TOK_DGREAT) {
+                ok = add_redir(arena, &redirs, REDIR_APPEND, fd, -1, word);
+            } else {
+                int src = dup_target(word);
+                if (src == -2) {
+                    ok = add_redir(arena, &redirs, REDIR_CLOSE, fd, -1, NULL);
+                } else if (src >= 0) {
+                    ok = add_redir(arena, &redirs, REDIR_DUP, fd, src, NULL);
+                } else if (t->type == TOK_GREATAND && t->io_number == -1) {
+                    // `>&file`: stdout and stderr both to file, as in csh and bash
+                    ok = add_redir(arena, &redirs, REDIR_OUT, 1, -1, word) &&
+                         add_redir(arena, &redirs, REDIR_DUP, 2, 1, NULL);
+                    word = NULL;
+                } else {
+                    fprintf(stderr, "thrash: %s: ambiguous redirect\n", word);
+                    goto syntax;
                 }
-                buff_index = 0;
+                if (word) arena_free(arena, word);
             }
-            p++;
-            continue;
+            if (!ok) goto oom;
+            stage_empty = false;
+            k++; // filename consumed; never part of argv
+            break;
         }
 
-        // 6) Regular character: accumulate
-        if (buff_index < (int)sizeof(token_buff) - 1) {
-            token_buff[buff_index++] = c;
+        case TOK_SEP:
+        case TOK_AMP:
+        default:
+            break; // callers hand us one segment; nothing to do
         }
-        p++;
     }
 
-    // Final flush if not aborted
-    if (!aborted) {
-        if (buff_index > 0) {
-            token_buff[buff_index] = '\0';
-            if (arg_index < MAX_ARGS - 1) {
-                current->argv[arg_index++] = strdup(token_buff);
-            }
-        }
-        current->argv[arg_index] = NULL;
-        current->argc = arg_index;
+    if (!finish_stage(arena, current, &args, &redirs, &stages)) goto oom;
+    *num_cmds = (int)stages.count;
+    return (Command **)vec_finish(arena, &stages);
 
-        if (cmd_index < MAX_CMDS) {
-            cmds[cmd_index++] = current;
-        } else {
-            LOG(LOG_LEVEL_ERR, "Final command exceeds MAX_CMDS, discarding");
-            free_command(current);
-        }
+syntax:
+    *num_cmds = -1;
+    return NULL;
+
+oom:
+    LOG(LOG_LEVEL_ERR, "parse_tokens: out of memory");
+    return NULL;
+}
+
+char **expand_words(const TokenList *tl, size_t first, size_t last,
+                    const VarTable *vars, int last_exit, Arena *arena, size_t *count) {
+    Parser P = { tl, vars, last_exit, arena };
+    PtrVec fields;
+    vec_init(&fields);
+    for (size_t k = first; k < last; ++k) {
+        if (tl->tok[k].type != TOK_WORD) continue;
+        if (!expand_word(&P, &tl->tok[k], true, &fields)) return NULL;
     }
+    *count = fields.count;
+    return (char **)vec_finish(arena, &fields);
+}
 
-    if (num_cmds) *num_cmds = cmd_index;
+/* parse_commands
+ * Split the first segment (up to ; or &) into pipeline stages (argv +
+ * redirections), taking words literally (no expansion). Thin wrapper over lex_input() +
+ * parse_tokens(); with an arena every Command, argv array and string comes
+ * from it, with NULL the result must be released with free_command_list(). */
+Command **parse_commands(const char *input, int *num_cmds, Arena *arena) {
+    TokenList tl;
+    if (num_cmds) *num_cmds = 0;
+    if (lex_input(input, arena, &tl) != LEX_OK) {
+        token_list_free(&tl, arena);
+        return NULL;
+    }
+    size_t end = 0;
+    while (end < tl.count && tl.tok[end].type != TOK_SEP && tl.tok[end].type != TOK_AMP) end++;
+    Command **cmds = parse_tokens(&tl, 0, end, NULL, 0, arena, num_cmds);
+    if (!arena) token_list_free(&tl, NULL); // argv strings were copied out of tl.text
     return cmds;
-}
\ No newline at end of file
+}
@@ -2,7 +2,20 @@
 #define PARSER_H
 
 #include "command.h"
+#include "arena.h"
+#include "lexer.h"
+#include "var.h"
 
-Command **parse_commands(const char *input, int *num_cmds);
+// Pipeline for tokens [first, last) of one segment, with words expanded
+// against vars (NULL = literal). *num_cmds = -1 reports a syntax error.
+Command **parse_tokens(const TokenList *tl, size_t first, size_t last,
+                       const VarTable *vars, int last_exit, Arena *arena, int *num_cmds);
+
+// Words [first, last) expanded and field split as arguments are: the list
+// after `for x in`. NULL-terminated, from arena; NULL when out of memory.
+char **expand_words(const TokenList *tl, size_t first, size_t last,
+                    const VarTable *vars, int last_exit, Arena *arena, size_t *count);
+
+Command **parse_commands(const char *input, int *num_cmds, Arena *arena);
 
 #endif
\ No newline at end of file
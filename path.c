@@ -8,6 +8,7 @@
 #include <sys/stat.h>
 #include "path.h"
 #include "debug.h"
+#include "hash.h"
 
 
 // Program prefix for error messages. Consider wiring this to your prompt name.
@@ -59,13 +60,161 @@ bool is_executable(const char *path) {
 }
 
 
-/* PATH lookup result codes to disambiguate outcomes without forking.  */
-enum path_lookup {
-    FOUND_EXEC   = 0,   // Found an executable regular file
-    NOT_FOUND    = -1,  // No candidate found anywhere on PATH
-    FOUND_NOEXEC = -2,  // Found regular file but not executable
-    FOUND_DIR    = -3   // Found a directory named like the command
-};
+/* Command hash
+ * Chained FNV-1a table (same scheme as the VarTable in var.c) mapping a bare
+ * command name to the path search_path_alloc() last resolved for it, so that
+ * repeated commands cost one access(2) instead of a stat storm over every
+ * PATH segment. Invalidated wholesale by path_hash_clear() when PATH changes. */
+typedef struct CmdHash {
+    char *name;            // Command name as typed (no slash)
+    char *path;            // Resolved candidate, e.g. "/usr/bin/ls"
+    unsigned hits;         // Times this entry satisfied a lookup
+    struct CmdHash *next;  // Next entry in the bucket chain
+} CmdHash;
+
+/* PATH as the shell sees it. var.c pushes every set/unset of PATH here, so
+ * lookups follow `PATH=...` even when it isn't exported, and never call getenv. */
+static char *search_path = NULL;
+static unsigned long search_gen = 0;
+
+static CmdHash **cmd_buckets = NULL; // Bucket heads; nbuckets is a power of two
+static size_t cmd_nbuckets = 0;
+static size_t cmd_count = 0;
+
+static CmdHash *path_hash_find(const char *cmd) {
+    if (!cmd_buckets) return NULL;
+    size_t idx = (size_t)(fnv1a64(cmd) & (cmd_nbuckets - 1));
+    for (CmdHash *e = cmd_buckets[idx]; e; e = e->next)
+        if (strcmp(e->name, cmd) == 0) return e;
+    return NULL;
+}
+
+/* Double the bucket array once load factor reaches 0.75 (mirrors maybe_resize in var.c). */
+static bool path_hash_grow(void) {
+    if (cmd_buckets && (cmd_count * 4) < (cmd_nbuckets * 3)) return true;
+    size_t newn = cmd_nbuckets ? cmd_nbuckets << 1 : 64;
+    CmdHash **newb = calloc(newn, sizeof(CmdHash *));
+    if (!newb) return false;
+    for (size_t i = 0; i < cmd_nbuckets; ++i) {
+        CmdHash *e = cmd_buckets[i];
+        while (e) {
+            CmdHash *next = e->next;
+            size_t idx = (size_t)(fnv1a64(e->name) & (newn - 1));
+            e->next = newb[idx];
+            newb[idx] = e;
+            e = next;
+        }
+    }
+    free(cmd_buckets);
+    cmd_buckets = newb;
+    cmd_nbuckets = newn;
+    return true;
+}
+
+/* Cache cmd → path. Failure to allocate only costs us the cache, never the lookup. */
+static void path_hash_insert(const char *cmd, const char *path) {
+    CmdHash *e = path_hash_find(cmd);
+    if (e) {
+        char *np = strdup(path);
+        if (!np) return;
+        free(e->path);
+        e->path = np;
+        return;
+    }
+    if (!path_hash_grow()) return;
+    e = calloc(1, sizeof(CmdHash));
+    if (!e) return;
+    e->name = strdup(cmd);
+    e->path = strdup(path);
+    if (!e->name || !e->path) {
+        free(e->name);
+        free(e->path);
+        free(e);
+        return;
+    }
+    size_t idx = (size_t)(fnv1a64(cmd) & (cmd_nbuckets - 1));
+    e->next = cmd_buckets[idx];
+    cmd_buckets[idx] = e;
+    cmd_count++;
+    LOG(LOG_LEVEL_INFO, "hashed %s -> %s", cmd, path);
+}
+
+bool path_hash_forget(const char *cmd) {
+    if (!cmd_buckets || !cmd) return false;
+    size_t idx = (size_t)(fnv1a64(cmd) & (cmd_nbuckets - 1));
+    for (CmdHash **pp = &cmd_buckets[idx]; *pp; pp = &(*pp)->next) {
+        CmdHash *e = *pp;
+        if (strcmp(e->name, cmd) == 0) {
+            *pp = e->next;
+            free(e->name);
+            free(e->path);
+            free(e);
+            cmd_count--;
+            return true;
+        }
+    }
+    return false;
+}
+
+void path_hash_clear(void) {
+    for (size_t i = 0; i < cmd_nbuckets; ++i) {
+        CmdHash *e = cmd_buckets[i];
+        while (e) {
+            CmdHash *next = e->next;
+            free(e->name);
+            free(e->path);
+            free(e);
+            e = next;
+        }
+        cmd_buckets[i] = NULL;
+    }
+    cmd_count = 0;
+}
+
+void path_hash_dispose(void) {
+    path_hash_clear();
+    free(cmd_buckets);
+    free(search_path);
+    search_path = NULL;
+    cmd_buckets = NULL;
+    cmd_nbuckets = 0;
+}
+
+void path_set_search(const char *path) {
+    char *copy = path ? strdup(path) : NULL;
+    if (path && !copy) return; // keep the old PATH rather than losing lookups
+    free(search_path);
+    search_path = copy;
+    search_gen++;
+    path_hash_clear(); // every cached resolution is suspect under a new PATH
+}
+
+const char *path_search(void) {
+    return search_path;
+}
+
+unsigned long path_generation(void) {
+    return search_gen;
+}
+
+bool path_hash_remember(const char *cmd) {
+    char *resolved = NULL;
+    path_hash_forget(cmd); // `hash name` always re-searches PATH
+    if (search_path_alloc(cmd, &resolved) != 0 || !resolved) return false;
+    free(resolved);
+    return true;
+}
+
+void path_hash_print(FILE *out) {
+    if (cmd_count == 0) {
+        fprintf(out, "hash: hash table empty\n");
+        return;
+    }
+    fprintf(out, "hits\tcommand\n");
+    for (size_t i = 0; i < cmd_nbuckets; ++i)
+        for (CmdHash *e = cmd_buckets[i]; e; e = e->next)
+            fprintf(out, "%4u\t%s\n", e->hits, e->path);
+}
 
  /* search_path_alloc
  * Resolve a command name (no slash) against PATH, trying each segment.
@@ -77,12 +226,28 @@ enum path_lookup {
  *
  * Notes:
  * - Empty PATH segment means current directory; we render "./cmd" in that case.
+ * - Only hits from absolute segments are hashed: relative ones follow cd.
  * - We prefer the first executable regular file we encounter.
  * - If we encounter only non-exec files or directories named like the cmd,
  *   we remember that to return a more precise error (126 vs 127). */
  // INTEGRATE WITH DEBUG!
  int search_path_alloc(const char *cmd, char **outp) {
-    const char *path = getenv("PATH");
+    // Hashed? The same checks as a fresh search confirm the entry is still
+    // runnable; a stale one (removed, chmod'ed, now a directory) is dropped
+    // and PATH is walked again.
+    CmdHash *hit = path_hash_find(cmd);
+    if (hit) {
+        if (is_regular(hit->path) && is_executable(hit->path)) {
+            char *copy = strdup(hit->path);
+            if (!copy) return NOT_FOUND;
+            hit->hits++;
+            *outp = copy;        // caller takes ownership
+            return FOUND_EXEC;
+        }
+        path_hash_forget(cmd);
+    }
+
+    const char *path = search_path;
     if (!path || !*path) return NOT_FOUND;
 
     int found_noexec = 0, found_dir = 0;
@@ -104,6 +269,8 @@ enum path_lookup {
             free(candidate);
         } else if (is_regular(candidate)) { 
             if (is_executable(candidate)) {
+                // A relative segment ("", ".") names another file after cd
+                if (candidate[0] == '/') path_hash_insert(cmd, candidate);
                 *outp = candidate;  // caller takes ownership
                 return FOUND_EXEC;
             } else {
@@ -1,6 +1,17 @@
 #ifndef PATH_H
 #define PATH_H
 
+#include <stdbool.h>
+#include <stdio.h>
+
+/* PATH lookup result codes to disambiguate outcomes without forking.  */
+enum path_lookup {
+    FOUND_EXEC   = 0,   // Found an executable regular file
+    NOT_FOUND    = -1,  // No candidate found anywhere on PATH
+    FOUND_NOEXEC = -2,  // Found regular file but not executable
+    FOUND_DIR    = -3   // Found a directory named like the command
+};
+
 int search_path_alloc(const char *cmd, char **outp);
 
 bool has_slash(const char *s); 
@@ -13,4 +24,19 @@ bool is_executable(const char *path);
 
 void print_exec_error(const char *what, int err);
 
-#endif
\ No newline at end of file
+// Command hash (bash-style `hash`): remembers name → resolved path for PATH lookups
+bool path_hash_remember(const char *cmd);  // resolve via PATH and cache; false if not found
+
+bool path_hash_forget(const char *cmd);    // drop one entry; false if not hashed
+
+void path_hash_clear(void);                // drop everything (PATH changed, `hash -r`)
+
+void path_hash_print(FILE *out);           // "hits\tcommand" listing for `hash`
+
+void path_hash_dispose(void);              // free all storage at shell exit
+
+void path_set_search(const char *path);    // PATH value to search (NULL = unset); clears the hash
+const char *path_search(void);             // that value, NULL if unset
+unsigned long path_generation(void);       // bumped by every path_set_search(); for caches keyed on PATH
+
+#endif
@@ -0,0 +1,51 @@
+#!/bin/sh
+# pgo_train.sh — training workload for `make pgo`.
+# Usage: ./pgo_train.sh path/to/thrash [path/to/bench]
+# Exercises what a tuned binary should be fast at: startup, lexing/parsing,
+# expansion, builtins, fork/spawn and pipelines, job control and `time`.
+# With the bench binary (built from the same instrumented objects) its
+# quick run is part of the workload too.
+set -e
+
+T=${1:?usage: $0 path/to/thrash [path/to/bench]}
+B=${2:-}
+WORK=$(mktemp -d "${TMPDIR:-/tmp}/thrash-pgo.XXXXXX")
+trap 'rm -rf "$WORK"' EXIT
+
+# Startup: one short -c command per run
+i=0
+while [ $i -lt 200 ]; do
+    "$T" -c 'true' </dev/null >/dev/null 2>&1
+    i=$((i + 1))
+done
+
+# Command latency: one long script mixing the usual kinds of lines
+S="$WORK/train.sh"
+i=0
+while [ $i -lt 400 ]; do
+    cat >>"$S" <<EOF
+X$i=value_$i; Y="\$X$i and \$HOME"; echo "\$Y" '\$literal' \$? >/dev/null
+export E$i=\$X$i; unset X$i
+true; false; : ; printf '%s\n' a b c >/dev/null
+echo one two three | cat | tr a-z A-Z >/dev/null
+/bin/true
+cd /; cd - >/dev/null
+EOF
+    i=$((i + 1))
+done
+cat >>"$S" <<'EOF'
+yes | head -c 1000000 | wc -c >/dev/null
+sleep 0.01 & sleep 0.01 & wait
+time -p true 2>/dev/null
+time -j echo x | cat >/dev/null 2>&1
+hash >/dev/null; jobs; trace dump >/dev/null; stats >/dev/null
+EOF
+"$T" "$S" </dev/null >/dev/null 2>&1 || true
+
+# Error paths are part of the workload too
+"$T" -c 'nosuchcommand; echo "unterminated' </dev/null >/dev/null 2>&1 || true
+"$T" -c '| bad; echo a >' </dev/null >/dev/null 2>&1 || true
+
+if [ -n "$B" ]; then
+    "$B" --quick --shell "$T" >/dev/null 2>&1
+fi
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE // pipe2(), F_SETPIPE_SZ
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
@@ -6,21 +7,60 @@
 #include <errno.h>
 #include <time.h>
 #include <limits.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
 #include "pipeline.h"
 #include "shell.h"
 #include "command.h"
 #include "executor.h"
 #include "signals.h"
 #include "builtins.h"
+#include "redirect.h"
+#include "debug.h"
+#include "var.h"
 
 
 // A pipe consists of two fds: [0]=read end, [1]=write end.
 typedef int pipe_pair_t[2];
+
+/* pipe_buffer_size
+ * Capacity requested for pipeline pipes, from $THRASH_PIPE_SIZE (bytes).
+ * Unset, empty, or not a positive number: keep the kernel default (64 KiB on
+ * Linux). Bigger pipes let a fast producer run ahead of its consumer with
+ * fewer context switches; the kernel rounds up to a power-of-two of pages
+ * and caps unprivileged requests at /proc/sys/fs/pipe-max-size. */
+int pipe_buffer_size(const ShellContext *shell) {
+    Var *v = shell ? vart_get(shell->vars, "THRASH_PIPE_SIZE") : NULL;
+    if (!v || !v->value || !*v->value) return 0;
+    char *end = NULL;
+    long n = strtol(v->value, &end, 10);
+    if (*end || n <= 0 || n > INT_MAX) return 0;
+    return (int)n;
+}
+
+// One pipe with both ends close-on-exec: pipe2() where available (always on
+// Linux), else pipe() + fcntl().
+int cloexec_pipe(int fds[2]) {
+#if defined(__linux__) || defined(HAVE_PIPE2)
+    return pipe2(fds, O_CLOEXEC);
+#else
+    if (pipe(fds) < 0) return -1;
+    if (fcntl(fds[0], F_SETFD, FD_CLOEXEC) < 0 || fcntl(fds[1], F_SETFD, FD_CLOEXEC) < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    return 0;
+#endif
+}
+
 /* create_pipes
  * Allocate and initialize num_cmds-1 pipes for a pipeline of num_cmds commands.
- * Returns a calloc’d array of pipe_pair_t, each with CLOEXEC set.
+ * Returns a calloc’d array of pipe_pair_t, each with CLOEXEC set and, when
+ * pipe_size > 0, resized with F_SETPIPE_SZ (a refused resize is not an error).
  * On failure closes any fds opened so far, frees the array, and returns NULL. */
-pipe_pair_t *create_pipes(int num_cmds) {
+pipe_pair_t *create_pipes(int num_cmds, int pipe_size) {
     int count = num_cmds - 1;
     if (count <= 0) {
         return NULL;
@@ -32,8 +72,7 @@ pipe_pair_t *create_pipes(int num_cmds) {
     }
 
     for (int i = 0; i < count; ++i) {
-#if defined(HAVE_PIPE2)
-        if (pipe2(pipes[i], O_CLOEXEC) < 0) {
+        if (cloexec_pipe(pipes[i]) < 0) {
             for (int j = 0; j < i; ++j) {
                 close(pipes[j][0]);
                 close(pipes[j][1]);
@@ -41,24 +80,9 @@ pipe_pair_t *create_pipes(int num_cmds) {
             free(pipes);
             return NULL;
         }
-#else
-        if (pipe(pipes[i]) < 0) {
-            for (int j = 0; j < i; ++j) {
-                close(pipes[j][0]);
-                close(pipes[j][1]);
-            }
-            free(pipes);
-            return NULL;
-        }
-        if (fcntl(pipes[i][0], F_SETFD, FD_CLOEXEC) < 0 ||
-            fcntl(pipes[i][1], F_SETFD, FD_CLOEXEC) < 0) {
-            for (int j = 0; j <= i; ++j) {
-                close(pipes[j][0]);
-                close(pipes[j][1]);
-            }
-            free(pipes);
-            return NULL;
-        }
+#ifdef F_SETPIPE_SZ
+        if (pipe_size > 0 && fcntl(pipes[i][1], F_SETPIPE_SZ, pipe_size) < 0)
+            LOG(LOG_LEVEL_WARN, "F_SETPIPE_SZ %d: %s", pipe_size, strerror(errno));
 #endif
     }
 
@@ -66,12 +90,19 @@ pipe_pair_t *create_pipes(int num_cmds) {
 }
 
 
-/* Close all pipe FDs in parent */
+/* Close all pipe FDs in parent (skipping ones already released) */
 void close_pipes(pipe_pair_t *pipes, int num_cmds) {
     if (!pipes) return;
-    for (int i = 0; i < num_cmds - 1; ++i) {
-        close(pipes[i][0]);
-        close(pipes[i][1]);
+    for (int i = 0; i < num_cmds - 1; ++i) release_pipe(pipes, i);
+}
+
+/* Close both ends of pipe i and mark them -1. The launch loop drops each pipe
+ * once both of its stages exist, so later stages inherit fewer fds and a
+ * reader sees EOF as soon as its writer exits. */
+void release_pipe(pipe_pair_t *pipes, int i) {
+    for (int e = 0; e < 2; ++e) {
+        if (pipes[i][e] >= 0) close(pipes[i][e]);
+        pipes[i][e] = -1;
     }
 }
 
@@ -85,16 +116,9 @@ void destroy_pipes(pipe_pair_t *pipes, int num_cmds) {
 
 /* Child-side setup: PGID, dup2 pipes, close FDs, reset signals, exec. */
 void setup_pipeline_child(ShellContext *shell, int idx, int num_cmds, pipe_pair_t *pipes, Command *cmd, pid_t leader_pgid) {
-    // Process group: leader or join existing group
-    if (leader_pgid == 0) {
-        setpgid(0, 0); // become group leader
-    } else {
-        if (setpgid(0, leader_pgid) < 0 &&
-            errno != EACCES && errno != EINVAL && errno != EPERM)
-        {
-            // benign races—parent will retry
-        }
-    }
+    // Process group: leader or join existing group (job control only). The
+    // parent makes the same call (join_pgid), so neither side has to win.
+    if (shell->interactive) setpgid(0, leader_pgid); // 0 → become group leader
 
     // Wire up stdin from previous pipe
     if (idx > 0) {
@@ -113,12 +137,7 @@ void setup_pipeline_child(ShellContext *shell, int idx, int num_cmds, pipe_pair_
     }
 
     // Close all pipe FDs (we're done with them)
-    if (pipes) {
-        for (int j = 0; j < num_cmds - 1; ++j) {
-            close(pipes[j][0]);
-            close(pipes[j][1]);
-        }
-    }
+    close_pipes(pipes, num_cmds);
 
     // Reset signals to default behavior
     setup_child_signals();
@@ -130,54 +149,123 @@ void setup_pipeline_child(ShellContext *shell, int idx, int num_cmds, pipe_pair_
     _exit(127);
 }
 
-void try_setpgid(pid_t pid, pid_t pgid) {
+/* join_pgid
+ * Parent's half of putting a child into its job's process group; the child
+ * makes the same setpgid() call before it execs. Whichever runs first does the
+ * work and the other is a no-op, so there is no ordering to wait for and
+ * nothing to retry. EACCES (the child already exec'd, having moved itself)
+ * and ESRCH (already exited) are expected. The group itself can't vanish
+ * mid-launch: its leader stays an unreaped zombie at worst, since nothing
+ * reaps until the launch loop is done. */
+void join_pgid(pid_t pid, pid_t pgid) {
     if (pid <= 0 || pgid <= 0) return;
+    if (setpgid(pid, pgid) < 0 && errno != EACCES && errno != ESRCH)
+        LOG(LOG_LEVEL_WARN, "setpgid(%d, %d): %s", (int)pid, (int)pgid, strerror(errno));
+}
 
-    struct timespec delay = {0, 5 * 1000 * 1000}; // 5ms
-
-    for (int attempt = 0; attempt < 10; ++attempt) {
-        if (setpgid(pid, pgid) == 0) return;
+/* Output of an in-process builtin on its way into a pipe. */
+typedef struct {
+    int fd;       // private dup of the stage's write end
+    char *buf;    // open_memstream buffer
+    size_t len;
+} PipeFeed;
 
-        switch (errno) {
-            case EACCES:
-            case EINVAL:
-            case EPERM:
-            case ESRCH:
-                return; // Fatal or process gone
-            default:
-                // Transient error—retry
-                break;
+static void *pipe_feeder(void *arg) {
+    PipeFeed *pf = arg;
+    size_t off = 0;
+    while (off < pf->len) {
+        ssize_t n = write(pf->fd, pf->buf + off, pf->len - off);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break; // EPIPE: reader went away (SIGPIPE is blocked in this thread)
         }
+        off += (size_t)n;
+    }
+    close(pf->fd);
+    free(pf->buf);
+    free(pf);
+    return NULL;
+}
+
+/* Hand buf to the pipe behind out_fd. A fresh pipe always has room for
+ * PIPE_BUF bytes, so small outputs are written directly without blocking.
+ * Anything larger goes to a detached thread holding its own dup of the write
+ * end, so a slow (or stopped, or absent) reader never stalls the shell.
+ * Takes ownership of buf. Returns false if nothing could be started. */
+static bool feed_pipe(int out_fd, char *buf, size_t len) {
+    if (len <= PIPE_BUF) {
+        if (len && write(out_fd, buf, len) < 0) LOG(LOG_LEVEL_WARN, "builtin pipe write: %s", strerror(errno));
+        free(buf);
+        return true;
+    }
+
+    PipeFeed *pf = malloc(sizeof(PipeFeed));
+    int fd = fcntl(out_fd, F_DUPFD_CLOEXEC, 0);
+    if (!pf || fd < 0) {
+        if (fd >= 0) close(fd);
+        free(pf);
+        free(buf);
+        return false;
+    }
+    *pf = (PipeFeed){ fd, buf, len };
 
-        nanosleep(&delay, NULL);
+    // The thread inherits a fully blocked mask: job-control signals keep going
+    // to the main thread, and a broken pipe shows up as EPIPE, not SIGPIPE.
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    pthread_t tid;
+    int rc = pthread_create(&tid, NULL, pipe_feeder, pf);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (rc != 0) {
+        close(fd);
+        free(pf->buf);
+        free(pf);
+        return false;
     }
-    // Optional: log persistent failure
-    fprintf(stderr, "try_setpgid: failed to setpgid(%d, %d): %s\n",
-            pid, pgid, strerror(errno));
+    pthread_detach(tid);
+    return true;
 }
 
-int handle_builtin_in_pipeline(ShellContext *shell, Command *cmd, int num_cmds) {
+/* handle_builtin_in_pipeline
+ * Run a builtin stage inside the shell instead of forking. out_fd is the
+ * stage's pipe write end, or -1 for the last stage (writes to stdout).
+ * Returns 1 when handled (*status set), 0 when the stage needs a child:
+ * not a builtin, or an output builtin with redirections that feeds a pipe. */
+int handle_builtin_in_pipeline(ShellContext *shell, Command *cmd, int out_fd, int *status) {
     if (!cmd || !cmd->argv || !cmd->argv[0]) return 0;
 
-    const char *name = cmd->argv[0];
+    const Builtin *b = find_builtin(cmd->argv[0]);
+    if (!b) return 0;
 
-    if (strcmp(name, "cd") == 0) {
-        handle_cd(cmd); // now accepts full Command*
-        reclaim_terminal(shell);
-        shell->pipeline_pgid = 0;
-        return 1; // handled, skip fork
+    if (b->flags & BI_NOPIPE) {
+        fprintf(stderr, "%s: cannot be used in a pipeline\n", b->name);
+        *status = 1;
+        return 1;
     }
+    // Redirections are applied in the shell around the builtin. An output
+    // builtin feeding a pipe forks instead when it has any, so that `2>&1`
+    // and the like see the pipe as fd 1; so does a cwd override.
+    if (!(b->flags & BI_SHELL) && (cmd->cwd_override || (out_fd >= 0 && command_has_redirections(cmd))))
+        return 0;
 
-    if (strcmp(name, "exit") == 0) {
-        if (num_cmds == 1) {
-            shell->running = 0;
-            return 2; // signal shell to exit
-        } else {
-            fprintf(stderr,
-                    "thrash: builtin 'exit' cannot be used in a pipeline\n");
-            return 1; // handled, skip fork
-        }
+    if (out_fd < 0) {
+        *status = run_builtin_redirected(shell, b, cmd, stdout);
+        return 1;
     }
 
-    return 0; // not a builtin
-}
\ No newline at end of file
+    char *buf = NULL;
+    size_t len = 0;
+    FILE *mem = open_memstream(&buf, &len);
+    if (!mem) return 0;
+    *status = run_builtin_redirected(shell, b, cmd, mem);
+    if (fclose(mem) != 0) {
+        free(buf);
+        return 0;
+    }
+    if (!feed_pipe(out_fd, buf, len)) {
+        LOG(LOG_LEVEL_ERR, "could not feed pipe for builtin %s", b->name);
+        *status = 1;
+    }
+    return 1;
+}
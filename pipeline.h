@@ -7,11 +7,14 @@
 #include "shell.h"
 typedef int pipe_pair_t[2];
 
-pipe_pair_t *create_pipes(int num_cmds);
+int cloexec_pipe(int fds[2]); // both ends O_CLOEXEC; 0 or -1 with errno
+int pipe_buffer_size(const ShellContext *shell); // $THRASH_PIPE_SIZE in bytes; 0 = kernel default
+pipe_pair_t *create_pipes(int num_cmds, int pipe_size);
 void close_pipes(pipe_pair_t *pipes, int num_cmds);
+void release_pipe(pipe_pair_t *pipes, int i);
 void destroy_pipes(pipe_pair_t *pipes, int num_cmds);
 void setup_pipeline_child(ShellContext *shell, int idx, int num_cmds, pipe_pair_t *pipes, Command *cmd, pid_t leader_pgid);
-void try_setpgid(pid_t pid, pid_t pgid);
-int handle_builtin_in_pipeline(ShellContext *shell, Command *cmd, int num_cmds);
+void join_pgid(pid_t pid, pid_t pgid); // parent side; the child calls setpgid() too
+int handle_builtin_in_pipeline(ShellContext *shell, Command *cmd, int out_fd, int *status);
 
 #endif
\ No newline at end of file
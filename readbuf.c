@@ -0,0 +1,161 @@
+// readbuf.c
+/* One Level per fd 0 the shell has had: the shell's own, then one for each
+ * redirection of fd 0 in effect, innermost on top. Each keeps its own
+ * read-ahead, so `read x < other` inside a `done < fifo` loop leaves the
+ * loop's buffered lines where they were. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "readbuf.h"
+#include "debug.h"
+
+#define READBUF_BLOCK (64 * 1024)
+
+typedef enum {
+    RB_UNKNOWN, // not looked at since fd 0 last changed hands
+    RB_SEEK,    // regular file: blocks, the rest given back by readbuf_sync()
+    RB_BLOCK,   // terminal or owned pipe: blocks, nothing to give back
+    RB_BYTE     // anything else: one byte per read(2)
+} Mode;
+
+typedef struct Level {
+    char *buf;
+    size_t cap;   // bytes allocated
+    size_t start; // first unread byte
+    size_t end;   // one past last valid byte
+    Mode mode;
+    bool owned;   // put there by a compound command's redirection
+    struct Level *outer;
+} Level;
+
+static Level shell_stdin;
+static Level *cur = &shell_stdin;
+static Level unstacked_level = { .mode = RB_BYTE }; // readbuf_push() out of memory...
+static int unstacked;                                // ...this many times
+static char *spare;    // a popped level's buffer, for the next one
+static size_t spare_cap;
+
+static Level *level(void) {
+    return unstacked ? &unstacked_level : cur;
+}
+
+static Mode probe(bool owned) {
+    struct stat st;
+    if (fstat(STDIN_FILENO, &st) != 0) return RB_BYTE;
+    if (S_ISREG(st.st_mode)) return RB_SEEK;
+    if (isatty(STDIN_FILENO)) return RB_BLOCK;
+    if (owned && (S_ISFIFO(st.st_mode) || S_ISSOCK(st.st_mode))) return RB_BLOCK;
+    return RB_BYTE;
+}
+
+// Room for at least one more byte plus the NUL, partial line slid to the front
+static bool make_room(Level *L, size_t *scan) {
+    if (L->start > 0) {
+        memmove(L->buf, L->buf + L->start, L->end - L->start);
+        L->end -= L->start;
+        *scan -= L->start;
+        L->start = 0;
+    }
+    if (L->end + 1 < L->cap) return true;
+    size_t ncap = L->cap ? L->cap * 2 : (L->mode == RB_BYTE ? 256 : READBUF_BLOCK);
+    if (!L->buf && spare && spare_cap >= ncap) {
+        L->buf = spare;
+        L->cap = spare_cap;
+        spare = NULL;
+        return true;
+    }
+    char *nb = realloc(L->buf, ncap);
+    if (!nb) return false;
+    L->buf = nb;
+    L->cap = ncap;
+    return true;
+}
+
+char *readbuf_line(size_t *len, bool *newline) {
+    Level *L = level();
+    if (L->mode == RB_UNKNOWN) L->mode = probe(L->owned);
+    size_t scan = L->start;
+    for (;;) {
+        char *nl = scan < L->end ? memchr(L->buf + scan, '\n', L->end - scan) : NULL;
+        if (nl) {
+            char *line = L->buf + L->start;
+            *nl = '\0';
+            *len = (size_t)(nl - line);
+            *newline = true;
+            L->start = (size_t)(nl - L->buf) + 1;
+            return line;
+        }
+        scan = L->end;
+        if (!make_room(L, &scan)) {
+            errno = ENOMEM;
+            return NULL;
+        }
+
+        size_t want = L->mode == RB_BYTE ? 1 : L->cap - L->end - 1;
+        ssize_t n = read(STDIN_FILENO, L->buf + L->end, want);
+        if (n < 0) return NULL;
+        if (n == 0) {
+            if (L->start == L->end) {
+                errno = 0;
+                return NULL;
+            }
+            char *line = L->buf + L->start;
+            L->buf[L->end] = '\0';
+            *len = L->end - L->start;
+            *newline = false;
+            L->start = L->end;
+            return line;
+        }
+        L->end += (size_t)n;
+    }
+}
+
+void readbuf_sync(void) {
+    Level *L = level();
+    if (L->mode == RB_SEEK && L->end > L->start) {
+        if (lseek(STDIN_FILENO, -(off_t)(L->end - L->start), SEEK_CUR) < 0)
+            LOG(LOG_LEVEL_WARN, "readbuf: lseek back: %s", strerror(errno));
+        L->start = L->end = 0;
+    }
+    // Whoever had fd 0 meanwhile may have read from it, or swapped it
+    if (L->start == L->end) {
+        L->start = L->end = 0;
+        if (L != &unstacked_level) L->mode = RB_UNKNOWN;
+    }
+}
+
+void readbuf_push(bool owned) {
+    readbuf_sync();
+    Level *L = unstacked ? NULL : calloc(1, sizeof(Level));
+    if (!L) {
+        // Byte at a time until the matching pop: slower, never wrong
+        LOG(LOG_LEVEL_WARN, "readbuf: out of memory, reading fd 0 unbuffered");
+        unstacked++;
+        return;
+    }
+    L->owned = owned;
+    L->outer = cur;
+    cur = L;
+}
+
+void readbuf_pop(void) {
+    readbuf_sync(); // the fd may be a dup of one that stays open
+    if (unstacked) {
+        unstacked_level.start = unstacked_level.end = 0;
+        unstacked--;
+        return;
+    }
+    if (cur == &shell_stdin) return; // unbalanced; nothing to undo
+    Level *L = cur;
+    cur = L->outer;
+    if (!spare) {
+        spare = L->buf;
+        spare_cap = L->cap;
+    } else {
+        free(L->buf);
+    }
+    free(L);
+}
@@ -0,0 +1,35 @@
+// readbuf.h
+#ifndef READBUF_H
+#define READBUF_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Read-ahead on the shell's own stdin, for the read builtin.
+ * read has to leave fd 0 just past the line it took, which on a pipe means
+ * one read(2) per byte. Here fd 0 is read in blocks wherever the extra can't
+ * be seen:
+ *   - a regular file: what was read ahead is given back with lseek() before
+ *     anyone else gets to use fd 0 (a child, or a redirection replacing it);
+ *   - a terminal: read(2) never returns more than a line there anyway;
+ *   - a pipe or FIFO a compound command's redirection put on fd 0
+ *     (`while read l; do ...; done < fifo`): the loop owns it, and what is
+ *     left over goes when the redirection is undone. A command in the body
+ *     that reads stdin itself starts after the read-ahead.
+ * Anything else, like the pipe thrash was started on, goes a byte at a time. */
+
+// Next line of fd 0 without its newline, NUL-terminated and valid until the
+// next call. *newline tells whether one ended it (not so for a last line cut
+// off by EOF). NULL at EOF with nothing read, or on error with errno set;
+// EINTR is returned too, with nothing lost, so the caller can decide.
+char *readbuf_line(size_t *len, bool *newline);
+
+// Before a child shares fd 0: seek back over the read-ahead
+void readbuf_sync(void);
+
+// A redirection in the shell is about to replace fd 0 (owned: by a compound
+// command), or is about to be undone. Called in pairs, innermost first.
+void readbuf_push(bool owned);
+void readbuf_pop(void);
+
+#endif // READBUF_H
@@ -1,5 +1,7 @@
 // redirect.c
+#define _GNU_SOURCE // memfd_create(), pipe2()
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <fcntl.h>
@@ -7,7 +9,10 @@
 #include "redirect.h"
 #include "debug.h"
 #include "command.h"
+#include "readbuf.h"
 #include <errno.h>
+#include <limits.h>     // PIPE_BUF
+#include <sys/mman.h>   // memfd_create()
 
 //-----------------------------------------------------------------------------
 // Helper: remove two entries (redir token + filename) from cmd->argv at `pos`
@@ -32,95 +37,248 @@
 */
 
 //-----------------------------------------------------------------------------
-// Perform all redirections in cmd, strip tokens from argv as we go.
-// Returns 0 on success, -1 on failure (errno set by open()).
+// Redirections are kept on the Command in source order and applied in that
+// order, so `>f 2>&1` and `2>&1 >f` mean what they mean in any shell.
 //-----------------------------------------------------------------------------
 
+// Cheap check used to keep redirection-free builtins on the fast path.
+bool command_has_redirections(const Command *cmd) {
+    return cmd->nredirs > 0 || cmd->heredoc || cmd->cwd_override;
+}
+
 int extract_redirections(const Command *cmd, Redirection **out) {
-    Redirection *list = calloc(8, sizeof(Redirection)); // max 8 redirs?
-    int count = 0;
+    int count = cmd->nredirs + (cmd->heredoc ? 1 : 0) + (cmd->cwd_override ? 1 : 0);
+    *out = NULL;
+    if (count == 0) return 0;
 
-    if (cmd->input_file) {
-        list[count++] = (Redirection){REDIR_IN, 0, -1, cmd->input_file};
-    }
-    if (cmd->output_file) {
-        list[count++] = (Redirection){REDIR_OUT, 1, -1, cmd->output_file};
-    }
-    if (cmd->append_file) {
-        list[count++] = (Redirection){REDIR_APPEND, 1, -1, cmd->append_file};
-    }
-    if (cmd->error_file) {
-        list[count++] = (Redirection){REDIR_ERR, 2, -1, cmd->error_file};
-    }
-    if (cmd->output_to_error) {
-        list[count++] = (Redirection){REDIR_DUP_OUT, 2, 1, NULL};
-    }
-    if (cmd->error_to_output) {
-        list[count++] = (Redirection){REDIR_DUP_ERR, 1, 2, NULL};
+    Redirection *list = malloc((size_t)count * sizeof(Redirection));
+    if (!list) return -1;
+
+    int n = 0;
+    for (int i = 0; i < cmd->nredirs; ++i) {
+        list[n++] = *cmd->redirs[i];
     }
     if (cmd->heredoc) {
-        list[count++] = (Redirection){REDIR_HEREDOC, 0, -1, NULL, cmd->heredoc};
+        list[n++] = (Redirection){REDIR_HEREDOC, 0, -1, NULL, cmd->heredoc};
     }
     if (cmd->cwd_override) {
-        list[count++] = (Redirection){REDIR_CWD, -1, -1, cmd->cwd_override};
+        list[n++] = (Redirection){REDIR_CWD, -1, -1, cmd->cwd_override, NULL};
     }
 
     *out = list;
     return count;
 }
 
+// Write all of data to fd, riding out short writes and EINTR.
+static int write_all(int fd, const char *data, size_t len) {
+    while (len) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
 
-int perform_redirections(Redirection *list, int count) {
-    for (int i = 0; i < count; ++i) {
-        Redirection *r = &list[i];
-        switch (r->type) {
-            case REDIR_IN: {
-                int fd = open(r->filename, O_RDONLY);
-                if (fd < 0) return -1;
-                dup2(fd, r->target_fd); close(fd);
-                break;
-            }
-            case REDIR_OUT: {
-                int fd = open(r->filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
-                if (fd < 0) return -1;
-                dup2(fd, r->target_fd); close(fd);
-                break;
-            }
-            case REDIR_APPEND: {
-                int fd = open(r->filename, O_WRONLY | O_CREAT | O_APPEND, 0666);
-                if (fd < 0) return -1;
-                dup2(fd, r->target_fd); close(fd);
-                break;
-            }
-            case REDIR_ERR: {
-                int fd = open(r->filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
-                if (fd < 0) return -1;
-                dup2(fd, r->target_fd); close(fd);
-                break;
-            }
-            case REDIR_DUP_OUT:
-            case REDIR_DUP_ERR: {
-                dup2(r->source_fd, r->target_fd);
-                break;
+/* heredoc_fd
+ * A readable fd positioned at the start of the heredoc body. Bodies up to
+ * PIPE_BUF go through a pipe, which always has room for them. Anything larger
+ * would block the write with nobody reading yet, so it goes to an anonymous
+ * memfd instead (an unlinked temp file where memfd_create is unavailable):
+ * the body is written once and the command reads it as a regular file.
+ * Returns -1 with errno set on failure. */
+static int heredoc_fd(const char *data) {
+    size_t len = data ? strlen(data) : 0;
+
+    if (len <= PIPE_BUF) {
+        int p[2];
+        if (pipe2(p, O_CLOEXEC) < 0) return -1;
+        int rc = write_all(p[1], data, len);
+        int saved = errno;
+        close(p[1]);
+        if (rc < 0) {
+            close(p[0]);
+            errno = saved;
+            return -1;
+        }
+        return p[0];
+    }
+
+    int fd = memfd_create("thrash-heredoc", MFD_CLOEXEC);
+    if (fd < 0) {
+        char tmpl[] = "/tmp/thrash-heredoc.XXXXXX";
+        fd = mkostemp(tmpl, O_CLOEXEC);
+        if (fd < 0) return -1;
+        unlink(tmpl);
+    }
+    if (write_all(fd, data, len) < 0 || lseek(fd, 0, SEEK_SET) < 0) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+    return fd;
+}
+
+// Make fd (opened with O_CLOEXEC) the target: moved into place, or, when
+// open() already returned the target number, kept across exec.
+static int install_fd(int fd, int target) {
+    if (fd == target) return fcntl(fd, F_SETFD, 0);
+    int rc = dup2(fd, target);
+    int saved = errno;
+    close(fd);
+    errno = saved;
+    return rc < 0 ? -1 : 0;
+}
+
+/* apply_one
+ * One redirection against the current process's fds. Failures are reported
+ * the way other shells word them ("thrash: file: No such file or directory",
+ * "thrash: 5: Bad file descriptor") and return -1. */
+static int apply_one(const Redirection *r) {
+    int fd = -1;
+    switch (r->type) {
+        case REDIR_IN:
+            fd = open(r->filename, O_RDONLY | O_CLOEXEC);
+            break;
+        case REDIR_OUT:
+            fd = open(r->filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+            break;
+        case REDIR_APPEND:
+            fd = open(r->filename, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+            break;
+        case REDIR_HEREDOC:
+            fd = heredoc_fd(r->heredoc_data);
+            if (fd < 0) {
+                fprintf(stderr, "thrash: heredoc: %s\n", strerror(errno));
+                return -1;
             }
-            case REDIR_HEREDOC: {
-                int pipefd[2];
-                pipe(pipefd);
-                write(pipefd[1], r->heredoc_data, strlen(r->heredoc_data));
-                close(pipefd[1]);
-                dup2(pipefd[0], r->target_fd);
-                close(pipefd[0]);
-                break;
+            break;
+        case REDIR_DUP:
+            // n>&n changes nothing, but n still has to be open
+            if (r->source_fd == r->target_fd ? fcntl(r->source_fd, F_GETFD) < 0
+                                             : dup2(r->source_fd, r->target_fd) < 0) {
+                fprintf(stderr, "thrash: %d: %s\n", r->source_fd, strerror(errno));
+                return -1;
             }
-            case REDIR_CWD: {
-                chdir(r->filename);
-                break;
+            return 0;
+        case REDIR_CLOSE:
+            close(r->target_fd); // closing what is already closed is fine
+            return 0;
+        case REDIR_CWD:
+            if (chdir(r->filename) < 0) {
+                fprintf(stderr, "thrash: cd: %s: %s\n", r->filename, strerror(errno));
+                return -1;
             }
+            return 0;
+    }
+
+    if (fd < 0) {
+        fprintf(stderr, "thrash: %s: %s\n", r->filename, strerror(errno));
+        return -1;
+    }
+    if (install_fd(fd, r->target_fd) < 0) {
+        fprintf(stderr, "thrash: %d: %s\n", r->target_fd, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+int perform_redirections(Redirection *list, int count) {
+    for (int i = 0; i < count; ++i) {
+        if (apply_one(&list[i]) < 0) return -1;
+    }
+    return 0;
+}
+
+/* save_fd
+ * Remember what fd is before the first redirection that touches it: a
+ * CLOEXEC copy at 10 or above (out of the way of user redirections), or -1
+ * when it is closed. A redirection aimed at one of those copies moves the
+ * copy first, so `10>file` can't clobber a saved stdout. */
+static int save_fd(RedirSave *save, int fd) {
+    for (int i = 0; i < save->count; ++i) {
+        if (save->fds[i].fd == fd) return 0; // first state is the one to restore
+    }
+    int copy = -1;
+    bool ours = false;
+    for (int i = 0; i < save->count; ++i) {
+        if (save->fds[i].saved == fd) {
+            int moved = fcntl(fd, F_DUPFD_CLOEXEC, 10);
+            if (moved < 0) return -1;
+            save->fds[i].saved = moved; // fd itself is about to be replaced
+            ours = true;                // and to the user it was never open
+        }
+    }
+
+    if (!ours) {
+        copy = fcntl(fd, F_DUPFD_CLOEXEC, 10);
+        if (copy < 0 && errno != EBADF) return -1;
+    }
+
+    if (save->count == save->cap) {
+        int ncap = save->cap ? save->cap * 2 : 4;
+        SavedFd *n = realloc(save->fds, (size_t)ncap * sizeof(SavedFd));
+        if (!n) {
+            if (copy >= 0) close(copy);
+            return -1;
         }
+        save->fds = n;
+        save->cap = ncap;
     }
+    save->fds[save->count++] = (SavedFd){ fd, copy };
     return 0;
 }
 
+int apply_redirections_saved(Redirection *list, int count, RedirSave *save) {
+    for (int i = 0; i < count; ++i) {
+        Redirection *r = &list[i];
+        if (r->type == REDIR_CWD) {
+            // would move the shell itself; such commands run in a child
+            fprintf(stderr, "thrash: cannot change directory for an in-shell builtin\n");
+            return -1;
+        }
+        int before = save->count;
+        if (save_fd(save, r->target_fd) < 0) {
+            fprintf(stderr, "thrash: %d: cannot save descriptor: %s\n", r->target_fd, strerror(errno));
+            return -1;
+        }
+        // read's buffered stdin follows fd 0 (the first change only; one pop undoes it)
+        if (r->target_fd == STDIN_FILENO && save->count > before) readbuf_push(save->owns_stdin);
+        if (apply_one(r) < 0) return -1;
+    }
+    return 0;
+}
 
+void restore_redirections(RedirSave *save) {
+    for (int i = save->count - 1; i >= 0; --i) {
+        SavedFd *s = &save->fds[i];
+        if (s->fd == STDIN_FILENO) readbuf_pop();
+        if (s->saved < 0) {
+            close(s->fd);
+        } else {
+            dup2(s->saved, s->fd);
+            close(s->saved);
+        }
+    }
+    free(save->fds);
+    *save = (RedirSave){0};
+}
 
+bool redirections_moved(const RedirSave *save, int fd) {
+    for (int i = 0; i < save->count; ++i) {
+        if (save->fds[i].fd == fd) return true;
+    }
+    return false;
+}
 
+int move_fd_high(int fd) {
+    if (fd < 0 || fd >= SHELL_FD_BASE) return fd;
+    int high = fcntl(fd, F_DUPFD_CLOEXEC, SHELL_FD_BASE);
+    if (high < 0) return fd; // RLIMIT_NOFILE too low: keep the low one
+    close(fd);
+    return high;
+}
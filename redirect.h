@@ -8,17 +8,16 @@
 #include "command.h" 
 
 typedef enum {
-    REDIR_IN, // <
-    REDIR_OUT, // >
-    REDIR_APPEND, // <<
-    REDIR_ERR, // 2> 
-    REDIR_DUP_OUT, // N>&M
-    REDIR_DUP_ERR, 
-    REDIR_HEREDOC, // EOF
-    REDIR_CWD 
+    REDIR_IN,      // [n]<file
+    REDIR_OUT,     // [n]>file
+    REDIR_APPEND,  // [n]>>file
+    REDIR_DUP,     // [n]>&m, [n]<&m: target_fd becomes a copy of source_fd
+    REDIR_CLOSE,   // [n]>&-, [n]<&-
+    REDIR_HEREDOC, // <<EOF
+    REDIR_CWD      // run in another directory (cwd_override)
 } RedirType;
 
-typedef struct {
+typedef struct Redirection {
     RedirType type;
     int target_fd;       // FD being redirected
     int source_fd;       // For dup2-style redirs
@@ -26,11 +25,40 @@ typedef struct {
     char *heredoc_data;  // For heredoc
 } Redirection;
 
+// Redirections applied in the shell itself, and how to undo them
+typedef struct {
+    int fd;     // descriptor a redirection changed
+    int saved;  // CLOEXEC copy of what it was before, -1 if it was closed
+} SavedFd;
+
+typedef struct {
+    SavedFd *fds;
+    int count, cap;
+    bool owns_stdin; // set by a compound command: read may buffer a pipe on fd 0
+} RedirSave;
+
+// cmd's redirections in order (file/dup/close, then heredoc, cwd) as a malloc'd
+// list; returns the count, or -1 (nothing allocated) when out of memory
 int extract_redirections(const Command *cmd, Redirection **out);
 
-//int perform_redirections(Command *cmd);
+bool command_has_redirections(const Command *cmd);
 
+// In a child: apply in order, reporting the first failure. 0 or -1.
 int perform_redirections(Redirection *list, int count);
 
+// In the shell: the same, recording each fd's prior state in save. On
+// failure what was applied stays applied; restore_redirections() undoes it.
+int apply_redirections_saved(Redirection *list, int count, RedirSave *save);
+void restore_redirections(RedirSave *save); // newest first; empties save
+bool redirections_moved(const RedirSave *save, int fd);
+
+// Lowest fd for descriptors the shell keeps open for its lifetime (SIGCHLD
+// pipe, tty, history, script file), above the save_fd() copies at 10+
+#define SHELL_FD_BASE 100
+
+// Move fd to SHELL_FD_BASE or above, close-on-exec, so redirections applied
+// in the shell can't replace it. Returns the new fd; the old one if it can't.
+int move_fd_high(int fd);
+
 
 #endif
@@ -0,0 +1,190 @@
+// script.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <ctype.h>
+#include "script.h"
+#include "input.h"
+#include "executor.h"
+#include "debug.h"
+#include "redirect.h"
+#include "readbuf.h"
+
+#define READER_CHUNK (64 * 1024)
+
+/* LineReader
+ * read(2) in large chunks and hand out one line at a time from the buffer;
+ * the buffer grows only when a single line is longer than what it holds. */
+typedef struct {
+    int fd;
+    char *buf;
+    size_t cap;    // bytes allocated
+    size_t start;  // first unread byte
+    size_t end;    // one past last valid byte
+    bool eof;
+} LineReader;
+
+// Returns a NUL-terminated line (newline stripped) valid until the next call,
+// or NULL at EOF / read error (errno set on error).
+static char *reader_next_line(LineReader *r) {
+    for (;;) {
+        char *nl = (r->end > r->start) ? memchr(r->buf + r->start, '\n', r->end - r->start) : NULL;
+        if (nl) {
+            char *line = r->buf + r->start;
+            *nl = '\0';
+            r->start = (size_t)(nl - r->buf) + 1;
+            return line;
+        }
+        if (r->eof) {
+            if (r->start == r->end) return NULL;
+            // Final line without trailing newline: make room for the NUL
+            if (r->end == r->cap) {
+                char *nb = realloc(r->buf, r->cap + 1);
+                if (!nb) return NULL;
+                r->buf = nb;
+                r->cap += 1;
+            }
+            char *line = r->buf + r->start;
+            r->buf[r->end] = '\0';
+            r->start = r->end;
+            return line;
+        }
+
+        // Slide the partial line to the front, then grow if it fills the buffer
+        if (r->start > 0) {
+            memmove(r->buf, r->buf + r->start, r->end - r->start);
+            r->end -= r->start;
+            r->start = 0;
+        }
+        if (r->end == r->cap) {
+            size_t ncap = r->cap ? r->cap * 2 : READER_CHUNK;
+            char *nb = realloc(r->buf, ncap);
+            if (!nb) return NULL;
+            r->buf = nb;
+            r->cap = ncap;
+        }
+
+        ssize_t n = read(r->fd, r->buf + r->end, r->cap - r->end);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return NULL;
+        }
+        if (n == 0) r->eof = true;
+        r->end += (size_t)n;
+    }
+}
+
+static bool is_comment_line(const char *line) {
+    while (*line == ' ' || *line == '\t') line++;
+    return *line == '#';
+}
+
+/* feed_line
+ * Accumulate one physical line; once the buffer is a complete command, run it
+ * and release everything the line allocated. */
+static void feed_line(ShellContext *shell, char **pending, const char *line) {
+    // Blank lines and full-line comments (including a #! line) only matter
+    // when they sit inside an open quote
+    if (!*pending && (*line == '\0' || is_comment_line(line))) return;
+
+    append_to_buffer(pending, line);
+    if (!*pending) return;
+
+    bool complete = execute_input(shell, *pending);
+    arena_reset(&shell->arena);
+    if (complete) free_buffer(pending);
+}
+
+static int finish(ShellContext *shell, char **pending) {
+    if (*pending) {
+        if (is_command_complete(*pending)) // quotes are closed: an if/while/for is not
+            fprintf(stderr, "thrash: syntax error: unexpected end of file\n");
+        else
+            fprintf(stderr, "thrash: unexpected EOF while looking for matching quote\n");
+        free_buffer(pending);
+        shell->last_status = 2;
+    }
+    return shell->last_status;
+}
+
+/* A script on the shell's own stdin shares fd 0 with the commands it runs:
+ * `read x` or `head -1` must find the line after their own, so lines come
+ * from readbuf, which leaves fd 0 just past the current one whenever anyone
+ * else can see it (see readbuf.h). */
+static int run_script_stdin(ShellContext *shell) {
+    char *pending = NULL;
+    while (shell->running) {
+        size_t len;
+        bool newline;
+        char *line = readbuf_line(&len, &newline);
+        if (!line) {
+            if (errno == EINTR) continue;
+            if (!errno) break;
+            perror("thrash: read");
+            free_buffer(&pending);
+            return 2;
+        }
+        feed_line(shell, &pending, line);
+    }
+    return finish(shell, &pending);
+}
+
+int run_script_fd(ShellContext *shell, int fd) {
+    if (fd == STDIN_FILENO) return run_script_stdin(shell);
+
+    LineReader r = { .fd = fd };
+    char *pending = NULL;
+    char *line;
+
+    while (shell->running && (line = reader_next_line(&r)) != NULL) {
+        feed_line(shell, &pending, line);
+    }
+    if (!r.eof && shell->running) {
+        perror("thrash: read");
+        free(r.buf);
+        free_buffer(&pending);
+        return 2;
+    }
+
+    free(r.buf);
+    return finish(shell, &pending);
+}
+
+int run_script_file(ShellContext *shell, const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "thrash: %s: %s\n", path, strerror(errno));
+        return 127;
+    }
+    fd = move_fd_high(fd); // `done 3<other` mustn't swap the script out
+    int rc = run_script_fd(shell, fd);
+    close(fd);
+    return rc;
+}
+
+int run_script_string(ShellContext *shell, const char *text) {
+    char *pending = NULL;
+    const char *p = text;
+
+    // The string is already in memory: walk it line by line without copying
+    // it into a reader buffer; only the line being fed gets a bounded copy.
+    while (shell->running && *p) {
+        const char *nl = strchr(p, '\n');
+        size_t len = nl ? (size_t)(nl - p) : strlen(p);
+        char *line = strndup(p, len);
+        if (!line) {
+            perror("thrash");
+            free_buffer(&pending);
+            return 2;
+        }
+        feed_line(shell, &pending, line);
+        free(line);
+        if (!nl) break;
+        p = nl + 1;
+    }
+    return finish(shell, &pending);
+}
@@ -0,0 +1,20 @@
+// script.h
+#ifndef SCRIPT_H
+#define SCRIPT_H
+
+#include "shell.h"
+
+/* Non-interactive execution: `thrash script.sh`, `thrash -c '...'` and
+ * `... | thrash`. Input is streamed through a buffered reader with no line
+ * length limit and fed to the same completeness check / execute path as the
+ * REPL, minus readline, history and the prompt. A script on fd 0 is read
+ * through readbuf instead, so the commands in it see stdin from the line
+ * after their own.
+ * Each returns the shell's final status (last_status, or 2 on a syntax/IO error). */
+int run_script_fd(ShellContext *shell, int fd);
+
+int run_script_file(ShellContext *shell, const char *path);
+
+int run_script_string(ShellContext *shell, const char *text);
+
+#endif // SCRIPT_H
@@ -1,46 +1,88 @@
-#include <stdio.h>
-#include "shell.h"
-#include <stdlib.h>
-#include <string.h>
-#include <unistd.h>     // open, dup, getpid, setpgid, tcsetpgrp
-#include <fcntl.h>      // O_RDWR, O_CLOEXEC
-#include <errno.h>      // errno, EACCES
-#include <signal.h>
-
-
-// job control
-void setup_shell_job_control(ShellContext *shell) {  
-    // Open controlling terminal
-    shell->tty_fd = open("/dev/tty", O_RDWR | O_CLOEXEC); // Open the controlling terminal. O_CLOEXEC=close on exec
-    if (shell->tty_fd < 0) { 
-        // Fallback to stdin if /dev/tty not available
-        shell->tty_fd = dup(STDIN_FILENO); // Duplicate stdin
-    }
-
-    // Put shell in its own process group
-    shell->shell_pgid = getpid(); // Get the shell's process ID and sets as pgid with setpgid
-    if (setpgid(0, shell->shell_pgid) < 0 && errno != EACCES) { // EACCES means we are already in a group (permission denied)
-        perror("setpgid(shell)"); 
-    }
-
-    // Make shell the foreground job on the terminal
-    if (tcsetpgrp(shell->tty_fd, shell->shell_pgid) < 0) {
-        // If this stops us (SIGTTOU) in a weird state, we’ll prevent it below by ignoring SIGTTOU.
-    }
-
-    // Shell should ignore job-control signals
-    struct sigaction sa = {0}; 
-    sa.sa_handler = SIG_IGN; 
-
-    sigaction(SIGTSTP, &sa, NULL); // do not allow shell itself to be stopped
-    sigaction(SIGTTIN, &sa, NULL); // avoid stop on tty reads while bg
-    sigaction(SIGTTOU, &sa, NULL); // avoid stop on tty writes/tcsetpgrp while bg
-
-    // Also typically ignore SIGINT and SIGQUIT in the shell itself
-    sigaction(SIGINT,  &sa, NULL);
-    sigaction(SIGQUIT, &sa, NULL);
-}
-
-//setup_variable_table(ShellContext *shell) {
-    
-//}
\ No newline at end of file
+#include <stdio.h>
+#include "shell.h"
+#include "debug.h"
+#include "redirect.h"   // move_fd_high()
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>     // open, dup, getpid, setpgid, tcsetpgrp
+#include <fcntl.h>      // O_RDWR, O_CLOEXEC
+#include <errno.h>      // errno, EACCES
+#include <signal.h>
+#include <sys/stat.h>
+
+
+// job control
+void setup_shell_job_control(ShellContext *shell) {  
+    // Open controlling terminal
+    shell->tty_fd = open("/dev/tty", O_RDWR | O_CLOEXEC); // Open the controlling terminal. O_CLOEXEC=close on exec
+    if (shell->tty_fd < 0) { 
+        // Fallback to stdin if /dev/tty not available
+        shell->tty_fd = dup(STDIN_FILENO); // Duplicate stdin
+    }
+    shell->tty_fd = move_fd_high(shell->tty_fd);
+
+    // Put shell in its own process group
+    shell->shell_pgid = getpid(); // Get the shell's process ID and sets as pgid with setpgid
+    if (setpgid(0, shell->shell_pgid) < 0 && errno != EACCES) { // EACCES means we are already in a group (permission denied)
+        perror("setpgid(shell)"); 
+    }
+
+    // Make shell the foreground job on the terminal
+    if (tcsetpgrp(shell->tty_fd, shell->shell_pgid) < 0) {
+        // If this stops us (SIGTTOU) in a weird state, we’ll prevent it below by ignoring SIGTTOU.
+    }
+
+    // Shell should ignore job-control signals
+    struct sigaction sa = {0}; 
+    sa.sa_handler = SIG_IGN; 
+
+    sigaction(SIGTSTP, &sa, NULL); // do not allow shell itself to be stopped
+    sigaction(SIGTTIN, &sa, NULL); // avoid stop on tty reads while bg
+    sigaction(SIGTTOU, &sa, NULL); // avoid stop on tty writes/tcsetpgrp while bg
+
+    // Also typically ignore SIGINT and SIGQUIT in the shell itself
+    sigaction(SIGINT,  &sa, NULL);
+    sigaction(SIGQUIT, &sa, NULL);
+}
+
+//setup_variable_table(ShellContext *shell) {
+    
+//}
+
+/* ---- Working directory ------------------------------------------------
+ * The shell only moves through cd, so cwd is asked of the kernel once at
+ * startup and once per successful cd, never per prompt (getcwd() walks the
+ * path, and on network filesystems every step is a round trip). PWD and
+ * OLDPWD are exported V_SPECIAL vars maintained from here. */
+
+// A path naming the same directory as "." (dev + inode): an inherited $PWD
+// worth keeping, symlinks and all, as other shells do
+static bool names_cwd(const char *path) {
+    struct stat a, b;
+    return path && path[0] == '/' && stat(path, &a) == 0 && stat(".", &b) == 0 &&
+           a.st_dev == b.st_dev && a.st_ino == b.st_ino;
+}
+
+void shell_init_cwd(ShellContext *shell) {
+    Var *pwd = vart_get(shell->vars, "PWD");
+    char *cwd = (pwd && names_cwd(pwd->value)) ? strdup(pwd->value) : getcwd(NULL, 0);
+    free(shell->cwd);
+    shell->cwd = cwd ? cwd : strdup(".");
+    free(shell->prompt);
+    shell->prompt = NULL;
+    if (shell->cwd) vart_set(shell->vars, "PWD", shell->cwd, V_EXPORT | V_SPECIAL);
+}
+
+void shell_cwd_changed(ShellContext *shell) {
+    char *cwd = getcwd(NULL, 0);
+    if (!cwd) {
+        LOG(LOG_LEVEL_WARN, "getcwd: %s", strerror(errno));
+        return; // keep the old one; reported, and the prompt stays as it was
+    }
+    if (shell->cwd) vart_set(shell->vars, "OLDPWD", shell->cwd, V_EXPORT | V_SPECIAL);
+    vart_set(shell->vars, "PWD", cwd, V_EXPORT | V_SPECIAL);
+    free(shell->cwd);
+    shell->cwd = cwd;
+    free(shell->prompt);
+    shell->prompt = NULL; // re-rendered by the next read_input()
+}
\ No newline at end of file
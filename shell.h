@@ -1,30 +1,41 @@
-
-#ifndef SHELL_H
-#define SHELL_H
-
-#include <sys/types.h>
-#include "history.h"
-#include "var.h" // Include variable table definitions 
-
-#define INPUT_SIZE 1024
-
-typedef struct {
-    char input[INPUT_SIZE];   // User input buffer
-    int running;              // Shell loop control flag
-    int  last_status; // Last command exit status
-    int   tty_fd; // Terminal file descriptor
-    pid_t shell_pgid; // Shell process group ID
-    pid_t last_pgid;    // Last foreground process group ID
-    pid_t pipeline_pgid; // Current pipeline process group ID
-    char cwd[512];            // Current working directory
-    History history; // Command history
-    VarTable *vars; // Hash table for variables
-} ShellContext;
-
-void add_to_history(ShellContext *ctx, const char *input); // Add command to history
-
-void setup_shell_job_control(ShellContext *shell);
-
-
-#endif
-
+
+#ifndef SHELL_H
+#define SHELL_H
+
+#include <sys/types.h>
+#include <stdbool.h>
+#include "history.h"
+#include "var.h" // Include variable table definitions 
+#include "arena.h" // Per-line scratch allocator
+
+typedef struct {
+    char *input;              // Current input line (heap, owned; no length limit)
+    int running;              // Shell loop control flag
+    bool interactive;         // REPL on a tty: readline, history, job control
+    int  last_status; // Last command exit status
+    int   tty_fd; // Terminal file descriptor
+    pid_t shell_pgid; // Shell process group ID
+    pid_t last_pgid;    // Last foreground process group ID
+    pid_t pipeline_pgid; // Current pipeline process group ID
+    char *cwd;                // Current working directory (heap), kept by shell_cwd_changed()
+    char *prompt;             // Rendered prompt for cwd, NULL until next needed
+    History history; // Command history
+    HistUsage usage; // Resources of the foreground jobs run for the current input line
+    uint64_t hist_id; // History entry of the input line being run, 0 if it wasn't recorded
+    VarTable *vars; // Hash table for variables
+    Arena arena; // Per-line parse/expand/execute scratch, reset each main loop iteration
+    int loop_depth;     // for/while/until loops running right now
+    int loop_ctl;       // break/continue: loop levels still to unwind
+    bool loop_continue; // ...and the last of them goes round again (continue)
+} ShellContext;
+
+void add_to_history(ShellContext *ctx, const char *input); // Add command to history
+
+void setup_shell_job_control(ShellContext *shell);
+
+void shell_init_cwd(ShellContext *shell);    // startup: cwd and $PWD
+void shell_cwd_changed(ShellContext *shell); // after a chdir in the shell: cwd, $PWD/$OLDPWD, prompt
+
+
+#endif
+
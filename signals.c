@@ -1,4 +1,5 @@
 // signals.c
+#define _GNU_SOURCE // pipe2()
 #include "signals.h"
 #include <signal.h>
 #include <termios.h>    // tcsetpgrp()
@@ -7,8 +8,90 @@
 #include <string.h>     // strcmp()
 #include <stdio.h>      // perror()
 #include <errno.h>
+#include <fcntl.h>
 #include "debug.h"
+#include "trace.h"
 #include "shell.h"
+#include "redirect.h"   // move_fd_high()
+
+static int sigchld_pipe[2] = { -1, -1 };
+static volatile sig_atomic_t sigchld_pending = 0; // set before the byte is written
+
+static void on_sigchld(int sig) {
+    (void)sig;
+    int saved = errno;
+    TRACE(TR_SIGCHLD, 0, 0);
+    sigchld_pending = 1;
+    // Full pipe: a wakeup is already pending, dropping this byte is fine
+    ssize_t w = write(sigchld_pipe[1], "c", 1);
+    (void)w;
+    errno = saved;
+}
+
+int setup_sigchld_handler(void) {
+    if (pipe2(sigchld_pipe, O_CLOEXEC | O_NONBLOCK) < 0) {
+        sigchld_pipe[0] = sigchld_pipe[1] = -1;
+        return -1;
+    }
+    // Out of reach of in-shell redirections like `done 4>file`
+    sigchld_pipe[0] = move_fd_high(sigchld_pipe[0]);
+    sigchld_pipe[1] = move_fd_high(sigchld_pipe[1]);
+
+    struct sigaction sa = {0};
+    sa.sa_handler = on_sigchld;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART; // readline and blocking reads just carry on
+    if (sigaction(SIGCHLD, &sa, NULL) < 0) {
+        close(sigchld_pipe[0]);
+        close(sigchld_pipe[1]);
+        sigchld_pipe[0] = sigchld_pipe[1] = -1;
+        return -1;
+    }
+    return 0;
+}
+
+int sigchld_fd(void) {
+    return sigchld_pipe[0];
+}
+
+static volatile sig_atomic_t sigint_seen = 0;
+static struct sigaction sigint_before;
+
+static void on_sigint(int sig) {
+    (void)sig;
+    sigint_seen = 1;
+}
+
+void sigint_catch(bool on) {
+    if (!on) {
+        sigaction(SIGINT, &sigint_before, NULL);
+        return;
+    }
+    struct sigaction sa = {0};
+    sa.sa_handler = on_sigint;
+    sigemptyset(&sa.sa_mask); // no SA_RESTART: a blocked poll() returns EINTR
+    sigint_seen = 0;
+    sigaction(SIGINT, &sa, &sigint_before);
+}
+
+bool sigint_caught(void) {
+    bool seen = sigint_seen;
+    sigint_seen = 0;
+    return seen;
+}
+
+bool sigchld_consume(void) {
+    if (sigchld_pipe[0] < 0) return true; // no handler: the caller must poll
+    // Nothing arrived: skip the read(), which is most calls (one per command)
+    if (!sigchld_pending) return false;
+    sigchld_pending = 0; // cleared first: a signal from here on is read below or next time
+    char buf[64];
+    bool any = false;
+    ssize_t n;
+    while ((n = read(sigchld_pipe[0], buf, sizeof(buf))) > 0 || (n < 0 && errno == EINTR))
+        if (n > 0) any = true;
+    return any;
+}
 
 
 
@@ -40,6 +123,7 @@ void setup_child_signals(void) {
 }
 
 void give_terminal_to_pgid(ShellContext *shell, pid_t pgid) { 
+    if (!shell->interactive) return; // no job control without a terminal
     // With SIGTTOU ignored, tcsetpgrp won’t stop us if we happen to be bg.
     if (tcsetpgrp(shell->tty_fd, pgid) < 0) { 
         // Don’t spam; log if you have a debug flag
@@ -49,6 +133,7 @@ void give_terminal_to_pgid(ShellContext *shell, pid_t pgid) {
 }
 
 void reclaim_terminal(ShellContext *shell) {
+    if (!shell->interactive) return;
     if (tcsetpgrp(shell->tty_fd, shell->shell_pgid) < 0) {
         // perror("tcsetpgrp(reclaim)");
     }
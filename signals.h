@@ -10,6 +10,22 @@ void setup_child_signals(void);
 // (Optional) Called in the parent after fork
 void setup_parent_signals(void);
 
+// SIGCHLD only writes a byte to a non-blocking self-pipe; the reaping itself
+// happens in jobs_reap(), outside signal context. Returns -1 if the pipe or
+// handler could not be set up (sigchld_consume() then always reports true).
+int setup_sigchld_handler(void);
+
+// Drain the self-pipe; true if SIGCHLD arrived since the last call
+bool sigchld_consume(void);
+int sigchld_fd(void); // its read end, to poll() for a child exiting; -1 without a handler
+
+// While the shell itself waits on jobs it put in groups of their own
+// (parallel), or reads the terminal (read), ^C reaches only the shell:
+// catch it instead of ignoring it.
+// on = false puts the previous disposition back.
+void sigint_catch(bool on);
+bool sigint_caught(void); // since the last call
+
 void reclaim_terminal(ShellContext *shell);
 
 void give_terminal_to_pgid(ShellContext *shell, pid_t pgid);
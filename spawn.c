@@ -0,0 +1,224 @@
+// spawn.c
+/* posix_spawn fast path for simple external commands.
+ * Everything the fork path does in the child (setpgid, signal reset, dup2 of
+ * pipe ends, file redirections) is expressed as spawn attributes and file
+ * actions, so the parent never duplicates its address space. */
+#include <spawn.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "spawn.h"
+#include "redirect.h"
+#include "builtins.h"
+#include "path.h"
+#include "var.h"
+#include "debug.h"
+
+SpawnBackend spawn_backend(const ShellContext *shell) {
+    Var *v = shell ? vart_get(shell->vars, "THRASH_SPAWN") : NULL;
+    if (v && v->value && strcmp(v->value, "fork") == 0) return SPAWN_FORK;
+    return SPAWN_POSIX;
+}
+
+/* spawn_eligible
+ * No builtin, no cwd override, and only file/dup redirections. */
+bool spawn_eligible(const Command *cmd) {
+    if (!cmd || !cmd->argv || !cmd->argv[0] || !cmd->resolved_path) return false;
+    if (cmd->is_builtin || is_builtin(cmd->argv[0])) return false;
+    if (cmd->cwd_override || cmd->heredoc) return false;
+    return true;
+}
+
+// Translate the Redirection list into file actions, in the same order
+// perform_redirections() would apply them in the child.
+static int add_redirections(posix_spawn_file_actions_t *fa, const Redirection *list, int count) {
+    for (int i = 0; i < count; ++i) {
+        const Redirection *r = &list[i];
+        int rc = 0;
+        switch (r->type) {
+            case REDIR_IN:
+                rc = posix_spawn_file_actions_addopen(fa, r->target_fd, r->filename, O_RDONLY, 0);
+                break;
+            case REDIR_OUT:
+                rc = posix_spawn_file_actions_addopen(fa, r->target_fd, r->filename,
+                                                      O_WRONLY | O_CREAT | O_TRUNC, 0666);
+                break;
+            case REDIR_APPEND:
+                rc = posix_spawn_file_actions_addopen(fa, r->target_fd, r->filename,
+                                                      O_WRONLY | O_CREAT | O_APPEND, 0666);
+                break;
+            case REDIR_DUP: // n>&n: glibc just clears CLOEXEC, as the fork path leaves it
+                rc = posix_spawn_file_actions_adddup2(fa, r->source_fd, r->target_fd);
+                break;
+            case REDIR_CLOSE:
+                rc = posix_spawn_file_actions_addclose(fa, r->target_fd);
+                break;
+            case REDIR_HEREDOC:
+            case REDIR_CWD:
+                rc = ENOTSUP; // spawn_eligible() keeps these on the fork path
+                break;
+        }
+        if (rc != 0) return rc;
+    }
+    return 0;
+}
+
+// Whether fd is open in the child when list[i] runs: the latest earlier
+// action on it decides, otherwise it is what the parent has (plus 0 and 1
+// when a pipe end was put there).
+static bool fd_open_before(const Redirection *list, int i, int fd, int in_fd, int out_fd) {
+    for (int j = i - 1; j >= 0; --j) {
+        if (list[j].target_fd == fd) return list[j].type != REDIR_CLOSE;
+    }
+    if ((fd == STDIN_FILENO && in_fd >= 0) || (fd == STDOUT_FILENO && out_fd >= 0)) return true;
+    return fcntl(fd, F_GETFD) >= 0;
+}
+
+// Where what the child writes to fd would go when list[i] runs, as a
+// descriptor in the parent: a file opened for it (*opened set; appending, as
+// the child already truncated it), a pipe end, the parent's own fd, or -1.
+static int child_fd_dest(const Redirection *list, int i, int fd, int in_fd, int out_fd, bool *opened) {
+    for (int j = i - 1; j >= 0; --j) {
+        if (list[j].target_fd != fd) continue;
+        switch (list[j].type) {
+            case REDIR_OUT:
+            case REDIR_APPEND:
+                *opened = true;
+                return open(list[j].filename, O_WRONLY | O_APPEND | O_NONBLOCK | O_CLOEXEC);
+            case REDIR_DUP:
+                return child_fd_dest(list, j, list[j].source_fd, in_fd, out_fd, opened);
+            default:
+                return -1; // closed, or open for reading only
+        }
+    }
+    if (fd == STDIN_FILENO && in_fd >= 0) return in_fd;
+    if (fd == STDOUT_FILENO && out_fd >= 0) return out_fd;
+    return fd;
+}
+
+// The message perform_redirections() would print in the child, on the
+// child's stderr as list[i] found it
+static void child_error(const Redirection *list, int i, int in_fd, int out_fd, const char *what, int err) {
+    bool opened = false;
+    int fd = child_fd_dest(list, i, STDERR_FILENO, in_fd, out_fd, &opened);
+    if (fd < 0) return;
+    if (fd == STDERR_FILENO) fflush(stderr);
+    dprintf(fd, "thrash: %s: %s\n", what, strerror(err));
+    if (opened) close(fd);
+}
+
+/* report_redirection_failure
+ * posix_spawn() only says that something failed. Replay the file actions in
+ * the parent, without side effects the child hasn't already had (no
+ * truncation; the creates happened up to the one that failed; O_NONBLOCK so a
+ * FIFO can't hang the shell), to find which; it is reported the way
+ * perform_redirections() words it on the fork path, and where that would
+ * write it. false when every redirection checks out, so it was the exec. */
+static bool report_redirection_failure(const Redirection *list, int count, int in_fd, int out_fd) {
+    for (int i = 0; i < count; ++i) {
+        const Redirection *r = &list[i];
+        int flags = O_NONBLOCK | O_CLOEXEC;
+        switch (r->type) {
+            case REDIR_IN:     flags |= O_RDONLY; break;
+            case REDIR_OUT:
+            case REDIR_APPEND: flags |= O_WRONLY | O_CREAT; break;
+            case REDIR_DUP:
+                if (!fd_open_before(list, i, r->source_fd, in_fd, out_fd)) {
+                    char num[16];
+                    snprintf(num, sizeof(num), "%d", r->source_fd);
+                    child_error(list, i, in_fd, out_fd, num, EBADF);
+                    return true;
+                }
+                continue;
+            default:
+                continue;
+        }
+        int fd = open(r->filename, flags, 0666);
+        if (fd >= 0) {
+            close(fd);
+        } else if (errno != ENXIO) { // ENXIO: a FIFO with no reader yet, which would block
+            child_error(list, i, in_fd, out_fd, r->filename, errno);
+            return true;
+        }
+    }
+    return false;
+}
+
+pid_t spawn_command(Command *cmd, pid_t pgid, int in_fd, int out_fd,
+                    char *const envp[], int *status_out) {
+    posix_spawnattr_t attr;
+    posix_spawn_file_actions_t fa;
+    pid_t pid = -1;
+    Redirection *redirs = NULL;
+    int redir_count = 0;
+    int rc;
+
+    if (status_out) *status_out = 0;
+
+    if ((rc = posix_spawnattr_init(&attr)) != 0) goto fail_early;
+    if ((rc = posix_spawn_file_actions_init(&fa)) != 0) {
+        posix_spawnattr_destroy(&attr);
+        goto fail_early;
+    }
+
+    // Mirror setup_child_signals(): the shell ignores job-control signals, and
+    // ignored dispositions survive exec, so reset them explicitly.
+    sigset_t defaults, empty;
+    sigemptyset(&defaults);
+    sigaddset(&defaults, SIGINT);
+    sigaddset(&defaults, SIGQUIT);
+    sigaddset(&defaults, SIGTSTP);
+    sigaddset(&defaults, SIGTTIN);
+    sigaddset(&defaults, SIGTTOU);
+    sigaddset(&defaults, SIGCHLD);
+    sigemptyset(&empty);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+    posix_spawnattr_setsigmask(&attr, &empty);
+    short flags = POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK;
+    if (pgid >= 0) {
+        posix_spawnattr_setpgroup(&attr, pgid); // 0 → child leads a new group
+        flags |= POSIX_SPAWN_SETPGROUP;
+    }
+    posix_spawnattr_setflags(&attr, flags);
+
+    // Pipe ends first (they carry CLOEXEC, so the originals vanish at exec)
+    if (in_fd >= 0 && (rc = posix_spawn_file_actions_adddup2(&fa, in_fd, STDIN_FILENO)) != 0)
+        goto out;
+    if (out_fd >= 0 && (rc = posix_spawn_file_actions_adddup2(&fa, out_fd, STDOUT_FILENO)) != 0)
+        goto out;
+
+    redir_count = extract_redirections(cmd, &redirs);
+    rc = redir_count < 0 ? ENOMEM : add_redirections(&fa, redirs, redir_count);
+    if (rc == 0) {
+        LOG(LOG_LEVEL_INFO, "posix_spawn %s (pgid=%d)", cmd->resolved_path, pgid);
+        rc = posix_spawn(&pid, cmd->resolved_path, &fa, &attr, cmd->argv, envp);
+    }
+
+out:
+    posix_spawn_file_actions_destroy(&fa);
+    posix_spawnattr_destroy(&attr);
+    if (rc == 0) {
+        free(redirs);
+        return pid;
+    }
+
+    // glibc reports exec and file-action failures alike through rc. A
+    // redirection that fails is a plain failure (1), as on the fork path;
+    // otherwise it was the exec.
+    if (redir_count > 0 && report_redirection_failure(redirs, redir_count, in_fd, out_fd)) {
+        if (status_out) *status_out = 1;
+    } else {
+        print_exec_error(cmd->resolved_path, rc);
+        if (status_out) *status_out = (rc == ENOENT || rc == ENOTDIR) ? 127 : 126;
+    }
+    free(redirs);
+    return -1;
+
+fail_early:
+    fprintf(stderr, "thrash: posix_spawn setup: %s\n", strerror(rc));
+    if (status_out) *status_out = 126;
+    return -1;
+}
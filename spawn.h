@@ -0,0 +1,32 @@
+// spawn.h
+#ifndef SPAWN_H
+#define SPAWN_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+#include "command.h"
+#include "shell.h"
+
+/* Process creation backends for external commands.
+ * SPAWN_POSIX uses posix_spawn(3) (vfork-style on glibc: no page-table copy),
+ * SPAWN_FORK is the classic fork()+exec path and the fallback for anything
+ * posix_spawn can't express (heredocs, cwd overrides).
+ * Selected at runtime with the shell variable THRASH_SPAWN=fork|posix. */
+typedef enum {
+    SPAWN_FORK,
+    SPAWN_POSIX
+} SpawnBackend;
+
+SpawnBackend spawn_backend(const ShellContext *shell);
+
+bool spawn_eligible(const Command *cmd);
+
+// Launch cmd (already resolved) into process group pgid (0 = new group led by
+// the child, -1 = stay in the shell's group), wiring in_fd/out_fd (-1 = inherit) to stdin/stdout before the
+// command's own redirections. envp is passed through untouched (normally the
+// VarTable's cached vart_envp()). Returns the child pid, or -1 after printing a
+// diagnostic, with the status the command should report in *status_out.
+pid_t spawn_command(Command *cmd, pid_t pgid, int in_fd, int out_fd,
+                    char *const envp[], int *status_out);
+
+#endif // SPAWN_H
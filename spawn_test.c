@@ -0,0 +1,99 @@
+// spawn_test.c
+/* The posix_spawn and fork backends must fail the same way: same message on
+ * stderr, same status. Each case runs under THRASH_SPAWN=posix and =fork and
+ * the two outputs are compared.
+ *
+ *   spawn_test [shell]      (default ./thrash; `make test` uses the release
+ *                            build, whose stderr carries no LOG() output) */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+typedef struct {
+    const char *script;
+    const char *want_err; // NULL: only compare the backends
+} Case;
+
+static const Case cases[] = {
+    { "cat < /nonexist; echo st=$?", "thrash: /nonexist: No such file or directory\n" },
+    { "ls > /nonexistdir/x; echo st=$?", "thrash: /nonexistdir/x: No such file or directory\n" },
+    { "cat 2>&5; echo st=$?", "thrash: 5: Bad file descriptor\n" },
+    { "cat < /etc/hostname 3</nonexist; echo st=$?", "thrash: /nonexist: No such file or directory\n" },
+    { "cat >/dev/null 2>&1 </nonexist; echo st=$?", NULL }, // the error goes to /dev/null
+    { "cat 2>/tmp/thrash-spawn-test.err </nonexist; cat /tmp/thrash-spawn-test.err; rm /tmp/thrash-spawn-test.err",
+      "thrash: /nonexist: No such file or directory\n" },
+    { "cat </nonexist | cat; echo st=$?", NULL },
+    { "/etc/passwd; echo st=$?", NULL },
+    // Builtins never reach a backend; their output is still checked here
+    { "printf 'abc%'; echo; echo st=$?", "abc%\nst=0\n" },
+    { "printf '%d%%%s|%' 7 x; echo", "7%x|%\n" },
+};
+
+// What `shell -c script` wrote to stdout and stderr together, under THRASH_SPAWN=backend
+static char *run(const char *shell, const char *backend, const char *script) {
+    int out[2];
+    assert(pipe(out) == 0);
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) {
+        dup2(out[1], STDOUT_FILENO);
+        dup2(out[1], STDERR_FILENO);
+        close(out[0]);
+        close(out[1]);
+        setenv("THRASH_SPAWN", backend, 1);
+        execl(shell, shell, "-c", script, (char *)NULL);
+        perror(shell);
+        _exit(127);
+    }
+    close(out[1]);
+
+    size_t len = 0, cap = 256;
+    char *buf = malloc(cap);
+    assert(buf);
+    ssize_t n;
+    while ((n = read(out[0], buf + len, cap - len - 1)) > 0) {
+        len += (size_t)n;
+        if (len + 1 == cap) {
+            buf = realloc(buf, cap *= 2);
+            assert(buf);
+        }
+    }
+    buf[len] = '\0';
+    close(out[0]);
+    waitpid(pid, NULL, 0);
+    return buf;
+}
+
+int main(int argc, char **argv) {
+    const char *shell = argc > 1 ? argv[1] : "./thrash";
+    int failed = 0;
+
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        const Case *c = &cases[i];
+        char *posix = run(shell, "posix", c->script);
+        char *fork_ = run(shell, "fork", c->script);
+        printf("=== %s ===\n%s", c->script, posix);
+
+        if (strcmp(posix, fork_) != 0) {
+            fprintf(stderr, "FAIL: backends differ\n  posix: %s  fork:  %s", posix, fork_);
+            failed++;
+        }
+        if (c->want_err && strncmp(posix, c->want_err, strlen(c->want_err)) != 0) {
+            fprintf(stderr, "FAIL: expected \"%.*s\"\n", (int)strlen(c->want_err) - 1, c->want_err);
+            failed++;
+        }
+        free(posix);
+        free(fork_);
+    }
+
+    if (failed) {
+        fprintf(stderr, "\n%d check(s) failed\n", failed);
+        return 1;
+    }
+    printf("\n✅ posix_spawn and fork backends report failures alike.\n");
+    return 0;
+}
@@ -0,0 +1,133 @@
+// stats.c
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "stats.h"
+
+/* One stage. Counters are only ever added to (max: compare-and-swap up),
+ * with relaxed ordering: a reader racing a writer may see a count one ahead
+ * of the total, which a latency table can live with. */
+typedef struct {
+    _Atomic uint64_t calls, total_ns, max_ns;
+    _Atomic uint64_t hist[STATS_BUCKETS];
+} StageStats;
+
+static StageStats stages[STAT_COUNT];
+
+static const char *const stage_name[STAT_COUNT] = {
+    [STAT_LEX]      = "lex",
+    [STAT_PARSE]    = "parse",
+    [STAT_EXPAND]   = "expand",
+    [STAT_RESOLVE]  = "resolve",
+    [STAT_FORK]     = "fork",
+    [STAT_SPAWN]    = "spawn",
+    [STAT_WAIT]     = "wait",
+    [STAT_HIST_ADD] = "hist-add",
+};
+
+uint64_t stats_clock(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+// floor(log2(ns)), 0 for 0 and 1
+static unsigned bucket_of(uint64_t ns) {
+    unsigned k = ns > 1 ? 63u - (unsigned)__builtin_clzll(ns) : 0;
+    return k < STATS_BUCKETS ? k : STATS_BUCKETS - 1;
+}
+
+void stats_record(StatStage stage, uint64_t ns) {
+    if ((unsigned)stage >= STAT_COUNT) return;
+    StageStats *s = &stages[stage];
+    atomic_fetch_add_explicit(&s->calls, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&s->total_ns, ns, memory_order_relaxed);
+    atomic_fetch_add_explicit(&s->hist[bucket_of(ns)], 1, memory_order_relaxed);
+    uint64_t max = atomic_load_explicit(&s->max_ns, memory_order_relaxed);
+    while (ns > max &&
+           !atomic_compare_exchange_weak_explicit(&s->max_ns, &max, ns,
+                                                  memory_order_relaxed, memory_order_relaxed)) {}
+}
+
+void stats_reset(void) {
+    for (int i = 0; i < STAT_COUNT; ++i) {
+        StageStats *s = &stages[i];
+        atomic_store_explicit(&s->calls, 0, memory_order_relaxed);
+        atomic_store_explicit(&s->total_ns, 0, memory_order_relaxed);
+        atomic_store_explicit(&s->max_ns, 0, memory_order_relaxed);
+        for (int k = 0; k < STATS_BUCKETS; ++k)
+            atomic_store_explicit(&s->hist[k], 0, memory_order_relaxed);
+    }
+}
+
+// Upper bound of the bucket holding the q-th fraction of calls, capped at max
+static double quantile_us(const uint64_t *hist, uint64_t calls, uint64_t max_ns, double q) {
+    uint64_t want = (uint64_t)(q * (double)calls + 0.5), seen = 0;
+    if (want == 0) want = 1;
+    for (int k = 0; k < STATS_BUCKETS; ++k) {
+        seen += hist[k];
+        if (seen >= want) {
+            uint64_t upper = k + 1 < 64 ? (uint64_t)1 << (k + 1) : UINT64_MAX;
+            return (double)(upper < max_ns ? upper : max_ns) / 1e3;
+        }
+    }
+    return (double)max_ns / 1e3;
+}
+
+static double tv_sec(struct timeval tv) {
+    return (double)tv.tv_sec + (double)tv.tv_usec / 1e6;
+}
+
+/* p50/p99 are histogram bucket bounds, so within a factor of two. "shell"
+ * adds up the stages the shell spends on its own (wait is time spent on the
+ * children, expand is already inside parse); rusage splits CPU time the
+ * same way. */
+void stats_print(FILE *out, bool histograms) {
+    fprintf(out, "%-9s %9s %11s %10s %10s %10s %10s\n",
+            "stage", "calls", "total_ms", "mean_us", "p50_us", "p99_us", "max_us");
+    double shell_ms = 0;
+    for (int i = 0; i < STAT_COUNT; ++i) {
+        StageStats *s = &stages[i];
+        uint64_t hist[STATS_BUCKETS];
+        for (int k = 0; k < STATS_BUCKETS; ++k)
+            hist[k] = atomic_load_explicit(&s->hist[k], memory_order_relaxed);
+        uint64_t calls = atomic_load_explicit(&s->calls, memory_order_relaxed);
+        uint64_t total = atomic_load_explicit(&s->total_ns, memory_order_relaxed);
+        uint64_t max = atomic_load_explicit(&s->max_ns, memory_order_relaxed);
+
+        double total_ms = (double)total / 1e6;
+        if (i != STAT_WAIT && i != STAT_EXPAND) shell_ms += total_ms;
+        if (!calls) {
+            fprintf(out, "%-9s %9d %11.3f %10s %10s %10s %10s\n", stage_name[i], 0, 0.0, "-", "-", "-", "-");
+            continue;
+        }
+        fprintf(out, "%-9s %9llu %11.3f %10.3f %10.3f %10.3f %10.3f\n", stage_name[i],
+                (unsigned long long)calls, total_ms, (double)total / 1e3 / (double)calls,
+                quantile_us(hist, calls, max, 0.50), quantile_us(hist, calls, max, 0.99),
+                (double)max / 1e3);
+        if (!histograms) continue;
+        for (int k = 0; k < STATS_BUCKETS; ++k) {
+            if (!hist[k]) continue;
+            fprintf(out, "  < %12.3f us %9llu\n", (double)((uint64_t)1 << (k + 1)) / 1e3,
+                    (unsigned long long)hist[k]);
+        }
+    }
+    fprintf(out, "shell     %.3f ms in lex, parse, resolve, fork, spawn and hist-add; %.3f ms waiting\n",
+            shell_ms, (double)atomic_load_explicit(&stages[STAT_WAIT].total_ns, memory_order_relaxed) / 1e6);
+
+    struct rusage self, kids;
+    if (getrusage(RUSAGE_SELF, &self) == 0 && getrusage(RUSAGE_CHILDREN, &kids) == 0) {
+        fprintf(out, "cpu       shell user %.3fs sys %.3fs, children user %.3fs sys %.3fs\n",
+                tv_sec(self.ru_utime), tv_sec(self.ru_stime),
+                tv_sec(kids.ru_utime), tv_sec(kids.ru_stime));
+    }
+}
+
+int stats_dump_file(const char *path) {
+    FILE *f = fopen(path, "a");
+    if (!f) return -1;
+    fprintf(f, "thrash pid %d\n", (int)getpid());
+    stats_print(f, false);
+    return fclose(f) == 0 ? 0 : -1;
+}
@@ -0,0 +1,43 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* Per-shell latency accounting.
+ * Each stage keeps a call count, total and maximum time and a log2
+ * histogram (bucket k: [2^k, 2^(k+1)) ns). Recording is a clock read and a
+ * few relaxed atomic adds, no locks or I/O. `stats` prints the table; with
+ * $THRASH_STATS_FILE set the shell appends it to that file on exit.
+ * Build with -DSTATS_DISABLE to compile every STATS_*() out. */
+
+typedef enum {
+    STAT_LEX,       // lex_input() of a whole line
+    STAT_PARSE,     // parse_tokens() of one segment, expansion included
+    STAT_EXPAND,    // expand_variables_ex() of one word
+    STAT_RESOLVE,   // search_path_alloc(): command hash, then PATH
+    STAT_FORK,      // fork() as seen by the parent
+    STAT_SPAWN,     // spawn_command(): posix_spawn and its setup
+    STAT_WAIT,      // job_wait(): the shell blocked on its foreground job
+    STAT_HIST_ADD,  // history_add()
+    STAT_COUNT
+} StatStage;
+
+#define STATS_BUCKETS 40 // up to 2^40 ns (~18 min); longer lands in the last one
+
+#ifdef STATS_DISABLE
+#define STATS_START() ((uint64_t)0)
+#define STATS_STOP(stage, t0) ((void)(t0))
+#else
+#define STATS_START() stats_clock()
+#define STATS_STOP(stage, t0) stats_record((stage), stats_clock() - (t0))
+#endif
+
+uint64_t stats_clock(void);                   // CLOCK_MONOTONIC, ns
+void stats_record(StatStage stage, uint64_t ns);
+void stats_print(FILE *out, bool histograms); // table, then shell vs children CPU time
+void stats_reset(void);
+int stats_dump_file(const char *path);        // append stats_print(); 0 or -1 with errno
+
+#endif // STATS_H
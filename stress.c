@@ -0,0 +1,205 @@
+// stress.c
+/* Scale test through the real APIs: a million history entries (add, search,
+ * save, load back) and a hundred thousand variables (set, get, export,
+ * overwrite, unset), with the time and the memory each phase took. A
+ * baseline for both tables as they grow, and a check that nothing is capped
+ * or truncated at that size: every phase verifies what it got back.
+ *
+ *   stress [--quick] [--history N] [--vars N]
+ *
+ * Build and run with `make stress`. Exit status 1 if a check failed. */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include "history.h"
+#include "histindex.h"
+#include "var.h"
+
+static int failures = 0;
+static uint64_t phase_t0;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+// Resident now, from /proc; 0 where there is none
+static long rss_kb(void) {
+    long pages = 0, resident = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (!f) return 0;
+    if (fscanf(f, "%ld %ld", &pages, &resident) != 2) resident = 0;
+    fclose(f);
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static long peak_rss_kb(void) {
+    struct rusage ru;
+    return getrusage(RUSAGE_SELF, &ru) == 0 ? ru.ru_maxrss : 0;
+}
+
+static void phase_start(void) {
+    phase_t0 = now_ns();
+}
+
+static void phase_end(const char *name, uint64_t ops, const char *unit) {
+    uint64_t ns = now_ns() - phase_t0;
+    printf("%-24s %10llu %-6s %10.1f ms %10.1f ns/%-6s %9ld KB %9ld KB\n", name,
+           (unsigned long long)ops, unit, ns / 1e6, ops ? (double)ns / ops : 0.0, unit,
+           rss_kb(), peak_rss_kb());
+    fflush(stdout);
+}
+
+static void check(bool ok, const char *what) {
+    if (ok) return;
+    fprintf(stderr, "stress: check failed: %s\n", what);
+    failures++;
+}
+
+// Lines of varied length, all different, some with characters the history
+// file has to escape
+static void make_line(char *buf, size_t cap, size_t i) {
+    static const char *const cmds[] = {
+        "git commit -m", "make -j8 &&", "ls -la", "grep -rn", "echo 'tab\there'",
+        "printf 'a\\nb'", "cd /usr/src/linux-6.1 && make", "ssh build-host",
+    };
+    snprintf(buf, cap, "%s %zu %.*s", cmds[i % 8], i, (int)(i % 61),
+             "-----------------------------------------------------------------");
+}
+
+static void stress_history(size_t n) {
+    char path[64], line[256];
+    snprintf(path, sizeof(path), "/tmp/thrash-stress-hist.%d", (int)getpid());
+    unlink(path);
+
+    History h;
+    if (history_init(&h, path, n, 0) != 0) {
+        check(false, "history_init");
+        return;
+    }
+    phase_start();
+    for (size_t i = 0; i < n; ++i) {
+        make_line(line, sizeof(line), i);
+        history_add(&h, line);
+        history_set_status_last(&h, (int)(i % 3));
+    }
+    phase_end("history_add", n, "entry");
+    check(history_count(&h) == n, "history_count after adds");
+
+    size_t hits[16];
+    phase_start();
+    size_t found = history_find(&h, "linux-6.1", 0, history_count(&h), hits, 16);
+    phase_end("history_find/first", 1, "query");
+    check(found == 16, "history_find found entries");
+    phase_start();
+    for (int q = 0; q < 100; ++q) history_find(&h, "ssh build", 0, history_count(&h), hits, 16);
+    phase_end("history_find/indexed", 100, "query");
+
+    phase_start();
+    check(history_save(&h) == 0, "history_save");
+    phase_end("history_save", n, "entry");
+    struct stat st;
+    if (stat(path, &st) == 0) printf("%-24s %10lld bytes\n", "history file", (long long)st.st_size);
+    history_dispose(&h);
+
+    History back;
+    phase_start();
+    bool loaded = history_init(&back, path, n, 0) == 0 && history_load(&back) == 0;
+    phase_end("history_load", n, "entry");
+    check(loaded, "history_load");
+    check(history_count(&back) == n, "every entry loaded back");
+    for (size_t i = 0; loaded && i < history_count(&back); i += 9973) {
+        make_line(line, sizeof(line), i);
+        const HistEntry *e = get_history(&back, i);
+        check(e && strcmp(e->line, line) == 0, "loaded line matches what was added");
+    }
+    history_dispose(&back);
+    unlink(path);
+}
+
+static void stress_vars(size_t n) {
+    VarTable vt;
+    if (!vart_init(&vt, 64)) {
+        check(false, "vart_init");
+        return;
+    }
+    char name[32], value[64];
+
+    phase_start();
+    for (size_t i = 0; i < n; ++i) {
+        snprintf(name, sizeof(name), "STRESS_VAR_%zu", i);
+        snprintf(value, sizeof(value), "value-%zu", i);
+        if (!vart_set(&vt, name, value, 0)) check(false, "vart_set");
+    }
+    phase_end("vart_set/new", n, "var");
+
+    phase_start();
+    size_t good = 0;
+    for (size_t i = 0; i < n; ++i) {
+        snprintf(name, sizeof(name), "STRESS_VAR_%zu", i);
+        snprintf(value, sizeof(value), "value-%zu", i);
+        Var *v = vart_get(&vt, name);
+        good += v && strcmp(v->value, value) == 0;
+    }
+    phase_end("vart_get", n, "var");
+    check(good == n, "every variable reads back");
+
+    size_t nexport = n / 10;
+    phase_start();
+    for (size_t i = 0; i < nexport; ++i) {
+        snprintf(name, sizeof(name), "STRESS_VAR_%zu", i);
+        vart_export(&vt, name);
+    }
+    char *const *envp = vart_envp(&vt);
+    phase_end("vart_export+envp", nexport, "var");
+    size_t nenv = 0;
+    while (envp && envp[nenv]) nenv++;
+    check(nenv == nexport, "envp has every exported variable");
+
+    phase_start();
+    for (size_t i = 0; i < n; ++i) {
+        snprintf(name, sizeof(name), "STRESS_VAR_%zu", i);
+        vart_set(&vt, name, "short", 0);
+    }
+    phase_end("vart_set/overwrite", n, "var");
+
+    phase_start();
+    for (size_t i = 0; i < n; ++i) {
+        snprintf(name, sizeof(name), "STRESS_VAR_%zu", i);
+        vart_unset(&vt, name);
+    }
+    phase_end("vart_unset", n, "var");
+    check(vt.count == 0, "table empty after unsetting everything");
+    vart_destroy(&vt);
+}
+
+int main(int argc, char **argv) {
+    size_t nhist = 1000000, nvars = 100000;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--quick") == 0) {
+            nhist /= 20;
+            nvars /= 20;
+        } else if (strcmp(argv[i], "--history") == 0 && i + 1 < argc) {
+            nhist = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--vars") == 0 && i + 1 < argc) {
+            nvars = strtoull(argv[++i], NULL, 10);
+        } else {
+            fprintf(stderr, "usage: %s [--quick] [--history N] [--vars N]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    printf("%-24s %17s %13s %19s %12s %12s\n", "phase", "ops", "time", "per op", "rss", "peak rss");
+    if (nhist) stress_history(nhist);
+    if (nvars) stress_vars(nvars);
+    if (failures) fprintf(stderr, "stress: %d check(s) failed\n", failures);
+    return failures ? 1 : 0;
+}
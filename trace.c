@@ -0,0 +1,85 @@
+// trace.c
+#include <stdatomic.h>
+#include <time.h>
+#include "trace.h"
+
+/* One slot. seq is n + 1 for the n-th record once it is complete, and 0
+ * while a writer is filling it in, so a reader copying the slot can tell a
+ * torn record from a whole one by reading seq before and after. */
+typedef struct {
+    _Atomic uint64_t seq;
+    uint64_t ns;     // CLOCK_MONOTONIC
+    int64_t a, b;
+    int32_t ev;
+} TraceRecord;
+
+static TraceRecord ring[TRACE_SLOTS];
+static _Atomic uint64_t next_seq = 0;  // records ever started
+static _Atomic uint64_t floor_seq = 0; // trace_clear(): hide records before this
+
+static const struct {
+    const char *name, *a, *b;
+} event_info[TR_COUNT] = {
+    [TR_NONE]       = { "none",      "a",        "b" },
+    [TR_SEGMENT]    = { "segment",   "stages",   "status" },
+    [TR_FORK]       = { "fork",      "pid",      "stage" },
+    [TR_SPAWN]      = { "spawn",     "pid",      "stage" },
+    [TR_REAP]       = { "reap",      "pid",      "wstatus" },
+    [TR_SIGCHLD]    = { "sigchld",   NULL,       NULL },
+    [TR_JOB_DONE]   = { "job-done",  "job",      "status" },
+    [TR_HIST_ADD]   = { "hist-add",  "id",       "len" },
+    [TR_VAR_SET]    = { "var-set",   "name_len", "value_len" },
+    [TR_VAR_UNSET]  = { "var-unset", "name_len", "found" },
+    [TR_EXPAND]     = { "expand",    "in_len",   "out_len" },
+};
+
+void trace_event(TraceEvent ev, int64_t a, int64_t b) {
+    uint64_t n = atomic_fetch_add_explicit(&next_seq, 1, memory_order_relaxed);
+    TraceRecord *r = &ring[n & (TRACE_SLOTS - 1)];
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    atomic_store_explicit(&r->seq, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    r->ns = (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+    r->a = a;
+    r->b = b;
+    r->ev = (int32_t)ev;
+    atomic_store_explicit(&r->seq, n + 1, memory_order_release);
+}
+
+void trace_clear(void) {
+    atomic_store_explicit(&floor_seq, atomic_load(&next_seq), memory_order_relaxed);
+}
+
+void trace_dump(FILE *out) {
+    uint64_t end = atomic_load_explicit(&next_seq, memory_order_acquire);
+    uint64_t start = atomic_load_explicit(&floor_seq, memory_order_relaxed);
+    if (end - start > TRACE_SLOTS) start = end - TRACE_SLOTS;
+
+    uint64_t t0 = 0;
+    size_t shown = 0, torn = 0;
+    for (uint64_t n = start; n < end; ++n) {
+        TraceRecord *r = &ring[n & (TRACE_SLOTS - 1)];
+        if (atomic_load_explicit(&r->seq, memory_order_acquire) != n + 1) {
+            torn++; // overwritten or still being written
+            continue;
+        }
+        TraceRecord copy = { .ns = r->ns, .a = r->a, .b = r->b, .ev = r->ev };
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&r->seq, memory_order_relaxed) != n + 1) {
+            torn++;
+            continue;
+        }
+
+        if (!shown) t0 = copy.ns;
+        int ev = (copy.ev > 0 && copy.ev < TR_COUNT) ? copy.ev : TR_NONE;
+        fprintf(out, "%8llu %12.6f  %-10s", (unsigned long long)n,
+                (double)(copy.ns - t0) / 1e9, event_info[ev].name);
+        if (event_info[ev].a) fprintf(out, " %s=%lld", event_info[ev].a, (long long)copy.a);
+        if (event_info[ev].b) fprintf(out, " %s=%lld", event_info[ev].b, (long long)copy.b);
+        fputc('\n', out);
+        shown++;
+    }
+    if (torn) fprintf(out, "(%zu records overwritten while dumping)\n", torn);
+}
@@ -0,0 +1,41 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* In-memory event trace.
+ * A fixed ring of timestamped records (event id + two integers) that is
+ * always on: recording is one atomic increment and a few stores, no locks
+ * and no I/O, so it is safe from signal handlers and cheap enough for hot
+ * paths. Old records are overwritten; `trace dump` prints what is left.
+ * Build with -DTRACE_DISABLE to compile every TRACE() out. */
+
+typedef enum {
+    TR_NONE = 0,
+    TR_SEGMENT,      // a: pipeline stages   b: exit status
+    TR_FORK,         // a: pid               b: stage index
+    TR_SPAWN,        // a: pid               b: stage index
+    TR_REAP,         // a: pid               b: wait status
+    TR_SIGCHLD,      // (from the signal handler)
+    TR_JOB_DONE,     // a: job id            b: exit status
+    TR_HIST_ADD,     // a: entry id (0: ignored)  b: line length
+    TR_VAR_SET,      // a: name length       b: value length
+    TR_VAR_UNSET,    // a: name length       b: 1 if it existed
+    TR_EXPAND,       // a: input length      b: output length
+    TR_COUNT
+} TraceEvent;
+
+#define TRACE_SLOTS 4096 // power of two
+
+#ifdef TRACE_DISABLE
+#define TRACE(ev, a, b) do {} while (0)
+#else
+#define TRACE(ev, a, b) trace_event((ev), (int64_t)(a), (int64_t)(b))
+#endif
+
+void trace_event(TraceEvent ev, int64_t a, int64_t b); // async-signal-safe
+void trace_dump(FILE *out);  // oldest first, times relative to the oldest record shown
+void trace_clear(void);
+
+#endif // TRACE_H
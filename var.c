@@ -12,39 +12,33 @@
 #include <errno.h>            // errno (not used here but included)
 
 #include "debug.h"
+#include "trace.h"
+#include "hash.h"             // fnv1a64n, fnv1a64_len
+#include "path.h"             // path_set_search (PATH changes reach the resolver and its hash)
 
 #include <ctype.h>
 
-//  Define a 64-bit FNV-1a hash for fast, well-distributed string hashing.
-//  Inline for performance; static to keep symbol local to this translation unit.
-static inline uint64_t fnv1a64(const char *s) {
-    //  Initialize with the FNV-1a offset basis constant for 64-bit.
-    uint64_t h = 1469598103934665603ull; // FNV offset basis
-    //  Iterate over each byte in the NUL-terminated string.
-    for (; *s; ++s) {
-        //  XOR the current byte into the hash; cast to unsigned to avoid sign-extension.
-        h ^= (unsigned char)*s;          // XOR byte into hash
-        //  Multiply by the 64-bit FNV prime to diffuse bits.
-        h *= 1099511628211ull;           // FNV prime
-    }
-    //  Return the final 64-bit hash value.
-    return h;
-}
-
 //  Compute the bucket index by masking the hash; nbuckets must be a power of two.
  // Compute bucket index from hash — assumes nbuckets is power-of-two
 //  Inline for speed; static for internal linkage.
-static inline size_t bucket_idx(const VarTable *t, const char *name) {
-    //  Hash the name, then mask with nbuckets-1 to map into [0, nbuckets).
-    return (size_t)(fnv1a64(name) & (t->nbuckets - 1)); // mask to bucket range
+static inline size_t bucket_idx(const VarTable *t, uint64_t hash) {
+    //  Mask with nbuckets-1 to map into [0, nbuckets).
+    return (size_t)(hash & (t->nbuckets - 1)); // mask to bucket range
+}
+
+//  Walk one chain for (name, len, hash). The stored hash and length reject
+//  almost every non-match, so memcmp only runs on the real one.
+static inline Var *chain_find(Var *v, const char *name, size_t len, uint64_t hash) {
+    for (; v; v = v->next)
+        if (v->hash == hash && v->name_len == len && memcmp(v->name, name, len) == 0) return v;
+    return NULL;
 }
 
- // Safe strdup wrapper — handles NULL input by duplicating empty string
-//  Static internal helper; returns heap-allocated copy.
-static char *xstrdup(const char *s) {
-    //  Ternary chooses "" if s is NULL; strdup allocates and copies.
-    char *p = strdup(s ? s : ""); // fallback to ""
-    //  Return the duplicated string (or NULL on allocation failure).
+//  Copy a value whose length is already known.
+static char *dup_value(const char *s, size_t len) {
+    char *p = malloc(len + 1);
+    if (!p) return NULL;
+    memcpy(p, s, len + 1);
     return p;
 }
 
@@ -61,25 +55,79 @@ bool vart_init(VarTable *t, size_t initial_buckets) {
     t->buckets = calloc(n, sizeof(Var*)); // zero-initialized bucket array
     //  Abort on allocation failure.
     if (!t->buckets) return false;
-    //  Record the number of buckets actually allocated.
-    t->nbuckets = n;
+    //  Record the number of buckets actually allocated; shrinking stops here.
+    t->nbuckets = t->min_buckets = n;
     //  Initialize the number of stored variables to zero.
     t->count = 0;
+    //  Var nodes are carved from slabs on demand.
+    t->slabs = NULL;
+    t->free_vars = NULL;
+    //  Start with an envp holding only its NULL terminator so vart_envp() is always valid.
+    t->envp = calloc(1, sizeof(char *));
+    t->env_owner = NULL;
+    t->env_len = t->env_cap = 0;
+    t->last_bg_pid = 0;
+    if (!t->envp) {
+        free(t->buckets);
+        t->buckets = NULL;
+        return false;
+    }
     //  Signal successful initialization.
     return true;
 }
 
-//  Helper to free a Var and its owned name/value strings safely.
+/* Var nodes
+ * Allocated VAR_SLAB_SIZE at a time and recycled through a free list, so a
+ * script churning temporaries does no malloc/free per variable node. Short
+ * names are stored inside the node too; only values (and long names) are
+ * separate allocations. Slabs are released by vart_destroy(). */
+
+//  Take a zeroed Var from the free list, carving a new slab when it is empty.
+static Var *alloc_var(VarTable *t) {
+    if (!t->free_vars) {
+        VarSlab *s = calloc(1, sizeof(VarSlab));
+        if (!s) return NULL;
+        s->next = t->slabs;
+        t->slabs = s;
+        for (size_t i = VAR_SLAB_SIZE; i-- > 0;) {
+            s->vars[i].next = t->free_vars;
+            t->free_vars = &s->vars[i];
+        }
+    }
+    Var *v = t->free_vars;
+    t->free_vars = v->next;
+    memset(v, 0, sizeof(*v));
+    return v;
+}
+
+//  Store a copy of name (len bytes) in v: inline when it fits.
+static bool set_name(Var *v, const char *name, size_t len) {
+    if (len < VAR_NAME_INLINE) {
+        v->name = v->name_inline;
+    } else {
+        v->name = malloc(len + 1);
+        if (!v->name) return false;
+    }
+    memcpy(v->name, name, len);
+    v->name[len] = '\0';
+    v->name_len = len;
+    return true;
+}
+
+//  Helper to free a Var's owned strings and hand the node back to the free list.
 //  Static internal because only used within this file.
-static void free_var(Var *v) {
+static void free_var(VarTable *t, Var *v) {
     //  Accept NULL and do nothing to simplify callers.
     if (!v) return;
-    //  Free the heap-allocated variable name.
-    free(v->name);
+    //  Free the variable name unless it lives inside the node.
+    if (v->name != v->name_inline) free(v->name);
     //  Free the heap-allocated variable value.
     free(v->value);
-    //  Free the Var struct itself.
-    free(v);
+    //  Free the cached env string (the envp slot must already be detached).
+    free(v->envstr);
+    //  Recycle the node itself.
+    v->next = t->free_vars;
+    t->free_vars = v;
 }
 
 //  Tear down an entire VarTable: free all nodes in all buckets, then the bucket array.
@@ -95,16 +143,29 @@ void vart_destroy(VarTable *t) {
         while (v) {
             //  Preserve next pointer before freeing current node.
             Var *n = v->next; // save next before freeing
-            //  Free the current Var (name, value, and struct).
-            free_var(v);
+            //  Free the current Var's strings (the node goes back to its slab).
+            free_var(t, v);
             //  Advance to the next node.
             v = n;
         }
     }
+    //  Every node is back on the free list: release the slabs wholesale.
+    while (t->slabs) {
+        VarSlab *next = t->slabs->next;
+        free(t->slabs);
+        t->slabs = next;
+    }
+    t->free_vars = NULL;
     //  Free the array of bucket pointers itself.
     free(t->buckets);
     //  Null out the buckets pointer to avoid dangling references.
     t->buckets = NULL;
+    //  The envp strings died with their Vars above; only the arrays remain.
+    free(t->envp);
+    free(t->env_owner);
+    t->envp = NULL;
+    t->env_owner = NULL;
+    t->env_len = t->env_cap = 0;
     //  Reset metadata to a consistent zeroed state.
     t->nbuckets = t->count = 0;
 }
@@ -115,22 +176,23 @@ void vart_destroy(VarTable *t) {
 Var *vart_get(const VarTable *t, const char *name) {
     //  Validate inputs: need a table and a non-NULL name.
     if (!t || !name) return NULL;
-    //  Traverse the appropriate bucket list computed from the name.
-    for (Var *v = t->buckets[bucket_idx(t, name)]; v; v = v->next)
-        //  Compare the current node's name to the lookup key.
-        if (strcmp(v->name, name) == 0) return v;
-    //  Name not found in the bucket chain.
-    return NULL;
+    //  Hash once; the chain walk compares hashes before names.
+    size_t len;
+    uint64_t h = fnv1a64_len(name, &len);
+    return chain_find(t->buckets[bucket_idx(t, h)], name, len, h);
 }
 
-//  Grow the hash table when load factor exceeds 0.75 by doubling bucket count.
- // Resize table if load factor exceeds 0.75 — doubles bucket count
-//  Returns true if no resize needed or if resize succeeds; false on allocation failure.
-static bool maybe_resize(VarTable *t) {
-    //  If count/nbuckets < 0.75, skip resizing; multiplied form avoids floating point.
-    if ((t->count * 4) < (t->nbuckets * 3)) return true; // load < 0.75
-    //  Compute the new bucket count by doubling the current count.
-    size_t newn = t->nbuckets << 1;
+//  Same lookup for a name given as pointer + length, e.g. straight out of the
+//  text being expanded: no temporary NUL-terminated copy is needed.
+Var *vart_getn(const VarTable *t, const char *name, size_t len) {
+    if (!t || !name) return NULL;
+    uint64_t h = fnv1a64n(name, len);
+    return chain_find(t->buckets[bucket_idx(t, h)], name, len, h);
+}
+
+//  Move every node into a fresh array of newn buckets (a power of two).
+//  Uses the stored hashes: no name is rehashed. False (table unchanged) on OOM.
+static bool rehash(VarTable *t, size_t newn) {
     //  Allocate a new, zeroed array for the resized bucket table.
     Var **newb = calloc(newn, sizeof(Var*));
     //  Bail out if the allocation fails; table remains unchanged.
@@ -146,8 +208,8 @@ static bool maybe_resize(VarTable *t) {
         while (v) {
             //  Save next pointer before relinking v into new buckets.
             Var *next = v->next;
-            //  Compute the new bucket index using the same hash and mask with newn-1.
-            size_t idx = (size_t)(fnv1a64(v->name) & (newn - 1));
+            //  Compute the new bucket index from the stored hash, masked with newn-1.
+            size_t idx = (size_t)(v->hash & (newn - 1));
             //  Insert node at the head of the new bucket's list to avoid extra traversal.
             v->next = newb[idx];
             //  Update the new bucket head to point to v.
@@ -167,6 +229,118 @@ static bool maybe_resize(VarTable *t) {
     return true;
 }
 
+//  Grow the hash table when load factor exceeds 0.75 by doubling bucket count.
+ // Resize table if load factor exceeds 0.75 — doubles bucket count
+//  Returns true if no resize needed or if resize succeeds; false on allocation failure.
+static bool maybe_resize(VarTable *t) {
+    //  If count/nbuckets < 0.75, skip resizing; multiplied form avoids floating point.
+    if ((t->count * 4) < (t->nbuckets * 3)) return true; // load < 0.75
+    return rehash(t, t->nbuckets << 1);
+}
+
+//  Shrink after mass unsets: once the load drops below 1/8, halve until it is
+//  back to at least 1/4 (never below the initial size). The gap to the 0.75
+//  growth threshold keeps a set/unset cycle from resizing every time.
+static void maybe_shrink(VarTable *t) {
+    if (t->nbuckets <= t->min_buckets || t->count * 8 >= t->nbuckets) return;
+    size_t newn = t->nbuckets;
+    while (newn > t->min_buckets && t->count * 4 < newn) newn >>= 1;
+    rehash(t, newn); // on OOM the table just stays large
+}
+
+/* Cached envp
+ * Every exported Var owns its "NAME=VALUE" string (envstr) and one slot in
+ * t->envp. Only the touched variable is rebuilt on set/unset/export/unexport,
+ * so handing the environment to execve/posix_spawn is a pointer copy. Removal
+ * swaps the last slot into the hole, hence env_owner to fix that Var's slot. */
+
+//  Format "NAME=VALUE" for v; NULL on allocation failure.
+static char *env_format(const Var *v) {
+    size_t namelen = v->name_len;
+    size_t vallen  = v->value_len;
+    char *s = malloc(namelen + 1 + vallen + 1);
+    if (!s) return NULL;
+    memcpy(s, v->name, namelen);
+    s[namelen] = '=';
+    memcpy(s + namelen + 1, v->value, vallen + 1);
+    return s;
+}
+
+//  Grow both parallel arrays together to hold newcap; envp keeps one extra slot for NULL.
+static bool env_reserve(VarTable *t, size_t newcap) {
+    if (newcap <= t->env_cap) return true;
+    char **ne = realloc(t->envp, (newcap + 1) * sizeof(char *));
+    if (!ne) return false;
+    t->envp = ne;
+    Var **no = realloc(t->env_owner, newcap * sizeof(Var *));
+    if (!no) return false;
+    t->env_owner = no;
+    t->env_cap = newcap;
+    return true;
+}
+
+//  Bring v's envp slot up to date with its value, claiming a slot if it has none.
+static bool env_sync(VarTable *t, Var *v) {
+    char *s = env_format(v);
+    if (!s) return false;
+    if (v->envstr) {
+        //  Already in envp: swap the string in place.
+        free(v->envstr);
+        v->envstr = s;
+        t->envp[v->env_slot] = s;
+        return true;
+    }
+    if (t->env_len == t->env_cap && !env_reserve(t, t->env_cap ? t->env_cap * 2 : 32)) {
+        free(s);
+        return false;
+    }
+    v->envstr = s;
+    v->env_slot = t->env_len;
+    t->envp[t->env_len] = s;
+    t->env_owner[t->env_len] = v;
+    t->env_len++;
+    t->envp[t->env_len] = NULL;
+    return true;
+}
+
+//  Detach v from envp (swap-remove) and drop its cached string.
+static void env_remove(VarTable *t, Var *v) {
+    if (!v->envstr) return;
+    size_t last = t->env_len - 1;
+    if (v->env_slot != last) {
+        Var *moved = t->env_owner[last];
+        t->envp[v->env_slot] = t->envp[last];
+        t->env_owner[v->env_slot] = moved;
+        moved->env_slot = v->env_slot;
+    }
+    t->env_len = last;
+    t->envp[last] = NULL;
+    free(v->envstr);
+    v->envstr = NULL;
+}
+
+//  Shell variable naming: [A-Za-z_][A-Za-z0-9_]*
+static bool valid_namen(const char *name, size_t len) {
+    //  First character must be a letter or underscore.
+    if (len == 0 || !( (name[0]=='_' ) || ( (name[0]>='A'&&name[0]<='Z') || (name[0]>='a'&&name[0]<='z') )))
+        return false;
+    //  Subsequent characters may be letters, digits, or underscore.
+    for (const char *p = name + 1; p < name + len; ++p)
+        if (!(*p=='_' || (*p>='A'&&*p<='Z') || (*p>='a'&&*p<='z') || (*p>='0'&&*p<='9'))) return false;
+    return true;
+}
+
+static bool valid_name(const char *name) {
+    return valid_namen(name, strlen(name));
+}
+
+static bool set_var(VarTable *t, const char *name, size_t len, uint64_t h,
+                    const char *value, size_t vlen, uint32_t set_flags);
+
+static inline bool is_path(const char *name, size_t len) {
+    return len == 4 && memcmp(name, "PATH", 4) == 0;
+}
+
 //  Create or update a variable; enforces readonly, merges flags, and triggers resize if needed.
  // Set or update a variable — handles readonly, export, and resizing
 //  set_flags may include bits like V_EXPORT and V_READONLY (if you allow setting it on creation).
@@ -175,54 +349,69 @@ bool vart_set(VarTable *t, const char *name, const char *value, uint32_t set_fla
     if (!t || !name) return false;
 
     //  Enforce shell variable naming: [A-Za-z_][A-Za-z0-9_]*
-    // Validate variable name: must match [A-Za-z_][A-Za-z0-9_]*
-    //  First character must be a letter or underscore.
-    if (!( (name[0]=='_' ) || ( (name[0]>='A'&&name[0]<='Z') || (name[0]>='a'&&name[0]<='z') )))
-        return false;
-    //  Subsequent characters may be letters, digits, or underscore.
-    for (const char *p = name+1; *p; ++p)
-        if (!(*p=='_' || (*p>='A'&&*p<='Z') || (*p>='a'&&*p<='z') || (*p>='0'&&*p<='9'))) return false;
+    if (!valid_name(name)) return false;
+
+    //  Hash and measure the name once; both are stored in a new node.
+    size_t len;
+    uint64_t h = fnv1a64_len(name, &len);
+    //  NULL value means empty string (like sh behavior).
+    if (!value) value = "";
+    return set_var(t, name, len, h, value, strlen(value), set_flags);
+}
 
+//  vart_set() past validation: name is len bytes (not necessarily NUL-terminated)
+//  with hash h, value is vlen bytes and NUL-terminated.
+static bool set_var(VarTable *t, const char *name, size_t len, uint64_t h,
+                    const char *value, size_t vlen, uint32_t set_flags) {
+    TRACE(TR_VAR_SET, len, vlen);
     //  Compute the target bucket for this name.
-    size_t idx = bucket_idx(t, name);
+    size_t idx = bucket_idx(t, h);
     //  Scan the chain to see if the variable already exists.
-    for (Var *v = t->buckets[idx]; v; v = v->next) {
-        //  Compare names for equality; strcmp == 0 means a match.
-        if (strcmp(v->name, name) == 0) {
-            //  Refuse to modify variables marked readonly.
-            if (v->flags & V_READONLY) return false; // can't modify readonly
-            //  If a value was provided, duplicate and replace the existing value.
-            if (value) {
-                //  Duplicate the new value string; may return NULL on OOM.
-                char *nv = xstrdup(value);
-                //  Propagate failure if duplication failed.
-                if (!nv) return false;
-                //  Free the previous heap-allocated value.
-                free(v->value);
-                //  Install the new value pointer.
-                v->value = nv;
-            } else {
-                //  Treat NULL value as setting an empty string (like sh behavior).
-                free(v->value);
-                v->value = xstrdup(""); // treat NULL as empty string
-            }
-            //  Merge new flags into existing flags (bitwise OR).
-            v->flags |= set_flags; // merge flags (e.g. preserve export)
-            //  Done updating; return success.
-            return true;
+    Var *v = chain_find(t->buckets[idx], name, len, h);
+    if (v) {
+        //  Refuse to modify variables marked readonly.
+        if (v->flags & V_READONLY) return false; // can't modify readonly
+        if (vlen < v->value_cap) {
+            //  Fits the current buffer: overwrite in place, so a loop assigning
+            //  the same variable over and over (read, for) never allocates.
+            memmove(v->value, value, vlen + 1);
+        } else {
+            //  Duplicate the new value string; may return NULL on OOM.
+            char *nv = dup_value(value, vlen);
+            //  Propagate failure if duplication failed.
+            if (!nv) return false;
+            //  Free the previous heap-allocated value.
+            free(v->value);
+            v->value = nv;
+            v->value_cap = vlen + 1;
         }
+        v->value_len = vlen;
+        //  Merge new flags into existing flags (bitwise OR).
+        v->flags |= set_flags; // merge flags (e.g. preserve export)
+        //  Command lookup follows the shell's PATH, not the inherited environ.
+        if (is_path(name, len)) path_set_search(v->value);
+        //  Exported: refresh this variable's envp slot so children see the new value.
+        if (v->flags & V_EXPORT) return env_sync(t, v);
+        //  Done updating; return success.
+        return true;
     }
 
     //  Not found in table; create a new Var node.
     // Not found — create new Var
-    //  Allocate a zero-initialized Var to ensure next is NULL and flags start at 0.
-    Var *nv = calloc(1, sizeof(Var));
+    //  Take a zero-initialized Var from the slab free list.
+    Var *nv = alloc_var(t);
     //  Abort on allocation failure.
     if (!nv) return false;
-    //  Duplicate and assign the variable name; store heap pointer in nv->name.
-    nv->name = xstrdup(name);
-    //  Duplicate and assign the value; use empty string if value is NULL.
-    nv->value = xstrdup(value ? value : "");
+    //  Copy the name (inline when short) and remember its hash.
+    nv->hash = h;
+    //  Duplicate and assign the value.
+    nv->value = dup_value(value, vlen);
+    nv->value_len = vlen;
+    nv->value_cap = vlen + 1;
+    if (!set_name(nv, name, len) || !nv->value) {
+        free_var(t, nv);
+        return false;
+    }
     //  Initialize flags with the provided set_flags (e.g., V_EXPORT).
     nv->flags = set_flags;
     //  Insert at the head of the appropriate bucket's singly linked list.
@@ -231,6 +420,9 @@ bool vart_set(VarTable *t, const char *name, const char *value, uint32_t set_fla
     t->buckets[idx] = nv;
     //  Increment the element count used for load factor and size decisions.
     t->count++;
+    if (is_path(name, len)) path_set_search(nv->value);
+    //  Created exported (export FOO=bar, or imported from environ): claim an envp slot.
+    if ((set_flags & V_EXPORT) && !env_sync(t, nv)) return false;
     //  Possibly resize the table; return its result (true on success).
     return maybe_resize(t); // resize if needed
 }
@@ -241,29 +433,31 @@ bool vart_set(VarTable *t, const char *name, const char *value, uint32_t set_fla
 bool vart_unset(VarTable *t, const char *name) {
     //  Validate inputs.
     if (!t || !name) return false;
-    LOG(LOG_LEVEL_INFO, "set bucket_idx");
     //  Compute the bucket containing the target (if present).
-    size_t idx = bucket_idx(t, name);
-    LOG(LOG_LEVEL_INFO, "setbucket success");
+    size_t len;
+    uint64_t h = fnv1a64_len(name, &len);
+    size_t idx = bucket_idx(t, h);
     //  Use a pointer-to-pointer to easily unlink from a singly linked list.
     Var **pp = &t->buckets[idx]; // pointer-to-pointer for unlinking
-    LOG(LOG_LEVEL_INFO, "p2p pass: %llu", idx);
     //  Traverse the list, keeping pp pointing to the current next field.
     for (Var *v = *pp; v; v = v->next) {
-        LOG(LOG_LEVEL_INFO, "checking for match");
-        //  Check for a name match on the current node.
-        if (strcmp(v->name, name) == 0) {
+        //  Check for a name match on the current node (hash and length first).
+        if (v->hash == h && v->name_len == len && memcmp(v->name, name, len) == 0) {
             //  Refuse to delete readonly variables.
-            LOG(LOG_LEVEL_INFO, "checking readonly");
             if (v->flags & V_READONLY) return false;
+            //  Removing PATH invalidates the command hash just like changing it.
+            if (strcmp(name, "PATH") == 0) path_set_search(NULL);
+            //  Pull it out of envp before the string is freed.
+            env_remove(t, v);
             //  Unlink v by updating the previous next-pointer (or bucket head).
-            LOG(LOG_LEVEL_INFO, "unlinking");
             *pp = v->next; // unlink
-            LOG(LOG_LEVEL_INFO, "unlink success");
             //  Free the removed node and its strings.
-            free_var(v);
+            free_var(t, v);
             //  Decrement the table's element count.
             t->count--;
+            //  Give back buckets once most of the table has been unset.
+            maybe_shrink(t);
+            TRACE(TR_VAR_UNSET, len, 1);
             //  Report successful deletion.
             return true;
         }
@@ -271,6 +465,7 @@ bool vart_unset(VarTable *t, const char *name) {
         pp = &v->next;
     }
     //  Name not found in the table.
+    TRACE(TR_VAR_UNSET, len, 0);
     return false;
 }
 
@@ -289,8 +484,8 @@ bool vart_export(VarTable *t, const char *name) {
     }
     //  Set the export flag bit on the existing variable.
     v->flags |= V_EXPORT;
-    //  Report success.
-    return true;
+    //  Publish (or refresh) it in the cached envp.
+    return env_sync(t, v);
 }
 
 //  Clear the export flag on an existing variable; no-op if not found.
@@ -302,10 +497,45 @@ bool vart_unexport(VarTable *t, const char *name) {
     if (!v) return false;
     //  Clear the export bit without affecting other flags.
     v->flags &= ~V_EXPORT;
+    //  Children no longer inherit it.
+    env_remove(t, v);
     //  Report success.
     return true;
 }
 
+//  Seed the table from a "NAME=VALUE" environment block (normally environ) as exported vars.
+//  Entries whose names are not valid shell identifiers are skipped, as in sh.
+//  One batch: buckets and envp are sized for the whole block first, so the
+//  import never rehashes or regrows, and names are hashed in place up to the
+//  '=' instead of being copied out to be NUL-terminated.
+bool vart_import_environ(VarTable *t, char **env) {
+    if (!t || !env) return false;
+    size_t n = 0;
+    for (char **e = env; *e; ++e) n++;
+
+    //  Keep the load under maybe_resize()'s 0.75 with everything in
+    size_t want = t->nbuckets;
+    while ((t->count + n) * 4 >= want * 3) want <<= 1;
+    if (want != t->nbuckets) rehash(t, want); // on OOM inserts still grow it
+    env_reserve(t, t->env_len + n);
+
+    bool ok = true;
+    for (char **e = env; *e; ++e) {
+        const char *eq = strchr(*e, '=');
+        if (!eq) continue;
+        size_t len = (size_t)(eq - *e);
+        if (!valid_namen(*e, len)) continue;
+        if (!set_var(t, *e, len, fnv1a64n(*e, len), eq + 1, strlen(eq + 1), V_EXPORT)) ok = false;
+    }
+    return ok;
+}
+
+//  The live envp for exec: exported variables only, NULL-terminated, owned by the table.
+//  Valid until the next set/unset/export/unexport; never free or modify it.
+char *const *vart_envp(const VarTable *t) {
+    return t ? t->envp : NULL;
+}
+
 //  Build a freshly allocated envp[] from the exported variables in the table.
 //  Caller takes ownership of the returned array and each string within it.
 //  Returns NULL on allocation failure or if 't' is NULL.
@@ -405,17 +635,16 @@ bool is_var_assignment(const char *s) {
 }
 
 
-/* Growable buffer helpers */
-static int ensure_cap(char **buf, size_t *cap, size_t min_needed, char **cursor) {
+/* Growable buffer helpers (arena-backed when a is non-NULL, heap otherwise) */
+static int ensure_cap(Arena *a, char **buf, size_t *cap, size_t min_needed, char **cursor) {
     size_t used = (size_t)(*cursor - *buf); 
     if (min_needed <= *cap) return 1;
     size_t new_cap = *cap ? *cap : 64;
     while (new_cap < min_needed) {
-        if (new_cap > SIZE_MAX / 2) new_cap = SIZE_MAX;
-        else new_cap *= 2;
-        if (new_cap < min_needed) return 0;
+        if (new_cap > SIZE_MAX / 2) return 0;
+        new_cap *= 2;
     }
-    char *nbuf = realloc(*buf, new_cap);
+    char *nbuf = arena_realloc(a, *buf, *cap, new_cap);
     if (!nbuf) return 0;
     *buf = nbuf;
     *cap = new_cap;
@@ -423,29 +652,41 @@ static int ensure_cap(char **buf, size_t *cap, size_t min_needed, char **cursor)
     return 1;
 }
 
-static int append_mem(char **buf, size_t *cap, char **cursor, const void *src, size_t n) {
+static int append_mem(Arena *a, char **buf, size_t *cap, char **cursor, const void *src, size_t n) {
     size_t used = (size_t)(*cursor - *buf);
-    if (!ensure_cap(buf, cap, used + n + 1, cursor)) return 0;
+    if (!ensure_cap(a, buf, cap, used + n + 1, cursor)) return 0;
     if (n) memcpy(*cursor, src, n);
     *cursor += n;
     **cursor = '\0';
     return 1;
 }
 
-static inline int append_ch(char **buf, size_t *cap, char **cursor, char c) {
-    return append_mem(buf, cap, cursor, &c, 1);
+static inline int append_ch(Arena *a, char **buf, size_t *cap, char **cursor, char c) {
+    return append_mem(a, buf, cap, cursor, &c, 1);
 }
 /* ... keep your ensure_cap/append_mem/append_ch helpers above ... */
 /* Expand variables:
  *  - $?      -> last_exit
- *  - $NAME   -> lookup via vart_get()
+ *  - $!      -> vars->last_bg_pid, empty before any background job
+ *  - $NAME   -> lookup via vart_getn()
  *  - ${NAME} -> lookup; if missing `}` emit literal "${" + rest
  *  - \$      -> literal $
  *
- * Returns malloc'd string (caller frees) or NULL on OOM/error.
+ * Text between expansions is copied in bulk runs found with memchr(), names
+ * are looked up in place (no copy, no length limit), and the output starts
+ * with room for the whole input. Input without any '$' is returned as is:
+ * the result is then input itself, so compare before freeing it.
+ * Otherwise the string is allocated from `arena` (released by arena_reset),
+ * or malloc'd for the caller to free when arena is NULL; NULL on OOM/error.
  */
-char *expand_variables_ex(const char *input, int last_exit, const VarTable *vars) {
+char *expand_variables_ex(const char *input, int last_exit, const VarTable *vars, Arena *arena) {
     if (!input) return NULL;
+    size_t in_len = strlen(input);
+    const char *end = input + in_len;
+    if (!memchr(input, '$', in_len)) {
+        TRACE(TR_EXPAND, in_len, in_len);
+        return (char *)input; // nothing to expand (and "\" only matters before '$')
+    }
 
     char exit_str[16];
     int exit_len = snprintf(exit_str, sizeof(exit_str), "%d", last_exit);
@@ -459,28 +700,43 @@ char *expand_variables_ex(const char *input, int last_exit, const VarTable *vars
     size_t cap = 0;
     char *dst = NULL;
 
-    if (!ensure_cap(&out, &cap, 64, &dst)) return NULL;
+    // Room for the input as is plus a little: most values are near their names' size
+    if (!ensure_cap(arena, &out, &cap, in_len + 64, &dst)) return NULL;
     *dst = '\0';
     const char *src = input;
-    while (*src) {
-        /* Escaped dollar: \$  -> emit literal '$' (drop backslash) */
-        if (src[0] == '\\' && src[1] == '$') {
-            if (!append_ch(&out, &cap, &dst, '$')) goto oom;
-            src += 2;
-            continue;
+    while (src < end) {
+        /* Literal run up to the next '$', copied at once */
+        const char *dollar = memchr(src, '$', (size_t)(end - src));
+        if (!dollar) {
+            if (!append_mem(arena, &out, &cap, &dst, src, (size_t)(end - src))) goto oom;
+            break;
         }
-
-        if (*src != '$') {
-            if (!append_ch(&out, &cap, &dst, *src++)) goto oom;
+        /* Escaped dollar: \$  -> emit literal '$' (drop backslash) */
+        if (dollar > src && dollar[-1] == '\\') {
+            if (!append_mem(arena, &out, &cap, &dst, src, (size_t)(dollar - 1 - src))) goto oom;
+            if (!append_ch(arena, &out, &cap, &dst, '$')) goto oom;
+            src = dollar + 1;
             continue;
         }
+        if (!append_mem(arena, &out, &cap, &dst, src, (size_t)(dollar - src))) goto oom;
 
         /* We have a '$' */
-        src++; /* consume '$' */
+        src = dollar + 1; /* consume '$' */
 
         /* Case: $? */
         if (*src == '?') {
-            if (!append_mem(&out, &cap, &dst, exit_str, (size_t)exit_len)) goto oom;
+            if (!append_mem(arena, &out, &cap, &dst, exit_str, (size_t)exit_len)) goto oom;
+            src++;
+            continue;
+        }
+
+        /* Case: $! (empty until a background job has started) */
+        if (*src == '!') {
+            if (vars && vars->last_bg_pid > 0) {
+                char pid_str[24];
+                int pid_len = snprintf(pid_str, sizeof(pid_str), "%ld", vars->last_bg_pid);
+                if (!append_mem(arena, &out, &cap, &dst, pid_str, (size_t)pid_len)) goto oom;
+            }
             src++;
             continue;
         }
@@ -488,33 +744,23 @@ char *expand_variables_ex(const char *input, int last_exit, const VarTable *vars
         /* Case: ${NAME} */
         if (*src == '{') {
             const char *name_start = ++src; /* skip '{' */
-            const char *scan = name_start;
-            while (*scan && *scan != '}') scan++;
-            if (*scan != '}') {
+            const char *scan = memchr(name_start, '}', (size_t)(end - name_start));
+            if (!scan) {
                 /* No closing brace: emit literal "${" and reprocess rest literally */
-                if (!append_mem(&out, &cap, &dst, "${", 2)) goto oom;
+                if (!append_mem(arena, &out, &cap, &dst, "${", 2)) goto oom;
                 src = name_start; /* reprocess rest literally */
                 continue;
             }
             size_t name_len = (size_t)(scan - name_start);
             if (name_len == 0) {
                 /* Empty name -> literal ${} */
-                if (!append_mem(&out, &cap, &dst, "${}", 3)) goto oom;
+                if (!append_mem(arena, &out, &cap, &dst, "${}", 3)) goto oom;
                 src = scan + 1;
                 continue;
             }
 
-            char name[256];
-            if (name_len >= sizeof(name)) name_len = sizeof(name) - 1;
-            memcpy(name, name_start, name_len);
-            name[name_len] = '\0';
-
-            const char *val = "";
-            if (vars) {
-                Var *v = vart_get(vars, name);
-                if (v && v->value) val = v->value;
-            }
-            if (!append_mem(&out, &cap, &dst, val, strlen(val))) goto oom;
+            Var *v = vars ? vart_getn(vars, name_start, name_len) : NULL;
+            if (v && !append_mem(arena, &out, &cap, &dst, v->value, v->value_len)) goto oom;
             src = scan + 1; /* skip '}' */
             continue;
         }
@@ -524,35 +770,26 @@ char *expand_variables_ex(const char *input, int last_exit, const VarTable *vars
         if (isalpha(c) || c == '_') {
             const char *name_start = src;
             src++;
-            while (*src) {
+            while (src < end) {
                 unsigned char d = (unsigned char)*src;
                 if (isalnum(d) || d == '_') src++;
                 else break;
             }
-            size_t name_len = (size_t)(src - name_start);
-            char name[256];
-            if (name_len >= sizeof(name)) name_len = sizeof(name) - 1;
-            memcpy(name, name_start, name_len);
-            name[name_len] = '\0';
-
-            const char *val = "";
-            if (vars) {
-                Var *v = vart_get(vars, name);
-                if (v && v->value) val = v->value;
-            }
-            if (!append_mem(&out, &cap, &dst, val, strlen(val))) goto oom;
+            Var *v = vars ? vart_getn(vars, name_start, (size_t)(src - name_start)) : NULL;
+            if (v && !append_mem(arena, &out, &cap, &dst, v->value, v->value_len)) goto oom;
             continue;
         }
         LOG(LOG_LEVEL_INFO, "unsupported: %c", c);
         /* Unsupported/positional/ lone '$' -> emit literal '$' and reprocess next char */
-        if (!append_ch(&out, &cap, &dst, '$')) goto oom;
+        if (!append_ch(arena, &out, &cap, &dst, '$')) goto oom;
         /* do not advance src here; next loop will handle current char */
     }
     *dst = '\0';
+    TRACE(TR_EXPAND, in_len, dst - out);
     LOG(LOG_LEVEL_INFO, "returning %s", out);
     return out;
 
 oom:
-    free(out);
+    arena_free(arena, out);
     return NULL;
 }
@@ -5,6 +5,7 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include "arena.h"
 //#include "shell.h"
 
 
@@ -17,17 +18,40 @@ typedef enum {
     V_SPECIAL  = 1u << 3  // e.g., PWD/OLDPWD
 } VarFlags;
 
+#define VAR_NAME_INLINE 24 // names shorter than this live inside the Var
+#define VAR_SLAB_SIZE   64 // Vars per slab allocation
+
 typedef struct Var {
-    char *name;
+    char *name;       // name_inline, or heap for long names
     char *value;      // "" means set-but-empty; never NULL after creation
+    size_t value_len; // strlen(value), kept with it
+    size_t value_cap; // bytes allocated for value; shorter values reuse it
     uint32_t flags;
-    struct Var *next; // pointer to next bucket head
+    char *envstr;     // cached "NAME=VALUE" while exported, else NULL
+    size_t env_slot;  // index of envstr in VarTable.envp
+    struct Var *next; // pointer to next bucket head (free list link when unused)
+    uint64_t hash;    // fnv1a64(name): compared before the name, reused on rehash
+    size_t name_len;
+    char name_inline[VAR_NAME_INLINE];
 } Var;
 
+typedef struct VarSlab {
+    struct VarSlab *next;
+    Var vars[VAR_SLAB_SIZE];
+} VarSlab;
+
 typedef struct VarTable {
     Var **buckets;
     size_t nbuckets;
+    size_t min_buckets; // never shrink below the initial size
     size_t count;     // number of entries
+    VarSlab *slabs;   // every Var comes from here...
+    Var *free_vars;   // ...and returns here on unset
+    char **envp;      // exported vars as NULL-terminated envp, kept current on every change
+    Var **env_owner;  // env_owner[i] is the Var whose envstr sits in envp[i]
+    size_t env_len;   // live entries in envp
+    size_t env_cap;   // allocated slots (excluding the NULL terminator)
+    long last_bg_pid; // $!: last stage of the newest background job, 0 before one
 } VarTable;
 
 // Lifecycle
@@ -36,6 +60,7 @@ void vart_destroy(VarTable *t);
 
 // Lookup
 Var *vart_get(const VarTable *t, const char *name);
+Var *vart_getn(const VarTable *t, const char *name, size_t len); // name need not be NUL-terminated
 
 // Set/unset
 bool is_var_assignment(const char *s);
@@ -46,9 +71,13 @@ bool vart_unset(VarTable *t, const char *name);
 bool vart_export(VarTable *t, const char *name);
 bool vart_unexport(VarTable *t, const char *name);
 
+// Environment
+bool vart_import_environ(VarTable *t, char **env);  // seed exported vars from environ
+char *const *vart_envp(const VarTable *t);         // cached envp for execve; read-only, owned by t
+
 // Helpers
 char **vart_build_envp(const VarTable *t); // malloc'd NULL-terminated array; caller frees
 void vart_free_envp(char **envp);
-char *expand_variables_ex(const char *input, int last_exit, const VarTable *vars);
+char *expand_variables_ex(const char *input, int last_exit, const VarTable *vars, Arena *arena);
 //void init_var_table(ShellContext *shell);
 #endif // var.h
\ No newline at end of file